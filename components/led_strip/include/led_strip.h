@@ -52,6 +52,25 @@ struct led_strip_s {
     */
     esp_err_t (*set_pixel)(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue);
 
+    /**
+    * @brief Set RGB for a contiguous run of pixels
+    *
+    * @param strip: LED strip
+    * @param index: index of the first pixel to set
+    * @param count: number of pixels to set
+    * @param rgb: packed red, green, blue bytes, three per pixel
+    *
+    * @return
+    *      - ESP_OK: Set RGB for the pixels successfully
+    *      - ESP_ERR_INVALID_ARG: Set RGB for the pixels failed because of invalid parameters
+    *
+    * @note:
+    *      This is equivalent to calling set_pixel once per pixel, but does not allocate and touches
+    *      each source byte exactly once, so whole frames can be copied directly from flash or a
+    *      framebuffer.
+    */
+    esp_err_t (*set_pixels)(led_strip_t *strip, uint32_t index, uint32_t count, const uint8_t *rgb);
+
     /**
     * @brief Refresh memory colors to LEDs
     *
@@ -112,6 +131,15 @@ typedef struct {
         .dev = dev_hdl,                           \
     }
 
+/**
+* @brief Gamma correction the driver applies to every byte it's given
+*
+* @note:
+*      Bytes 0 to 21 all show as off, and at the bright end the output steps by more than one. Anything that
+*      dims in fine steps needs this to know which bytes actually show differently.
+*/
+extern const uint8_t gamma_lut[256];
+
 /**
 * @brief Install a new apa104 driver (based on RMT peripheral)
 *
@@ -18,6 +18,11 @@ curl.exe -X POST -m 1 http://lightclock.local/reboot
 # Run OTA upgrade (run from root of lc-esp32 repo)
 curl.exe -X PUT http://lightclock.local/firmware/update --data-binary "@$($(get-location).Path+"\build\lc-esp32.bin")"
 
+# Upload an animation clip, then play it
+curl.exe -X PUT http://lightclock.local/clip --data-binary "@clip.bin"
+$clip_pattern = (curl.exe -s http://lightclock.local/settings | ConvertFrom-Json).ranges.alarm_led_pattern.IndexOf('clip')
+curl.exe -X GET "http://lightclock.local/command?run_pattern=$clip_pattern"
+
 # Extract core dump
 curl.exe -X GET http://lightclock.local/coredump --output core.bin
 
@@ -26,3 +31,13 @@ curl.exe -X GET http://lightclock.local/coredump --output core.bin
 # https://github.com/espressif/esp-idf/issues/6124
 python $env:IDF_PATH\components\espcoredump\espcoredump.py info_corefile --core .\core.bin --core-format raw .\build\lc-esp32.elf
 python $env:IDF_PATH\components\espcoredump\espcoredump.py dbg_corefile --core .\core.bin --core-format raw .\build\lc-esp32.elf
+
+# Show frames streamed from a lighting controller (or tools/stream_send.py) over DDP/E1.31
+$stream_pattern = (curl.exe -s http://lightclock.local/settings | ConvertFrom-Json).ranges.alarm_led_pattern.IndexOf('stream')
+curl.exe -X GET "http://lightclock.local/command?run_pattern=$stream_pattern"
+python tools/stream_send.py --host lightclock.local --protocol ddp --fps 60 --drop 0.01
+curl.exe http://lightclock.local/diag
+
+# Save what the strips are showing, then put it back (360 bytes of R,G,B, strip after strip)
+curl.exe -s http://lightclock.local/frame -o frame.bin
+curl.exe -X PUT http://lightclock.local/frame --data-binary "@frame.bin"
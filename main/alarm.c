@@ -12,6 +12,9 @@
 // settings facility
 #include "settings_storage.h"
 
+// alarms, sleep timers and patterns by time of day
+#include "schedule.h"
+
 typedef enum _alarm_wait_task_state_t
 {
     initializing,
@@ -24,323 +27,546 @@ typedef enum _alarm_wait_task_state_t
     sleep_mode_fade,
 } alarm_wait_task_state_t;
 
-#define ALARM_STOP_BIT BIT0
-#define ALARM_SNOOZE_BIT BIT1
-#define ALARM_RECONFIG_BIT BIT2
-#define ALARM_MANUAL_START_BIT BIT3
-#define SLEEP_START_BIT BIT4
-#define SLEEP_STOP_BIT BIT5
-
-#define ALARM_ALL_BITS ( \
-      ALARM_STOP_BIT \
-    | ALARM_SNOOZE_BIT \
-    | ALARM_RECONFIG_BIT \
-    | ALARM_MANUAL_START_BIT \
-    | SLEEP_START_BIT \
-    | SLEEP_STOP_BIT \
-    )
-
-static EventGroupHandle_t alarm_event_group;
+#define TRANSMOG(name) #name,
+const char* alarm_command_names[] = { ALARM_COMMANDS };
+#undef TRANSMOG
+
+// How long stopping waits for room in a full queue; nothing else waits
+#define ALARM_STOP_SEND_WAIT_MS 1000
+
 static TaskHandle_t alarm_task;
 
 alarm_wait_task_state_t alarm_current_state = initializing;
 
-void alarm_task_func(void* param)
-{
-    const int seconds_per_loop = 1;
-    // move to global for diag route
-    //alarm_wait_task_state_t alarm_current_state = initializing;
-    alarm_wait_task_state_t alarm_next_state = initializing;
-    time_t prev_now = 0;
-    time_t now = 0;
-    uint32_t alarm_enabled_raw = 0;
-    bool alarm_enabled = pdFALSE;
-    uint32_t alarm_hour = 0;
-    uint32_t alarm_minute = 0;
-    uint32_t alarm_snooze_interval_min = 0;
-    uint32_t alarm_on_cycle_count = 0;
-    // TODO make this sa config option, and maybe in wall-clock units
-    const uint32_t alarm_on_cycle_count_max = 50;
-    time_t snooze_start_time = 0;
-    uint32_t alarm_led_pattern_raw = 0;
-    led_pattern_t alarm_pattern = lpat_fill_white;
-    // sleep values
-    time_t sleep_mode_start_time = 0;
-    uint32_t sleep_delay_min = 0;
-    uint32_t sleep_fade_time_min = 0;
-    int sleep_mode_step_count = 0;
-    time_t sleep_elapsed_time = 0;
-    time_t sleep_delay = 0;
-    time_t sleep_step = 0;
+// No deadline; wait for an event
+#define ALARM_NO_DEADLINE INT64_MAX
+// How often the running alarm redraws its pattern
+#define ALARM_RUNNING_CYCLE_MS 1000
+// Longest single wait, so a wall-clock step nobody reported (a manual
+// settimeofday, say) can only delay a trigger so long
+#define ALARM_MAX_WAIT_S (6 * 60 * 60)
 
-    while (pdTRUE)
+// Ticks to wait for deadline_us, rounded up so the task never wakes early
+static TickType_t alarm_ticks_until(int64_t deadline_us, int64_t now_us)
+{
+    if (deadline_us == ALARM_NO_DEADLINE)
+    {
+        return portMAX_DELAY;
+    }
+    int64_t remaining_us = deadline_us - now_us;
+    if (remaining_us <= 0)
     {
-        // Gather state machine inputs: event bits, current time, previous time, configuration values
+        return 0;
+    }
+    if (remaining_us > (int64_t)ALARM_MAX_WAIT_S * 1000000)
+    {
+        remaining_us = (int64_t)ALARM_MAX_WAIT_S * 1000000;
+    }
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    return (TickType_t)((remaining_us + tick_us - 1) / tick_us);
+}
 
-        EventBits_t bits = xEventGroupWaitBits(alarm_event_group,
-            ALARM_ALL_BITS,
-            pdTRUE,
-            pdFALSE,
-            seconds_per_loop * 1000 / portTICK_PERIOD_MS);
+// State that lives across steps
+static uint32_t alarm_enabled_raw = 0;
+static bool alarm_is_enabled = pdFALSE;
+// The schedule event that moved the machine out of waiting, if any
+static schedule_event_t due_event;
+static bool event_due = pdFALSE;
+static time_t next_event_time = 0;
+static uint32_t snooze_interval_min = 0;
+static uint32_t alarm_on_cycle_count = 0;
+// TODO make this sa config option, and maybe in wall-clock units
+static const uint32_t alarm_on_cycle_count_max = 50;
+static time_t snooze_start_time = 0;
+static uint32_t alarm_led_pattern_raw = 0;
+static led_pattern_t alarm_pattern = lpat_fill_white;
+// sleep values
+static time_t sleep_mode_start_time = 0;
+static uint32_t sleep_delay_minutes = 0;
+static uint32_t sleep_fade_minutes = 0;
+static time_t sleep_delay = 0;
+static time_t sleep_fade = 0;
+// sunrise values
+static uint32_t sunrise_minutes = 0;
+static time_t sunrise_lead = 0;
+// The alarm the last sunrise led up to, and the last one dismissed before it
+// went off
+static time_t sunrise_alarm_time = 0;
+static time_t sunrise_dismissed_alarm_time = 0;
+// The running alarm follows a sunrise, so it holds the daylight rather than
+// cycling patterns
+static bool alarm_gentle = pdFALSE;
 
-        time(&now);
+// Step timing, for /diag
+static uint32_t alarm_steps = 0;
+static uint32_t alarm_transitions = 0;
+static uint64_t alarm_step_cycles_total = 0;
+static uint32_t alarm_step_cycles_max = 0;
+// Time spent drawing in the current step, which isn't the state machine's
+static uint32_t alarm_led_cycles = 0;
 
-        // Encode state transitions separate from state actions
-        // Note that this design will swallow simultaneously set bits.
+static void alarm_run_pattern(led_pattern_t p)
+{
+    uint32_t start_cycles = alarm_cycles();
+    led_run_sync(p);
+    alarm_led_cycles += alarm_cycles() - start_cycles;
+}
+
+// The next alarm whose sunrise hasn't started yet, if sunrises are on
+static bool alarm_next_sunrise(time_t now, time_t* alarm_time)
+{
+    return sunrise_lead > 0 &&
+           schedule_next_action_time(schedule_action_alarm, now, alarm_time) &&
+           *alarm_time != sunrise_alarm_time;
+}
+
+// Whether a sunrise is showing, leading up to an alarm
+static bool alarm_sunrise_showing(time_t now)
+{
+    return sunrise_alarm_time > now && sunrise_alarm_time != sunrise_dismissed_alarm_time;
+}
+
+int64_t alarm_step(alarm_command command, int64_t now_us)
+{
+    uint32_t step_start_cycles = alarm_cycles();
+    alarm_led_cycles = 0;
+    time_t now = (time_t)(now_us / 1000000);
+    alarm_wait_task_state_t alarm_next_state;
+    // When the next state needs attention without an event
+    int64_t deadline_us;
 
-        // Default to staying in the same state.
-        alarm_next_state = alarm_current_state;
+    // Encode state transitions separate from state actions
 
-        switch (alarm_current_state)
+    // Default to staying in the same state.
+    alarm_next_state = alarm_current_state;
+
+    switch (alarm_current_state)
+    {
+    case initializing:
+        // wait for the first alarm configuration event
+        if (command == alarm_command_reconfig)
         {
-        case initializing:
-            // wait for the first alarm configuration event
-            if (bits & ALARM_RECONFIG_BIT)
-            {
-                alarm_next_state = configuring;
-            }
-            break;
-        case configuring:
-            alarm_next_state = waiting;
-            break;
-        case waiting:
-            if (bits & ALARM_RECONFIG_BIT)
-            {
-                alarm_next_state = configuring;
-            }
-            else if (bits & SLEEP_START_BIT)
-            {
-                alarm_next_state = sleep_mode_start;
-            }
-            else if (alarm_enabled)
-            {
-                // convert running timestamps into local times
-                struct tm prev_local_now;
-                localtime_r(&prev_now, &prev_local_now);
-                struct tm local_now;
-                localtime_r(&now, &local_now);
-                // the current now is guaranteed to be between these three times
-                // today alarm time
-                struct tm today_alarm_local_time = local_now;
-                today_alarm_local_time.tm_hour = alarm_hour;
-                today_alarm_local_time.tm_min = alarm_minute;
-                today_alarm_local_time.tm_sec = 0;
-                // trust mktime to handle all the nastiness of adding/subtracting/setting time
-                // https://linux.die.net/man/3/mktime
-                time_t today_alarm_time = mktime(&today_alarm_local_time);
-                // yesterday alarm time
-                struct tm yesterday_alarm_local_time = local_now;
-                yesterday_alarm_local_time.tm_hour = alarm_hour;
-                yesterday_alarm_local_time.tm_min = alarm_minute;
-                yesterday_alarm_local_time.tm_sec = 0;
-                yesterday_alarm_local_time.tm_mday -= 1;
-                time_t yesterday_alarm_time = mktime(&yesterday_alarm_local_time);
-                // tomorrow alarm time
-                struct tm tomorrow_alarm_local_time = local_now;
-                tomorrow_alarm_local_time.tm_hour = alarm_hour;
-                tomorrow_alarm_local_time.tm_min = alarm_minute;
-                tomorrow_alarm_local_time.tm_sec = 0;
-                tomorrow_alarm_local_time.tm_mday += 1;
-                time_t tomorrow_alarm_time = mktime(&tomorrow_alarm_local_time);
-                // if it was during last wait, trigger alarm
-                // Checking all three makes this resilient to near-midnight alarm times
-                if ((prev_now <= yesterday_alarm_time && yesterday_alarm_time <= now) ||
-                    (prev_now <= today_alarm_time && today_alarm_time <= now) ||
-                    (prev_now <= tomorrow_alarm_time && tomorrow_alarm_time <= now) ||
-                    (bits & ALARM_MANUAL_START_BIT) )
-                {
-                    ESP_LOGI(TAG, "Alarm triggered at Unix Epoch %ld", now);
-                    alarm_next_state = running;
-                }
-            }
-            break;
-        case snoozing:
-            if (bits & ALARM_STOP_BIT)
-            {
-                alarm_next_state = waiting;
-            }
-            else if (bits & ALARM_RECONFIG_BIT)
+            alarm_next_state = configuring;
+        }
+        break;
+    case configuring:
+        alarm_next_state = waiting;
+        break;
+    case waiting:
+        if (command == alarm_command_reconfig)
+        {
+            alarm_next_state = configuring;
+        }
+        else if (command == alarm_command_sleep_start)
+        {
+            alarm_next_state = sleep_mode_start;
+        }
+        else if (alarm_is_enabled && (command == alarm_command_manual_start))
+        {
+            ESP_LOGI(TAG, "Alarm triggered at Unix Epoch %ld", now);
+            alarm_next_state = running;
+        }
+        // Whatever is due is consumed here and acted on below
+        else if ((event_due = schedule_pop_due(now, &due_event)))
+        {
+            ESP_LOGI(TAG, "Scheduled %s for Unix Epoch %ld triggered at %ld",
+                     schedule_action_names[due_event.action], due_event.when, now);
+            if (due_event.action == schedule_action_alarm && due_event.when == sunrise_dismissed_alarm_time)
             {
-                alarm_next_state = configuring;
+                ESP_LOGI(TAG, "Alarm already dismissed during its sunrise");
             }
-            else if (now - snooze_start_time > alarm_snooze_interval_min * 60)
+            else if (due_event.action == schedule_action_alarm)
             {
                 alarm_next_state = running;
+                alarm_gentle = due_event.when == sunrise_alarm_time;
             }
-            break;
-        case running:
-            if (bits & ALARM_STOP_BIT || alarm_on_cycle_count > alarm_on_cycle_count_max)
-            {
-                alarm_next_state = waiting;
-            }
-            else if (bits & ALARM_RECONFIG_BIT)
-            {
-                alarm_next_state = configuring;
-            }
-            else if (bits & ALARM_SNOOZE_BIT)
-            {
-                alarm_next_state = snoozing;
-            }
-            break;
-        // TODO: Consider using fade-to-on (gentle) as alarm instead of cycling patterns (annoying)
-        case sleep_mode_start:
-            alarm_next_state = sleep_mode_delay;
-            break;
-        case sleep_mode_delay:
-            if (bits & SLEEP_STOP_BIT)
-            {
-                alarm_next_state = waiting;
-            }
-            else if (bits & ALARM_RECONFIG_BIT)
-            {
-                alarm_next_state = configuring;
-            }
-            else if (now - sleep_mode_start_time > sleep_delay)
-            {
-                alarm_next_state = sleep_mode_fade;
-            }
-            break;
-        case sleep_mode_fade:
-            if (bits & SLEEP_STOP_BIT || sleep_mode_step_count > FADE_STEP_COUNT)
+            else if (due_event.action == schedule_action_sleep)
             {
-                alarm_next_state = waiting;
-            }
-            else if (bits & ALARM_RECONFIG_BIT)
-            {
-                alarm_next_state = configuring;
+                alarm_next_state = sleep_mode_start;
             }
-            break;
-        default:
-            ESP_LOGE(TAG, "Invalid enum value seen! %d", alarm_current_state);
         }
-
-        if (alarm_next_state != alarm_current_state)
+        break;
+    case snoozing:
+        if (command == alarm_command_stop)
+        {
+            alarm_next_state = waiting;
+        }
+        else if (command == alarm_command_reconfig)
+        {
+            alarm_next_state = configuring;
+        }
+        else if (now - snooze_start_time >= snooze_interval_min * 60)
+        {
+            alarm_next_state = running;
+        }
+        break;
+    case running:
+        if (command == alarm_command_stop || alarm_on_cycle_count > alarm_on_cycle_count_max)
+        {
+            alarm_next_state = waiting;
+        }
+        else if (command == alarm_command_reconfig)
+        {
+            alarm_next_state = configuring;
+        }
+        else if (command == alarm_command_snooze)
+        {
+            alarm_next_state = snoozing;
+        }
+        break;
+    case sleep_mode_start:
+        alarm_next_state = sleep_mode_delay;
+        break;
+    case sleep_mode_delay:
+        if (command == alarm_command_sleep_stop)
+        {
+            alarm_next_state = waiting;
+        }
+        else if (command == alarm_command_reconfig)
+        {
+            alarm_next_state = configuring;
+        }
+        else if (now - sleep_mode_start_time >= sleep_delay)
+        {
+            alarm_next_state = sleep_mode_fade;
+        }
+        break;
+    case sleep_mode_fade:
+        if (command == alarm_command_sleep_stop || now - sleep_mode_start_time >= sleep_fade)
         {
-            ESP_LOGI(TAG, "Alarm state machine transition, %d -> %d", alarm_current_state, alarm_next_state);
+            alarm_next_state = waiting;
         }
+        else if (command == alarm_command_reconfig)
+        {
+            alarm_next_state = configuring;
+        }
+        break;
+    default:
+        ESP_LOGE(TAG, "Invalid enum value seen! %d", alarm_current_state);
+    }
+
+    if (alarm_next_state != alarm_current_state)
+    {
+        ESP_LOGI(TAG, "Alarm state machine transition, %d -> %d", alarm_current_state, alarm_next_state);
+        alarm_transitions++;
+    }
 
-        // per-state actions
-        switch (alarm_current_state)
+    // per-state actions
+    switch (alarm_current_state)
+    {
+    case initializing:
+        // On transition out of this state, set status LED
+        if (alarm_current_state != alarm_next_state)
         {
-        case initializing:
-            // On transition out of this state, set status LED
-            if (alarm_current_state != alarm_next_state)
-            {
-                led_set_status_indicator(led_status_alarm, LED_STATUS_COLOR_SUCCESS);
-            }
-            break;
-        case configuring:
-            // Reset the time interval
-            prev_now = now;
-            // Read and interpret configuration values
-            ESP_ERROR_CHECK( get_setting("alarm_enabled", &alarm_enabled_raw) );
-            alarm_enabled = alarm_enabled_raw != 0;
-            ESP_ERROR_CHECK( get_setting("alarm_hour", &alarm_hour) );
-            ESP_ERROR_CHECK( get_setting("alarm_minute", &alarm_minute) );
-            ESP_ERROR_CHECK( get_setting("alarm_snooze_interval_min", &alarm_snooze_interval_min) );
-            ESP_ERROR_CHECK( get_setting("alarm_led_pattern", &alarm_led_pattern_raw) );
-            alarm_pattern = (led_pattern_t)alarm_led_pattern_raw;
-            ESP_ERROR_CHECK( get_setting("sleep_delay_min", &sleep_delay_min) );
-            sleep_delay = sleep_delay_min * 60;
-            ESP_ERROR_CHECK( get_setting("sleep_fade_time_min", &sleep_fade_time_min) );
-            sleep_step = sleep_fade_time_min * 60 / FADE_STEP_COUNT;
-            ESP_LOGI(TAG, "Configuration complete.");
-            break;
-        case waiting:
-            // When control comes back, we'll compare then and now to see if the alarm should fire.
-            prev_now = now;
-            // Reset the counter used to track how many times the alarm pattern has run
-            // TODO: consider making this a wall-clock delta instead
-            if (alarm_next_state == running)
-            {
-                alarm_on_cycle_count = 0;
-            }
-            break;
-        case snoozing:
-            prev_now = now;
-            break;
-        case running:
-            prev_now = now;
-            alarm_on_cycle_count++;
-            if (bits & ALARM_SNOOZE_BIT)
+            led_set_status_indicator(led_status_alarm, LED_STATUS_COLOR_SUCCESS);
+        }
+        break;
+    case configuring:
+        // Read and interpret configuration values
+        alarm_enabled_raw = get_setting_u32(setting_alarm_enabled);
+        alarm_is_enabled = alarm_enabled_raw != 0;
+        snooze_interval_min = get_setting_u32(setting_alarm_snooze_interval_min);
+        alarm_led_pattern_raw = get_setting_u32(setting_alarm_led_pattern);
+        alarm_pattern = (led_pattern_t)alarm_led_pattern_raw;
+        sleep_delay_minutes = get_setting_u32(setting_sleep_delay_min);
+        sleep_delay = sleep_delay_minutes * 60;
+        sleep_fade_minutes = get_setting_u32(setting_sleep_fade_time_min);
+        sleep_fade = sleep_fade_minutes * 60;
+        sunrise_minutes = get_setting_u32(setting_sunrise_duration_min);
+        sunrise_lead = sunrise_minutes * 60;
+        // Settings changes, schedule changes and time syncs all land
+        // here, so this is the only place the schedule needs rebuilding.
+        schedule_invalidate();
+        ESP_LOGI(TAG, "Configuration complete.");
+        break;
+    case waiting:
+        // Reset the counter used to track how many times the alarm pattern has run
+        // TODO: consider making this a wall-clock delta instead
+        if (alarm_next_state == running)
+        {
+            alarm_on_cycle_count = 0;
+        }
+        if (event_due && due_event.action == schedule_action_pattern)
+        {
+            alarm_run_pattern(due_event.pattern);
+        }
+        event_due = pdFALSE;
+        if (alarm_next_state == waiting)
+        {
+            time_t alarm_time;
+            if (command == alarm_command_stop && alarm_sunrise_showing(now))
             {
-                snooze_start_time = now;
-                led_run_sync(lpat_fill_black);
+                // Up before the alarm; it needn't go off
+                ESP_LOGI(TAG, "Alarm for Unix Epoch %ld dismissed during its sunrise", sunrise_alarm_time);
+                sunrise_dismissed_alarm_time = sunrise_alarm_time;
+                alarm_run_pattern(lpat_fill_black);
             }
-            // Don't run one last pair before turning off, just turn off.
-            else if (alarm_current_state == alarm_next_state)
+            else if (alarm_next_sunrise(now, &alarm_time) && now >= alarm_time - sunrise_lead)
             {
-                // TODO: I find on/off to be too irritating, so eventually make it a setting.
-                // For now, alternate to irritate me.
-                led_run_sync(lpat_fill_black);
-                led_run_sync(alarm_pattern);
+                sunrise_alarm_time = alarm_time;
+                uint32_t start_cycles = alarm_cycles();
+                led_run_sunrise(alarm_time);
+                alarm_led_cycles += alarm_cycles() - start_cycles;
             }
-            break;
-        case sleep_mode_start:
+        }
+        break;
+    case snoozing:
+        break;
+    case running:
+        alarm_on_cycle_count++;
+        if (command == alarm_command_snooze)
+        {
+            // Back from snooze, the alarm insists
+            alarm_gentle = pdFALSE;
+            snooze_start_time = now;
+            alarm_run_pattern(lpat_fill_black);
+        }
+        // Don't run one last pair before turning off, just turn off. After
+        // a sunrise the daylight it ended on stays up instead.
+        else if (alarm_current_state == alarm_next_state && !alarm_gentle)
+        {
+            // TODO: I find on/off to be too irritating, so eventually make it a setting.
+            // For now, alternate to irritate me.
+            alarm_run_pattern(lpat_fill_black);
+            alarm_run_pattern(alarm_pattern);
+        }
+        break;
+    case sleep_mode_start:
+        sleep_mode_start_time = now;
+        alarm_run_pattern(lpat_fade_start);
+        break;
+    case sleep_mode_delay:
+        if (alarm_next_state == sleep_mode_fade)
+        {
+            // The render task runs the whole fade from here
             sleep_mode_start_time = now;
-            sleep_mode_step_count = 0;
-            led_run_sync(lpat_fade_start);
-            break;
-        case sleep_mode_delay:
-            if (alarm_current_state != alarm_next_state)
-            {
-                sleep_mode_start_time = now;
-            }
-            break;
-        case sleep_mode_fade:
-            sleep_elapsed_time = now - sleep_mode_start_time;
-            if (// a fade step interval has passed
-                ((sleep_elapsed_time) > (sleep_step)) &&
-                // state exit conditions are not yet met
-                (alarm_current_state == alarm_next_state)
-                )
-            {
-                sleep_mode_start_time = now;
-                sleep_mode_step_count++;
-                led_run_sync(lpat_fade_step);
-            }
-            break;
-        default:
-            ESP_LOGE(TAG, "Invalid enum value seen! %d", alarm_current_state);
+            alarm_run_pattern(lpat_fade_step);
+        }
+        break;
+    case sleep_mode_fade:
+        if (command == alarm_command_sleep_stop)
+        {
+            // Cancelling the timer puts the light back on rather than
+            // leaving it wherever the fade had got to
+            alarm_run_pattern(lpat_fade_start);
+        }
+        break;
+    default:
+        ESP_LOGE(TAG, "Invalid enum value seen! %d", alarm_current_state);
+    }
+
+    alarm_current_state = alarm_next_state;
+
+    // Work out when the new state next has something to do on its own.
+    // Everything else arrives as a command.
+    switch (alarm_current_state)
+    {
+    case configuring:
+    case sleep_mode_start:
+        // Move straight on
+        deadline_us = now_us;
+        break;
+    case waiting:
+        deadline_us = schedule_next_time(now, &next_event_time) ? (int64_t)next_event_time * 1000000 : ALARM_NO_DEADLINE;
+        if (alarm_next_sunrise(now, &next_event_time) &&
+            (int64_t)(next_event_time - sunrise_lead) * 1000000 < deadline_us)
+        {
+            deadline_us = (int64_t)(next_event_time - sunrise_lead) * 1000000;
+        }
+        break;
+    case snoozing:
+        deadline_us = (int64_t)(snooze_start_time + snooze_interval_min * 60) * 1000000;
+        break;
+    case running:
+        deadline_us = alarm_clock_us() + ALARM_RUNNING_CYCLE_MS * 1000;
+        break;
+    case sleep_mode_delay:
+        deadline_us = (int64_t)(sleep_mode_start_time + sleep_delay) * 1000000;
+        break;
+    case sleep_mode_fade:
+        deadline_us = (int64_t)(sleep_mode_start_time + sleep_fade) * 1000000;
+        break;
+    case initializing:
+    default:
+        deadline_us = ALARM_NO_DEADLINE;
+        break;
+    }
+
+    uint32_t step_cycles = alarm_cycles() - step_start_cycles - alarm_led_cycles;
+    alarm_steps++;
+    alarm_step_cycles_total += step_cycles;
+    if (step_cycles > alarm_step_cycles_max)
+    {
+        alarm_step_cycles_max = step_cycles;
+    }
+
+    return deadline_us;
+}
+
+// Command statistics
+static uint32_t alarm_commands = 0;
+static uint32_t alarm_commands_dropped = 0;
+static uint32_t alarm_commands_superseded = 0;
+static uint32_t alarm_command_latency_us_last = 0;
+static uint64_t alarm_command_latency_us_total = 0;
+static uint32_t alarm_command_latency_us_max = 0;
+
+// Drop commands a later one in the batch makes moot: any snooze when there's
+// a stop (in either order, so stopping always wins), and all but the last of
+// several reconfigurations. Returns the new count.
+static int alarm_resolve_batch(alarm_command_message_t* batch, int count)
+{
+    bool has_stop = pdFALSE;
+    int last_reconfig = -1;
+    for (int msgIdx = 0; msgIdx < count; msgIdx++)
+    {
+        if (batch[msgIdx].command == alarm_command_stop)
+        {
+            has_stop = pdTRUE;
         }
+        else if (batch[msgIdx].command == alarm_command_reconfig)
+        {
+            last_reconfig = msgIdx;
+        }
+    }
 
-        alarm_current_state = alarm_next_state;
-    } // while pdTRUE
+    int kept = 0;
+    for (int msgIdx = 0; msgIdx < count; msgIdx++)
+    {
+        alarm_command command = batch[msgIdx].command;
+        if ((has_stop && command == alarm_command_snooze) ||
+            (command == alarm_command_reconfig && msgIdx != last_reconfig))
+        {
+            ESP_LOGI(TAG, "Dropping %s, superseded", alarm_command_names[command]);
+            alarm_commands_superseded++;
+            continue;
+        }
+        batch[kept++] = batch[msgIdx];
+    }
+    return kept;
+}
+
+int64_t alarm_task_pass(int64_t deadline_us)
+{
+    alarm_command_message_t batch[ALARM_COMMAND_QUEUE_LEN];
+
+    // Everything already queued is taken as one batch, so commands sent
+    // close together are resolved against each other before any acts
+    int count = 0;
+    if (alarm_wait_command(&batch[0], alarm_ticks_until(deadline_us, alarm_clock_us())))
+    {
+        count = 1;
+        while (count < ALARM_COMMAND_QUEUE_LEN && alarm_wait_command(&batch[count], 0))
+        {
+            count++;
+        }
+        count = alarm_resolve_batch(batch, count);
+    }
+
+    if (count == 0)
+    {
+        deadline_us = alarm_step(alarm_command_none, alarm_clock_us());
+    }
+    for (int msgIdx = 0; msgIdx < count; msgIdx++)
+    {
+        uint32_t latency_us = (uint32_t)(alarm_uptime_us() - batch[msgIdx].sent_us);
+        alarm_commands++;
+        alarm_command_latency_us_last = latency_us;
+        alarm_command_latency_us_total += latency_us;
+        if (latency_us > alarm_command_latency_us_max)
+        {
+            alarm_command_latency_us_max = latency_us;
+        }
+        deadline_us = alarm_step(batch[msgIdx].command, alarm_clock_us());
+        // configuring and sleep_mode_start move on whatever they're given,
+        // so finish passing through them before the next command, which
+        // they'd otherwise swallow
+        while (alarm_current_state == configuring || alarm_current_state == sleep_mode_start)
+        {
+            deadline_us = alarm_step(alarm_command_none, alarm_clock_us());
+        }
+    }
+    return deadline_us;
+}
+
+void alarm_task_func(void* param)
+{
+    int64_t deadline_us = ALARM_NO_DEADLINE;
+
+    while (pdTRUE)
+    {
+        deadline_us = alarm_task_pass(deadline_us);
+    }
+}
+
+void alarm_get_stats(alarm_stats_t* stats)
+{
+    stats->steps = alarm_steps;
+    stats->transitions = alarm_transitions;
+    stats->step_cycles_avg = alarm_steps > 0 ? alarm_step_cycles_total / alarm_steps : 0;
+    stats->step_cycles_max = alarm_step_cycles_max;
+    stats->commands = alarm_commands;
+    stats->commands_dropped = alarm_commands_dropped;
+    stats->commands_superseded = alarm_commands_superseded;
+    stats->command_latency_us_last = alarm_command_latency_us_last;
+    stats->command_latency_us_avg = alarm_commands > 0 ? alarm_command_latency_us_total / alarm_commands : 0;
+    stats->command_latency_us_max = alarm_command_latency_us_max;
+}
+
+static void alarm_send(alarm_command command)
+{
+    alarm_command_message_t message = {
+        .command = command,
+        .sent_us = alarm_uptime_us(),
+    };
+    // Nothing waits for room except stopping, which mustn't get lost
+    TickType_t wait = (command == alarm_command_stop || command == alarm_command_sleep_stop)
+        ? ALARM_STOP_SEND_WAIT_MS / portTICK_PERIOD_MS : 0;
+    if (!alarm_post_command(&message, wait))
+    {
+        alarm_commands_dropped++;
+        ESP_LOGE(TAG, "%s: queue full, dropped %s", __FUNCTION__, alarm_command_names[command]);
+    }
 }
 
 void alarm_system_time_or_settings_changed()
 {
-    xEventGroupSetBits(alarm_event_group, ALARM_RECONFIG_BIT);
+    alarm_send(alarm_command_reconfig);
 }
 
 void alarm_snooze()
 {
-    xEventGroupSetBits(alarm_event_group, ALARM_SNOOZE_BIT);
+    alarm_send(alarm_command_snooze);
 }
 
 void alarm_stop()
 {
-    xEventGroupSetBits(alarm_event_group, ALARM_STOP_BIT);
+    alarm_send(alarm_command_stop);
 }
 
 void alarm_manual_start()
 {
-    xEventGroupSetBits(alarm_event_group, ALARM_MANUAL_START_BIT);
+    alarm_send(alarm_command_manual_start);
 }
 
 void sleep_start()
 {
-    xEventGroupSetBits(alarm_event_group, SLEEP_START_BIT);
+    alarm_send(alarm_command_sleep_start);
 }
 
 void sleep_stop()
 {
-    xEventGroupSetBits(alarm_event_group, SLEEP_STOP_BIT);
+    alarm_send(alarm_command_sleep_stop);
 }
 
 esp_err_t init_alarm()
 {
-    alarm_event_group = xEventGroupCreate();
+    esp_err_t err = alarm_platform_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: failed to create command queue", __FUNCTION__);
+        return err;
+    }
     xTaskCreate(alarm_task_func, "time_check_task Task", 4*1024, NULL, 1, &alarm_task);
 
     return ESP_OK;
@@ -9,8 +9,32 @@
 // esp_err_t
 #include "esp_err.h"
 
-// FreeRTOS event groups
-#include "freertos/event_groups.h"
+// MAKE_ENUM
+#include "color.h"
+
+// TRANSMOG(name)
+#define ALARM_COMMANDS \
+    TRANSMOG(none) \
+    TRANSMOG(stop) \
+    TRANSMOG(snooze) \
+    TRANSMOG(reconfig) \
+    TRANSMOG(manual_start) \
+    TRANSMOG(sleep_start) \
+    TRANSMOG(sleep_stop) \
+
+#define TRANSMOG(name) alarm_command_##name,
+MAKE_ENUM(alarm_command, ALARM_COMMANDS)
+#undef TRANSMOG
+
+extern const char* alarm_command_names[];
+
+// The functions below queue one of these each, and the state machine acts on
+// them one at a time in the order they were sent
+typedef struct _alarm_command_message_t {
+    alarm_command command;
+    // alarm_uptime_us when it was sent, for latency statistics
+    int64_t sent_us;
+} alarm_command_message_t;
 
 void alarm_system_time_or_settings_changed();
 void alarm_snooze();
@@ -21,3 +45,54 @@ void sleep_start();
 void sleep_stop();
 
 esp_err_t init_alarm();
+
+// Plenty for a burst of button presses and settings posts
+#define ALARM_COMMAND_QUEUE_LEN 16
+
+// Seams for driving the state machine off the device. alarm_platform.c
+// implements them on the device; a host build links its own virtual clock and
+// command source instead, and with its own led_run_sync and get_setting_u32,
+// runs weeks of schedule without waiting.
+
+// Create the command queue
+esp_err_t alarm_platform_init(void);
+// Wall clock, in microseconds since the Unix Epoch
+int64_t alarm_clock_us(void);
+// Monotonic time since boot, in microseconds, for command latency
+int64_t alarm_uptime_us(void);
+// Free-running CPU cycle counter, for step timing
+uint32_t alarm_cycles(void);
+// Queue a command, waiting up to ticks for room. False if it didn't fit.
+bool alarm_post_command(const alarm_command_message_t* message, TickType_t ticks);
+// Take the next command, waiting up to ticks for one. False if none came.
+bool alarm_wait_command(alarm_command_message_t* message, TickType_t ticks);
+
+// Run the state machine once, as if woken at now_us by command (or by its
+// own deadline, for alarm_command_none). Returns when it next needs to run
+// without a command, or INT64_MAX for never.
+int64_t alarm_step(alarm_command command, int64_t now_us);
+
+// One pass of the alarm task: wait until deadline_us (INT64_MAX for no
+// deadline) for commands, then act on them, or step on the deadline if none
+// came. Returns the next deadline. The alarm task calls this forever; a build
+// off the device can call it directly instead.
+int64_t alarm_task_pass(int64_t deadline_us);
+
+typedef struct _alarm_stats_t {
+    uint32_t steps;
+    uint32_t transitions;
+    // CPU cycles per step, not counting time spent in led_run_sync
+    uint32_t step_cycles_avg;
+    uint32_t step_cycles_max;
+    // commands acted on, dropped with the queue full, and dropped because a
+    // later command in the same batch overrides them
+    uint32_t commands;
+    uint32_t commands_dropped;
+    uint32_t commands_superseded;
+    // from sending a command to the state machine acting on it, in us
+    uint32_t command_latency_us_last;
+    uint32_t command_latency_us_avg;
+    uint32_t command_latency_us_max;
+} alarm_stats_t;
+
+void alarm_get_stats(alarm_stats_t* stats);
@@ -0,0 +1,51 @@
+#include "alarm.h"
+
+// gettimeofday
+#include <sys/time.h>
+
+// FreeRTOS queues
+#include "freertos/queue.h"
+
+// xthal_get_ccount, for step timing
+#include "xtensa/hal.h"
+
+// esp_timer_get_time, for command latency
+#include "esp_timer.h"
+
+// The alarm state machine's clocks and command queue on the device. A host
+// build leaves this file out and supplies its own; see alarm.h.
+
+static QueueHandle_t alarm_command_queue;
+
+esp_err_t alarm_platform_init(void)
+{
+    alarm_command_queue = xQueueCreate(ALARM_COMMAND_QUEUE_LEN, sizeof(alarm_command_message_t));
+    return alarm_command_queue != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+int64_t alarm_clock_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int64_t alarm_uptime_us(void)
+{
+    return esp_timer_get_time();
+}
+
+uint32_t alarm_cycles(void)
+{
+    return xthal_get_ccount();
+}
+
+bool alarm_post_command(const alarm_command_message_t* message, TickType_t ticks)
+{
+    return xQueueSend(alarm_command_queue, message, ticks) == pdTRUE;
+}
+
+bool alarm_wait_command(alarm_command_message_t* message, TickType_t ticks)
+{
+    return xQueueReceive(alarm_command_queue, message, ticks) == pdTRUE;
+}
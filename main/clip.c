@@ -0,0 +1,440 @@
+
+#include "clip.h"
+
+// Logging facility
+#include <esp_log.h>
+
+// memcpy
+#include <string.h>
+
+#define TAG "clip.c"
+
+static const esp_partition_t* clip_partition = NULL;
+
+// Only one mapping is handed out at a time; uploading waits for it to be released.
+static bool clip_is_mapped = pdFALSE;
+
+// Upload progress
+static bool clip_upload_in_progress = pdFALSE;
+static size_t clip_upload_len = 0;
+static size_t clip_upload_offset = 0;
+
+static const esp_partition_t* clip_find_partition()
+{
+    if (clip_partition == NULL)
+    {
+        clip_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, CLIP_PARTITION_SUBTYPE, CLIP_PARTITION_LABEL);
+        if (clip_partition == NULL)
+        {
+            ESP_LOGE(TAG, "%s: no '%s' partition in the partition table", __FUNCTION__, CLIP_PARTITION_LABEL);
+        }
+    }
+    return clip_partition;
+}
+
+// Returns the total length of the stored clip described by header, or 0 if
+// the header is invalid or the clip would not fit in limit bytes.
+static size_t clip_stored_len(const esp_partition_t* partition, const clip_header_t* header, size_t limit)
+{
+    if (header->magic != CLIP_MAGIC)
+    {
+        ESP_LOGE(TAG, "%s: bad magic 0x%08x", __FUNCTION__, header->magic);
+        return 0;
+    }
+    if (header->version != CLIP_VERSION_RAW && header->version != CLIP_VERSION_DELTA)
+    {
+        ESP_LOGE(TAG, "%s: unsupported version %d", __FUNCTION__, header->version);
+        return 0;
+    }
+    if (header->header_len < sizeof(clip_header_t) ||
+        header->strip_count == 0 ||
+        header->leds_per_strip == 0 ||
+        header->frame_count == 0 ||
+        header->fps == 0)
+    {
+        ESP_LOGE(TAG, "%s: malformed header (len %d, %dx%d, %d frames, %d fps)", __FUNCTION__,
+                 header->header_len, header->strip_count, header->leds_per_strip, header->frame_count, header->fps);
+        return 0;
+    }
+
+    size_t clip_len;
+    if (header->version == CLIP_VERSION_RAW)
+    {
+        size_t frame_len = (size_t)header->strip_count * header->leds_per_strip * 3;
+        clip_len = header->header_len + frame_len * header->frame_count;
+    }
+    else
+    {
+        // The offset table is read in place, so it has to be word-aligned.
+        size_t table_len = ((size_t)header->frame_count + 1) * sizeof(uint32_t);
+        if (header->header_len % sizeof(uint32_t) != 0 || header->header_len + table_len > limit)
+        {
+            ESP_LOGE(TAG, "%s: record table misplaced", __FUNCTION__);
+            return 0;
+        }
+        // The final offset is the end of the clip
+        uint32_t end_offset;
+        if (esp_partition_read(partition, header->header_len + table_len - sizeof(uint32_t), &end_offset, sizeof(end_offset)) != ESP_OK)
+        {
+            return 0;
+        }
+        // Past the table, with room for at least the first record's type byte
+        if (end_offset < header->header_len + table_len + 1)
+        {
+            ESP_LOGE(TAG, "%s: clip ends at %u, inside its record table", __FUNCTION__, end_offset);
+            return 0;
+        }
+        clip_len = end_offset;
+    }
+
+    if (clip_len > limit)
+    {
+        ESP_LOGE(TAG, "%s: clip length %zu exceeds %zu", __FUNCTION__, clip_len, limit);
+        return 0;
+    }
+    return clip_len;
+}
+
+static bool clip_is_keyframe(const clip_t* clip, uint32_t frame_idx)
+{
+    const uint8_t* record = (const uint8_t*)clip->header + clip->record_offsets[frame_idx];
+    return *record != clip_record_xor;
+}
+
+// Check the record table of a mapped delta clip so decoding never reads outside the mapping
+static bool clip_validate_records(const clip_t* clip, size_t clip_len)
+{
+    const clip_header_t* header = clip->header;
+    const uint32_t* offsets = clip->record_offsets;
+    size_t table_end = header->header_len + ((size_t)header->frame_count + 1) * sizeof(uint32_t);
+
+    for (uint32_t recordIdx = 0; recordIdx < header->frame_count; recordIdx++)
+    {
+        // Every record holds at least its type byte
+        if (offsets[recordIdx] < table_end || offsets[recordIdx] >= offsets[recordIdx + 1] || offsets[recordIdx + 1] > clip_len)
+        {
+            ESP_LOGE(TAG, "%s: record %u out of bounds", __FUNCTION__, recordIdx);
+            return pdFALSE;
+        }
+    }
+    if (!clip_is_keyframe(clip, 0))
+    {
+        ESP_LOGE(TAG, "%s: first record is not a keyframe", __FUNCTION__);
+        return pdFALSE;
+    }
+    return pdTRUE;
+}
+
+esp_err_t clip_map(clip_t* clip, uint8_t* framebuffer, size_t framebuffer_len)
+{
+    if (clip == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (clip_is_mapped || clip_upload_in_progress)
+    {
+        ESP_LOGE(TAG, "%s: clip is busy", __FUNCTION__);
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_t* partition = clip_find_partition();
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Read the header first so only the used part of the partition has to be mapped
+    clip_header_t header;
+    esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    size_t clip_len = clip_stored_len(partition, &header, partition->size);
+    if (clip_len == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t frame_len = (size_t)header.strip_count * header.leds_per_strip * 3;
+    if (header.version == CLIP_VERSION_DELTA && (framebuffer == NULL || framebuffer_len < frame_len))
+    {
+        ESP_LOGE(TAG, "%s: %zu-byte frames need a framebuffer", __FUNCTION__, frame_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const void* mapped = NULL;
+    err = esp_partition_mmap(partition, 0, clip_len, SPI_FLASH_MMAP_DATA, &mapped, &clip->mmap_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: mapping %zu bytes failed (0x%x)", __FUNCTION__, clip_len, err);
+        return err;
+    }
+
+    clip->header = (const clip_header_t*)mapped;
+    clip->frame_len = frame_len;
+    clip->frames = NULL;
+    clip->record_offsets = NULL;
+    clip->framebuffer = NULL;
+    clip->decoded_idx = -1;
+    clip->decoded_keyframe = -1;
+    if (header.version == CLIP_VERSION_RAW)
+    {
+        clip->frames = (const uint8_t*)mapped + header.header_len;
+    }
+    else
+    {
+        clip->record_offsets = (const uint32_t*)((const uint8_t*)mapped + header.header_len);
+        clip->framebuffer = framebuffer;
+        if (!clip_validate_records(clip, clip_len))
+        {
+            spi_flash_munmap(clip->mmap_handle);
+            clip->header = NULL;
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    clip_is_mapped = pdTRUE;
+
+    return ESP_OK;
+}
+
+// Apply record record_idx to the framebuffer. Keyframes replace its contents;
+// deltas move it from frame record_idx-1 to record_idx, or back again.
+static bool clip_apply_record(clip_t* clip, uint32_t record_idx)
+{
+    const uint8_t* record = (const uint8_t*)clip->header + clip->record_offsets[record_idx];
+    const uint8_t* record_end = (const uint8_t*)clip->header + clip->record_offsets[record_idx + 1];
+    const size_t frame_len = clip->frame_len;
+    uint8_t* fb = clip->framebuffer;
+    size_t fb_idx = 0;
+
+    clip_record_type_t type = *record++;
+    switch (type)
+    {
+    case clip_record_raw:
+        if (record_end - record != frame_len)
+        {
+            break;
+        }
+        memcpy(fb, record, frame_len);
+        return pdTRUE;
+    case clip_record_rle:
+        while (record_end - record >= 4)
+        {
+            size_t run_len = record[0] * 3;
+            if (run_len > frame_len - fb_idx)
+            {
+                break;
+            }
+            for (size_t byteIdx = 0; byteIdx < run_len; byteIdx += 3)
+            {
+                fb[fb_idx + byteIdx + 0] = record[1];
+                fb[fb_idx + byteIdx + 1] = record[2];
+                fb[fb_idx + byteIdx + 2] = record[3];
+            }
+            fb_idx += run_len;
+            record += 4;
+        }
+        return record == record_end && fb_idx == frame_len;
+    case clip_record_xor:
+        while (record_end - record >= 2)
+        {
+            size_t skip_len = record[0] * 3;
+            size_t run_len = record[1] * 3;
+            record += 2;
+            if (skip_len > frame_len - fb_idx ||
+                run_len > frame_len - fb_idx - skip_len ||
+                run_len > record_end - record)
+            {
+                break;
+            }
+            fb_idx += skip_len;
+            for (size_t byteIdx = 0; byteIdx < run_len; byteIdx++)
+            {
+                fb[fb_idx + byteIdx] ^= record[byteIdx];
+            }
+            fb_idx += run_len;
+            record += run_len;
+        }
+        return record == record_end;
+    default:
+        break;
+    }
+
+    ESP_LOGE(TAG, "%s: record %u (type %d) is corrupt", __FUNCTION__, record_idx, type);
+    return pdFALSE;
+}
+
+// The last keyframe in [floor, frame_idx], or -1 if there is none. Callers
+// only look back as far as they are about to decode forward anyway, so the
+// search never costs more than the decode.
+static int32_t clip_find_keyframe(const clip_t* clip, int32_t frame_idx, int32_t floor)
+{
+    for (int32_t recordIdx = frame_idx; recordIdx >= floor; recordIdx--)
+    {
+        if (clip_is_keyframe(clip, recordIdx))
+        {
+            return recordIdx;
+        }
+    }
+    return -1;
+}
+
+const uint8_t* clip_get_frame(clip_t* clip, uint32_t frame_idx)
+{
+    if (clip == NULL || clip->header == NULL || frame_idx >= clip->header->frame_count)
+    {
+        return NULL;
+    }
+    if (clip->header->version == CLIP_VERSION_RAW)
+    {
+        return clip->frames + frame_idx * clip->frame_len;
+    }
+
+    const int32_t target = frame_idx;
+    const int32_t current = clip->decoded_idx;
+    // First record to apply on the way forward to target
+    int32_t first;
+    bool ok = pdTRUE;
+
+    if (current == target)
+    {
+        return clip->framebuffer;
+    }
+    else if (0 <= current && current < target)
+    {
+        // Step forward from the current frame, or from the last keyframe on
+        // the way if there is one
+        int32_t keyframe = clip_find_keyframe(clip, target, current + 1);
+        first = current + 1;
+        if (keyframe >= 0)
+        {
+            first = keyframe;
+            clip->decoded_keyframe = keyframe;
+        }
+    }
+    else if (0 <= current && clip->decoded_keyframe <= target)
+    {
+        // Back within the current keyframe's run of deltas
+        if (current - target <= target - clip->decoded_keyframe)
+        {
+            // Undoing deltas beats re-decoding from the keyframe
+            for (int32_t recordIdx = current; ok && recordIdx > target; recordIdx--)
+            {
+                ok = clip_apply_record(clip, recordIdx);
+            }
+            clip->decoded_idx = ok ? target : -1;
+            return ok ? clip->framebuffer : NULL;
+        }
+        first = clip->decoded_keyframe;
+    }
+    else
+    {
+        // Start over from the closest keyframe; record 0 always is one
+        first = clip_find_keyframe(clip, target, 0);
+        clip->decoded_keyframe = first;
+    }
+
+    for (int32_t recordIdx = first; ok && recordIdx <= target; recordIdx++)
+    {
+        ok = clip_apply_record(clip, recordIdx);
+    }
+    clip->decoded_idx = ok ? target : -1;
+    return ok ? clip->framebuffer : NULL;
+}
+
+void clip_unmap(clip_t* clip)
+{
+    if (clip == NULL || clip->header == NULL)
+    {
+        return;
+    }
+    spi_flash_munmap(clip->mmap_handle);
+    clip->header = NULL;
+    clip->frames = NULL;
+    clip->record_offsets = NULL;
+    clip->framebuffer = NULL;
+    clip->frame_len = 0;
+    clip->decoded_idx = -1;
+    clip->decoded_keyframe = -1;
+    clip_is_mapped = pdFALSE;
+}
+
+esp_err_t clip_upload_begin(size_t clip_len)
+{
+    if (clip_is_mapped || clip_upload_in_progress)
+    {
+        ESP_LOGE(TAG, "%s: clip is busy", __FUNCTION__);
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_t* partition = clip_find_partition();
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (clip_len < sizeof(clip_header_t) || clip_len > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Erase whole sectors covering the incoming clip
+    size_t erase_len = (clip_len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    esp_err_t err = esp_partition_erase_range(partition, 0, erase_len);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: erasing %zu bytes failed (0x%x)", __FUNCTION__, erase_len, err);
+        return err;
+    }
+
+    clip_upload_in_progress = pdTRUE;
+    clip_upload_len = clip_len;
+    clip_upload_offset = 0;
+    return ESP_OK;
+}
+
+esp_err_t clip_upload_write(const void* data, size_t len)
+{
+    if (!clip_upload_in_progress)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len > clip_upload_len - clip_upload_offset)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = esp_partition_write(clip_partition, clip_upload_offset, data, len);
+    if (err == ESP_OK)
+    {
+        clip_upload_offset += len;
+    }
+    return err;
+}
+
+esp_err_t clip_upload_end(void)
+{
+    if (!clip_upload_in_progress)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    clip_upload_in_progress = pdFALSE;
+
+    if (clip_upload_offset != clip_upload_len)
+    {
+        ESP_LOGE(TAG, "%s: received %zu of %zu bytes", __FUNCTION__, clip_upload_offset, clip_upload_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    clip_header_t header;
+    esp_err_t err = esp_partition_read(clip_partition, 0, &header, sizeof(header));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    size_t clip_len = clip_stored_len(clip_partition, &header, clip_upload_len);
+    if (clip_len == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(TAG, "Stored %d-frame %dx%d version %d clip at %d fps in %zu bytes",
+             header.frame_count, header.strip_count, header.leds_per_strip, header.version, header.fps, clip_len);
+    return ESP_OK;
+}
@@ -0,0 +1,122 @@
+
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+
+// esp_err_t
+#include "esp_err.h"
+
+// spi_flash_mmap_handle_t
+#include "esp_partition.h"
+
+// Animation clips are precomputed frame sequences stored in their own data
+// partition (see partitions.csv) so that patterns can play them back without
+// doing any color math at runtime. tools/clip_encode.py builds them.
+//
+// The partition holds one clip at a time. A frame is every pixel of every
+// strip as R,G,B bytes: strip 0 pixels 0..n-1, then strip 1 pixels 0..n-1...
+//
+// Version 1 (raw) clips store the frames back to back:
+//
+//   clip_header_t
+//   frame 0
+//   frame 1
+//   ...
+//
+// Version 2 (delta) clips store one variable-length record per frame, located
+// through a table of frame_count+1 offsets from the start of the partition.
+// The last offset marks the end of the clip.
+//
+//   clip_header_t
+//   uint32_t record_offsets[frame_count + 1]
+//   record 0
+//   record 1
+//   ...
+//
+// Each record starts with a clip_record_type_t byte:
+//
+//   raw keyframe: the whole frame.
+//   RLE keyframe: (count, r, g, b) runs of identical pixels covering the frame.
+//   XOR delta:    (skip, count, count*(r, g, b)) ops. skip pixels are left as
+//                 they are, then the next count pixels are XORed with the
+//                 given bytes. Pixels after the last op are unchanged.
+//
+// Record 0 is always a keyframe. Because XOR is its own inverse, a delta that
+// turns frame n-1 into frame n also turns frame n back into frame n-1, so
+// clips can be played backward without re-decoding from a keyframe.
+//
+// All multi-byte fields are little-endian, which is also the ESP32's native
+// byte order, so the header and offset table can be used in place once the
+// partition is mapped.
+
+#define CLIP_PARTITION_LABEL "clips"
+#define CLIP_PARTITION_SUBTYPE ((esp_partition_subtype_t)0x40)
+
+// 'C' 'L' 'I' 'P' when read as bytes
+#define CLIP_MAGIC 0x50494C43
+#define CLIP_VERSION_RAW 1
+#define CLIP_VERSION_DELTA 2
+
+typedef struct _clip_header_t {
+    uint32_t magic;
+    uint16_t version;
+    // offset of frame 0 (raw) or of the record offset table (delta) from the start of the partition
+    uint16_t header_len;
+    uint16_t strip_count;
+    uint16_t leds_per_strip;
+    uint16_t frame_count;
+    uint16_t fps;
+} clip_header_t;
+
+typedef enum _clip_record_type_t {
+    clip_record_raw,
+    clip_record_rle,
+    clip_record_xor,
+} clip_record_type_t;
+
+typedef enum _clip_playback_mode_t {
+    // play once and hold the last frame
+    clip_mode_once,
+    // play from the first frame to the last frame, repeatedly
+    clip_mode_loop,
+    // play forward, then backward, repeatedly, without repeating the end frames
+    clip_mode_ping_pong,
+} clip_playback_mode_t;
+
+// A clip mapped into the address space for playback.
+typedef struct _clip_t {
+    const clip_header_t* header;
+    size_t frame_len;
+    // raw clips: the first frame
+    const uint8_t* frames;
+    // delta clips: the record table, and the caller-provided buffer frames are decoded into
+    const uint32_t* record_offsets;
+    uint8_t* framebuffer;
+    // index of the frame currently in framebuffer, or -1, and of the last
+    // keyframe at or before it
+    int32_t decoded_idx;
+    int32_t decoded_keyframe;
+    spi_flash_mmap_handle_t mmap_handle;
+} clip_t;
+
+// Map the stored clip for playback. Fails if the partition does not hold a
+// valid clip. framebuffer must hold at least one frame if the clip is
+// delta-encoded; it is not used for raw clips.
+esp_err_t clip_map(clip_t* clip, uint8_t* framebuffer, size_t framebuffer_len);
+void clip_unmap(clip_t* clip);
+
+// Get the pixels of frame frame_idx. Raw clips return a pointer into flash.
+// Delta clips are decoded in place in the framebuffer, starting from whatever
+// frame it already holds when that is cheaper than starting from a keyframe,
+// so sequential playback in either direction costs O(changed pixels) per frame.
+// Returns NULL if the clip is corrupt.
+const uint8_t* clip_get_frame(clip_t* clip, uint32_t frame_idx);
+
+// Replace the stored clip. Mirrors esp_ota_begin/write/end: the partition is
+// erased up front, data is streamed in, and the result is validated at the end.
+// Uploading is refused while the clip is mapped.
+esp_err_t clip_upload_begin(size_t clip_len);
+esp_err_t clip_upload_write(const void* data, size_t len);
+esp_err_t clip_upload_end(void);
@@ -17,9 +17,10 @@ static const char* main_page_content =
 "<body bgcolor=\"0x111111\" style=\"color: #BBBBEE;\">\n"
 "<h1>"CONFIG_LC_MDNS_INSTANCE" Control Panel</h1>\n"
 "<h2 id=\"current_time\">Current Local Time: ...</h2>\n"
+"<p><canvas id=\"preview\" width=\"600\" height=\"30\" style=\"width: 100%; max-width: 600px; background: #000000;\"></canvas></p>\n"
 "<h2>Actions</h2>\n"
 "<p><button id=\"on\">On</button> <button id=\"off\">Off</button></p>\n"
-"<p><button id=\"night_light\">Night</button></p>\n"
+"<p><button id=\"night_light\">Night</button> <button id=\"circadian\">Circadian</button></p>\n"
 "<p>Alarm:</p>\n"
 "<p><button id=\"alarm_snooze\">Snooze</button> <button id=\"alarm_stop\">Stop</button></p>\n"
 "<p>Sleep Timer:</p>\n"
@@ -29,13 +30,26 @@ static const char* main_page_content =
 "<p>Enabled: <select id=\"alarm_enabled\"></select></p>\n"
 "<p>LED Pattern: <select id=\"alarm_led_pattern\"></select> <button id=\"run_pattern\">Demo Pattern</button></p>\n"
 "<p>Snooze Interval (min): <select id=\"alarm_snooze_interval_min\"></select></p>\n"
+"<p>Sunrise: <select id=\"sunrise_duration_min\"></select> minutes of light brightening up to the alarm (0 = off), curve <select id=\"sunrise_curve\"></select> 0 = linear, 1 = perceptual, 2 = smooth</p>\n"
 "<h2>Sleep Timer Settings</h2>\n"
 "<p>Delay: <select id=\"sleep_delay_min\"></select> minutes from trigger to fade start</p>\n"
 "<p>Fade Time: <select id=\"sleep_fade_time_min\"></select> minutes from fade start to full-off</p>\n"
 "<p>Start Color Temp: <select id=\"sleep_fade_start_temp\"></select>K, Brightness: <select id=\"sleep_fade_start_luminosity\"></select></p>\n"
-"<p>Fill Time: <select id=\"sleep_fade_fill_time_ms\"></select> fade step transition duration (ms)</p>\n"
+"<h2>Circadian Light Settings</h2>\n"
+"<p>Midnight: <select id=\"circadian_temp_0h\"></select>K, Brightness: <select id=\"circadian_lm_0h\"></select></p>\n"
+"<p>4 AM: <select id=\"circadian_temp_4h\"></select>K, Brightness: <select id=\"circadian_lm_4h\"></select></p>\n"
+"<p>8 AM: <select id=\"circadian_temp_8h\"></select>K, Brightness: <select id=\"circadian_lm_8h\"></select></p>\n"
+"<p>Noon: <select id=\"circadian_temp_12h\"></select>K, Brightness: <select id=\"circadian_lm_12h\"></select></p>\n"
+"<p>4 PM: <select id=\"circadian_temp_16h\"></select>K, Brightness: <select id=\"circadian_lm_16h\"></select></p>\n"
+"<p>8 PM: <select id=\"circadian_temp_20h\"></select>K, Brightness: <select id=\"circadian_lm_20h\"></select></p>\n"
 "<h2>Color Pattern Parameters</h2>\n"
 "<p>Fill Time: <select id=\"fill_time_ms\"></select> duration of fill patterns (ms)</p>\n"
+"<p>Particles: <select id=\"particle_budget\"></select> most particles alive at once in particle effects</p>\n"
+"<p>Night Light: <select id=\"night_light_mode\"></select> 0 = steady, 1 = candle, 2 = fire, 3 = aurora</p>\n"
+"<p>WiFi Latency: <select id=\"wifi_latency_budget_ms\"></select> ms the radio may sleep between listens (0 = never sleep)</p>\n"
+"<p>Clip Playback: <select id=\"clip_playback_mode\"></select> 0 = once, 1 = loop, 2 = ping-pong</p>\n"
+"<p>Transition: <select id=\"transition_time_ms\"></select> cross-fade between patterns (ms), easing <select id=\"transition_easing\"></select> 0 = linear, 1 = smooth, 2 = ease in, 3 = ease out</p>\n"
+"<p>Palette: <select id=\"palette_pattern_palette\"></select> 0 = rainbow, 1 = fire, 2 = ocean, 3 = sunrise, 4 = custom, 5 = aurora; custom hues from <select id=\"palette_custom_hue_start\"></select> to <select id=\"palette_custom_hue_end\"></select></p>\n"
 "<h2>Save Settings</h2>\n"
 "<p><button id=\"save\">Save</button></p>\n"
 "<!-- positioned at end so DOM elements are already loaded -->\n"
@@ -90,6 +104,27 @@ static const char* main_page_content =
 "    setTimeout(refreshTime, 1000);\n"
 "}\n"
 "refreshTime();\n"
+"// Live preview of the strips, drawn the way the clock is read: pixel 0 on the right, strip 0 on top\n"
+"const PREVIEW_STRIP_COUNT = 2;\n"
+"async function refreshPreview() {\n"
+"    var frame_req = await fetch('/frame');\n"
+"    var frame = new Uint8Array(await frame_req.arrayBuffer());\n"
+"    var canvas = document.getElementById('preview');\n"
+"    var ctx = canvas.getContext('2d');\n"
+"    var leds_per_strip = frame.length / 3 / PREVIEW_STRIP_COUNT;\n"
+"    var px_w = canvas.width / leds_per_strip;\n"
+"    var px_h = canvas.height / PREVIEW_STRIP_COUNT;\n"
+"    for (var strip = 0; strip < PREVIEW_STRIP_COUNT; strip++) {\n"
+"        for (var led = 0; led < leds_per_strip; led++) {\n"
+"            var idx = (strip * leds_per_strip + led) * 3;\n"
+"            ctx.fillStyle = 'rgb('+frame[idx]+','+frame[idx+1]+','+frame[idx+2]+')';\n"
+"            ctx.fillRect((leds_per_strip - 1 - led) * px_w, strip * px_h, px_w - 1, px_h - 1);\n"
+"        }\n"
+"    }\n"
+"    // Only poll while the page is being looked at\n"
+"    setTimeout(refreshPreview, document.hidden ? 2000 : 200);\n"
+"}\n"
+"refreshPreview();\n"
 "document.getElementById('alarm_snooze').onclick = async function alarm_snooze() {\n"
 "    await fetch('/command?alarm_snooze=1');\n"
 "};\n"
@@ -115,6 +150,11 @@ static const char* main_page_content =
 "    await fetch('/command?sleep_stop=1');\n"
 "    await fetch('/command?run_pattern='+ranges.alarm_led_pattern.indexOf('night_light'));\n"
 "};\n"
+"document.getElementById('circadian').onclick = async function run_pattern() {\n"
+"    await fetch('/command?alarm_stop=1');\n"
+"    await fetch('/command?sleep_stop=1');\n"
+"    await fetch('/command?run_pattern='+ranges.alarm_led_pattern.indexOf('circadian'));\n"
+"};\n"
 "document.getElementById('off').onclick = async function run_pattern() {\n"
 "    await fetch('/command?alarm_stop=1');\n"
 "    await fetch('/command?sleep_stop=1');\n"
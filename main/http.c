@@ -17,6 +17,18 @@
 // send the alarm commands
 #include "alarm.h"
 
+// store animation clips
+#include "clip.h"
+
+// Pixel streaming statistics
+#include "stream.h"
+
+// alarm, sleep and pattern schedules
+#include "schedule.h"
+
+// hold a power lock per request, and report power stats
+#include "power.h"
+
 // Tag used to prefix log entries from this file
 #define TAG "lc-esp32 http"
 
@@ -105,6 +117,68 @@ static const httpd_uri_t settings_put = {
     .user_ctx  = NULL,
 };
 
+static esp_err_t schedule_get_handler(httpd_req_t *req)
+{
+    char* buf;
+    size_t buf_len = CONFIG_LC_HTTP_SETTINGS_BUFFER_SIZE;
+    buf = malloc(buf_len);
+    if (buf == NULL)
+    {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "malloc failed");
+    }
+    buf[buf_len-1] = '\0';
+    ESP_ERROR_CHECK_WITHOUT_ABORT( schedule_to_json(buf, buf_len-1) );
+    ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_resp_set_type(req, "application/json") );
+    esp_err_t send_err = httpd_resp_send(req, buf, strlen(buf));
+    free(buf);
+    return send_err;
+}
+
+static const httpd_uri_t schedule_get = {
+    .uri       = "/schedule",
+    .method    = HTTP_GET,
+    .handler   = schedule_get_handler,
+    .user_ctx  = NULL,
+};
+
+static esp_err_t schedule_post_handler(httpd_req_t *req)
+{
+    char* buf;
+    const size_t buf_len = CONFIG_LC_HTTP_SETTINGS_BUFFER_SIZE;
+    // allow for adding null termination
+    buf = malloc(buf_len+1);
+    if (buf == NULL)
+    {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "malloc failed in schedule_post_handler");
+    }
+    int bytes_read = httpd_req_recv(req, buf, buf_len);
+
+    if (bytes_read < 0 || buf_len < bytes_read)
+    {
+        free(buf);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "error receiving data");
+        return ESP_OK;
+    }
+    buf[bytes_read] = '\0';
+
+    esp_err_t status = json_to_schedule(buf, (size_t)bytes_read + 1);
+    free(buf);
+    if (status != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid schedule");
+        return ESP_OK;
+    }
+
+    return schedule_get_handler(req);
+}
+
+static const httpd_uri_t schedule_put = {
+    .uri       = "/schedule",
+    .method    = HTTP_POST,
+    .handler   = schedule_post_handler,
+    .user_ctx  = NULL,
+};
+
 static esp_err_t command_handler(httpd_req_t *req)
 {
     // commands come in as parameters
@@ -288,17 +362,30 @@ void vApplicationStackOverflowHook( TaskHandle_t xTask,
     bad_stack_callback_count++;
 }
 // be goose, do evil thing
-extern led_color_t status_bits[];
 extern int current_state;
 extern int alarm_current_state;
 
+// Format a histogram as one line: prefix, then space-separated bucket counts
+static void format_histogram(char* buf, size_t buf_len, const char* prefix, const uint32_t* histogram)
+{
+    int written = snprintf(buf, buf_len, "%s", prefix);
+    for (int bucket = 0; bucket < LED_STATS_HISTOGRAM_BUCKETS && (size_t)written < buf_len; bucket++)
+    {
+        written += snprintf(buf + written, buf_len - written, bucket == 0 ? "%u" : " %u", histogram[bucket]);
+    }
+    if ((size_t)written < buf_len)
+    {
+        snprintf(buf + written, buf_len - written, "\n");
+    }
+}
+
 static esp_err_t diag_handler(httpd_req_t *req)
 {
     // heap usage
     // task stack high water marks
     // uptime?
     // ?
-    #define MESSAGE_BUF_LEN 32
+    #define MESSAGE_BUF_LEN 128
     char message[MESSAGE_BUF_LEN];
     esp_err_t send_err;
 
@@ -317,19 +404,30 @@ static esp_err_t diag_handler(httpd_req_t *req)
     send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
     //vTaskGetRunTimeStats(NULL); not available
     snprintf(message, MESSAGE_BUF_LEN, "ls:f%d l%d v%d n%d w%d m%d t%d a%d\n",
-             status_bits[led_status_full_system],
-             status_bits[led_status_led],
-             status_bits[led_status_nvs],
-             status_bits[led_status_netif],
-             status_bits[led_status_wifi],
-             status_bits[led_status_mdns],
-             status_bits[led_status_sntp],
-             status_bits[led_status_alarm]);
+             led_get_status_indicator(led_status_full_system),
+             led_get_status_indicator(led_status_led),
+             led_get_status_indicator(led_status_nvs),
+             led_get_status_indicator(led_status_netif),
+             led_get_status_indicator(led_status_wifi),
+             led_get_status_indicator(led_status_mdns),
+             led_get_status_indicator(led_status_sntp),
+             led_get_status_indicator(led_status_alarm));
     send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
     snprintf(message, MESSAGE_BUF_LEN, "main:%d\n", current_state);
     send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
     snprintf(message, MESSAGE_BUF_LEN, "alarm:%d\n", alarm_current_state);
     send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // alarm state machine: steps, transitions, average and worst cycles per step
+    alarm_stats_t alarm_stats;
+    alarm_get_stats(&alarm_stats);
+    snprintf(message, MESSAGE_BUF_LEN, "as:%u t%u c%u m%u\n",
+             alarm_stats.steps, alarm_stats.transitions, alarm_stats.step_cycles_avg, alarm_stats.step_cycles_max);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // alarm commands: acted on, dropped (queue full), superseded, send-to-act latency in us (last, avg, max)
+    snprintf(message, MESSAGE_BUF_LEN, "ac:%u d%u s%u l%u a%u m%u\n",
+             alarm_stats.commands, alarm_stats.commands_dropped, alarm_stats.commands_superseded,
+             alarm_stats.command_latency_us_last, alarm_stats.command_latency_us_avg, alarm_stats.command_latency_us_max);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
     int64_t uptime = esp_timer_get_time();
     snprintf(message, MESSAGE_BUF_LEN, "up:%lldd%lldh%lldm%llds\n",
              (uptime / 1000 / 1000 / 60 / 60 / 24),
@@ -342,6 +440,74 @@ static esp_err_t diag_handler(httpd_req_t *req)
     bool heap_err = heap_caps_check_integrity_all(true);
     snprintf(message, MESSAGE_BUF_LEN, "heapok:%d\n", (int)heap_err);
     send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // streaming: packets (rejected, lost), frames (shown, dropped), input-to-wire latency in us
+    stream_stats_t stream_stats;
+    stream_get_stats(&stream_stats);
+    snprintf(message, MESSAGE_BUF_LEN, "sp:%u r%u l%u\n",
+             stream_stats.packets, stream_stats.packets_rejected, stream_stats.packets_lost);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    snprintf(message, MESSAGE_BUF_LEN, "sf:%u s%u d%u %ufps\n",
+             stream_stats.frames, stream_stats.frames_shown, stream_stats.frames_dropped, stream_stats.fps);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    snprintf(message, MESSAGE_BUF_LEN, "sl:%u a%u m%u\n",
+             stream_stats.latency_us_last, stream_stats.latency_us_avg, stream_stats.latency_us_max);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // schedules: entries, pending in the heap, heap rebuilds, events fired, next due (Unix Epoch)
+    schedule_stats_t schedule_stats;
+    schedule_get_stats(&schedule_stats);
+    snprintf(message, MESSAGE_BUF_LEN, "sch:%u p%u r%u f%u n%ld\n",
+             schedule_stats.entries, schedule_stats.pending, schedule_stats.rebuilds, schedule_stats.fired, schedule_stats.next);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // settings storage: changes reported, flash commits, unchanged saves skipped, errors,
+    // commit time in us (last, avg, max), blob bytes, version loaded at boot and load time in us
+    settings_storage_stats_t settings_stats;
+    settings_get_stats(&settings_stats);
+    snprintf(message, MESSAGE_BUF_LEN, "ss:%u c%u k%u e%u l%u a%u m%u b%u v%u/%u\n",
+             settings_stats.save_requests, settings_stats.commits, settings_stats.saves_skipped, settings_stats.save_errors,
+             settings_stats.commit_us_last,
+             settings_stats.commits > 0 ? (uint32_t)(settings_stats.commit_us_total / settings_stats.commits) : 0,
+             settings_stats.commit_us_max, settings_stats.blob_len,
+             settings_stats.loaded_version, settings_stats.load_us);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // power: time awake vs. uptime (ms), lock acquisitions (render, http), wifi power save and
+    // listen interval, then estimated average and idle current (mA). The residency is measured; the
+    // currents are not (there's no current sense), they're worked out from it and typical figures.
+    power_stats_t power_stats;
+    power_get_stats(&power_stats);
+    snprintf(message, MESSAGE_BUF_LEN, "pm:%llu/%llu r%u h%u w%u/%u est~%umA i~%umA\n",
+             power_stats.active_us / 1000, power_stats.uptime_us / 1000,
+             power_stats.acquisitions[power_lock_render], power_stats.acquisitions[power_lock_http],
+             power_stats.wifi_ps, power_stats.wifi_listen_interval,
+             power_stats.estimated_ma, power_stats.estimated_idle_ma);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // particles: live now, peak, spawned, dropped over budget, particles drawn per ms
+    led_particle_stats_t particle_stats;
+    led_get_particle_stats(&particle_stats);
+    snprintf(message, MESSAGE_BUF_LEN, "pt:%u p%u s%u d%u %u/ms\n",
+             particle_stats.live, particle_stats.peak, particle_stats.spawned, particle_stats.dropped, particle_stats.per_ms);
+    send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    // per pattern that has drawn anything: frames, fps, late frames, worst jitter (us),
+    // average and max render cycles per frame, pixels sent per frame, render and refresh time log2(us) histograms
+    for (led_pattern_t p = 0; p < lpat_max; p++)
+    {
+        led_pattern_stats_t pattern_stats;
+        led_get_pattern_stats(p, &pattern_stats);
+        if (pattern_stats.frames == 0)
+        {
+            continue;
+        }
+        snprintf(message, MESSAGE_BUF_LEN, "p:%s f%u %ufps l%u j%u\n", led_pattern_names[p],
+                 pattern_stats.frames, pattern_stats.fps, pattern_stats.late_frames, pattern_stats.worst_jitter_us);
+        send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+        snprintf(message, MESSAGE_BUF_LEN, "pc:%llu m%u px%llu\n",
+                 pattern_stats.render_cycles / pattern_stats.frames, pattern_stats.render_cycles_max,
+                 pattern_stats.pixels_sent / pattern_stats.frames);
+        send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+        format_histogram(message, MESSAGE_BUF_LEN, "pr:", pattern_stats.render_us_histogram);
+        send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+        format_histogram(message, MESSAGE_BUF_LEN, "pf:", pattern_stats.refresh_us_histogram);
+        send_err = httpd_resp_send_chunk(req, message, strnlen(message, MESSAGE_BUF_LEN));
+    }
 
     // terminate chunked encoding
     send_err = httpd_resp_send_chunk(req, NULL, 0);
@@ -576,15 +742,169 @@ static const httpd_uri_t firmware_status_uri = {
     .user_ctx  = NULL,
 };
 
+static esp_err_t clip_upload_handler(httpd_req_t *req)
+{
+    char msg[120];
+    const size_t msg_len = sizeof(msg);
+    esp_err_t err;
+
+    ESP_LOGI(TAG, "Receiving %zu-byte clip", req->content_len);
+
+    // The clip can't be rewritten while it's mapped for playback, so stop
+    // whatever is showing. Patterns fade out while still mapped, so go
+    // straight to black instead.
+    static const uint8_t black_frame[LED_FRAME_LEN] = { 0 };
+    led_show_frame(black_frame);
+
+    err = clip_upload_begin(req->content_len);
+    if (err != ESP_OK)
+    {
+        snprintf(msg, msg_len, "clip_upload_begin returned 0x%x", err);
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, msg);
+    }
+
+    char *buf = malloc(CONFIG_LC_HTTP_OTA_RX_BUFFER_SIZE);
+    if (buf == NULL)
+    {
+        clip_upload_end();
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "malloc failed in clip_upload_handler");
+    }
+
+    size_t remaining = req->content_len;
+    while (remaining > 0)
+    {
+        int count = httpd_req_recv(req, buf, remaining < CONFIG_LC_HTTP_OTA_RX_BUFFER_SIZE ? remaining : CONFIG_LC_HTTP_OTA_RX_BUFFER_SIZE);
+        if (count == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            // retry on timeout like the httpd examples do
+            continue;
+        }
+        if (count <= 0)
+        {
+            snprintf(msg, msg_len, "HTTPD error while receiving data: %d", count);
+            err = ESP_FAIL;
+            break;
+        }
+        err = clip_upload_write(buf, count);
+        if (err != ESP_OK)
+        {
+            snprintf(msg, msg_len, "Failed to write %d bytes to flash, error 0x%x.", count, err);
+            break;
+        }
+        remaining -= count;
+    }
+
+    free(buf);
+
+    // Always finish so the partition is released, but keep the first error
+    esp_err_t end_err = clip_upload_end();
+    if (err == ESP_OK && end_err != ESP_OK)
+    {
+        err = end_err;
+        snprintf(msg, msg_len, "Clip rejected, error 0x%x; see log for details.", err);
+    }
+
+    if (err != ESP_OK)
+    {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, msg);
+    }
+    return httpd_resp_sendstr(req, "Clip stored");
+}
+
+static const httpd_uri_t clip_upload_uri = {
+    .uri       = "/clip",
+    .method    = HTTP_PUT,
+    .handler   = clip_upload_handler,
+    .user_ctx  = NULL,
+};
+
+// The frame is LED_FRAME_LEN bytes of R,G,B, strip after strip, as shown
+// before gamma correction.
+static esp_err_t frame_get_handler(httpd_req_t *req)
+{
+    uint8_t frame[LED_FRAME_LEN];
+
+    led_get_frame(frame);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    // the preview polls this, so don't let anything in between cache it
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, (const char*)frame, sizeof(frame));
+}
+
+static const httpd_uri_t frame_get_uri = {
+    .uri       = "/frame",
+    .method    = HTTP_GET,
+    .handler   = frame_get_handler,
+    .user_ctx  = NULL,
+};
+
+static esp_err_t frame_put_handler(httpd_req_t *req)
+{
+    uint8_t frame[LED_FRAME_LEN];
+    size_t received = 0;
+
+    if (req->content_len != sizeof(frame))
+    {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Frames are %d bytes, not %zu", LED_FRAME_LEN, req->content_len);
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, msg);
+    }
+
+    while (received < sizeof(frame))
+    {
+        int count = httpd_req_recv(req, (char*)frame + received, sizeof(frame) - received);
+        if (count == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "HTTPD error while receiving frame");
+        }
+        received += count;
+    }
+
+    led_show_frame(frame);
+    return httpd_resp_sendstr(req, "Frame shown");
+}
+
+static const httpd_uri_t frame_put_uri = {
+    .uri       = "/frame",
+    .method    = HTTP_PUT,
+    .handler   = frame_put_handler,
+    .user_ctx  = NULL,
+};
+
 // Web server handle
 httpd_handle_t server = NULL;
 
+// Every handler runs through here, holding the HTTP power lock only while
+// a request is actually being handled
+static esp_err_t power_locked_handler(httpd_req_t *req)
+{
+    esp_err_t (*handler)(httpd_req_t *req) = req->user_ctx;
+    power_lock_acquire(power_lock_http);
+    esp_err_t err = handler(req);
+    power_lock_release(power_lock_http);
+    return err;
+}
+
+// The server keeps its own copy of the registration, so a local one will do
+static esp_err_t register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    httpd_uri_t locked = *uri_handler;
+    locked.handler = power_locked_handler;
+    locked.user_ctx = uri_handler->handler;
+    return httpd_register_uri_handler(handle, &locked);
+}
+
 esp_err_t lc_http_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
     // Allow for more URIs
-    config.max_uri_handlers = 13;
+    config.max_uri_handlers = 20;
 
     if (server != NULL)
     {
@@ -598,19 +918,24 @@ esp_err_t lc_http_start(void)
     if (start_result == ESP_OK) {
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &settings_get) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &settings_put) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &main_page) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &command_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &temp_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &reboot_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &time_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &coredump_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &diag_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &firmware_update_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &firmware_confirm_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &firmware_rollback_uri) );
-        ESP_ERROR_CHECK_WITHOUT_ABORT( httpd_register_uri_handler(server, &firmware_status_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &settings_get) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &settings_put) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &schedule_get) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &schedule_put) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &main_page) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &command_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &temp_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &reboot_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &time_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &coredump_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &diag_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &firmware_update_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &firmware_confirm_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &firmware_rollback_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &firmware_status_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &clip_upload_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &frame_get_uri) );
+        ESP_ERROR_CHECK_WITHOUT_ABORT( register_uri_handler(server, &frame_put_uri) );
     }
     else
     {
@@ -10,6 +10,7 @@
 
 // Time functions
 #include "time.h"
+#include <sys/time.h>
 
 // settings subsystem
 #include "settings_storage.h"
@@ -17,12 +18,36 @@
 // Color definitions
 #include "color.h"
 
+// Animation clips stored in flash
+#include "clip.h"
+
+// esp_timer_get_time
+#include "esp_timer.h"
+
+// memcpy, memset
+#include <string.h>
+
+// xthal_get_ccount
+#include "xtensa/hal.h"
+
+// Frames streamed over the network
+#include "stream.h"
+
+// Gradient palettes
+#include "palette.h"
+
+// Noise for the ambient night lights
+#include "noise.h"
+
+// Status indicators are updated without locks
+#include <stdatomic.h>
+
+// Stay at full speed and awake while drawing
+#include "power.h"
+
 // logging tag
 #define TAG "lc led.c"
 
-#define LED_STRIP_COUNT 2
-#define LEDS_PER_STRIP 60
-
 // time display pixel definitions
 #define PXS_UNUSED      COLOR_RGB_FROM_STRUCT(color_rgb_color_values[color_rgb_color_nearly_off])
 #define PXS_UNDERSCORE  COLOR_RGB_FROM_STRUCT(color_rgb_color_values[color_rgb_color_yellow])
@@ -35,6 +60,8 @@
 // TODO: Consider pattern-verb command structure instead of unified IDs
 
 void led_reset_status_indicators();
+void led_render_task(void* param);
+static void led_request_frame(led_pattern_t p);
 
 SemaphoreHandle_t led_semaphore;
 
@@ -45,6 +72,342 @@ const char* led_pattern_names[] = {
 
 led_strip_t* strips[LED_STRIP_COUNT];
 
+// Patterns draw into led_frame, in the LED_FRAME_LEN layout and before gamma
+// correction, then call frame_commit to show it. During a transition the
+// pattern being replaced keeps drawing into the other buffer, and commits show
+// a blend of the two.
+static uint8_t led_frames[2][LED_FRAME_LEN];
+static uint8_t* led_frame = led_frames[0];
+
+// The last committed frame, for readers outside the LED code. Commits fill the
+// back snapshot without holding anything, then swap under the spinlock, so a
+// reader only ever waits for a pointer swap or another reader's copy.
+static uint8_t led_snapshots[2][LED_FRAME_LEN];
+static uint8_t* led_snapshot_front = led_snapshots[0];
+static uint8_t* led_snapshot_back = led_snapshots[1];
+static portMUX_TYPE led_snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Cross-fade from the pattern being replaced (outgoing) to the one drawing
+// into led_frame. Only touched with led_semaphore held.
+static bool led_transition_active = pdFALSE;
+static uint8_t* led_outgoing_frame = led_frames[1];
+// lpat_max when the outgoing frame is a still image
+static led_pattern_t led_outgoing_animation = lpat_max;
+static int64_t led_outgoing_next_us = -1;
+static int64_t led_transition_start_us = 0;
+static int64_t led_transition_duration_us = 0;
+static led_easing_t led_transition_easing = led_easing_smooth;
+// Set while the outgoing animation draws, so its commits only update its buffer
+static bool led_drawing_outgoing = pdFALSE;
+// Lets the render task tell whether a pass showed anything, and when, on the
+// pattern clock, the strips last changed
+static uint32_t led_commit_count = 0;
+static int64_t led_last_commit_us = INT64_MIN;
+
+// Rate the render task shows frames at when it's making them up itself:
+// transition blends and interpolated frames
+#define LED_OUTPUT_FPS 60
+#define LED_OUTPUT_FRAME_US (1000000 / LED_OUTPUT_FPS)
+
+// Keyframes of an animation that renders slower than LED_OUTPUT_FPS. The
+// render task shows frames interpolated from the last two, so the animation
+// is always one keyframe behind. Only touched with led_semaphore held.
+static uint8_t led_keyframes[2][LED_FRAME_LEN];
+static uint8_t* led_keyframe_prev = led_keyframes[0];
+static uint8_t* led_keyframe_last = led_keyframes[1];
+static int64_t led_keyframe_prev_us = 0;
+static int64_t led_keyframe_last_us = 0;
+static int led_keyframe_count = 0;
+static int64_t led_output_next_us = 0;
+// Set while the animation draws a keyframe, so its commit only captures it
+static bool led_capturing_keyframe = pdFALSE;
+
+// Rendering statistics, indexed by pattern. Only written with led_semaphore held.
+static led_pattern_stats_t led_stats[lpat_max];
+static int64_t led_stats_fps_window_start_us[lpat_max];
+static uint32_t led_stats_fps_window_frames[lpat_max];
+// The pattern drawing into led_frame, and when it started on the current frame
+static led_pattern_t led_stats_pattern = lpat_max;
+static int64_t led_frame_start_us = 0;
+static uint32_t led_frame_start_ccount = 0;
+
+// The frame timer wakes the render task within tens of microseconds of a
+// deadline, so a frame more than this late means something else held the CPU
+// or led_semaphore.
+#define LED_LATE_FRAME_US 1000
+
+static int stats_bucket(uint32_t us)
+{
+    int bucket = 0;
+    while (us > 1 && bucket < LED_STATS_HISTOGRAM_BUCKETS - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Clocks
+//
+// Patterns take the time only from these, so a build off the device can
+// override them (they're weak) to run patterns on a virtual clock and get the
+// same frames every time. Rendering statistics keep using the real clocks.
+
+int64_t __attribute__((weak)) led_clock_us(void)
+{
+    return esp_timer_get_time();
+}
+
+void __attribute__((weak)) led_clock_wall(struct timeval* tv)
+{
+    gettimeofday(tv, NULL);
+}
+
+void __attribute__((weak)) led_clock_delay_ms(int ms)
+{
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+// When frame tick + 1 of an animation on a fixed timeline from start_us is
+// due. Rounded up, so a pass woken exactly on time has reached that tick
+// instead of drawing tick again.
+static inline int64_t frame_tick_deadline(int64_t start_us, uint32_t tick, uint32_t fps)
+{
+    return start_us + (((int64_t)tick + 1) * 1000000 + fps - 1) / fps;
+}
+
+// Start timing a frame of pattern p
+static void frame_begin(led_pattern_t p)
+{
+    led_stats_pattern = p;
+    led_frame_start_us = esp_timer_get_time();
+    led_frame_start_ccount = xthal_get_ccount();
+}
+
+// Patterns started so far, so one drawing inside led_run_sync can tell it has
+// been replaced. Only touched with led_semaphore held.
+static uint32_t led_pattern_starts = 0;
+
+// Wait between the frames of a pattern that runs inside led_run_sync, without
+// counting the wait as drawing time. led_semaphore is free for the wait, so
+// the render task keeps the outgoing animation and the blend going. Returns
+// false if another pattern started meanwhile, and the caller must stop
+// drawing. Must be called with led_semaphore held.
+static bool frame_delay_ms(int ms)
+{
+    led_pattern_t p = led_stats_pattern;
+    uint32_t starts = led_pattern_starts;
+    xSemaphoreGive(led_semaphore);
+    led_clock_delay_ms(ms);
+    xSemaphoreTake(led_semaphore, portMAX_DELAY);
+    frame_begin(p);
+    return led_pattern_starts == starts;
+}
+
+static void frame_record(int64_t commit_us, uint32_t commit_ccount, int64_t refreshed_us, uint32_t pixels_sent)
+{
+    if (led_stats_pattern >= lpat_max)
+    {
+        return;
+    }
+    led_pattern_stats_t* stats = &led_stats[led_stats_pattern];
+    uint32_t render_cycles = commit_ccount - led_frame_start_ccount;
+
+    stats->frames++;
+    stats->pixels_sent += pixels_sent;
+    stats->render_cycles += render_cycles;
+    if (render_cycles > stats->render_cycles_max)
+    {
+        stats->render_cycles_max = render_cycles;
+    }
+    stats->render_us_histogram[stats_bucket((uint32_t)(commit_us - led_frame_start_us))]++;
+    stats->refresh_us_histogram[stats_bucket((uint32_t)(refreshed_us - commit_us))]++;
+
+    led_stats_fps_window_frames[led_stats_pattern]++;
+    int64_t window_us = refreshed_us - led_stats_fps_window_start_us[led_stats_pattern];
+    if (window_us >= 1000000)
+    {
+        // A window that spans a long idle gap just reads low once
+        stats->fps = (uint32_t)(led_stats_fps_window_frames[led_stats_pattern] * 1000000LL / window_us);
+        led_stats_fps_window_start_us[led_stats_pattern] = refreshed_us;
+        led_stats_fps_window_frames[led_stats_pattern] = 0;
+    }
+}
+
+// Record how far from its deadline an animation frame started
+static void frame_record_jitter(led_pattern_t p, int64_t lateness_us)
+{
+    led_pattern_stats_t* stats = &led_stats[p];
+    uint32_t jitter_us = (uint32_t)(lateness_us < 0 ? -lateness_us : lateness_us);
+    if (jitter_us > stats->worst_jitter_us)
+    {
+        stats->worst_jitter_us = jitter_us;
+    }
+    if (lateness_us > LED_LATE_FRAME_US)
+    {
+        stats->late_frames++;
+    }
+}
+
+void led_get_pattern_stats(led_pattern_t p, led_pattern_stats_t* stats)
+{
+    if (p >= lpat_max)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = led_stats[p];
+}
+
+static inline void frame_set_pixel(int stripIdx, int pixelIdx, uint32_t red, uint32_t green, uint32_t blue)
+{
+    if (pixelIdx < 0 || LEDS_PER_STRIP <= pixelIdx)
+    {
+        ESP_LOGE(TAG, "%s: pixel %d is off the end of the strip", __FUNCTION__, pixelIdx);
+        return;
+    }
+    uint8_t* px = led_frame + (stripIdx * LEDS_PER_STRIP + pixelIdx) * 3;
+    px[0] = red;
+    px[1] = green;
+    px[2] = blue;
+}
+
+#define FRAME_STRIP(stripIdx) (1 << (stripIdx))
+#define FRAME_ALL_STRIPS ((1 << LED_STRIP_COUNT) - 1)
+
+// How far the current transition has gone at time now, eased, from 0 (all
+// outgoing) to 256 (all incoming)
+static uint32_t transition_weight(int64_t now)
+{
+    int64_t elapsed_us = now - led_transition_start_us;
+    if (elapsed_us <= 0)
+    {
+        return 0;
+    }
+    if (elapsed_us >= led_transition_duration_us)
+    {
+        return 256;
+    }
+
+    // t and the eased value are 0.16 fixed point
+    uint64_t t = (uint64_t)(elapsed_us * 65536 / led_transition_duration_us);
+    uint64_t eased;
+    switch (led_transition_easing)
+    {
+    case led_easing_smooth:
+        // 3t^2 - 2t^3
+        eased = (t * t * (3 * 65536 - 2 * t)) >> 32;
+        break;
+    case led_easing_ease_in:
+        eased = (t * t) >> 16;
+        break;
+    case led_easing_ease_out:
+        eased = 65536 - (((65536 - t) * (65536 - t)) >> 16);
+        break;
+    case led_easing_linear:
+    default:
+        eased = t;
+        break;
+    }
+    return (uint32_t)((eased + 128) >> 8);
+}
+
+// Show led_frame on the strips in strip_mask (FRAME_STRIP bits). Strips left
+// out must not have been drawn on since they were last committed. Must be
+// called with led_semaphore held.
+void frame_commit_strips(uint32_t strip_mask)
+{
+    uint32_t commit_ccount = xthal_get_ccount();
+    int64_t commit_us = esp_timer_get_time();
+
+    if (led_drawing_outgoing)
+    {
+        // Shown through the blend on the incoming pattern's next commit
+        frame_record(commit_us, commit_ccount, commit_us, 0);
+        frame_begin(led_stats_pattern);
+        return;
+    }
+
+    if (led_capturing_keyframe)
+    {
+        // Shown by interpolation; the oldest keyframe is recycled
+        uint8_t* keyframe = led_keyframe_prev;
+        led_keyframe_prev = led_keyframe_last;
+        led_keyframe_last = keyframe;
+        memcpy(keyframe, led_frame, LED_FRAME_LEN);
+        frame_record(commit_us, commit_ccount, commit_us, 0);
+        frame_begin(led_stats_pattern);
+        return;
+    }
+
+    if (led_transition_active)
+    {
+        // The blend replaces the snapshot copy, so a transition costs one
+        // multiply-add per channel over a plain commit. Every pixel changes
+        // while blending, so every strip is refreshed.
+        // On the pattern clock, like the transition's start
+        uint32_t incoming_weight = transition_weight(led_clock_us());
+        uint32_t outgoing_weight = 256 - incoming_weight;
+        for (int i = 0; i < LED_FRAME_LEN; i++)
+        {
+            led_snapshot_back[i] = (uint8_t)((led_outgoing_frame[i] * outgoing_weight + led_frame[i] * incoming_weight) >> 8);
+        }
+        strip_mask = FRAME_ALL_STRIPS;
+    }
+    else
+    {
+        memcpy(led_snapshot_back, led_frame, LED_FRAME_LEN);
+    }
+
+    uint32_t pixels_sent = 0;
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        if (strip_mask & FRAME_STRIP(stripIdx))
+        {
+            led_strip_t* strip = strips[stripIdx];
+            strip->set_pixels(strip, 0, LEDS_PER_STRIP, led_snapshot_back + stripIdx * LEDS_PER_STRIP * 3);
+            pixels_sent += LEDS_PER_STRIP;
+        }
+    }
+
+    portENTER_CRITICAL(&led_snapshot_lock);
+    uint8_t* published = led_snapshot_back;
+    led_snapshot_back = led_snapshot_front;
+    led_snapshot_front = published;
+    portEXIT_CRITICAL(&led_snapshot_lock);
+
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        if (strip_mask & FRAME_STRIP(stripIdx))
+        {
+            led_strip_t* strip = strips[stripIdx];
+            strip->refresh(strip);
+        }
+    }
+
+    led_commit_count++;
+    led_last_commit_us = led_clock_us();
+    int64_t refreshed_us = esp_timer_get_time();
+    frame_record(commit_us, commit_ccount, refreshed_us, pixels_sent);
+    // Anything drawn from here on belongs to the pattern's next frame
+    frame_begin(led_stats_pattern);
+}
+
+// Show led_frame on the strips. Must be called with led_semaphore held.
+void frame_commit(void)
+{
+    frame_commit_strips(FRAME_ALL_STRIPS);
+}
+
+void led_get_frame(uint8_t* rgb)
+{
+    portENTER_CRITICAL(&led_snapshot_lock);
+    memcpy(rgb, led_snapshot_front, LED_FRAME_LEN);
+    portEXIT_CRITICAL(&led_snapshot_lock);
+}
+
+TaskHandle_t led_render_task_handle = NULL;
+
 EventGroupHandle_t led_init_task_event;
 
 void led_init_task(void* param)
@@ -141,12 +504,30 @@ esp_err_t led_init(void)
 
     vEventGroupDelete(led_init_task_event);
 
+    // Animations are drawn by their own task. Like the RMT ISR, keep it off
+    // of the WiFi driver's CPU.
+    if (ret == ESP_OK)
+    {
+        err = xTaskCreatePinnedToCore(
+            led_render_task,
+            "led.c render task",
+            4*1024,
+            NULL,
+            2,
+            &led_render_task_handle,
+            1
+            );
+        if (err != pdPASS)
+        {
+            ret = ESP_FAIL;
+        }
+    }
+
     return ret;
 }
 
 void color_showcase()
 {
-    led_strip_t* strip = strips[0];
     const int LEDS_PER_SET = 6;
     const int MAX_INTENSITY = color_hsv_val_values[color_hsv_val_60];
     const int SETS = LEDS_PER_STRIP / LEDS_PER_SET;
@@ -165,23 +546,22 @@ void color_showcase()
                                                         color_hsv_sat_values[color_hsv_sat_100],
                                                         STEP_SIZE * set + 1
                                                         ));
-            strip->set_pixel(strip, ledIdx++, COLOR_RGB_FROM_STRUCT(color));
+            frame_set_pixel(0, ledIdx++, COLOR_RGB_FROM_STRUCT(color));
         }
     }
-    strip->refresh(strip);
+    frame_commit();
 
     // Another strip demos as many continuous colors as possible
     const int HUE_CHUNK_SIZE = 359 / LEDS_PER_STRIP;
-    strip = strips[1];
     for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
     {
         color_rgb_t color = color_hsv_to_rgb(COLOR_HSV_TO_STRUCT(
             HUE_CHUNK_SIZE * pixelIdx, color_hsv_sat_values[color_hsv_sat_100], color_hsv_val_values[color_hsv_val_100]
         ));
 
-        strip->set_pixel(strip, pixelIdx, COLOR_RGB_FROM_STRUCT(color));
+        frame_set_pixel(1, pixelIdx, COLOR_RGB_FROM_STRUCT(color));
     }
-    strip->refresh(strip);
+    frame_commit();
 }
 
 void set_all_rgb(color_rgb_t c)
@@ -189,13 +569,12 @@ void set_all_rgb(color_rgb_t c)
     ESP_LOGI(TAG, "Running pattern %s r=%d g=%d b=%d", __FUNCTION__, COLOR_RGB_FROM_STRUCT(c));
     for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
     {
-        led_strip_t* strip = strips[stripIdx];
         for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
         {
-            strip->set_pixel(strip, pixelIdx, COLOR_RGB_FROM_STRUCT(c));
+            frame_set_pixel(stripIdx, pixelIdx, COLOR_RGB_FROM_STRUCT(c));
         }
-        strip->refresh(strip);
     }
+    frame_commit();
     ESP_LOGI(TAG, "Running pattern %s complete.", __FUNCTION__);
 }
 
@@ -206,11 +585,14 @@ void fill_all_rgb(int per_pixel_delay_ms, color_rgb_t c)
     {
         for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
         {
-            led_strip_t* strip = strips[stripIdx];
-            strip->set_pixel(strip, pixelIdx, COLOR_RGB_FROM_STRUCT(c));
-            strip->refresh(strip);
+            frame_set_pixel(stripIdx, pixelIdx, COLOR_RGB_FROM_STRUCT(c));
+        }
+        frame_commit();
+        if (!frame_delay_ms(per_pixel_delay_ms))
+        {
+            ESP_LOGI(TAG, "Running pattern %s replaced.", __FUNCTION__);
+            return;
         }
-        vTaskDelay(per_pixel_delay_ms / portTICK_PERIOD_MS);
     }
     ESP_LOGI(TAG, "Running pattern %s complete.", __FUNCTION__);
 }
@@ -221,29 +603,27 @@ void fill_brightness_gradient(uint8_t min, uint8_t max)
 
     for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
     {
-        led_strip_t* strip = strips[stripIdx];
         for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
         {
             char brightness = pixelIdx * step_size;
             color_rgb_t grey = color_hsv_to_rgb(COLOR_HSV_TO_STRUCT(0, 0, brightness));
-            strip->set_pixel(strip, pixelIdx, COLOR_RGB_FROM_STRUCT(grey));
+            frame_set_pixel(stripIdx, pixelIdx, COLOR_RGB_FROM_STRUCT(grey));
         }
-        strip->refresh(strip);
     }
+    frame_commit();
 }
 
 void show_integer(int stripIdx, int bitCount, int value, int ledStartIdx, int valueStartIdx, color_rgb_t color)
 {
-    led_strip_t* strip = strips[stripIdx];
     for (int bitIdx = 0; bitIdx < bitCount; bitIdx++)
     {
-        if ((1<<(valueStartIdx+bitIdx)) & value)
+        if ((1u<<(valueStartIdx+bitIdx)) & (uint32_t)value)
         {
-            strip->set_pixel(strip, ledStartIdx+bitIdx, COLOR_RGB_FROM_STRUCT(color));
+            frame_set_pixel(stripIdx, ledStartIdx+bitIdx, COLOR_RGB_FROM_STRUCT(color));
         }
         else
         {
-            strip->set_pixel(strip,
+            frame_set_pixel(stripIdx,
                             ledStartIdx+bitIdx,
                             COLOR_RGB_FROM_STRUCT(color_rgb_color_values[color_rgb_color_nearly_off])
                             );
@@ -271,26 +651,66 @@ uint32_t int_to_bcd(uint32_t val)
     return result;
 }
 
-void show_current_time()
+// Parts of the clock display, so a redraw can skip what hasn't changed
+#define CLOCK_PART_LAYOUT  (1 << 0)
+#define CLOCK_PART_HOURS   (1 << 1)
+#define CLOCK_PART_MINUTES (1 << 2)
+#define CLOCK_PART_SECONDS (1 << 3)
+#define CLOCK_PART_DATE    (1 << 4)
+#define CLOCK_PART_ALL     (CLOCK_PART_LAYOUT | CLOCK_PART_HOURS | CLOCK_PART_MINUTES | CLOCK_PART_SECONDS | CLOCK_PART_DATE)
+
+// Show count delimiter pixels from idx downward. Returns the next free index.
+static int show_delimiter(int stripIdx, int idx, int count, bool draw, uint8_t red, uint8_t green, uint8_t blue)
+{
+    for (; count > 0; count--, idx--)
+    {
+        if (draw)
+        {
+            frame_set_pixel(stripIdx, idx, red, green, blue);
+        }
+    }
+    return idx;
+}
+
+// Show value as digitCount BCD digits from idx downward, most significant
+// first, separated by dashes. The first digit gets topBits bits and the rest
+// get four. Returns the next free index, whether or not anything was drawn.
+static int show_bcd_field(int stripIdx, int idx, uint32_t value, int digitCount, int topBits, color_rgb_t color, bool draw)
+{
+    uint32_t bcd = draw ? int_to_bcd(value) : 0;
+    for (int digit = digitCount - 1; digit >= 0; digit--)
+    {
+        int bits = (digit == digitCount - 1) ? topBits : 4;
+        idx -= bits;
+        if (draw)
+        {
+            show_integer(stripIdx, bits, bcd, idx+1, digit * 4, color);
+        }
+        if (digit > 0)
+        {
+            idx = show_delimiter(stripIdx, idx, 1, draw, PXS_DASH);
+        }
+    }
+    return idx;
+}
+
+// Draw the parts of the clock display for local_now. Does not commit.
+static void show_current_time(const struct tm* local_now, uint32_t parts)
 {
 #if LED_STRIP_COUNT >= 2 && LEDS_PER_STRIP >= 60
-    led_strip_t* upperStrip = strips[0];
-    led_strip_t* lowerStrip = strips[1];
-    // Clear the strips
-    for (int ledIdx = 0; ledIdx < LEDS_PER_STRIP; ledIdx++)
+    const bool layout = parts & CLOCK_PART_LAYOUT;
+    // The date is short enough to redraw along with its delimiters
+    const bool date = parts & CLOCK_PART_DATE;
+
+    if (layout)
     {
-        upperStrip->set_pixel(upperStrip, ledIdx, PXS_UNUSED);
-        lowerStrip->set_pixel(lowerStrip, ledIdx, PXS_UNUSED);
+        // Clear the strips
+        for (int ledIdx = 0; ledIdx < LEDS_PER_STRIP; ledIdx++)
+        {
+            frame_set_pixel(0, ledIdx, PXS_UNUSED);
+            frame_set_pixel(1, ledIdx, PXS_UNUSED);
+        }
     }
-    // Get the time
-    time_t now;
-    time(&now);
-    // Translate it into a struct
-    struct tm local_now;
-    localtime_r(&now, &local_now);
-    ESP_LOGI(TAG, "Time from tm struct: %02d:%02d:%02d %02d/%02d/%04d",
-        local_now.tm_hour, local_now.tm_min, local_now.tm_sec,
-        local_now.tm_mon, local_now.tm_mday, local_now.tm_year + 1900);
     // LEDS_PER_STRIP is currently 60.
     // 59                                                         0
     // ------------------------------------------------------------
@@ -309,116 +729,61 @@ void show_current_time()
 
     int currentIdx = LEDS_PER_STRIP - 1;
 
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_UNDERSCORE);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_UNDERSCORE);
+    currentIdx = show_delimiter(0, currentIdx, 2, layout, PXS_UNDERSCORE);
 
     // Show BCD time on upperStrip
-    int hour_bcd = int_to_bcd(local_now.tm_hour);
-    currentIdx -= 2;
-    show_integer(0, 2, hour_bcd, currentIdx+1, 4, PXS_TIME_BIT);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(0, 4, hour_bcd, currentIdx+1, 0, PXS_TIME_BIT);
-
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_COLON);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_COLON);
-
-    int min_bcd = int_to_bcd(local_now.tm_min);
-    currentIdx -= 3;
-    show_integer(0, 3, min_bcd, currentIdx+1, 4, PXS_TIME_BIT);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(0, 4, min_bcd, currentIdx+1, 0, PXS_TIME_BIT);
-
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_COLON);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_COLON);
-
-    int sec_bcd = int_to_bcd(local_now.tm_sec);
-    currentIdx -= 3;
-    show_integer(0, 3, sec_bcd, currentIdx+1, 4, PXS_TIME_BIT);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(0, 4, sec_bcd, currentIdx+1, 0, PXS_TIME_BIT);
-
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_UNDERSCORE);
-    upperStrip->set_pixel(upperStrip, currentIdx--, PXS_UNDERSCORE);
-
-    // Indicate bitness
-    const uint32_t PX_SOFT = 40;
-    upperStrip->set_pixel(upperStrip, 3, 0, PX_SOFT, 0);
-    upperStrip->set_pixel(upperStrip, 2, 0, PX_SOFT/2, 0);
-    upperStrip->set_pixel(upperStrip, 1, 0, PX_SOFT/6, 0);
-    upperStrip->set_pixel(upperStrip, 0, 0, 1, 0);
+    currentIdx = show_bcd_field(0, currentIdx, local_now->tm_hour, 2, 2, PXS_TIME_BIT, parts & CLOCK_PART_HOURS);
+    currentIdx = show_delimiter(0, currentIdx, 2, layout, PXS_COLON);
+    currentIdx = show_bcd_field(0, currentIdx, local_now->tm_min, 2, 3, PXS_TIME_BIT, parts & CLOCK_PART_MINUTES);
+    currentIdx = show_delimiter(0, currentIdx, 2, layout, PXS_COLON);
+    currentIdx = show_bcd_field(0, currentIdx, local_now->tm_sec, 2, 3, PXS_TIME_BIT, parts & CLOCK_PART_SECONDS);
+    currentIdx = show_delimiter(0, currentIdx, 2, layout, PXS_UNDERSCORE);
+
+    if (layout)
+    {
+        // Indicate bitness
+        const uint32_t PX_SOFT = 40;
+        frame_set_pixel(0, 3, 0, PX_SOFT, 0);
+        frame_set_pixel(0, 2, 0, PX_SOFT/2, 0);
+        frame_set_pixel(0, 1, 0, PX_SOFT/6, 0);
+        frame_set_pixel(0, 0, 0, 1, 0);
+    }
 
     // Show BCD date in American format on lowerStrip
 
     currentIdx = LEDS_PER_STRIP - 1;
 
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-
+    currentIdx = show_delimiter(1, currentIdx, 2, date, PXS_UNDERSCORE);
     // tm_mon is months since January, humans use one-indexed value
-    int month_bcd = int_to_bcd(local_now.tm_mon + 1);
-    currentIdx -= 1;
-    show_integer(1, 1, month_bcd, currentIdx+1, 4, PXS_DATE_BIT);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(1, 4, month_bcd, currentIdx+1, 0, PXS_DATE_BIT);
-
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_SLASH);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_SLASH);
-
+    currentIdx = show_bcd_field(1, currentIdx, local_now->tm_mon + 1, 2, 1, PXS_DATE_BIT, date);
+    currentIdx = show_delimiter(1, currentIdx, 2, date, PXS_SLASH);
     // tm_mday is one-indexed
-    int day_bcd = int_to_bcd(local_now.tm_mday);
-    currentIdx -= 2;
-    show_integer(1, 2, day_bcd, currentIdx+1, 4, PXS_DATE_BIT);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(1, 4, day_bcd, currentIdx+1, 0, PXS_DATE_BIT);
-
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_SLASH);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_SLASH);
-
+    currentIdx = show_bcd_field(1, currentIdx, local_now->tm_mday, 2, 2, PXS_DATE_BIT, date);
+    currentIdx = show_delimiter(1, currentIdx, 2, date, PXS_SLASH);
     // tm_year is years since 1900
-    int year_bcd = int_to_bcd(local_now.tm_year + 1900);
-    currentIdx -= 2;
-    show_integer(1, 2, year_bcd, currentIdx+1, 12, PXS_DATE_BIT);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(1, 4, year_bcd, currentIdx+1, 8, PXS_DATE_BIT);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(1, 4, year_bcd, currentIdx+1, 4, PXS_DATE_BIT);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_DASH);
-    currentIdx -= 4;
-    show_integer(1, 4, year_bcd, currentIdx+1, 0, PXS_DATE_BIT);
-
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-
-    currentIdx -= 1;
-    show_integer(1, 1, local_now.tm_isdst, currentIdx+1, 0, PXS_DATE_BIT);
-
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-
+    currentIdx = show_bcd_field(1, currentIdx, local_now->tm_year + 1900, 4, 2, PXS_DATE_BIT, date);
+    currentIdx = show_delimiter(1, currentIdx, 1, date, PXS_UNDERSCORE);
+    // tm_isdst is negative when unknown
+    currentIdx = show_bcd_field(1, currentIdx, local_now->tm_isdst > 0, 1, 1, PXS_DATE_BIT, date);
+    currentIdx = show_delimiter(1, currentIdx, 2, date, PXS_UNDERSCORE);
     // tm_wday is zero-indexed
-    currentIdx -= 3;
-    show_integer(1, 3, local_now.tm_wday+1, currentIdx+1, 0, PXS_DATE_BIT);
-
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-    lowerStrip->set_pixel(lowerStrip, currentIdx--, PXS_UNDERSCORE);
-
-    // Flush pattern to strips
-
-    upperStrip->refresh(upperStrip);
-    lowerStrip->refresh(lowerStrip);
+    currentIdx = show_bcd_field(1, currentIdx, local_now->tm_wday + 1, 1, 3, PXS_DATE_BIT, date);
+    currentIdx = show_delimiter(1, currentIdx, 2, date, PXS_UNDERSCORE);
 
 #endif // LED_STRIP_COUNT and LEDS_PER_STRIP
 }
 
-// Add an extra for displaying the end of the string on the light strip
-#define LED_STATUS_ARRAY_SIZE (led_status_MAX+1)
-led_color_t status_bits[LED_STATUS_ARRAY_SIZE];
+// Each indicator's led_color_t is a nibble of one word, so setting one is a
+// compare-and-swap that never waits on the LEDs. The status display redraws
+// from the word on its next frame; the end of the string is always on.
+#define LED_STATUS_BITS 4
+#define LED_STATUS_MASK ((1u << LED_STATUS_BITS) - 1)
+_Static_assert(led_status_MAX * LED_STATUS_BITS <= 32, "status indicators don't fit in a word");
+static _Atomic uint32_t led_status_word = 0;
+// What the status display last drew, and when
+static uint32_t led_status_shown_word = 0;
+static time_t led_status_shown_time = 0;
+static bool led_status_shown = pdFALSE;
 
 color_rgb_t led_status_id_to_rgb(led_color_t color_id)
 {
@@ -450,287 +815,1965 @@ color_rgb_t led_status_id_to_rgb(led_color_t color_id)
 
 void led_reset_status_indicators()
 {
-    for (int ledIdx = 0; ledIdx < LED_STATUS_ARRAY_SIZE; ledIdx++)
+    atomic_store(&led_status_word, 0);
+    led_request_frame(lpat_status_indicators);
+}
+
+led_color_t led_get_status_indicator(led_status_index idx)
+{
+    if (idx >= led_status_MAX)
     {
-        status_bits[ledIdx] = LED_STATUS_COLOR_OFF;
+        return LED_STATUS_COLOR_OFF;
     }
-    status_bits[LED_STATUS_ARRAY_SIZE-1] = LED_STATUS_COLOR_ON;
+    uint32_t word = atomic_load(&led_status_word);
+    return (led_color_t)((word >> (idx * LED_STATUS_BITS)) & LED_STATUS_MASK);
 }
 
-void led_refresh_status_indicators()
+void status_indicators_start()
 {
-    led_strip_t* strip = strips[0];
-    for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+    led_status_shown = pdFALSE;
+}
+
+// Redraws only when an indicator or the time has changed, so a burst of
+// status changes costs one refresh
+int64_t status_indicators_frame(int64_t now)
+{
+    uint32_t word = atomic_load(&led_status_word);
+    struct timeval tv;
+    led_clock_wall(&tv);
+    time_t now_time = tv.tv_sec;
+
+    if (!led_status_shown || word != led_status_shown_word || now_time != led_status_shown_time)
     {
-        color_rgb_t color;
-        if (pixelIdx <= LED_STATUS_ARRAY_SIZE)
-        {
-            color = led_status_id_to_rgb(status_bits[pixelIdx]);
-        }
-        else
+        for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
         {
-            color = led_status_id_to_rgb(LED_STATUS_COLOR_OFF);
+            led_color_t color_id = LED_STATUS_COLOR_OFF;
+            if (pixelIdx < led_status_MAX)
+            {
+                color_id = (led_color_t)((word >> (pixelIdx * LED_STATUS_BITS)) & LED_STATUS_MASK);
+            }
+            else if (pixelIdx == led_status_MAX)
+            {
+                color_id = LED_STATUS_COLOR_ON;
+            }
+            color_rgb_t color = led_status_id_to_rgb(color_id);
+            frame_set_pixel(0, pixelIdx, COLOR_RGB_FROM_STRUCT(color));
         }
-        strip->set_pixel(strip, pixelIdx, COLOR_RGB_FROM_STRUCT(color));
+        // The low 32 bits, whatever the size of time_t
+        show_integer(0, 32, (int)now_time, led_status_MAX + 1, 0, color_rgb_color_values[color_rgb_color_green]);
+        frame_commit();
+
+        led_status_shown = pdTRUE;
+        led_status_shown_word = word;
+        led_status_shown_time = now_time;
     }
-    strip->refresh(strip);
 
-    time_t now;
-    time(&now);
-    // N.B. Will fail with 64-bit time_t
-    show_integer(0, sizeof(now)*8, now, LED_STATUS_ARRAY_SIZE, 0, color_rgb_color_values[color_rgb_color_green]);
-    strip->refresh(strip);
+    // Keep the time current
+    return now + (1000000 - tv.tv_usec);
 }
 
-bool led_current_display_is_status = pdFALSE;
-
+// Safe from any task: never takes led_semaphore or touches the strips
 void led_set_status_indicator(led_status_index idx, led_color_t color_id)
 {
     // Don't allow setting the end-of-string marker
     if (idx >= led_status_MAX)
     {
-        ESP_LOGE(TAG, "Invalid LED Status Indicator index: %d > %d", idx, LED_STATUS_ARRAY_SIZE-1);
+        ESP_LOGE(TAG, "Invalid LED Status Indicator index: %d > %d", idx, led_status_MAX);
         return;
     }
-    status_bits[idx] = color_id;
 
-    // This debugging facility needs to be coordinated with the normal path.
-    xSemaphoreTake(led_semaphore, portMAX_DELAY);
-    if (led_current_display_is_status)
+    uint32_t shift = idx * LED_STATUS_BITS;
+    uint32_t old_word = atomic_load(&led_status_word);
+    uint32_t new_word;
+    do
     {
-        led_refresh_status_indicators();
-    }
-    xSemaphoreGive(led_semaphore);
+        new_word = (old_word & ~(LED_STATUS_MASK << shift)) | (((uint32_t)color_id & LED_STATUS_MASK) << shift);
+        if (new_word == old_word)
+        {
+            return;
+        }
+    } while (!atomic_compare_exchange_weak(&led_status_word, &old_word, new_word));
+
+    led_request_frame(lpat_status_indicators);
 }
 
-// TODO: Consider fading in/out based on bool setting
-// TODO: Consider fading from A to B based on a new color enum setting
-// TODO: Consider using color temperature https://tannerhelland.com/2012/09/18/convert-temperature-rgb-algorithm-code.html
+// Circadian light
+//
+// Ambient light that follows the time of day, from a curve of color
+// temperature and brightness keyframes every four hours in settings. The
+// curve is expanded into a table with an entry per minute of the day when the
+// pattern starts or the settings change, so color_cct_to_rgb and its powf
+// calls only run then; a frame is a lerp between two minutes. The sleep fade
+// and the sunrise both pick up from the color showing, so handing over to
+// either has no jump.
+
+#define CIRCADIAN_KEYFRAMES 6
+#define CIRCADIAN_KEYFRAME_MIN (24 * 60 / CIRCADIAN_KEYFRAMES)
+#define CIRCADIAN_TABLE_LEN (24 * 60)
+// The table changes by well under a step a minute, so there's no point
+// looking more often than this
+#define CIRCADIAN_REFRESH_S 10
+
+static const settings_name circadian_temp_settings[CIRCADIAN_KEYFRAMES] = {
+    setting_circadian_temp_0h, setting_circadian_temp_4h, setting_circadian_temp_8h,
+    setting_circadian_temp_12h, setting_circadian_temp_16h, setting_circadian_temp_20h,
+};
+static const settings_name circadian_lm_settings[CIRCADIAN_KEYFRAMES] = {
+    setting_circadian_lm_0h, setting_circadian_lm_4h, setting_circadian_lm_8h,
+    setting_circadian_lm_12h, setting_circadian_lm_16h, setting_circadian_lm_20h,
+};
 
-static color_hsv_t fade_start_color = { 0 };
-static int fade_step_counter = 0;
-const int FADE_STEP_COUNT = 40;
-static int fade_px_delay_ms = 150;
+// R,G,B for each minute of the local day
+static uint8_t circadian_table[CIRCADIAN_TABLE_LEN][3];
+static volatile bool circadian_table_valid = pdFALSE;
+static uint8_t circadian_shown[3];
+static bool circadian_drawn = pdFALSE;
 
-void fade_start()
+static void circadian_build_table(void)
 {
-    uint32_t setting;
-    color_cct_t temperature;
-
-    ESP_ERROR_CHECK( get_setting("sleep_fade_start_temp", &setting) );
-    temperature.temp = (uint16_t)setting;
-    ESP_ERROR_CHECK( get_setting("sleep_fade_start_luminosity", &setting) );
-    temperature.lm = (color_component_t)setting;
+    color_cct_t keyframes[CIRCADIAN_KEYFRAMES];
 
-    ESP_ERROR_CHECK( get_setting("sleep_fade_fill_time_ms", &setting) );
-    fade_px_delay_ms = (signed)setting / FADE_STEP_COUNT;
-
-    color_rgb_t rgb = color_cct_to_rgb(temperature);
-    fade_start_color = color_rgb_to_hsv(rgb);
-    fill_all_rgb(fade_px_delay_ms, color_hsv_to_rgb(fade_start_color));
+    // Marked valid before the settings are read, so a change that lands
+    // mid-build builds it again
+    circadian_table_valid = pdTRUE;
+    for (int keyIdx = 0; keyIdx < CIRCADIAN_KEYFRAMES; keyIdx++)
+    {
+        keyframes[keyIdx].temp = (uint16_t)get_setting_u32(circadian_temp_settings[keyIdx]);
+        keyframes[keyIdx].lm = (color_component_t)get_setting_u32(circadian_lm_settings[keyIdx]);
+    }
 
-    fade_step_counter = 0;
+    int64_t start_us = esp_timer_get_time();
+    for (int minute = 0; minute < CIRCADIAN_TABLE_LEN; minute++)
+    {
+        const color_cct_t* a = &keyframes[minute / CIRCADIAN_KEYFRAME_MIN];
+        const color_cct_t* b = &keyframes[(minute / CIRCADIAN_KEYFRAME_MIN + 1) % CIRCADIAN_KEYFRAMES];
+        int num = minute % CIRCADIAN_KEYFRAME_MIN;
+        color_cct_t cct = {
+            .temp = a->temp + ((int32_t)b->temp - a->temp) * num / CIRCADIAN_KEYFRAME_MIN,
+            .lm = a->lm + ((int32_t)b->lm - a->lm) * num / CIRCADIAN_KEYFRAME_MIN,
+        };
+        color_rgb_t rgb = color_cct_to_rgb(cct);
+        circadian_table[minute][0] = rgb.r;
+        circadian_table[minute][1] = rgb.g;
+        circadian_table[minute][2] = rgb.b;
+    }
+    ESP_LOGI(TAG, "Built the circadian table in %lld us", esp_timer_get_time() - start_us);
 }
 
-void fade_step()
+// The circadian color at wall-clock time tv, with channels in 8.8 fixed point
+static void circadian_level(const struct timeval* tv, uint16_t level[3])
 {
-    color_hsv_t current_color = fade_start_color;
+    struct tm local;
 
-    if (fade_step_counter < FADE_STEP_COUNT)
+    if (!circadian_table_valid)
     {
-        current_color.v = fade_start_color.v * (FADE_STEP_COUNT - fade_step_counter++) / FADE_STEP_COUNT;
+        circadian_build_table();
     }
-    else
+    localtime_r(&tv->tv_sec, &local);
+    int minute = local.tm_hour * 60 + local.tm_min;
+    // A leap second holds the minute's last color
+    int sec = local.tm_sec < 60 ? local.tm_sec : 59;
+    const uint8_t* a = circadian_table[minute];
+    const uint8_t* b = circadian_table[(minute + 1) % CIRCADIAN_TABLE_LEN];
+    for (int c = 0; c < 3; c++)
     {
-        current_color.v = 0;
+        level[c] = ((a[c] * (60 - sec) + b[c] * sec) << 8) / 60;
     }
+}
 
-    fill_all_rgb(fade_px_delay_ms, color_hsv_to_rgb(current_color));
+void circadian_start()
+{
+    circadian_drawn = pdFALSE;
+    ESP_LOGI(TAG, "Showing circadian light");
 }
 
-void demo_cie(void)
+int64_t circadian_frame(int64_t now)
 {
-    color_cie_t cie;
-    color_rgb_t result;
-    int pixelIdx = 0;
+    struct timeval tv;
+    uint16_t level[3];
+    uint8_t px[3];
 
-    for (int lmIdx = 0; lmIdx < color_cie_lm_enum_max; lmIdx++)
+    led_clock_wall(&tv);
+    circadian_level(&tv, level);
+    for (int c = 0; c < 3; c++)
     {
-        color_component_t CCY = color_cie_luminosity_values[lmIdx];
-        for (int colorIdx = 0; colorIdx < color_cie_chroma_enum_max; colorIdx++)
+        px[c] = (level[c] + 0x80) >> 8;
+    }
+    if (!circadian_drawn || memcmp(px, circadian_shown, sizeof(px)) != 0)
+    {
+        for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
         {
-            cie = color_cie_chroma_values[colorIdx];
-            cie.CCY = CCY;
-            result = color_cie_to_rgb(cie);
-            strips[0]->set_pixel(strips[0], pixelIdx++, COLOR_RGB_FROM_STRUCT(result));
-		}
-	}
-    strips[0]->refresh(strips[0]);
+            for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+            {
+                frame_set_pixel(stripIdx, pixelIdx, px[0], px[1], px[2]);
+            }
+        }
+        frame_commit();
+        memcpy(circadian_shown, px, sizeof(px));
+        circadian_drawn = pdTRUE;
+    }
+    // On the wall clock's next multiple of the refresh interval
+    int64_t until_us = (int64_t)(CIRCADIAN_REFRESH_S - tv.tv_sec % CIRCADIAN_REFRESH_S) * 1000000 - tv.tv_usec;
+    return now + until_us;
+}
 
-    pixelIdx = 0;
-        for (int colorIdx = 0; colorIdx < color_cie_chroma_enum_max; colorIdx++)
-        {
-    for (int lmIdx = 0; lmIdx < color_cie_lm_enum_max; lmIdx++)
-    {
-        color_component_t CCY = color_cie_luminosity_values[lmIdx];
-            cie = color_cie_chroma_values[colorIdx];
-            cie.CCY = CCY;
-            result = color_cie_to_rgb(cie);
-            strips[1]->set_pixel(strips[1], pixelIdx++, COLOR_RGB_FROM_STRUCT(result));
-		}
-	}
-    strips[1]->refresh(strips[1]);
+void led_settings_changed(void)
+{
+    circadian_table_valid = pdFALSE;
 }
 
-void demo_cct(void)
+// Light
+//
+// The driver sends every byte through gamma_lut, so the bytes patterns draw
+// aren't linear in light: 0 to 21 are all off, and each step near the bottom
+// is a large share of the light. Effects that change brightness slowly work
+// in light instead, in 8.8 fixed point on the scale of the driver's output
+// (255 << 8 is full), and turn it into bytes here.
+
+typedef struct _led_light_step_t {
+    // The dimmest bytes showing the outputs just below and just above the light
+    uint8_t lo;
+    uint8_t hi;
+    // How far the light is from lo's output to hi's, in 1/256ths
+    uint8_t frac;
+} led_light_step_t;
+
+// The first byte that shows brighter than output, or 256 if none does
+static int gamma_first_above(uint32_t output)
 {
-    set_all_rgb(color_rgb_color_values[color_rgb_color_off]);
+    int lo = 0;
+    int hi = 256;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (gamma_lut[mid] > output)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
 
-    int ledIdx;
-    led_strip_t *strip;
+// The light a byte in 8.8 fixed point shows, between the table's entries
+static uint16_t gamma_light(uint16_t level)
+{
+    int b = level >> 8;
+    uint32_t a = (uint32_t)gamma_lut[b] << 8;
+    uint32_t next = (uint32_t)gamma_lut[b < 255 ? b + 1 : b] << 8;
+    return a + (((next - a) * (level & 0xFF)) >> 8);
+}
 
-    // string 0 demos the temp presets
-    ledIdx = 0;
-    strip = strips[0];
-    color_rgb_t color;
-    for (color_cct_temp tempId = 0; tempId < color_cct_temp_enum_max; tempId++)
+static led_light_step_t light_step(uint32_t light)
+{
+    led_light_step_t step;
+    int above = gamma_first_above(light >> 8);
+    uint8_t lo_output = gamma_lut[above - 1];
+    step.lo = lo_output > 0 ? gamma_first_above(lo_output - 1) : 0;
+    if (above > 255)
+    {
+        step.hi = step.lo;
+        step.frac = 0;
+        return step;
+    }
+    step.hi = above;
+    step.frac = (light - ((uint32_t)lo_output << 8)) / (gamma_lut[above] - lo_output);
+    return step;
+}
+
+// Sleep fade
+//
+// fade_start turns the strips on at the sleep fade's start color; fade_step
+// then fades from there to off over sleep_fade_time_min. The fade is just its
+// two colors, a start time and a duration, and the render task works out each
+// frame from how far along it is, so there are no steps to see however long it
+// runs. The driver gamma-corrects what it's given, so the channels are
+// interpolated in light, at 16 bits, and each frame shows the bytes whose
+// outputs are nearest; the dim end of the fade gets every output step rather
+// than going black a fifth of the way early. The frame is only redrawn when
+// an output changes, so a long, dim fade redraws every few seconds and lets
+// the chip sleep in between.
+
+typedef struct _led_fade_t {
+    // Channels' light
+    uint16_t from[3];
+    uint16_t to[3];
+    // The from color holds until start_us
+    int64_t start_us;
+    int64_t duration_us;
+} led_fade_t;
+
+static led_fade_t fade = { 0 };
+// Outputs, after gamma
+static uint8_t fade_shown[3];
+static bool fade_drawn = pdFALSE;
+
+static color_rgb_t fade_start_color(void)
+{
+    uint32_t setting;
+    color_cct_t temperature;
+
+    setting = get_setting_u32(setting_sleep_fade_start_temp);
+    temperature.temp = (uint16_t)setting;
+    setting = get_setting_u32(setting_sleep_fade_start_luminosity);
+    temperature.lm = (color_component_t)setting;
+    return color_cct_to_rgb(temperature);
+}
+
+void fade_start()
+{
+    set_all_rgb(fade_start_color());
+}
+
+// Start the fade, from the start color or, taking over from the circadian
+// light, from whatever it's showing
+void fade_step(bool from_circadian)
+{
+    uint32_t setting;
+
+    if (from_circadian)
+    {
+        struct timeval tv;
+        led_clock_wall(&tv);
+        circadian_level(&tv, fade.from);
+        for (int c = 0; c < 3; c++)
+        {
+            fade.from[c] = gamma_light(fade.from[c]);
+        }
+    }
+    else
+    {
+        color_rgb_t from = fade_start_color();
+        fade.from[0] = gamma_light(from.r << 8);
+        fade.from[1] = gamma_light(from.g << 8);
+        fade.from[2] = gamma_light(from.b << 8);
+    }
+    setting = get_setting_u32(setting_sleep_fade_time_min);
+    memset(fade.to, 0, sizeof(fade.to));
+    fade.start_us = led_clock_us();
+    fade.duration_us = (int64_t)setting * 60 * 1000000;
+    fade_drawn = pdFALSE;
+    ESP_LOGI(TAG, "Fading from output r=%d g=%d b=%d to off over %u minutes",
+             fade.from[0] >> 8, fade.from[1] >> 8, fade.from[2] >> 8, setting);
+}
+
+// Channel c's light elapsed_us into the fade
+static uint16_t fade_level(int c, int64_t elapsed_us)
+{
+    if (elapsed_us <= 0)
+    {
+        return fade.from[c];
+    }
+    if (elapsed_us >= fade.duration_us)
+    {
+        return fade.to[c];
+    }
+    return fade.from[c] + ((int32_t)fade.to[c] - fade.from[c]) * elapsed_us / fade.duration_us;
+}
+
+// When channel c's nearest output is next other than shown, as time into the
+// fade
+static int64_t fade_next_change(int c, uint8_t shown)
+{
+    int32_t span = (int32_t)fade.to[c] - fade.from[c];
+    // The light at which the nearest output tips over to the next one, half
+    // way between them
+    int32_t edge;
+    if (span > 0)
+    {
+        int above = gamma_first_above(shown);
+        if (above > 255)
+        {
+            return fade.duration_us;
+        }
+        edge = 0x80 * (shown + gamma_lut[above]);
+    }
+    else if (span < 0 && shown > 0)
+    {
+        uint8_t below = gamma_lut[gamma_first_above(shown - 1) - 1];
+        edge = 0x80 * (shown + below) - 1;
+    }
+    else
+    {
+        return fade.duration_us;
+    }
+    // Round up, so the level is past the edge by then
+    int64_t distance = ((int64_t)edge - fade.from[c]) * fade.duration_us;
+    return (distance + span - (span > 0 ? 1 : -1)) / span;
+}
+
+int64_t fade_frame(int64_t now)
+{
+    int64_t elapsed_us = now - fade.start_us;
+    uint8_t px[3];
+    uint8_t output[3];
+
+    for (int c = 0; c < 3; c++)
+    {
+        led_light_step_t step = light_step(fade_level(c, elapsed_us));
+        px[c] = step.frac >= 0x80 ? step.hi : step.lo;
+        output[c] = gamma_lut[px[c]];
+    }
+    if (!fade_drawn || memcmp(output, fade_shown, sizeof(output)) != 0)
+    {
+        for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+        {
+            for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+            {
+                frame_set_pixel(stripIdx, pixelIdx, px[0], px[1], px[2]);
+            }
+        }
+        frame_commit();
+        memcpy(fade_shown, output, sizeof(output));
+        fade_drawn = pdTRUE;
+    }
+
+    if (elapsed_us >= fade.duration_us)
+    {
+        return -1;
+    }
+    if (elapsed_us < 0)
+    {
+        return fade.start_us;
+    }
+    int64_t next_us = fade.duration_us;
+    for (int c = 0; c < 3; c++)
+    {
+        int64_t change_us = fade_next_change(c, output[c]);
+        if (change_us < next_us)
+        {
+            next_us = change_us;
+        }
+    }
+    next_us += fade.start_us;
+    // A fast fade still only needs the output rate
+    if (next_us < now + LED_OUTPUT_FRAME_US)
+    {
+        next_us = now + LED_OUTPUT_FRAME_US;
+    }
+    return next_us;
+}
+
+// Sunrise
+//
+// A gentle alarm: the strips glow deep red at 1000 K and next to no
+// brightness, then warm and brighten to daylight over sunrise_duration_min,
+// ending at the alarm time. The color and the brightness curve are sampled
+// into a small table of light levels when the sunrise starts, so a frame is
+// one lerp between two entries. The first minutes sit within a few steps of
+// the driver's 8-bit output, so while the light is that dim each pixel is
+// dithered over time, showing the bytes whose outputs are either side of its
+// 16-bit light level in the right proportion, with neighbouring pixels out of
+// phase so the strips don't flicker as a whole.
+
+#define SUNRISE_TABLE_LEN 64
+#define SUNRISE_START_TEMP 1000
+#define SUNRISE_END_TEMP 5500
+// Dither while the brightest channel's light is below this many output steps
+// (8.8 fixed point); past that, one step is too small a change to see, and
+// frames are only drawn when the output changes
+#define SUNRISE_DITHER_BELOW (8 << 8)
+#define SUNRISE_FPS 10
+// How long a sunrise run as a pattern, rather than for an alarm, takes
+#define SUNRISE_DEMO_S 60
+
+// Channels' light, at evenly spaced times from start to end
+static uint16_t sunrise_table[SUNRISE_TABLE_LEN][3];
+static int64_t sunrise_start_us = 0;
+static int64_t sunrise_duration_us = 0;
+static uint8_t sunrise_phase = 0;
+static uint8_t sunrise_shown[3];
+static bool sunrise_drawn = pdFALSE;
+
+// Light x of the way through the sunrise, from 0 to 1
+static float sunrise_curve_level(sunrise_curve_t curve, float x)
+{
+    switch (curve)
+    {
+    case sunrise_curve_linear:
+        return x;
+    case sunrise_curve_smooth:
+        return x * x * (3.0f - 2.0f * x);
+    case sunrise_curve_perceptual:
+    default:
+        // Perceived brightness goes roughly as the cube root of light, and
+        // the table is in light, so this brightens at an even pace to the eye
+        return x * x * x;
+    }
+}
+
+// Start a sunrise that reaches daylight at end_us, on led_clock_us. Starting
+// late joins it partway through. Taking over from the circadian light, it
+// starts from whatever that's showing. Must be called with led_semaphore held.
+static void sunrise_start(int64_t end_us, int64_t duration_us, bool from_circadian)
+{
+    uint32_t setting;
+
+    setting = get_setting_u32(setting_sunrise_curve);
+    for (int idx = 0; idx < SUNRISE_TABLE_LEN; idx++)
+    {
+        float x = (float)idx / (SUNRISE_TABLE_LEN - 1);
+        color_cct_t cct = {
+            .temp = SUNRISE_START_TEMP + (SUNRISE_END_TEMP - SUNRISE_START_TEMP) * x,
+            .lm = COLOR_COMPONENT_MAX,
+        };
+        color_rgb_t rgb = color_cct_to_rgb(cct);
+        float level = sunrise_curve_level((sunrise_curve_t)setting, x);
+        sunrise_table[idx][0] = gamma_light(rgb.r << 8) * level;
+        sunrise_table[idx][1] = gamma_light(rgb.g << 8) * level;
+        sunrise_table[idx][2] = gamma_light(rgb.b << 8) * level;
+    }
+    if (from_circadian)
+    {
+        struct timeval tv;
+        led_clock_wall(&tv);
+        circadian_level(&tv, sunrise_table[0]);
+        for (int c = 0; c < 3; c++)
+        {
+            sunrise_table[0][c] = gamma_light(sunrise_table[0][c]);
+        }
+    }
+    sunrise_duration_us = duration_us;
+    sunrise_start_us = end_us - duration_us;
+    sunrise_drawn = pdFALSE;
+    ESP_LOGI(TAG, "Sunrise over %lld s on curve %u, %lld s from now",
+             duration_us / 1000000, setting, (end_us - led_clock_us()) / 1000000);
+}
+
+static inline uint8_t bit_reverse8(uint8_t b)
+{
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+int64_t sunrise_frame(int64_t now)
+{
+    int64_t elapsed_us = now - sunrise_start_us;
+    // Position along the table, in 1/256ths of an entry
+    uint32_t pos = 0;
+    if (elapsed_us >= sunrise_duration_us)
+    {
+        pos = (SUNRISE_TABLE_LEN - 1) << 8;
+    }
+    else if (elapsed_us > 0)
+    {
+        pos = (uint32_t)(elapsed_us * ((SUNRISE_TABLE_LEN - 1) << 8) / sunrise_duration_us);
+    }
+    int idx = pos >> 8;
+    uint32_t w = pos & 0xFF;
+    const uint16_t* a = sunrise_table[idx];
+    const uint16_t* b = sunrise_table[idx + 1 < SUNRISE_TABLE_LEN ? idx + 1 : idx];
+    led_light_step_t step[3];
+    uint32_t brightest = 0;
+    bool between = pdFALSE;
+    for (int c = 0; c < 3; c++)
+    {
+        uint32_t level = (a[c] * (256 - w) + b[c] * w) >> 8;
+        brightest = level > brightest ? level : brightest;
+        step[c] = light_step(level);
+        between |= step[c].frac != 0;
+    }
+
+    if (elapsed_us < 0)
+    {
+        // Not started yet: dark until then
+        if (!sunrise_drawn)
+        {
+            memset(led_frame, 0, LED_FRAME_LEN);
+            frame_commit();
+            memset(sunrise_shown, 0, sizeof(sunrise_shown));
+            sunrise_drawn = pdTRUE;
+        }
+        return sunrise_start_us;
+    }
+
+    if (brightest < SUNRISE_DITHER_BELOW && between)
+    {
+        // Each pixel's threshold visits every value once per 256 frames, in
+        // bit-reversed order so its brighter frames are spread out rather
+        // than bunched
+        sunrise_phase++;
+        for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+        {
+            for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+            {
+                uint8_t threshold = bit_reverse8(sunrise_phase + (stripIdx * LEDS_PER_STRIP + pixelIdx) * 167);
+                frame_set_pixel(stripIdx, pixelIdx,
+                                threshold < step[0].frac ? step[0].hi : step[0].lo,
+                                threshold < step[1].frac ? step[1].hi : step[1].lo,
+                                threshold < step[2].frac ? step[2].hi : step[2].lo);
+            }
+        }
+        frame_commit();
+        sunrise_drawn = pdFALSE;
+        return now + LED_OUTPUT_FRAME_US;
+    }
+
+    // Each output has one byte it's drawn with, so the bytes only differ
+    // when the output does
+    uint8_t px[3];
+    for (int c = 0; c < 3; c++)
+    {
+        px[c] = step[c].frac >= 0x80 ? step[c].hi : step[c].lo;
+    }
+    if (!sunrise_drawn || memcmp(px, sunrise_shown, sizeof(px)) != 0)
+    {
+        for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+        {
+            for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+            {
+                frame_set_pixel(stripIdx, pixelIdx, px[0], px[1], px[2]);
+            }
+        }
+        frame_commit();
+        memcpy(sunrise_shown, px, sizeof(px));
+        sunrise_drawn = pdTRUE;
+    }
+    if (elapsed_us >= sunrise_duration_us)
+    {
+        // Daylight stays up
+        return -1;
+    }
+    uint32_t tick = (uint32_t)(elapsed_us * SUNRISE_FPS / 1000000);
+    return frame_tick_deadline(sunrise_start_us, tick, SUNRISE_FPS);
+}
+
+void demo_cie(void)
+{
+    color_cie_t cie;
+    color_rgb_t result;
+    int pixelIdx = 0;
+
+    for (int lmIdx = 0; lmIdx < color_cie_lm_enum_max; lmIdx++)
+    {
+        color_component_t CCY = color_cie_luminosity_values[lmIdx];
+        for (int colorIdx = 0; colorIdx < color_cie_chroma_enum_max; colorIdx++)
+        {
+            cie = color_cie_chroma_values[colorIdx];
+            cie.CCY = CCY;
+            result = color_cie_to_rgb(cie);
+            frame_set_pixel(0, pixelIdx++, COLOR_RGB_FROM_STRUCT(result));
+		}
+	}
+    frame_commit();
+
+    pixelIdx = 0;
+        for (int colorIdx = 0; colorIdx < color_cie_chroma_enum_max; colorIdx++)
+        {
+    for (int lmIdx = 0; lmIdx < color_cie_lm_enum_max; lmIdx++)
+    {
+        color_component_t CCY = color_cie_luminosity_values[lmIdx];
+            cie = color_cie_chroma_values[colorIdx];
+            cie.CCY = CCY;
+            result = color_cie_to_rgb(cie);
+            frame_set_pixel(1, pixelIdx++, COLOR_RGB_FROM_STRUCT(result));
+		}
+	}
+    frame_commit();
+}
+
+void demo_cct(void)
+{
+    set_all_rgb(color_rgb_color_values[color_rgb_color_off]);
+
+    int ledIdx;
+
+    // string 0 demos the temp presets
+    ledIdx = 0;
+    color_rgb_t color;
+    for (color_cct_temp tempId = 0; tempId < color_cct_temp_enum_max; tempId++)
     {
         color_cct_t temp;
         temp.temp = color_cct_temp_values[tempId];
         temp.lm = color_cct_luminosity_values[color_cct_lm_high];
         color = color_cct_to_rgb(temp);
-        strip->set_pixel(strip, ledIdx++, COLOR_RGB_FROM_STRUCT(color));
+        frame_set_pixel(0, ledIdx++, COLOR_RGB_FROM_STRUCT(color));
+	}
+    frame_commit();
+
+    // string 1 demos the luminosity presets
+    ledIdx = 0;
+    for (color_cct_luminosity lmIdx = 0; lmIdx < color_cct_lm_enum_max; lmIdx++)
+    {
+        color_cct_t temp;
+        temp.temp = color_cct_temp_values[color_cct_temp_warm_2500];
+        temp.lm = color_cct_luminosity_values[lmIdx];
+        color = color_cct_to_rgb(temp);
+        frame_set_pixel(1, ledIdx++, COLOR_RGB_FROM_STRUCT(color));
 	}
-    strip->refresh(strip);
+    frame_commit();
+}
+
+void clear_all(void)
+{
+    memset(led_frame, 0, LED_FRAME_LEN);
+}
+
+// Scrolling
+//
+// Anything that scrolls is precomputed once into a ring of pixels (R,G,B,
+// in the led_frame layout). Showing the ring at any offset is then at most two
+// span copies per strip, wherever the window wraps around the end of the ring,
+// and the commit hands each strip to the driver in one bulk set_pixels call.
+
+// Show a strip-long window of a ring_len-pixel ring on strip stripIdx, starting from ring pixel offset
+void frame_scroll(int stripIdx, const uint8_t* ring, int ring_len, int offset)
+{
+    uint8_t* dst = led_frame + stripIdx * LEDS_PER_STRIP * 3;
+    int remaining = LEDS_PER_STRIP;
+
+    offset %= ring_len;
+    if (offset < 0)
+    {
+        offset += ring_len;
+    }
+    // Rings shorter than a strip just repeat
+    while (remaining > 0)
+    {
+        int span = ring_len - offset;
+        if (span > remaining)
+        {
+            span = remaining;
+        }
+        memcpy(dst, ring + offset * 3, span * 3);
+        dst += span * 3;
+        remaining -= span;
+        offset = 0;
+    }
+}
+
+// Fill ring with ring_len colors spanning the full hue circle
+void build_hue_ring(uint8_t* ring, int ring_len, int brightness)
+{
+    for (int idx = 0; idx < ring_len; idx++)
+    {
+        color_rgb_t color = color_hsv_to_rgb(COLOR_HSV_TO_STRUCT(idx * 360 / ring_len,
+                                             color_hsv_sat_values[color_hsv_sat_100],
+                                             brightness
+                                             ));
+        ring[idx * 3 + 0] = color.r;
+        ring[idx * 3 + 1] = color.g;
+        ring[idx * 3 + 2] = color.b;
+    }
+}
+
+// A strip shows 3/4 of the hue circle at a time, so the full circle is 4/3 strips long
+#define RAINBOW_RING_LEN (LEDS_PER_STRIP * 4 / 3)
+static uint8_t rainbow_ring[RAINBOW_RING_LEN * 3];
+static bool rainbow_ring_ready = false;
+
+void rambo_brite(void)
+{
+    //clear_all(); // avoid black flash on pattern repeat; just means below has to write to all LEDs
+    // The basic approach is one for loop with a scroll step and a delay.
+    // This could be munged a bit to tease apart the color range, scroll rate,
+    // and duration.
+    const int brightness = 50;
+    const int delay = 22; // ~45 Hz, one ring pixel per frame
+    const int steps = 5 * RAINBOW_RING_LEN;
+
+    if (false == rainbow_ring_ready)
+    {
+        build_hue_ring(rainbow_ring, RAINBOW_RING_LEN, brightness);
+        rainbow_ring_ready = true;
+    }
+
+    for (int step = 0; step < steps; step++)
+    {
+        frame_scroll(0, rainbow_ring, RAINBOW_RING_LEN, step);
+        frame_scroll(1, rainbow_ring, RAINBOW_RING_LEN, step);
+        frame_commit();
+        if (!frame_delay_ms(delay))
+        {
+            return;
+        }
+    }
+}
+
+// Animated patterns
+//
+// Patterns that run indefinitely or need accurate frame timing can't run to
+// completion inside led_run_sync. Instead, led_run_sync sets them up and hands
+// them to the render task, which draws each frame when it is due. Running any
+// other pattern stops the current animation.
+
+// lpat_max when no animation is running
+static led_pattern_t led_animation = lpat_max;
+
+// Show one frame of packed RGB bytes, laid out strip after strip
+void write_frame_rgb(const uint8_t* rgb)
+{
+    memcpy(led_frame, rgb, LED_FRAME_LEN);
+    frame_commit();
+}
+
+static clip_t clip_playing = { 0 };
+// delta-encoded clips are decoded in place here
+static uint8_t clip_framebuffer[LED_FRAME_LEN];
+static clip_playback_mode_t clip_mode = clip_mode_loop;
+static int64_t clip_start_us = 0;
+
+esp_err_t clip_start()
+{
+    uint32_t setting;
+    setting = get_setting_u32(setting_clip_playback_mode);
+    clip_mode = (clip_playback_mode_t)setting;
+
+    esp_err_t err = clip_map(&clip_playing, clip_framebuffer, sizeof(clip_framebuffer));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: no playable clip stored (0x%x)", __FUNCTION__, err);
+        return err;
+    }
+
+    const clip_header_t* header = clip_playing.header;
+    if (header->strip_count != LED_STRIP_COUNT || header->leds_per_strip != LEDS_PER_STRIP)
+    {
+        ESP_LOGE(TAG, "%s: clip is %dx%d but the strips are %dx%d", __FUNCTION__,
+                 header->strip_count, header->leds_per_strip, LED_STRIP_COUNT, LEDS_PER_STRIP);
+        clip_unmap(&clip_playing);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ESP_LOGI(TAG, "Playing %d-frame clip at %d fps, mode %d", header->frame_count, header->fps, clip_mode);
+    clip_start_us = led_clock_us();
+    return ESP_OK;
+}
+
+// Returns when the next frame is due, or a negative value once the clip is finished.
+int64_t clip_frame(int64_t now)
+{
+    const clip_header_t* header = clip_playing.header;
+    const uint32_t frame_count = header->frame_count;
+    int64_t next_frame_us;
+
+    // Frames sit on a fixed timeline that starts when playback starts, so a
+    // late frame causes a dropped frame instead of slowing the whole clip down.
+    uint32_t tick = (uint32_t)((now - clip_start_us) * header->fps / 1000000);
+    uint32_t frame_idx;
+    next_frame_us = frame_tick_deadline(clip_start_us, tick, header->fps);
+
+    switch (clip_mode)
+    {
+    case clip_mode_once:
+        frame_idx = tick;
+        if (frame_idx >= frame_count - 1)
+        {
+            // Make sure the last frame is shown even if it's late, then stop.
+            frame_idx = frame_count - 1;
+            next_frame_us = -1;
+        }
+        break;
+    case clip_mode_ping_pong:
+        if (frame_count > 1)
+        {
+            // Forward then backward without doubling up on the first and last frames
+            const uint32_t cycle_len = 2 * frame_count - 2;
+            frame_idx = tick % cycle_len;
+            if (frame_idx >= frame_count)
+            {
+                frame_idx = cycle_len - frame_idx;
+            }
+            break;
+        }
+        // A single frame can't ping-pong, so just loop it.
+        // fall through
+    case clip_mode_loop:
+    default:
+        frame_idx = tick % frame_count;
+        break;
+    }
+
+    const uint8_t* pixels = clip_get_frame(&clip_playing, frame_idx);
+    if (pixels == NULL)
+    {
+        ESP_LOGE(TAG, "%s: clip frame %u could not be decoded", __FUNCTION__, frame_idx);
+        return -1;
+    }
+    write_frame_rgb(pixels);
+
+    return next_frame_us;
+}
+
+// The live clock redraws only the fields that changed, once per second, and
+// only refreshes the strips they are on. The date strip normally changes
+// only at midnight.
+static struct tm clock_shown;
+static uint32_t clock_parts_pending = CLOCK_PART_ALL;
+
+void clock_start()
+{
+    // Draw everything on the first frame
+    clock_parts_pending = CLOCK_PART_ALL;
+    ESP_LOGI(TAG, "Showing the live clock");
+}
+
+// Returns the esp_timer time of the next second boundary
+int64_t clock_frame(int64_t now)
+{
+    struct timeval tv;
+    led_clock_wall(&tv);
+    struct tm local_now;
+    localtime_r(&tv.tv_sec, &local_now);
+
+    uint32_t parts = clock_parts_pending;
+    if (local_now.tm_hour != clock_shown.tm_hour) { parts |= CLOCK_PART_HOURS; }
+    if (local_now.tm_min != clock_shown.tm_min) { parts |= CLOCK_PART_MINUTES; }
+    if (local_now.tm_sec != clock_shown.tm_sec) { parts |= CLOCK_PART_SECONDS; }
+    if (local_now.tm_mday != clock_shown.tm_mday ||
+        local_now.tm_mon != clock_shown.tm_mon ||
+        local_now.tm_year != clock_shown.tm_year ||
+        local_now.tm_isdst != clock_shown.tm_isdst ||
+        local_now.tm_wday != clock_shown.tm_wday)
+    {
+        parts |= CLOCK_PART_DATE;
+    }
+    clock_parts_pending = 0;
+
+    if (parts != 0)
+    {
+        uint32_t strip_mask = 0;
+        if (parts & (CLOCK_PART_LAYOUT | CLOCK_PART_HOURS | CLOCK_PART_MINUTES | CLOCK_PART_SECONDS))
+        {
+            strip_mask |= FRAME_STRIP(0);
+        }
+        if (parts & (CLOCK_PART_LAYOUT | CLOCK_PART_DATE))
+        {
+            strip_mask |= FRAME_STRIP(1);
+        }
+        show_current_time(&local_now, parts);
+        frame_commit_strips(strip_mask);
+        clock_shown = local_now;
+    }
+
+    // Wake right as the next second starts. If SNTP slews the clock and this
+    // comes up a little early, nothing has changed and the next wakeup is
+    // only microseconds away.
+    return now + (1000000 - tv.tv_usec);
+}
+
+// Analog clock. Each strip is read as a dial, left to right like the digital
+// clock, so the last pixel is 12 o'clock. The hour and minute hands share the
+// upper strip and the second hand sweeps the lower one. Hands move smoothly:
+// each is drawn at a sub-pixel position through a precomputed falloff kernel.
+#define ANALOG_CLOCK_FPS 60
+// Sub-pixel positions the kernel is computed for, and pixels it touches
+#define ANALOG_KERNEL_PHASES 16
+#define ANALOG_KERNEL_TAPS 4
+// Resync with the wall clock this often, to follow SNTP adjustments
+#define ANALOG_RESYNC_US (60 * 1000000LL)
+#define ANALOG_HOUR_COLOR   color_rgb_color_values[color_rgb_color_red]
+#define ANALOG_MINUTE_COLOR color_rgb_color_values[color_rgb_color_green]
+#define ANALOG_SECOND_COLOR color_rgb_color_values[color_rgb_color_blue]
+#define ANALOG_MARK_COLOR   color_rgb_color_values[color_rgb_color_nearly_off]
+
+// analog_kernel[phase][tap]: weight out of 255 for pixel (hand pixel - 1 + tap)
+// when the hand is phase/ANALOG_KERNEL_PHASES of the way to the next pixel
+static uint8_t analog_kernel[ANALOG_KERNEL_PHASES][ANALOG_KERNEL_TAPS];
+static bool analog_kernel_ready = pdFALSE;
+static int64_t analog_start_us = 0;
+// Local time of day in microseconds at esp_timer time analog_sync_us
+static int64_t analog_sync_us = 0;
+static int64_t analog_sync_day_us = 0;
+
+static void analog_build_kernel(void)
+{
+    // A tent 1.5 pixels in radius, normalized per phase so a moving hand
+    // doesn't pulse in brightness.
+    const float radius = 1.5f;
+    for (int phase = 0; phase < ANALOG_KERNEL_PHASES; phase++)
+    {
+        float center = 1.0f + (float)phase / ANALOG_KERNEL_PHASES;
+        float weights[ANALOG_KERNEL_TAPS];
+        float sum = 0.0f;
+        for (int tap = 0; tap < ANALOG_KERNEL_TAPS; tap++)
+        {
+            float distance = tap > center ? tap - center : center - tap;
+            weights[tap] = distance < radius ? radius - distance : 0.0f;
+            sum += weights[tap];
+        }
+        for (int tap = 0; tap < ANALOG_KERNEL_TAPS; tap++)
+        {
+            analog_kernel[phase][tap] = (uint8_t)(weights[tap] * 255.0f / sum + 0.5f);
+        }
+    }
+    analog_kernel_ready = pdTRUE;
+}
+
+static void analog_sync(int64_t now)
+{
+    struct timeval tv;
+    led_clock_wall(&tv);
+    struct tm local_now;
+    localtime_r(&tv.tv_sec, &local_now);
+    analog_sync_us = now;
+    analog_sync_day_us = ((local_now.tm_hour * 60 + local_now.tm_min) * 60 + local_now.tm_sec) * 1000000LL + tv.tv_usec;
+}
+
+// Add a hand at position pos, in 1/256ths of a pixel from 12 o'clock
+static void analog_draw_hand(int stripIdx, int32_t pos, color_rgb_t color)
+{
+    const int pixel = pos >> 8;
+    const uint8_t* weights = analog_kernel[(pos & 0xFF) * ANALOG_KERNEL_PHASES >> 8];
+    for (int tap = 0; tap < ANALOG_KERNEL_TAPS; tap++)
+    {
+        if (weights[tap] == 0)
+        {
+            continue;
+        }
+        int dial_idx = (pixel - 1 + tap + LEDS_PER_STRIP) % LEDS_PER_STRIP;
+        uint8_t* px = led_frame + (stripIdx * LEDS_PER_STRIP + (LEDS_PER_STRIP - 1 - dial_idx)) * 3;
+        const uint8_t components[3] = { COLOR_RGB_FROM_STRUCT(color) };
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t value = px[c] + ((components[c] * weights[tap]) >> 8);
+            px[c] = value > 255 ? 255 : value;
+        }
+    }
+}
+
+void analog_clock_start()
+{
+    if (!analog_kernel_ready)
+    {
+        analog_build_kernel();
+    }
+    analog_start_us = led_clock_us();
+    analog_sync(analog_start_us);
+    ESP_LOGI(TAG, "Showing the analog clock at %d fps", ANALOG_CLOCK_FPS);
+}
+
+int64_t analog_clock_frame(int64_t now)
+{
+    if (now - analog_sync_us >= ANALOG_RESYNC_US)
+    {
+        analog_sync(now);
+    }
+    const int64_t day_us = analog_sync_day_us + (now - analog_sync_us);
+
+    // Hand positions in 1/256ths of a pixel around the dial
+    const int64_t dial = LEDS_PER_STRIP * 256;
+    int32_t second_pos = (int32_t)((day_us % (60 * 1000000LL)) * dial / (60 * 1000000LL));
+    int32_t minute_pos = (int32_t)((day_us % (3600 * 1000000LL)) * dial / (3600 * 1000000LL));
+    int32_t hour_pos = (int32_t)((day_us % (12 * 3600 * 1000000LL)) * dial / (12 * 3600 * 1000000LL));
+
+    // Faint marks every five minutes
+    memset(led_frame, 0, LED_FRAME_LEN);
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        for (int mark = 0; mark < 12; mark++)
+        {
+            frame_set_pixel(stripIdx, LEDS_PER_STRIP - 1 - mark * LEDS_PER_STRIP / 12, COLOR_RGB_FROM_STRUCT(ANALOG_MARK_COLOR));
+        }
+    }
+    analog_draw_hand(0, hour_pos, ANALOG_HOUR_COLOR);
+    analog_draw_hand(0, minute_pos, ANALOG_MINUTE_COLOR);
+    analog_draw_hand(1, second_pos, ANALOG_SECOND_COLOR);
+    frame_commit();
+
+    // Fixed timeline, like clips
+    uint32_t tick = (uint32_t)((now - analog_start_us) * ANALOG_CLOCK_FPS / 1000000);
+    return frame_tick_deadline(analog_start_us, tick, ANALOG_CLOCK_FPS);
+}
+
+// Shows streamed frames as they arrive. The listener wakes the render task
+// when a frame is complete, so this only needs to wake up on its own to keep
+// the animation alive.
+int64_t stream_frame(int64_t now)
+{
+    int64_t received_us;
+    const uint8_t* pixels = stream_lock_frame(&received_us);
+    if (pixels != NULL)
+    {
+        // Only the copy needs the frame; the listener can start filling the
+        // next one while the strips refresh.
+        memcpy(led_frame, pixels, LED_FRAME_LEN);
+        stream_unlock_frame();
+        frame_commit();
+        stream_frame_shown(received_us, esp_timer_get_time());
+    }
+    return now + 1000000;
+}
+
+// The incoming animation's next deadline, or 0 to draw as soon as possible
+static int64_t led_next_frame_us = 0;
+// The running animation has something new to show before its deadline, like
+// a streamed frame or a status change
+static volatile bool led_frame_ready_pending = pdFALSE;
+
+// Palette scroll
+//
+// Scrolls a palette along both strips, each strip a quarter turn of the ring
+// apart. The ring is sampled from the palette's table when the pattern starts,
+// so each frame is just the two frame_scroll copies.
+
+#define PALETTE_SCROLL_FPS 30
+// Show half the palette on a strip at a time
+#define PALETTE_RING_LEN (LEDS_PER_STRIP * 2)
+// The tables run to full brightness; keep the pattern as bright as the fills
+#define PALETTE_SCROLL_BRIGHTNESS COLOR_RGB_BASE
+static uint8_t palette_ring[PALETTE_RING_LEN * 3];
+static int64_t palette_start_us = 0;
+
+void palette_scroll_start()
+{
+    uint32_t setting;
+
+    setting = get_setting_u32(setting_palette_pattern_palette);
+    const color_rgb_t* lut = palette_lut((palette_id)setting);
+    for (int idx = 0; idx < PALETTE_RING_LEN; idx++)
+    {
+        // Run up the palette and back down, so the ring has no seam
+        int lut_idx = idx * 2 * PALETTE_LUT_LEN / PALETTE_RING_LEN;
+        if (lut_idx >= PALETTE_LUT_LEN)
+        {
+            lut_idx = 2 * PALETTE_LUT_LEN - 1 - lut_idx;
+        }
+        color_rgb_t color = lut[lut_idx];
+        palette_ring[idx * 3 + 0] = color.r * PALETTE_SCROLL_BRIGHTNESS / COLOR_COMPONENT_MAX;
+        palette_ring[idx * 3 + 1] = color.g * PALETTE_SCROLL_BRIGHTNESS / COLOR_COMPONENT_MAX;
+        palette_ring[idx * 3 + 2] = color.b * PALETTE_SCROLL_BRIGHTNESS / COLOR_COMPONENT_MAX;
+    }
+    palette_start_us = led_clock_us();
+    ESP_LOGI(TAG, "Scrolling palette %s", palette_names[setting < palette_id_enum_max ? setting : palette_rainbow]);
+}
+
+int64_t palette_scroll_frame(int64_t now)
+{
+    uint32_t tick = (uint32_t)((now - palette_start_us) * PALETTE_SCROLL_FPS / 1000000);
+    frame_scroll(0, palette_ring, PALETTE_RING_LEN, tick);
+    frame_scroll(1, palette_ring, PALETTE_RING_LEN, tick + PALETTE_RING_LEN / 4);
+    frame_commit();
+    return frame_tick_deadline(palette_start_us, tick, PALETTE_SCROLL_FPS);
+}
+
+// Ambient night lights
+//
+// Each pixel's color comes from noise at (pixel position, time), so the
+// effects drift without ever repeating. The night light has always been a
+// dim red, so these stay about as dim.
+
+// Slow enough changes that 20 keyframes a second, interpolated, look as good
+// as rendering every frame
+#define AMBIENT_FPS 20
+#define NIGHT_LIGHT_COLOR ((color_rgb_t){.r = 60, .g = 0, .b = 0})
+#define AMBIENT_LEVEL 60
+static night_light_mode_t ambient_mode = night_light_static;
+static int64_t ambient_start_us = 0;
+// Random offsets into the noise field, so each start looks different
+static uint32_t ambient_offset_x = 0;
+static uint32_t ambient_offset_y = 0;
+static const color_rgb_t* ambient_palette = NULL;
+
+// Noise elapsed_us into an effect moving at rate noise units per second
+static inline uint32_t ambient_time(int64_t elapsed_us, uint32_t rate)
+{
+    return (uint32_t)(elapsed_us * rate / 1000000);
+}
+
+// Spread the middle half of the noise range, where nearly all of it falls,
+// over a full palette index
+static inline uint8_t ambient_stretch(uint16_t n)
+{
+    int32_t idx = ((int32_t)n - 16384) >> 7;
+    return idx < 0 ? 0 : (idx > 255 ? 255 : idx);
+}
+
+// Returns whether mode is animated; the static night light is just a fill
+bool ambient_start()
+{
+    uint32_t setting;
+    noise_rand_t rand;
+
+    setting = get_setting_u32(setting_night_light_mode);
+    ambient_mode = (night_light_mode_t)setting;
+    switch (ambient_mode)
+    {
+    case night_light_fire:
+        ambient_palette = palette_lut(palette_fire);
+        break;
+    case night_light_aurora:
+        ambient_palette = palette_lut(palette_aurora);
+        break;
+    case night_light_candle:
+        break;
+    default:
+        return pdFALSE;
+    }
+
+    ambient_start_us = led_clock_us();
+    noise_rand_seed(&rand, (uint32_t)ambient_start_us);
+    ambient_offset_x = noise_rand_next(&rand);
+    ambient_offset_y = noise_rand_next(&rand);
+    ESP_LOGI(TAG, "Showing night light mode %d at %d fps", ambient_mode, AMBIENT_FPS);
+    return pdTRUE;
+}
+
+static void candle_draw(int64_t elapsed_us)
+{
+    // A fast flicker over a slow sway, the same along most of each strip
+    uint32_t flicker_t = ambient_time(elapsed_us, 3 * NOISE_ONE) + ambient_offset_y;
+    uint32_t sway_t = ambient_time(elapsed_us, NOISE_ONE / 2) + ambient_offset_y;
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+        {
+            uint32_t x = ambient_offset_x + (stripIdx * LEDS_PER_STRIP + pixelIdx) * (NOISE_ONE / 64);
+            uint32_t level = (noise2(x, flicker_t) + noise2(x, sway_t)) >> 9;
+            // Never dimmer than half
+            level = 128 + (level > 255 ? 255 : level) / 2;
+            frame_set_pixel(stripIdx, pixelIdx,
+                            AMBIENT_LEVEL * level >> 8,
+                            AMBIENT_LEVEL * level * 2 / 5 >> 8,
+                            AMBIENT_LEVEL * level / 20 >> 8);
+        }
+    }
+}
+
+static void fire_draw(int64_t elapsed_us)
+{
+    uint32_t t = ambient_time(elapsed_us, NOISE_ONE * 3 / 2) + ambient_offset_y;
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+        {
+            uint32_t x = ambient_offset_x + (stripIdx * LEDS_PER_STRIP + pixelIdx) * (NOISE_ONE / 6);
+            color_rgb_t color = ambient_palette[ambient_stretch(noise2(x, t))];
+            frame_set_pixel(stripIdx, pixelIdx,
+                            color.r * AMBIENT_LEVEL >> 8,
+                            color.g * AMBIENT_LEVEL >> 8,
+                            color.b * AMBIENT_LEVEL >> 8);
+        }
+    }
+}
+
+static void aurora_draw(int64_t elapsed_us)
+{
+    // Color drifts slowly; the curtains' brightness moves a little faster
+    uint32_t hue_t = ambient_time(elapsed_us, NOISE_ONE / 8) + ambient_offset_y;
+    uint32_t curtain_t = ambient_time(elapsed_us, NOISE_ONE / 3) + ambient_offset_y;
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        for (int pixelIdx = 0; pixelIdx < LEDS_PER_STRIP; pixelIdx++)
+        {
+            uint32_t x = ambient_offset_x + pixelIdx * (NOISE_ONE / 12);
+            color_rgb_t color = ambient_palette[ambient_stretch(noise3(x, stripIdx * NOISE_ONE / 2, hue_t))];
+            uint32_t level = ambient_stretch(noise2(x * 2, curtain_t));
+            frame_set_pixel(stripIdx, pixelIdx,
+                            color.r * level * AMBIENT_LEVEL >> 16,
+                            color.g * level * AMBIENT_LEVEL >> 16,
+                            color.b * level * AMBIENT_LEVEL >> 16);
+        }
+    }
+}
+
+int64_t ambient_frame(int64_t now)
+{
+    int64_t elapsed_us = now - ambient_start_us;
+    switch (ambient_mode)
+    {
+    case night_light_candle:
+        candle_draw(elapsed_us);
+        break;
+    case night_light_fire:
+        fire_draw(elapsed_us);
+        break;
+    case night_light_aurora:
+        aurora_draw(elapsed_us);
+        break;
+    default:
+        return -1;
+    }
+    frame_commit();
+
+    uint32_t tick = (uint32_t)(elapsed_us * AMBIENT_FPS / 1000000);
+    return frame_tick_deadline(ambient_start_us, tick, AMBIENT_FPS);
+}
+
+// Particles
+//
+// Comets, twinkles and raindrops are particles: a point with a sub-pixel
+// position and velocity that fades as it goes, added onto whatever else is in
+// the frame. They live in a fixed pool kept dense, so spawning takes the next
+// free slot and freeing moves the last live particle into the hole; nothing is
+// allocated while the effect runs. When the budget is full, spawns are
+// dropped, so a busy effect just gets sparser rather than slower.
+
+#define PARTICLE_FPS 60
+#define PARTICLE_POOL_SIZE 128
+
+// Raindrops burst into a splash when they land
+#define PARTICLE_SPLASHES 0x01
+
+typedef struct _particle_t {
+    // Position along the strip, in 1/256ths of a pixel, and speed and
+    // acceleration in 1/256ths of a pixel per frame
+    int32_t pos;
+    int32_t vel;
+    int32_t accel;
+    // Brightness out of 256, and how much of it is lost each frame
+    uint16_t life;
+    uint16_t decay;
+    // Pixels of fading tail behind a moving particle
+    uint8_t tail;
+    uint8_t strip;
+    uint8_t flags;
+    color_rgb_t color;
+} particle_t;
+
+static particle_t particle_pool[PARTICLE_POOL_SIZE];
+static int particle_count = 0;
+static int particle_budget_count = PARTICLE_POOL_SIZE;
+static led_pattern_t particle_effect = lpat_comets;
+static int64_t particle_start_us = 0;
+static noise_rand_t particle_rand;
+static const color_rgb_t* particle_palette = NULL;
+
+static led_particle_stats_t particle_stats;
+static uint64_t particle_updates = 0;
+static int64_t particle_update_us = 0;
+
+void led_get_particle_stats(led_particle_stats_t* stats)
+{
+    *stats = particle_stats;
+    stats->live = particle_count;
+    stats->per_ms = particle_update_us > 0 ? (uint32_t)(particle_updates * 1000 / particle_update_us) : 0;
+}
+
+// Returns a zeroed particle, or NULL when the budget is used up
+static particle_t* particle_spawn(void)
+{
+    if (particle_count >= particle_budget_count)
+    {
+        particle_stats.dropped++;
+        return NULL;
+    }
+    particle_t* p = &particle_pool[particle_count++];
+    memset(p, 0, sizeof(*p));
+    particle_stats.spawned++;
+    if (particle_count > particle_stats.peak)
+    {
+        particle_stats.peak = particle_count;
+    }
+    return p;
+}
+
+static inline void particle_free(int idx)
+{
+    particle_pool[idx] = particle_pool[--particle_count];
+}
 
-    // string 1 demos the luminosity presets
-    ledIdx = 0;
-    strip = strips[1];
-    for (color_cct_luminosity lmIdx = 0; lmIdx < color_cct_lm_enum_max; lmIdx++)
+// Add color at level/256 onto a pixel, saturating
+static inline void particle_add(int stripIdx, int pixelIdx, color_rgb_t color, uint32_t level)
+{
+    if (pixelIdx < 0 || LEDS_PER_STRIP <= pixelIdx || level == 0)
     {
-        color_cct_t temp;
-        temp.temp = color_cct_temp_values[color_cct_temp_warm_2500];
-        temp.lm = color_cct_luminosity_values[lmIdx];
-        color = color_cct_to_rgb(temp);
-        strip->set_pixel(strip, ledIdx++, COLOR_RGB_FROM_STRUCT(color));
-	}
-    strip->refresh(strip);
+        return;
+    }
+    uint8_t* px = led_frame + (stripIdx * LEDS_PER_STRIP + pixelIdx) * 3;
+    uint32_t r = px[0] + (color.r * level >> 8);
+    uint32_t g = px[1] + (color.g * level >> 8);
+    uint32_t b = px[2] + (color.b * level >> 8);
+    px[0] = r > 255 ? 255 : r;
+    px[1] = g > 255 ? 255 : g;
+    px[2] = b > 255 ? 255 : b;
 }
 
-void clear_all(void)
+static void particle_draw(const particle_t* p)
 {
-    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    // Split each point between the two pixels it falls across
+    int32_t pixel = p->pos >> 8;
+    uint32_t frac = p->pos & 0xFF;
+    int dir = p->vel >= 0 ? -1 : 1;
+    for (int t = 0; t <= p->tail; t++)
     {
-        led_strip_t *strip = strips[stripIdx];
-        strip->clear(strip);
+        uint32_t level = p->life * (p->tail + 1 - t) / (p->tail + 1);
+        int32_t at = pixel + dir * t;
+        particle_add(p->strip, at, p->color, level * (256 - frac) >> 8);
+        particle_add(p->strip, at + 1, p->color, level * frac >> 8);
     }
 }
 
-void refresh_all(void)
+static void particle_splash(const particle_t* drop)
 {
-    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    for (int side = -1; side <= 1; side += 2)
     {
-        led_strip_t *strip = strips[stripIdx];
-        strip->refresh(strip);
+        particle_t* p = particle_spawn();
+        if (p == NULL)
+        {
+            return;
+        }
+        p->strip = drop->strip;
+        p->pos = 0;
+        p->vel = side * (int32_t)(16 + noise_rand_below(&particle_rand, 24));
+        p->life = 160;
+        p->decay = 12;
+        p->color = drop->color;
+    }
+}
+
+// Move, fade and draw every particle, freeing the ones that are done
+static void particles_step(void)
+{
+    int idx = 0;
+    while (idx < particle_count)
+    {
+        particle_t* p = &particle_pool[idx];
+        p->vel += p->accel;
+        p->pos += p->vel;
+        p->life = p->life > p->decay ? p->life - p->decay : 0;
+
+        int32_t pixel = p->pos >> 8;
+        if (pixel < 0 && (p->flags & PARTICLE_SPLASHES))
+        {
+            particle_splash(p);
+            particle_free(idx);
+            continue;
+        }
+        if (p->life == 0 || pixel < -1 - p->tail || LEDS_PER_STRIP + p->tail < pixel)
+        {
+            particle_free(idx);
+            continue;
+        }
+        particle_draw(p);
+        idx++;
     }
 }
 
-// strip - pointer to led_strip_t strip
-// brightness - the 'v' in hsv
-// led0 to led_n - the range of LED indices, inclusive, to draw the rainbow on
-// angle_start - 'h' in hsv angle to start the rainbo
-// angle_size - add to angle_start to calculate 'h' value to stop at, exclusive
-void write_rainbow(led_strip_t *strip, int brightness, int led0, int led_n, int angle_start, int angle_size)
+static color_rgb_t particle_palette_color(void)
+{
+    color_rgb_t color = particle_palette[noise_rand_below(&particle_rand, PALETTE_LUT_LEN)];
+    color.r = color.r * COLOR_RGB_BASE / COLOR_COMPONENT_MAX;
+    color.g = color.g * COLOR_RGB_BASE / COLOR_COMPONENT_MAX;
+    color.b = color.b * COLOR_RGB_BASE / COLOR_COMPONENT_MAX;
+    return color;
+}
+
+static void comets_spawn(void)
 {
-    #define RAINBOW_COLORS_COUNT LEDS_PER_STRIP
-    static bool rainbow_initiated = false;
-    static color_rgb_t rainbow_colors[RAINBOW_COLORS_COUNT];
-    const int rainbow_brightness = 50;
+    // About one new comet every second and a half
+    if (noise_rand_below(&particle_rand, 90) != 0)
+    {
+        return;
+    }
+    particle_t* p = particle_spawn();
+    if (p == NULL)
+    {
+        return;
+    }
+    p->strip = noise_rand_below(&particle_rand, LED_STRIP_COUNT);
+    p->vel = 40 + noise_rand_below(&particle_rand, 80);
+    p->pos = -256;
+    if (noise_rand_below(&particle_rand, 2))
+    {
+        p->vel = -p->vel;
+        p->pos = LEDS_PER_STRIP * 256;
+    }
+    p->life = 256;
+    p->tail = 4 + noise_rand_below(&particle_rand, 7);
+    p->color = particle_palette_color();
+}
 
-    if (false == rainbow_initiated)
+static void twinkles_spawn(void)
+{
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
     {
-        rainbow_initiated = true;
-        for (int idx = 0; idx < RAINBOW_COLORS_COUNT; idx++)
+        if (noise_rand_below(&particle_rand, 4) != 0)
+        {
+            continue;
+        }
+        particle_t* p = particle_spawn();
+        if (p == NULL)
         {
-            rainbow_colors[idx] = color_hsv_to_rgb(COLOR_HSV_TO_STRUCT(idx * 360 / RAINBOW_COLORS_COUNT,
-                                                   color_hsv_sat_values[color_hsv_sat_100],
-                                                   rainbow_brightness
-                                                   ));
+            return;
         }
+        p->strip = stripIdx;
+        p->pos = noise_rand_below(&particle_rand, LEDS_PER_STRIP) << 8;
+        p->life = 256;
+        p->decay = 3 + noise_rand_below(&particle_rand, 6);
+        p->color = particle_palette_color();
     }
+}
 
-    // argument validation
-    // if strip is null, there's nothing else to do (consider logging or throwing error)
-    if (strip == NULL)
+static void raindrops_spawn(void)
+{
+    if (noise_rand_below(&particle_rand, 12) != 0)
     {
         return;
     }
-    // cap brightness to 100 arbitrarily -- I think that's part of HSV ranges and can't be bothered to check right now
-    if (brightness >= 100) { brightness = 100; }
-    // validate the LED indices' ranges
-    if (led0 < 0 || LEDS_PER_STRIP <= led0 ||
-        led_n < 0 || LEDS_PER_STRIP <= led_n)
+    particle_t* p = particle_spawn();
+    if (p == NULL)
     {
         return;
     }
-    if (led0 > led_n)
-    {
-        // handle wraparound by splitting into two calls
-        // split angle_size proportionately between them
-        int bottom_size = led_n + 1;
-        int top_size = LEDS_PER_STRIP - led0;
-        int top_angle_start = angle_start;
-        int top_angle_size = angle_size * top_size / (top_size + bottom_size);
-        int bottom_angle_start = top_angle_start + top_angle_size;
-        int bottom_angle_size = angle_size - top_angle_size;
-        write_rainbow(strip, brightness, 0, led_n, bottom_angle_start, bottom_angle_size);
-        write_rainbow(strip, brightness, led0, LEDS_PER_STRIP-1, top_angle_start, top_angle_size);
+    // Falling from the far end of the strip toward pixel 0, speeding up
+    p->strip = noise_rand_below(&particle_rand, LED_STRIP_COUNT);
+    p->pos = (LEDS_PER_STRIP - 1) << 8;
+    p->vel = -(int32_t)(8 + noise_rand_below(&particle_rand, 24));
+    p->accel = -1;
+    p->life = 256;
+    p->tail = 2;
+    p->flags = PARTICLE_SPLASHES;
+    p->color = particle_palette_color();
+}
+
+void particles_start(led_pattern_t p)
+{
+    uint32_t setting;
+
+    setting = get_setting_u32(setting_particle_budget);
+    particle_budget_count = setting < PARTICLE_POOL_SIZE ? setting : PARTICLE_POOL_SIZE;
+    particle_effect = p;
+    particle_count = 0;
+    particle_palette = palette_lut(p == lpat_raindrops ? palette_ocean : palette_rainbow);
+    particle_start_us = led_clock_us();
+    noise_rand_seed(&particle_rand, (uint32_t)particle_start_us);
+    clear_all();
+    ESP_LOGI(TAG, "Showing %s with up to %d particles", led_pattern_names[p], particle_budget_count);
+}
+
+int64_t particles_frame(int64_t now)
+{
+    switch (particle_effect)
+    {
+    case lpat_comets:
+        comets_spawn();
+        break;
+    case lpat_twinkles:
+        twinkles_spawn();
+        break;
+    case lpat_raindrops:
+        raindrops_spawn();
+        break;
+    default:
+        break;
+    }
+
+    clear_all();
+    int64_t step_start_us = esp_timer_get_time();
+    particles_step();
+    particle_update_us += esp_timer_get_time() - step_start_us;
+    particle_updates += particle_count;
+    frame_commit();
+
+    uint32_t tick = (uint32_t)((now - particle_start_us) * PARTICLE_FPS / 1000000);
+    return frame_tick_deadline(particle_start_us, tick, PARTICLE_FPS);
+}
+
+// Have the render task draw a frame of p now, if p is running. Never blocks.
+static void led_request_frame(led_pattern_t p)
+{
+    // Racy read, but the worst case is one spurious or one missed wakeup
+    if (led_animation == p)
+    {
+        led_frame_ready_pending = pdTRUE;
+        xTaskNotifyGive(led_render_task_handle);
+    }
+}
+
+void led_notify_frame_ready(void)
+{
+    led_request_frame(lpat_stream);
+}
+
+void led_start_animation(led_pattern_t p)
+{
+    led_animation = p;
+    led_next_frame_us = 0;
+    led_keyframe_count = 0;
+    xTaskNotifyGive(led_render_task_handle);
+}
+
+// Release whatever animation p holds. Must be called with led_semaphore held.
+static void led_animation_cleanup(led_pattern_t p)
+{
+    switch (p)
+    {
+    case lpat_clip:
+        clip_unmap(&clip_playing);
+        break;
+    default:
+        break;
+    }
+}
+
+// Must be called with led_semaphore held
+void led_stop_animation()
+{
+    led_animation_cleanup(led_animation);
+    led_animation = lpat_max;
+}
+
+// Finish the current transition, if any, leaving only the incoming pattern.
+// Must be called with led_semaphore held.
+static void led_transition_end(void)
+{
+    if (led_transition_active)
+    {
+        led_animation_cleanup(led_outgoing_animation);
+        led_outgoing_animation = lpat_max;
+        led_transition_active = pdFALSE;
+    }
+}
+
+// Animations that draw from the same state, like the particle effects'
+// shared pool, get the same family. Starting one resets that state, so it
+// can't also keep animating the one being replaced.
+static led_pattern_t led_animation_family(led_pattern_t p)
+{
+    switch (p)
+    {
+    case lpat_comets:
+    case lpat_twinkles:
+    case lpat_raindrops:
+        return lpat_comets;
+    default:
+        return p;
+    }
+}
+
+// Start fading from whatever is showing to pattern incoming, which is about
+// to be drawn. The running animation, if any, keeps animating underneath until
+// the fade is done. Must be called with led_semaphore held.
+static void led_transition_begin(led_pattern_t incoming)
+{
+    uint32_t setting;
+
+    led_pattern_starts++;
+    setting = get_setting_u32(setting_transition_time_ms);
+    if (setting == 0)
+    {
+        led_transition_end();
+        led_stop_animation();
         return;
     }
-    int angle;
-    color_rgb_t color;
-    const int count = led_n - led0 + 1;
-    for (int led_idx = 0; led_idx < count; led_idx++)
+    led_transition_duration_us = (int64_t)setting * 1000;
+    setting = get_setting_u32(setting_transition_easing);
+    led_transition_easing = (led_easing_t)setting;
+
+    if (led_transition_active)
+    {
+        // Interrupting a transition: fade out from the blend as it stands,
+        // rather than jumping to either end of it
+        led_transition_end();
+        led_stop_animation();
+        memcpy(led_outgoing_frame, led_snapshot_front, LED_FRAME_LEN);
+    }
+    else
     {
-        angle = angle_start + angle_size * led_idx / count;
-        if (led0 == led_n)
+        if (led_animation != lpat_max && led_animation_family(led_animation) == led_animation_family(incoming))
         {
-            // take the midpoint color
-            angle = angle_start + angle_size / 2;
+            // Restarting an animation, or starting another from its family,
+            // resets the state both would share, so the old one fades out as
+            // a still
+            led_stop_animation();
         }
-        // The color-scrolling algorithm slows down drastically after the first
-        // couple of steps. This function has a floating-point matrix multiplication
-        // and so could be quite slow once the pipeline fills; what I do know is that
-        // commenting out the call fixes the issue.
-        // One option is to switch the function to fixed-point math, but that takes
-        // a lot of analysis I don't feel like doing right now.
-        //color = color_hsv_to_rgb(COLOR_HSV_TO_STRUCT(angle,
-        //                         color_hsv_sat_values[color_hsv_sat_100],
-        //                         brightness
-        //                         ));
-        // Another option, since I know what kind of range I want, is to precompute
-        // them and just copy them around in various permutations.
-        color = rainbow_colors[(angle * RAINBOW_COLORS_COUNT / 360) % RAINBOW_COLORS_COUNT];
-        strip->set_pixel(strip, led0 + led_idx, COLOR_RGB_FROM_STRUCT(color));
+        // The outgoing animation keeps the buffer it has been drawing into
+        uint8_t* outgoing_frame = led_frame;
+        led_frame = led_outgoing_frame;
+        led_outgoing_frame = outgoing_frame;
+        led_outgoing_animation = led_animation;
+        led_outgoing_next_us = led_next_frame_us;
+        led_animation = lpat_max;
     }
+
+    // Patterns that paint over the old frame, like the fills, start from what
+    // is showing
+    memcpy(led_frame, led_snapshot_front, LED_FRAME_LEN);
+    led_transition_start_us = led_clock_us();
+    led_transition_active = pdTRUE;
+    xTaskNotifyGive(led_render_task_handle);
 }
 
-void rambo_brite(void)
+// Draw a frame of animation p. Must be called with led_semaphore held.
+// Returns when the next frame is due, or a negative value once p is finished.
+int64_t led_animation_frame(led_pattern_t p, int64_t now)
 {
-    //clear_all(); // avoid black flash on pattern repeat; just means below has to write to all LEDs
-    // The basic approach is one for loop with a color increment and a delay.
-    // This could be munged a bit to tease apart the color range, scroll rate,
-    // and duration.
-    const int color_angle_step = 360 / LEDS_PER_STRIP;
-    const int brightness = 50;
-    const int delay = 29; // ~35 Hz
-    const int steps = 5 * 360 / color_angle_step;
-    for (int step = 0; step < steps; step++)
+    switch (p)
+    {
+    case lpat_current_time:
+        return clock_frame(now);
+    case lpat_analog_clock:
+        return analog_clock_frame(now);
+    case lpat_clip:
+        return clip_frame(now);
+    case lpat_stream:
+        return stream_frame(now);
+    case lpat_palette:
+        return palette_scroll_frame(now);
+    case lpat_night_light:
+        return ambient_frame(now);
+    case lpat_fade_step:
+        return fade_frame(now);
+    case lpat_sunrise:
+        return sunrise_frame(now);
+    case lpat_circadian:
+        return circadian_frame(now);
+    case lpat_status_indicators:
+        return status_indicators_frame(now);
+    case lpat_comets:
+    case lpat_twinkles:
+    case lpat_raindrops:
+        return particles_frame(now);
+    default:
+        ESP_LOGE(TAG, "%s: pattern %d is not animated", __FUNCTION__, p);
+        return -1;
+    }
+}
+
+// Draw a frame of the outgoing animation into its own buffer. Must be called
+// with led_semaphore held.
+static void led_draw_outgoing(int64_t now)
+{
+    uint8_t* incoming_frame = led_frame;
+    led_frame = led_outgoing_frame;
+    led_drawing_outgoing = pdTRUE;
+    frame_begin(led_outgoing_animation);
+    led_outgoing_next_us = led_animation_frame(led_outgoing_animation, now);
+    led_drawing_outgoing = pdFALSE;
+    led_frame = incoming_frame;
+
+    if (led_outgoing_next_us < 0)
+    {
+        // Its last frame stays in the blend
+        led_animation_cleanup(led_outgoing_animation);
+        led_outgoing_animation = lpat_max;
+    }
+}
+
+// Wakes the render task exactly when the next frame is due, rather than on
+// the next tick after it
+static esp_timer_handle_t led_frame_timer = NULL;
+static volatile bool led_frame_timer_fired = pdFALSE;
+
+static void led_frame_timer_callback(void* arg)
+{
+    led_frame_timer_fired = pdTRUE;
+    xTaskNotifyGive(led_render_task_handle);
+}
+
+// Native render rate of animations that render slower than the strips are
+// refreshed. The render task fills in the frames between from their last two
+// keyframes. Anything not listed draws every frame it shows.
+static const uint8_t led_render_fps[lpat_max] = {
+    [lpat_night_light] = AMBIENT_FPS,
+    [lpat_palette] = PALETTE_SCROLL_FPS,
+};
+
+static inline bool led_interpolated(led_pattern_t p)
+{
+    return p < lpat_max && led_render_fps[p] != 0 && led_render_fps[p] < LED_OUTPUT_FPS;
+}
+
+// Draw a keyframe of the incoming animation. Must be called with
+// led_semaphore held.
+static int64_t led_draw_keyframe(int64_t now)
+{
+    led_capturing_keyframe = pdTRUE;
+    int64_t next_us = led_animation_frame(led_animation, now);
+    led_capturing_keyframe = pdFALSE;
+
+    led_keyframe_prev_us = led_keyframe_last_us;
+    led_keyframe_last_us = now;
+    if (led_keyframe_count++ == 0)
+    {
+        // Nothing to come from yet, so hold the first keyframe
+        memcpy(led_keyframe_prev, led_keyframe_last, LED_FRAME_LEN);
+        led_keyframe_prev_us = now - 1000000 / led_render_fps[led_animation];
+        led_output_next_us = now;
+    }
+    return next_us;
+}
+
+// Show the frame between the last two keyframes that is as far past the last
+// one as the last one was past the one before. Must be called with
+// led_semaphore held.
+static void led_draw_interpolated(int64_t now)
+{
+    int64_t span_us = led_keyframe_last_us - led_keyframe_prev_us;
+    int64_t elapsed_us = now - led_keyframe_last_us;
+    uint32_t w = 256;
+    if (span_us > 0 && elapsed_us < span_us)
+    {
+        w = elapsed_us > 0 ? (uint32_t)(elapsed_us * 256 / span_us) : 0;
+    }
+    for (int i = 0; i < LED_FRAME_LEN; i++)
+    {
+        led_frame[i] = (uint8_t)((led_keyframe_prev[i] * (256 - w) + led_keyframe_last[i] * w) >> 8);
+    }
+    // Not a rendered frame, so not counted against the pattern
+    frame_begin(lpat_max);
+    frame_commit();
+}
+
+static int64_t earliest(int64_t a, int64_t b)
+{
+    if (a < 0)
+    {
+        return b;
+    }
+    if (b < 0)
+    {
+        return a;
+    }
+    return a < b ? a : b;
+}
+
+// Waits at least this long give up the render power lock, so a slow
+// animation lets the chip scale down or light-sleep between frames. Shorter
+// ones keep it, so 60 fps output doesn't pay wakeup latency every frame.
+#define LED_PM_RELEASE_WAIT_US 30000
+
+// One pass of the render task: draw whatever is due at led_clock_us, then
+// return when the next pass is due, or a negative value once nothing is
+// animating. due_us is the deadline the pass was woken for and on_deadline
+// whether it was woken by that deadline coming, as opposed to something
+// starting or a streamed frame arriving, for the jitter statistics.
+int64_t led_render_pass(int64_t due_us, bool on_deadline)
+{
+    xSemaphoreTake(led_semaphore, portMAX_DELAY);
+    int64_t now = led_clock_us();
+    uint32_t commits = led_commit_count;
+
+    if (led_transition_active && led_outgoing_animation != lpat_max && led_outgoing_next_us <= now)
+    {
+        led_draw_outgoing(now);
+    }
+
+    if (led_animation != lpat_max && (led_next_frame_us <= now || led_frame_ready_pending))
+    {
+        if (on_deadline && due_us == led_next_frame_us)
+        {
+            frame_record_jitter(led_animation, now - led_next_frame_us);
+        }
+        led_frame_ready_pending = pdFALSE;
+        frame_begin(led_animation);
+        if (led_interpolated(led_animation))
+        {
+            led_next_frame_us = led_draw_keyframe(now);
+        }
+        else
+        {
+            led_next_frame_us = led_animation_frame(led_animation, now);
+        }
+        if (led_next_frame_us < 0)
+        {
+            ESP_LOGI(TAG, "Animation %s complete.", led_pattern_names[led_animation]);
+            led_stop_animation();
+        }
+    }
+
+    bool interpolating = led_animation != lpat_max && led_interpolated(led_animation) && led_keyframe_count > 0;
+    if (interpolating && led_output_next_us <= now)
+    {
+        led_draw_interpolated(now);
+        led_output_next_us += LED_OUTPUT_FRAME_US;
+        if (led_output_next_us <= now)
+        {
+            // Fell behind; don't try to catch up
+            led_output_next_us = now + LED_OUTPUT_FRAME_US;
+        }
+    }
+
+    int64_t transition_end_us = led_transition_start_us + led_transition_duration_us;
+    if (led_transition_active)
+    {
+        // Every commit shows the blend, so blend steps only fill in when
+        // nothing else has committed for an output frame. Otherwise an
+        // incoming animation at about the output rate gets a blend step just
+        // before each of its frames, and the strips are refreshed twice.
+        bool blend_due = led_commit_count == commits && now >= led_last_commit_us + LED_OUTPUT_FRAME_US;
+        if (blend_due || now >= transition_end_us)
+        {
+            // Advance the blend, and make sure its last step lands
+            // exactly on the incoming frame. Not any pattern's frame.
+            frame_begin(lpat_max);
+            frame_commit();
+        }
+        if (now >= transition_end_us)
+        {
+            led_transition_end();
+        }
+    }
+
+    int64_t wake_us = -1;
+    if (led_animation != lpat_max)
+    {
+        wake_us = led_next_frame_us;
+    }
+    if (interpolating)
+    {
+        wake_us = earliest(wake_us, led_output_next_us);
+    }
+    if (led_transition_active)
+    {
+        int64_t blend_us = led_last_commit_us + LED_OUTPUT_FRAME_US;
+        if (wake_us >= 0 && wake_us <= blend_us + LED_OUTPUT_FRAME_US / 4)
+        {
+            // A frame due about then advances the blend anyway
+            blend_us = wake_us;
+        }
+        wake_us = earliest(wake_us, blend_us < transition_end_us ? blend_us : transition_end_us);
+        if (led_outgoing_animation != lpat_max)
+        {
+            wake_us = earliest(wake_us, led_outgoing_next_us);
+        }
+    }
+    xSemaphoreGive(led_semaphore);
+    return wake_us;
+}
+
+void led_render_task(void* param)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = led_frame_timer_callback,
+        .name = "led frame",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &led_frame_timer));
+
+    while (pdTRUE)
     {
-        write_rainbow(strips[0], brightness, 0, LEDS_PER_STRIP-1, color_angle_step * step, 270);
-        write_rainbow(strips[1], brightness, 0, LEDS_PER_STRIP-1, color_angle_step * step, 270);
-        refresh_all();
-        vTaskDelay(delay / portTICK_PERIOD_MS);
+        // Sleep until led_run_sync starts an animation or a transition
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        power_lock_acquire(power_lock_render);
+
+        int64_t wake_us = 0;
+        bool on_deadline = pdFALSE;
+        while (wake_us >= 0)
+        {
+            wake_us = led_render_pass(wake_us, on_deadline);
+
+            if (wake_us >= 0)
+            {
+                // Starting a new pattern or a streamed frame arriving also
+                // notifies this task, which cuts the wait short.
+                int64_t wait_us = wake_us - led_clock_us();
+                on_deadline = pdTRUE;
+                if (wait_us > 0)
+                {
+                    bool long_wait = wait_us >= LED_PM_RELEASE_WAIT_US;
+                    if (long_wait)
+                    {
+                        power_lock_release(power_lock_render);
+                    }
+                    led_frame_timer_fired = pdFALSE;
+                    ESP_ERROR_CHECK(esp_timer_start_once(led_frame_timer, wait_us));
+                    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                    esp_timer_stop(led_frame_timer);
+                    on_deadline = led_frame_timer_fired;
+                    if (long_wait)
+                    {
+                        power_lock_acquire(power_lock_render);
+                    }
+                }
+            }
+        }
+        power_lock_release(power_lock_render);
     }
 }
 
@@ -738,14 +2781,55 @@ esp_err_t led_run_sync(led_pattern_t p)
 {
     esp_err_t retVal = ESP_OK;
     time_t now;
+    struct timeval tv;
     uint32_t fill_pattern_duration_ms;
     int fill_interval_ms;
 
-    ESP_ERROR_CHECK( get_setting("fill_time_ms", &fill_pattern_duration_ms) );
+    fill_pattern_duration_ms = get_setting_u32(setting_fill_time_ms);
     fill_interval_ms = (signed)fill_pattern_duration_ms / LEDS_PER_STRIP;
 
+    // Fills and wipes draw from this task, so it needs the clocks up too
+    power_lock_acquire(power_lock_render);
     xSemaphoreTake(led_semaphore, portMAX_DELAY);
 
+    // The sleep timer and the sunrise carry on from the circadian light
+    bool from_circadian = led_animation == lpat_circadian;
+    if (from_circadian && p == lpat_fade_start)
+    {
+        // Already on, so it stays on, following the time of day, until the
+        // fade takes over
+        xSemaphoreGive(led_semaphore);
+        power_lock_release(power_lock_render);
+        return ESP_OK;
+    }
+
+    // Check what can fail before touching what's showing, so a bad request
+    // leaves it be. A clip already mapped for what's showing is the stored
+    // clip, which can't have changed while mapped, so it's started again
+    // after the old one lets go of it.
+    if (p >= lpat_max)
+    {
+        xSemaphoreGive(led_semaphore);
+        power_lock_release(power_lock_render);
+        return ESP_ERR_INVALID_ARG;
+    }
+    bool clip_started = pdFALSE;
+    if (p == lpat_clip && led_animation != lpat_clip && led_outgoing_animation != lpat_clip)
+    {
+        retVal = clip_start();
+        if (retVal != ESP_OK)
+        {
+            xSemaphoreGive(led_semaphore);
+            power_lock_release(power_lock_render);
+            return retVal;
+        }
+        clip_started = pdTRUE;
+    }
+
+    // Whatever runs next replaces the current pattern, fading over from it
+    led_transition_begin(p);
+    frame_begin(p);
+
     switch (p)
     {
     // instant color patterns
@@ -809,11 +2893,19 @@ esp_err_t led_run_sync(led_pattern_t p)
         fill_all_rgb(fill_interval_ms, color_rgb_color_values[color_rgb_color_whosebloodisthisred]);
         break;
     case lpat_night_light:
-        fill_all_rgb(fill_interval_ms, (color_rgb_t){.r = 60, .g = 0, .b = 0});
+        if (ambient_start())
+        {
+            led_start_animation(p);
+        }
+        else
+        {
+            fill_all_rgb(fill_interval_ms, NIGHT_LIGHT_COLOR);
+        }
         break;
     // data patterns
     case lpat_current_time:
-        show_current_time();
+        clock_start();
+        led_start_animation(p);
         break;
     // technical patterns
     case lpat_color_showcase:
@@ -830,30 +2922,112 @@ esp_err_t led_run_sync(led_pattern_t p)
         break;
     // diagnostic patterns
     case lpat_status_indicators:
-        led_refresh_status_indicators();
+        status_indicators_start();
+        led_start_animation(p);
         break;
     case lpat_local_time_in_unix_epoch_seconds:
-        localtime(&now);
-        show_integer(1, sizeof(now)*8, now, 0, 0, color_rgb_color_values[color_rgb_color_green]);
-        strips[1]->refresh(strips[1]);
+        led_clock_wall(&tv);
+        now = tv.tv_sec;
+        show_integer(1, 32, (int)now, 0, 0, color_rgb_color_values[color_rgb_color_green]);
+        frame_commit();
         break;
     // internal patterns
     case lpat_fade_start:
         fade_start();
         break;
     case lpat_fade_step:
-        fade_step();
+        fade_step(from_circadian);
+        led_start_animation(p);
         break;
     case lpat_rambo_brite:
         rambo_brite();
         break;
+    // animated patterns
+    case lpat_clip:
+        if (!clip_started)
+        {
+            retVal = clip_start();
+        }
+        if (retVal == ESP_OK)
+        {
+            led_start_animation(p);
+        }
+        break;
+    case lpat_stream:
+        ESP_LOGI(TAG, "Showing frames streamed over DDP/E1.31");
+        led_start_animation(p);
+        break;
+    case lpat_analog_clock:
+        analog_clock_start();
+        led_start_animation(p);
+        break;
+    case lpat_palette:
+        palette_scroll_start();
+        led_start_animation(p);
+        break;
+    case lpat_comets:
+    case lpat_twinkles:
+    case lpat_raindrops:
+        particles_start(p);
+        led_start_animation(p);
+        break;
+    case lpat_circadian:
+        circadian_start();
+        led_start_animation(p);
+        break;
+    case lpat_sunrise:
+        sunrise_start(led_clock_us() + SUNRISE_DEMO_S * 1000000LL, SUNRISE_DEMO_S * 1000000LL, from_circadian);
+        led_start_animation(p);
+        break;
     default:
         retVal = ESP_ERR_INVALID_ARG;
     }
 
-    led_current_display_is_status = (p == lpat_status_indicators);
-
     xSemaphoreGive(led_semaphore);
+    power_lock_release(power_lock_render);
 
     return retVal;
 }
+
+esp_err_t led_run_sunrise(time_t alarm_time)
+{
+    uint32_t setting;
+    struct timeval tv;
+
+    setting = get_setting_u32(setting_sunrise_duration_min);
+    if (setting == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    power_lock_acquire(power_lock_render);
+    xSemaphoreTake(led_semaphore, portMAX_DELAY);
+    bool from_circadian = led_animation == lpat_circadian;
+    led_transition_begin(lpat_sunrise);
+    frame_begin(lpat_sunrise);
+    // The alarm is on the wall clock; patterns run on led_clock_us
+    led_clock_wall(&tv);
+    int64_t wall_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    sunrise_start(led_clock_us() + (int64_t)alarm_time * 1000000 - wall_us, (int64_t)setting * 60 * 1000000,
+                  from_circadian);
+    led_start_animation(lpat_sunrise);
+    xSemaphoreGive(led_semaphore);
+    power_lock_release(power_lock_render);
+    return ESP_OK;
+}
+
+// Show a frame supplied from outside, replacing whatever pattern is running
+esp_err_t led_show_frame(const uint8_t* rgb)
+{
+    power_lock_acquire(power_lock_render);
+    xSemaphoreTake(led_semaphore, portMAX_DELAY);
+    // Shown as is, so that callers see exactly the frame they supplied
+    led_transition_end();
+    led_stop_animation();
+    // Not a pattern, so not counted in the statistics
+    frame_begin(lpat_max);
+    write_frame_rgb(rgb);
+    xSemaphoreGive(led_semaphore);
+    power_lock_release(power_lock_render);
+    return ESP_OK;
+}
@@ -12,6 +12,14 @@
 // FreeRTOS event groups
 #include "freertos/event_groups.h"
 
+// struct timeval
+#include <sys/time.h>
+
+#define LED_STRIP_COUNT 2
+#define LEDS_PER_STRIP 60
+// One frame is every pixel of every strip as R,G,B bytes, strip after strip
+#define LED_FRAME_LEN (LED_STRIP_COUNT * LEDS_PER_STRIP * 3)
+
 #define LED_PATTERN_NAME_TEMPLATE \
     TRANSMOG(sudden_red) \
     TRANSMOG(sudden_green) \
@@ -43,6 +51,15 @@
     TRANSMOG(fade_start) \
     TRANSMOG(fade_step) \
     TRANSMOG(rambo_brite) \
+    TRANSMOG(clip) \
+    TRANSMOG(stream) \
+    TRANSMOG(analog_clock) \
+    TRANSMOG(palette) \
+    TRANSMOG(comets) \
+    TRANSMOG(twinkles) \
+    TRANSMOG(raindrops) \
+    TRANSMOG(sunrise) \
+    TRANSMOG(circadian) \
     TRANSMOG(max)
 
 #define TRANSMOG(n) lpat_##n,
@@ -54,8 +71,6 @@ typedef enum _led_pattern
 
 extern const char* led_pattern_names[];
 
-extern const int FADE_STEP_COUNT;
-
 typedef enum _led_status_index
 {
     led_status_full_system,
@@ -79,9 +94,116 @@ typedef enum _led_color_t {
     LED_STATUS_COLOR_SUCCESS,
 } led_color_t;
 
+// Never blocks, so it's safe from event handlers. Changes show on the status
+// display's next frame.
 void led_set_status_indicator(led_status_index idx, led_color_t color_id);
+led_color_t led_get_status_indicator(led_status_index idx);
 
 // Configuration is a combination of hard-coded and sdkconfig.h items.
 
 esp_err_t led_init(void);
 esp_err_t led_run_sync(led_pattern_t p);
+
+// What the night light pattern shows
+typedef enum _night_light_mode_t {
+    // a steady dim red
+    night_light_static,
+    // a warm flicker
+    night_light_candle,
+    // flames moving along the strips
+    night_light_fire,
+    // slow green and violet curtains
+    night_light_aurora,
+} night_light_mode_t;
+
+// How a transition between patterns moves from the old pattern to the new one
+typedef enum _led_easing_t {
+    // constant speed
+    led_easing_linear,
+    // starts and ends slowly (smoothstep)
+    led_easing_smooth,
+    // starts slowly
+    led_easing_ease_in,
+    // ends slowly
+    led_easing_ease_out,
+} led_easing_t;
+
+// How a sunrise alarm brightens
+typedef enum _sunrise_curve_t {
+    // evenly in light, so it seems to jump up early and crawl at the end
+    sunrise_curve_linear,
+    // evenly to the eye
+    sunrise_curve_perceptual,
+    // starts and ends slowly (smoothstep)
+    sunrise_curve_smooth,
+} sunrise_curve_t;
+
+// Start a sunrise that reaches daylight at alarm_time (Unix Epoch), lasting
+// sunrise_duration_min. ESP_ERR_INVALID_STATE if sunrises are turned off.
+esp_err_t led_run_sunrise(time_t alarm_time);
+
+// Rebuild anything precomputed from settings, like the circadian table, the
+// next time it's used
+void led_settings_changed(void);
+
+// Per-pattern rendering statistics. A frame is everything drawn between two
+// commits to the strips; one-shot patterns that commit once count one frame.
+#define LED_STATS_HISTOGRAM_BUCKETS 16
+typedef struct _led_pattern_stats_t {
+    uint32_t frames;
+    // pixels handed to the strip driver, over all frames
+    uint64_t pixels_sent;
+    // frames per second, measured over about a second of the pattern running
+    uint32_t fps;
+    // animation frames drawn more than a tick after they were due
+    uint32_t late_frames;
+    // largest difference between when an animation frame was due and when it was drawn
+    uint32_t worst_jitter_us;
+    // CPU cycles spent drawing frames, not counting the refresh. Wall-clock
+    // cycles, so time lost to preemption is included.
+    uint64_t render_cycles;
+    uint32_t render_cycles_max;
+    // Bucket n counts durations in [2^n, 2^(n+1)) us. Bucket 0 includes 0 us
+    // and the last bucket includes everything longer.
+    uint32_t render_us_histogram[LED_STATS_HISTOGRAM_BUCKETS];
+    uint32_t refresh_us_histogram[LED_STATS_HISTOGRAM_BUCKETS];
+} led_pattern_stats_t;
+
+// Copy the statistics for pattern p. Not synchronized with drawing, so a
+// copy taken mid-frame may be one frame out of date in places.
+void led_get_pattern_stats(led_pattern_t p, led_pattern_stats_t* stats);
+
+// Particle effects (comets, twinkles, raindrops)
+typedef struct _led_particle_stats_t {
+    // particles alive now, and the most there have been at once
+    uint32_t live;
+    uint32_t peak;
+    uint32_t spawned;
+    // spawns refused because the particle budget was full
+    uint32_t dropped;
+    // particles moved and drawn per millisecond spent doing it
+    uint32_t per_ms;
+} led_particle_stats_t;
+
+void led_get_particle_stats(led_particle_stats_t* stats);
+
+// The clocks patterns run on. Weak, so a build off the device can replace them
+// with a virtual clock and render patterns deterministically.
+int64_t led_clock_us(void);
+void led_clock_wall(struct timeval* tv);
+void led_clock_delay_ms(int ms);
+
+// One pass of the render task: draw whatever animation frame, interpolated
+// frame or transition step is due, and return when the next pass is due (on
+// led_clock_us), or a negative value once nothing is animating. The render
+// task calls this; a build off the device can call it directly instead.
+int64_t led_render_pass(int64_t due_us, bool on_deadline);
+
+// Copy the frame most recently shown on the strips (LED_FRAME_LEN bytes).
+// Never waits for a refresh or for the pattern being drawn.
+void led_get_frame(uint8_t* rgb);
+// Show an LED_FRAME_LEN-byte frame, stopping any running pattern
+esp_err_t led_show_frame(const uint8_t* rgb);
+
+// Wake the render task because a streamed frame is ready to be shown
+void led_notify_frame_ready(void);
@@ -41,6 +41,18 @@ void lc_http_stop(void);
 // Alarm/Sleep interop
 #include "alarm.h"
 
+// UDP pixel streaming
+#include "stream.h"
+
+// Gradient palettes
+#include "palette.h"
+
+// Alarm, sleep and pattern schedules
+#include "schedule.h"
+
+// Frequency scaling, light sleep and WiFi power save
+#include "power.h"
+
 // Tag used to prefix log entries from this file
 #define TAG "lc-esp32 main"
 
@@ -170,6 +182,16 @@ void app_main(void)
     // move to global scope for diag route
     //lc_state current_state = bootup;
 
+    // Everything that gets busy takes a power lock, so this comes first
+    ESP_LOGI(TAG, "Initializing power management...");
+    ESP_ERROR_CHECK(power_init());
+    ESP_LOGI(TAG, "Initializing power management complete.");
+
+    // Palettes are shared by patterns and settings, so they come up first
+    ESP_LOGI(TAG, "Initializing palettes...");
+    ESP_ERROR_CHECK(palette_init());
+    ESP_LOGI(TAG, "Initializing palettes complete.");
+
     ESP_LOGI(TAG, "Initializing the LED driver...");
     ESP_ERROR_CHECK(led_init());
     ESP_LOGI(TAG, "Initializing the LED driver complete.");
@@ -197,6 +219,17 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
     ESP_LOGI(TAG, "Initializing NVS complete.");
+
+    // Everything after this reads the stored settings
+    ESP_LOGI(TAG, "Loading settings...");
+    ESP_ERROR_CHECK(settings_init());
+    ESP_LOGI(TAG, "Loading settings complete.");
+
+    // The stored schedules are loaded here, and they're reachable over HTTP
+    // before the alarm task starts
+    ESP_LOGI(TAG, "Initializing schedules...");
+    ESP_ERROR_CHECK(schedule_init());
+    ESP_LOGI(TAG, "Initializing schedules complete.");
     led_set_status_indicator(led_status_nvs, LED_STATUS_COLOR_SUCCESS);
 
     // The wifi driver seems to rely on the NET-IF being initialized.
@@ -231,10 +264,14 @@ void app_main(void)
             .password = CONFIG_LC_WIFI_PASSWORD
         },
     };
+    // Sleep through as many beacons as the latency budget allows
+    power_wifi_configure(&wifi_config);
     // Tell the wifi driver to operate as a client station, not an access point
     ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
     // Tell the wifi driver to use the provided SSID/password
     ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+    // Apply the matching power save mode
+    power_settings_changed();
 
     // Event handlers
     // This is where the bulk of the work happens.
@@ -293,6 +330,13 @@ void app_main(void)
     ESP_ERROR_CHECK(init_alarm());
     ESP_LOGI(TAG, "Initializing Alarm/Sleep complete.");
 
+    // Listen for streamed pixels. The sockets bind to any address, so this
+    // doesn't need to wait for an IP.
+
+    ESP_LOGI(TAG, "Initializing pixel stream listener...");
+    ESP_ERROR_CHECK(stream_init());
+    ESP_LOGI(TAG, "Initializing pixel stream listener complete.");
+
     uint32_t switch_count = 0;
     while (pdTRUE)
     {
@@ -0,0 +1,146 @@
+
+#include "noise.h"
+
+// Ken Perlin's reference permutation. Indexing it twice as long as it is
+// avoids wrapping the sum of a hash and a coordinate.
+#define NOISE_PERM \
+    151, 160, 137,  91,  90,  15, 131,  13, 201,  95,  96,  53, 194, 233,   7, 225, \
+    140,  36, 103,  30,  69, 142,   8,  99,  37, 240,  21,  10,  23, 190,   6, 148, \
+    247, 120, 234,  75,   0,  26, 197,  62,  94, 252, 219, 203, 117,  35,  11,  32, \
+     57, 177,  33,  88, 237, 149,  56,  87, 174,  20, 125, 136, 171, 168,  68, 175, \
+     74, 165,  71, 134, 139,  48,  27, 166,  77, 146, 158, 231,  83, 111, 229, 122, \
+     60, 211, 133, 230, 220, 105,  92,  41,  55,  46, 245,  40, 244, 102, 143,  54, \
+     65,  25,  63, 161,   1, 216,  80,  73, 209,  76, 132, 187, 208,  89,  18, 169, \
+    200, 196, 135, 130, 116, 188, 159,  86, 164, 100, 109, 198, 173, 186,   3,  64, \
+     52, 217, 226, 250, 124, 123,   5, 202,  38, 147, 118, 126, 255,  82,  85, 212, \
+    207, 206,  59, 227,  47,  16,  58,  17, 182, 189,  28,  42, 223, 183, 170, 213, \
+    119, 248, 152,   2,  44, 154, 163,  70, 221, 153, 101, 155, 167,  43, 172,   9, \
+    129,  22,  39, 253,  19,  98, 108, 110,  79, 113, 224, 232, 178, 185, 112, 104, \
+    218, 246,  97, 228, 251,  34, 242, 193, 238, 210, 144,  12, 191, 179, 162, 241, \
+     81,  51, 145, 235, 249,  14, 239, 107,  49, 192, 214,  31, 181, 199, 106, 157, \
+    184,  84, 204, 176, 115, 121,  50,  45, 127,   4, 150, 254, 138, 236, 205,  93, \
+    222, 114,  67,  29,  24,  72, 243, 141, 128, 195,  78,  66, 215,  61, 156, 180
+
+static const uint8_t noise_perm[512] = {
+    NOISE_PERM,
+    NOISE_PERM
+};
+
+// Gradient directions, as unit steps on each axis. 3D uses Perlin's twelve
+// cube-edge directions (padded to 16 so a hash picks one with a mask); 2D and
+// 1D use the first eight and first two.
+static const int8_t noise_grad3[16][3] = {
+    { 1,  1,  0}, {-1,  1,  0}, { 1, -1,  0}, {-1, -1,  0},
+    { 1,  0,  1}, {-1,  0,  1}, { 1,  0, -1}, {-1,  0, -1},
+    { 0,  1,  1}, { 0, -1,  1}, { 0,  1, -1}, { 0, -1, -1},
+    { 1,  1,  0}, {-1,  1,  0}, { 0, -1,  1}, { 0, -1, -1},
+};
+static const int8_t noise_grad2[8][2] = {
+    { 1,  1}, {-1,  1}, { 1, -1}, {-1, -1},
+    { 1,  0}, {-1,  0}, { 0,  1}, { 0, -1},
+};
+
+// 6t^5 - 15t^4 + 10t^3, for t in 16.16 on [0, 1)
+static inline int32_t noise_fade(int32_t t)
+{
+    int32_t t3 = (int32_t)(((int64_t)t * t >> 16) * t >> 16);
+    int32_t inner = (int32_t)((int64_t)t * (6 * t - 15 * NOISE_ONE) >> 16) + 10 * NOISE_ONE;
+    return (int32_t)((int64_t)t3 * inner >> 16);
+}
+
+static inline int32_t noise_lerp(int32_t a, int32_t b, int32_t t)
+{
+    return a + (int32_t)((int64_t)(b - a) * t >> 16);
+}
+
+// Map a signed 16.16 result on about [-1, 1] onto 0-65535
+static inline uint16_t noise_to_u16(int32_t n)
+{
+    int32_t u = (n + NOISE_ONE) >> 1;
+    if (u < 0)
+    {
+        return 0;
+    }
+    if (u > 65535)
+    {
+        return 65535;
+    }
+    return (uint16_t)u;
+}
+
+static inline int32_t noise_dot1(uint8_t hash, int32_t dx)
+{
+    return (hash & 1) ? -dx : dx;
+}
+
+static inline int32_t noise_dot2(uint8_t hash, int32_t dx, int32_t dy)
+{
+    const int8_t* g = noise_grad2[hash & 7];
+    return g[0] * dx + g[1] * dy;
+}
+
+static inline int32_t noise_dot3(uint8_t hash, int32_t dx, int32_t dy, int32_t dz)
+{
+    const int8_t* g = noise_grad3[hash & 15];
+    return g[0] * dx + g[1] * dy + g[2] * dz;
+}
+
+uint16_t noise1(uint32_t x)
+{
+    uint8_t xi = (x >> 16) & 0xFF;
+    int32_t xf = x & 0xFFFF;
+    int32_t u = noise_fade(xf);
+
+    int32_t a = noise_dot1(noise_perm[xi], xf);
+    int32_t b = noise_dot1(noise_perm[xi + 1], xf - NOISE_ONE);
+    // A 1D gradient only reaches 1/2 between lattice points
+    return noise_to_u16(noise_lerp(a, b, u) * 2);
+}
+
+uint16_t noise2(uint32_t x, uint32_t y)
+{
+    uint8_t xi = (x >> 16) & 0xFF;
+    uint8_t yi = (y >> 16) & 0xFF;
+    int32_t xf = x & 0xFFFF;
+    int32_t yf = y & 0xFFFF;
+    int32_t u = noise_fade(xf);
+    int32_t v = noise_fade(yf);
+
+    uint8_t a = noise_perm[xi] + yi;
+    uint8_t b = noise_perm[xi + 1] + yi;
+    int32_t x0 = noise_lerp(noise_dot2(noise_perm[a], xf, yf),
+                            noise_dot2(noise_perm[b], xf - NOISE_ONE, yf), u);
+    int32_t x1 = noise_lerp(noise_dot2(noise_perm[a + 1], xf, yf - NOISE_ONE),
+                            noise_dot2(noise_perm[b + 1], xf - NOISE_ONE, yf - NOISE_ONE), u);
+    return noise_to_u16(noise_lerp(x0, x1, v));
+}
+
+uint16_t noise3(uint32_t x, uint32_t y, uint32_t z)
+{
+    uint8_t xi = (x >> 16) & 0xFF;
+    uint8_t yi = (y >> 16) & 0xFF;
+    uint8_t zi = (z >> 16) & 0xFF;
+    int32_t xf = x & 0xFFFF;
+    int32_t yf = y & 0xFFFF;
+    int32_t zf = z & 0xFFFF;
+    int32_t u = noise_fade(xf);
+    int32_t v = noise_fade(yf);
+    int32_t w = noise_fade(zf);
+
+    uint8_t a = noise_perm[xi] + yi;
+    uint8_t aa = noise_perm[a] + zi;
+    uint8_t ab = noise_perm[a + 1] + zi;
+    uint8_t b = noise_perm[xi + 1] + yi;
+    uint8_t ba = noise_perm[b] + zi;
+    uint8_t bb = noise_perm[b + 1] + zi;
+
+    int32_t y0 = noise_lerp(noise_lerp(noise_dot3(noise_perm[aa], xf, yf, zf),
+                                       noise_dot3(noise_perm[ba], xf - NOISE_ONE, yf, zf), u),
+                            noise_lerp(noise_dot3(noise_perm[ab], xf, yf - NOISE_ONE, zf),
+                                       noise_dot3(noise_perm[bb], xf - NOISE_ONE, yf - NOISE_ONE, zf), u), v);
+    int32_t y1 = noise_lerp(noise_lerp(noise_dot3(noise_perm[aa + 1], xf, yf, zf - NOISE_ONE),
+                                       noise_dot3(noise_perm[ba + 1], xf - NOISE_ONE, yf, zf - NOISE_ONE), u),
+                            noise_lerp(noise_dot3(noise_perm[ab + 1], xf, yf - NOISE_ONE, zf - NOISE_ONE),
+                                       noise_dot3(noise_perm[bb + 1], xf - NOISE_ONE, yf - NOISE_ONE, zf - NOISE_ONE), u), v);
+    return noise_to_u16(noise_lerp(y0, y1, w));
+}
@@ -0,0 +1,53 @@
+
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Noise
+//
+// Fixed-point gradient (Perlin) noise in one, two and three dimensions, for
+// effects that should move organically rather than repeat. Integer math and
+// static tables only, so it's safe to call per pixel per frame from any task.
+//
+// Coordinates are 16.16 fixed point: the lattice repeats every 256 units and
+// one unit is one noise "feature", so stepping a pixel 1/8 of a unit (8192)
+// gives smooth variation along a strip. Results are 0-65535, centered on
+// 32768. 2D and 3D rarely come near the ends; 1D reaches them at its peaks.
+
+#define NOISE_ONE 65536
+
+uint16_t noise1(uint32_t x);
+uint16_t noise2(uint32_t x, uint32_t y);
+uint16_t noise3(uint32_t x, uint32_t y, uint32_t z);
+
+// Deterministic pseudo-random numbers (xorshift32). Each user keeps its own
+// state, so effects don't disturb each other and replay the same way from the
+// same seed.
+typedef struct _noise_rand_t {
+    uint32_t state;
+} noise_rand_t;
+
+static inline void noise_rand_seed(noise_rand_t* r, uint32_t seed)
+{
+    // Zero is xorshift's one fixed point
+    r->state = seed != 0 ? seed : 0x9E3779B9;
+}
+
+static inline uint32_t noise_rand_next(noise_rand_t* r)
+{
+    uint32_t x = r->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    r->state = x;
+    return x;
+}
+
+// Uniform on [0, n) without a divide
+static inline uint32_t noise_rand_below(noise_rand_t* r, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)noise_rand_next(r) * n) >> 32);
+}
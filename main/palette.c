@@ -0,0 +1,232 @@
+
+#include "palette.h"
+
+#include "esp_log.h"
+#define TAG "palette.c"
+
+// Semaphore
+#include <freertos/semphr.h>
+
+// settings subsystem
+#include "settings_storage.h"
+
+// LWIP_ARRAYSIZE
+#include <lwip/def.h>
+
+// memset
+#include <string.h>
+
+#define TRANSMOG(name) #name,
+const char* palette_names[] = { PALETTE_NAMES };
+#undef TRANSMOG
+
+// Built-in gradients
+
+static const palette_stop_t palette_rainbow_stops[] = {
+    PALETTE_STOP_HSV(0, 0, 100, 100),
+    PALETTE_STOP_HSV(255, 359, 100, 100),
+};
+
+static const palette_stop_t palette_fire_stops[] = {
+    PALETTE_STOP_RGB(0, 0, 0, 0),
+    PALETTE_STOP_RGB(96, 160, 0, 0),
+    PALETTE_STOP_RGB(160, 255, 80, 0),
+    PALETTE_STOP_RGB(220, 255, 200, 20),
+    PALETTE_STOP_RGB(255, 255, 255, 160),
+};
+
+static const palette_stop_t palette_ocean_stops[] = {
+    PALETTE_STOP_RGB(0, 0, 0, 40),
+    PALETTE_STOP_RGB(100, 0, 40, 160),
+    PALETTE_STOP_RGB(180, 0, 160, 200),
+    PALETTE_STOP_RGB(255, 160, 255, 255),
+};
+
+static const palette_stop_t palette_sunrise_stops[] = {
+    PALETTE_STOP_CCT(0, 1000, 0),
+    PALETTE_STOP_CCT(128, 2500, 128),
+    PALETTE_STOP_CCT(255, 5500, 255),
+};
+
+static const palette_stop_t palette_aurora_stops[] = {
+    PALETTE_STOP_RGB(0, 0, 0, 0),
+    PALETTE_STOP_RGB(80, 0, 60, 20),
+    PALETTE_STOP_RGB(150, 0, 200, 80),
+    PALETTE_STOP_RGB(200, 0, 160, 160),
+    PALETTE_STOP_RGB(255, 120, 40, 200),
+};
+
+// Rebuilt from settings whenever the palette is expanded
+static palette_stop_t palette_custom_stops[2];
+
+typedef struct _palette_definition_t {
+    const palette_stop_t* stops;
+    int stop_count;
+} palette_definition_t;
+
+static const palette_definition_t palette_definitions[] = {
+    [palette_rainbow] = { palette_rainbow_stops, LWIP_ARRAYSIZE(palette_rainbow_stops) },
+    [palette_fire] = { palette_fire_stops, LWIP_ARRAYSIZE(palette_fire_stops) },
+    [palette_ocean] = { palette_ocean_stops, LWIP_ARRAYSIZE(palette_ocean_stops) },
+    [palette_sunrise] = { palette_sunrise_stops, LWIP_ARRAYSIZE(palette_sunrise_stops) },
+    [palette_custom] = { palette_custom_stops, LWIP_ARRAYSIZE(palette_custom_stops) },
+    [palette_aurora] = { palette_aurora_stops, LWIP_ARRAYSIZE(palette_aurora_stops) },
+};
+
+// The expanded tables, shared by every pattern. 768 bytes each, so they're
+// only expanded when something uses them.
+static color_rgb_t palette_luts[palette_id_enum_max][PALETTE_LUT_LEN];
+static bool palette_lut_valid[palette_id_enum_max];
+static SemaphoreHandle_t palette_mutex = NULL;
+
+esp_err_t palette_init(void)
+{
+    palette_mutex = xSemaphoreCreateMutex();
+    if (palette_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "%s: failed to create mutex", __FUNCTION__);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static color_rgb_t palette_stop_to_rgb(const palette_stop_t* stop)
+{
+    switch (stop->space)
+    {
+    case color_space_cie_1931_xyY:
+        return color_cie_to_rgb(stop->cie);
+    case color_space_cct:
+        return color_cct_to_rgb(stop->cct);
+    case color_space_hsv:
+        {
+            color_hsv_t hsv = stop->hsv;
+            hsv.h %= 360;
+            return color_hsv_to_rgb(hsv);
+        }
+    case color_space_rgb:
+        return stop->rgb;
+    default:
+        ESP_LOGE(TAG, "%s: unknown color space %d", __FUNCTION__, stop->space);
+        return color_rgb_color_values[color_rgb_color_off];
+    }
+}
+
+// Integer lerp with num/den of the way from a to b
+#define PALETTE_LERP(a, b, num, den) ((a) + ((int32_t)(b) - (int32_t)(a)) * (num) / (den))
+
+// The color num/den of the way from stop a to stop b
+static color_rgb_t palette_interpolate(const palette_stop_t* a, const palette_stop_t* b, int num, int den)
+{
+    if (a->space != b->space)
+    {
+        color_rgb_t ca = palette_stop_to_rgb(a);
+        color_rgb_t cb = palette_stop_to_rgb(b);
+        return COLOR_RGB_TO_STRUCT(PALETTE_LERP(ca.r, cb.r, num, den),
+                                   PALETTE_LERP(ca.g, cb.g, num, den),
+                                   PALETTE_LERP(ca.b, cb.b, num, den));
+    }
+
+    palette_stop_t mixed = *a;
+    switch (a->space)
+    {
+    case color_space_cie_1931_xyY:
+        mixed.cie.CCx = a->cie.CCx + (b->cie.CCx - a->cie.CCx) * num / den;
+        mixed.cie.CCy = a->cie.CCy + (b->cie.CCy - a->cie.CCy) * num / den;
+        mixed.cie.CCY = PALETTE_LERP(a->cie.CCY, b->cie.CCY, num, den);
+        break;
+    case color_space_cct:
+        mixed.cct.temp = PALETTE_LERP(a->cct.temp, b->cct.temp, num, den);
+        mixed.cct.lm = PALETTE_LERP(a->cct.lm, b->cct.lm, num, den);
+        break;
+    case color_space_hsv:
+        mixed.hsv.h = PALETTE_LERP(a->hsv.h, b->hsv.h, num, den);
+        mixed.hsv.s = PALETTE_LERP(a->hsv.s, b->hsv.s, num, den);
+        mixed.hsv.v = PALETTE_LERP(a->hsv.v, b->hsv.v, num, den);
+        break;
+    case color_space_rgb:
+    default:
+        mixed.rgb.r = PALETTE_LERP(a->rgb.r, b->rgb.r, num, den);
+        mixed.rgb.g = PALETTE_LERP(a->rgb.g, b->rgb.g, num, den);
+        mixed.rgb.b = PALETTE_LERP(a->rgb.b, b->rgb.b, num, den);
+        break;
+    }
+    return palette_stop_to_rgb(&mixed);
+}
+
+void palette_build_lut(color_rgb_t* lut, const palette_stop_t* stops, int stop_count)
+{
+    if (stop_count <= 0)
+    {
+        memset(lut, 0, PALETTE_LUT_LEN * sizeof(*lut));
+        return;
+    }
+
+    int stopIdx = 0;
+    for (int lutIdx = 0; lutIdx < PALETTE_LUT_LEN; lutIdx++)
+    {
+        while (stopIdx + 1 < stop_count && stops[stopIdx + 1].index <= lutIdx)
+        {
+            stopIdx++;
+        }
+        const palette_stop_t* a = &stops[stopIdx];
+        if (lutIdx <= a->index || stopIdx + 1 == stop_count)
+        {
+            // Before the first stop, on a stop, or past the last one
+            lut[lutIdx] = palette_stop_to_rgb(a);
+        }
+        else
+        {
+            const palette_stop_t* b = &stops[stopIdx + 1];
+            lut[lutIdx] = palette_interpolate(a, b, lutIdx - a->index, b->index - a->index);
+        }
+    }
+}
+
+// Must be called with palette_mutex held
+static void palette_load_custom_stops(void)
+{
+    uint32_t hue_start, hue_end;
+
+    hue_start = get_setting_u32(setting_palette_custom_hue_start);
+    hue_end = get_setting_u32(setting_palette_custom_hue_end);
+    // Always go up the hue circle, wrapping past red if need be
+    if (hue_end < hue_start)
+    {
+        hue_end += 360;
+    }
+    palette_custom_stops[0] = (palette_stop_t)PALETTE_STOP_HSV(0, hue_start, 100, 100);
+    palette_custom_stops[1] = (palette_stop_t)PALETTE_STOP_HSV(255, hue_end, 100, 100);
+}
+
+const color_rgb_t* palette_lut(palette_id id)
+{
+    if (id >= palette_id_enum_max)
+    {
+        ESP_LOGE(TAG, "%s: unknown palette %d", __FUNCTION__, id);
+        id = palette_rainbow;
+    }
+
+    xSemaphoreTake(palette_mutex, portMAX_DELAY);
+    if (!palette_lut_valid[id])
+    {
+        if (id == palette_custom)
+        {
+            palette_load_custom_stops();
+        }
+        const palette_definition_t* def = &palette_definitions[id];
+        palette_build_lut(palette_luts[id], def->stops, def->stop_count);
+        palette_lut_valid[id] = pdTRUE;
+        ESP_LOGI(TAG, "Expanded palette %s", palette_names[id]);
+    }
+    xSemaphoreGive(palette_mutex);
+
+    return palette_luts[id];
+}
+
+void palette_settings_changed(void)
+{
+    xSemaphoreTake(palette_mutex, portMAX_DELAY);
+    palette_lut_valid[palette_custom] = pdFALSE;
+    xSemaphoreGive(palette_mutex);
+}
@@ -0,0 +1,73 @@
+
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+
+// Color definitions
+#include "color.h"
+
+// Palettes
+//
+// A palette is a gradient, given as a list of stops in any supported color
+// space, expanded once into a table of PALETTE_LUT_LEN RGB colors. Patterns
+// pick colors by 8-bit index, so a palette-driven effect costs one table
+// lookup per pixel no matter how the gradient was defined.
+
+#define PALETTE_LUT_LEN 256
+
+// TRANSMOG(name)
+#define PALETTE_NAMES \
+    TRANSMOG(rainbow) \
+    TRANSMOG(fire) \
+    TRANSMOG(ocean) \
+    TRANSMOG(sunrise) \
+    TRANSMOG(custom) \
+    TRANSMOG(aurora) \
+
+#define TRANSMOG(name) palette_##name,
+MAKE_ENUM(palette_id, PALETTE_NAMES)
+#undef TRANSMOG
+
+extern const char* palette_names[];
+
+// One point on a gradient. Between two stops in the same color space the
+// gradient is interpolated in that space (so CCT stops follow the blackbody
+// curve and HSV stops go around the hue circle); between stops in different
+// spaces it is interpolated in RGB.
+typedef struct _palette_stop_t {
+    // where the stop falls in the table, 0-255; stops must be in order
+    uint8_t index;
+    color_space space;
+    union {
+        color_cie_t cie;
+        color_cct_t cct;
+        // h may run past 360 to keep going around the circle
+        color_hsv_t hsv;
+        color_rgb_t rgb;
+    };
+} palette_stop_t;
+
+#define PALETTE_STOP_CIE(i, x, y, Y) { .index = i, .space = color_space_cie_1931_xyY, .cie = COLOR_CIE_TO_STRUCT(x, y, Y) }
+#define PALETTE_STOP_CCT(i, t, l) { .index = i, .space = color_space_cct, .cct = COLOR_CCT_TO_STRUCT(t, l) }
+#define PALETTE_STOP_HSV(i, h, s, v) { .index = i, .space = color_space_hsv, .hsv = COLOR_HSV_TO_STRUCT(h, s, v) }
+#define PALETTE_STOP_RGB(i, r, g, b) { .index = i, .space = color_space_rgb, .rgb = COLOR_RGB_TO_STRUCT(r, g, b) }
+
+esp_err_t palette_init(void);
+
+// Get the table for palette id, expanding it first if it hasn't been used
+// since it was last changed. The table is shared and stays valid forever, but
+// a palette edited while a pattern is reading it can show a mix of old and
+// new colors for a frame.
+const color_rgb_t* palette_lut(palette_id id);
+
+// Expand stops into lut. Stops must be in index order; indexes before the
+// first stop and after the last take their colors.
+void palette_build_lut(color_rgb_t* lut, const palette_stop_t* stops, int stop_count);
+
+// Re-read the palettes defined by settings the next time they're used
+void palette_settings_changed(void);
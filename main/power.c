@@ -0,0 +1,238 @@
+
+#include "power.h"
+
+#include "esp_log.h"
+#define TAG "power.c"
+
+// frequency scaling, light sleep and locks
+#include "esp_pm.h"
+
+// residency timing
+#include "esp_timer.h"
+
+// settings subsystem
+#include "settings_storage.h"
+
+// Typical ESP32 figures, in mA, for the current estimates. They come from the
+// datasheet, not this board, so the estimates are only as good as they are.
+// both cores at full speed with the radio asleep
+#define POWER_CPU_MAX_MA 50
+// scaled down by DFS
+#define POWER_CPU_MIN_MA 15
+// automatic light sleep between wakeups
+#define POWER_LIGHT_SLEEP_MA 1
+// receiver on
+#define POWER_WIFI_RX_MA 100
+// receiver time per beacon listened to, in us
+#define POWER_BEACON_RX_US 3000
+// 100 TU, the near-universal beacon interval, in us
+#define POWER_BEACON_INTERVAL_US 102400
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t power_pm_locks[power_lock_max];
+#endif
+static const char* power_lock_names[power_lock_max] = {
+    [power_lock_render] = "render",
+    [power_lock_http] = "http",
+};
+
+// Guards the counts and residency below
+static portMUX_TYPE power_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t power_lock_counts[power_lock_max];
+static uint32_t power_acquisitions[power_lock_max];
+static uint32_t power_held_total = 0;
+static int64_t power_active_since_us = 0;
+static uint64_t power_active_us = 0;
+
+// The driver's own default until settings say otherwise
+static wifi_ps_type_t power_wifi_ps = WIFI_PS_MIN_MODEM;
+static uint8_t power_wifi_listen_interval = 0;
+
+esp_err_t power_init(void)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_LC_PM_MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_LC_PM_MIN_CPU_FREQ_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: esp_pm_configure failed (%d)", __FUNCTION__, err);
+        return err;
+    }
+
+    for (power_lock_t lock = 0; lock < power_lock_max; lock++)
+    {
+        // Full CPU speed also pins APB, which the RMT's bit timing is built on,
+        // and keeps the chip out of light sleep
+        err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, power_lock_names[lock], &power_pm_locks[lock]);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "%s: failed to create %s lock (%d)", __FUNCTION__, power_lock_names[lock], err);
+            return err;
+        }
+    }
+    ESP_LOGI(TAG, "DFS %d-%d MHz, light sleep %d", pm_config.min_freq_mhz, pm_config.max_freq_mhz, pm_config.light_sleep_enable);
+#else
+    ESP_LOGI(TAG, "Power management disabled; counting locks only");
+#endif
+    return ESP_OK;
+}
+
+void power_lock_acquire(power_lock_t lock)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(power_pm_locks[lock]);
+#endif
+    portENTER_CRITICAL(&power_spinlock);
+    power_lock_counts[lock]++;
+    power_acquisitions[lock]++;
+    if (power_held_total++ == 0)
+    {
+        power_active_since_us = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&power_spinlock);
+}
+
+void power_lock_release(power_lock_t lock)
+{
+    portENTER_CRITICAL(&power_spinlock);
+    bool was_held = power_lock_counts[lock] > 0;
+    if (was_held)
+    {
+        power_lock_counts[lock]--;
+        if (--power_held_total == 0)
+        {
+            power_active_us += esp_timer_get_time() - power_active_since_us;
+        }
+    }
+    portEXIT_CRITICAL(&power_spinlock);
+
+    if (!was_held)
+    {
+        ESP_LOGE(TAG, "%s: %s lock released more than acquired", __FUNCTION__, power_lock_names[lock]);
+        return;
+    }
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(power_pm_locks[lock]);
+#endif
+}
+
+// Map a latency budget onto a power save mode and listen interval: with
+// no budget the receiver stays on, with up to two beacons' worth the station
+// wakes for every DTIM beacon, and past that it sleeps through as many
+// beacons as fit.
+static void power_wifi_mode_for_budget(uint32_t budget_ms, wifi_ps_type_t* ps, uint8_t* listen_interval)
+{
+    uint32_t beacons = budget_ms * 1000 / POWER_BEACON_INTERVAL_US;
+    if (budget_ms == 0)
+    {
+        *ps = WIFI_PS_NONE;
+        *listen_interval = 0;
+    }
+    else if (beacons < 2)
+    {
+        *ps = WIFI_PS_MIN_MODEM;
+        *listen_interval = 0;
+    }
+    else
+    {
+        *ps = WIFI_PS_MAX_MODEM;
+        *listen_interval = beacons > UINT8_MAX ? UINT8_MAX : beacons;
+    }
+}
+
+void power_wifi_configure(wifi_config_t* wifi_config)
+{
+    uint32_t budget_ms;
+    wifi_ps_type_t ps;
+    uint8_t listen_interval;
+
+    budget_ms = get_setting_u32(setting_wifi_latency_budget_ms);
+    power_wifi_mode_for_budget(budget_ms, &ps, &listen_interval);
+    // 0 leaves the driver's default
+    wifi_config->sta.listen_interval = listen_interval;
+}
+
+void power_settings_changed(void)
+{
+    uint32_t budget_ms;
+    wifi_ps_type_t ps;
+    uint8_t listen_interval;
+
+    budget_ms = get_setting_u32(setting_wifi_latency_budget_ms);
+    power_wifi_mode_for_budget(budget_ms, &ps, &listen_interval);
+    if (ps == power_wifi_ps && listen_interval == power_wifi_listen_interval)
+    {
+        return;
+    }
+    esp_err_t err = esp_wifi_set_ps(ps);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: esp_wifi_set_ps(%d) failed (%d)", __FUNCTION__, ps, err);
+        return;
+    }
+    power_wifi_ps = ps;
+    power_wifi_listen_interval = listen_interval;
+    ESP_LOGI(TAG, "WiFi power save %d, listen interval %d for a %u ms budget", ps, listen_interval, budget_ms);
+}
+
+void power_get_stats(power_stats_t* stats)
+{
+    portENTER_CRITICAL(&power_spinlock);
+    int64_t now = esp_timer_get_time();
+    stats->active_us = power_active_us;
+    if (power_held_total > 0)
+    {
+        stats->active_us += now - power_active_since_us;
+    }
+    for (power_lock_t lock = 0; lock < power_lock_max; lock++)
+    {
+        stats->acquisitions[lock] = power_acquisitions[lock];
+    }
+    portEXIT_CRITICAL(&power_spinlock);
+    stats->uptime_us = now;
+    stats->wifi_ps = power_wifi_ps;
+    stats->wifi_listen_interval = power_wifi_listen_interval;
+
+    // Receiver current averaged over time
+    uint32_t wifi_ua;
+    switch (power_wifi_ps)
+    {
+    case WIFI_PS_NONE:
+        wifi_ua = POWER_WIFI_RX_MA * 1000;
+        break;
+    case WIFI_PS_MAX_MODEM:
+        wifi_ua = (uint64_t)POWER_WIFI_RX_MA * 1000 * POWER_BEACON_RX_US / (POWER_BEACON_INTERVAL_US * power_wifi_listen_interval);
+        break;
+    case WIFI_PS_MIN_MODEM:
+    default:
+        wifi_ua = (uint64_t)POWER_WIFI_RX_MA * 1000 * POWER_BEACON_RX_US / POWER_BEACON_INTERVAL_US;
+        break;
+    }
+
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    // The receiver keeps the chip awake while it's on
+    uint32_t cpu_idle_ua = power_wifi_ps == WIFI_PS_NONE ? POWER_CPU_MIN_MA * 1000 : POWER_LIGHT_SLEEP_MA * 1000;
+#elif CONFIG_PM_ENABLE
+    uint32_t cpu_idle_ua = POWER_CPU_MIN_MA * 1000;
+#else
+    uint32_t cpu_idle_ua = POWER_CPU_MAX_MA * 1000;
+#endif
+    uint32_t idle_ua = cpu_idle_ua + wifi_ua;
+    uint32_t active_ua = POWER_CPU_MAX_MA * 1000 + wifi_ua;
+    stats->estimated_idle_ma = (idle_ua + 500) / 1000;
+    if (stats->uptime_us > 0)
+    {
+        uint64_t idle_us = stats->uptime_us - stats->active_us;
+        stats->estimated_ma = (uint32_t)(((uint64_t)active_ua * stats->active_us + (uint64_t)idle_ua * idle_us) / stats->uptime_us / 1000);
+    }
+    else
+    {
+        stats->estimated_ma = stats->estimated_idle_ma;
+    }
+}
@@ -0,0 +1,64 @@
+
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+
+// wifi_config_t
+#include "esp_wifi.h"
+
+// Power management
+//
+// The clock spends nearly all its time showing a frame the LEDs latch on
+// their own, or nothing. With CONFIG_PM_ENABLE the CPU scales down and, with
+// tickless idle, light-sleeps whenever nobody holds a power lock. Anything
+// with deadlines to meet or bytes to move holds its lock only while it's
+// actually busy, which also keeps APB at full speed under the RMT.
+//
+// Without CONFIG_PM_ENABLE the locks still count, so /diag can show how
+// much of the time the clock would have been able to sleep.
+
+typedef enum _power_lock_t {
+    // the render task, and anyone running a pattern synchronously
+    power_lock_render,
+    // HTTP requests in flight
+    power_lock_http,
+    power_lock_max,
+} power_lock_t;
+
+typedef struct _power_stats_t {
+    // time since boot with at least one lock held, and in total
+    uint64_t active_us;
+    uint64_t uptime_us;
+    uint32_t acquisitions[power_lock_max];
+    // Estimated, not measured: average current in mA, from the measured time
+    // active vs. idle and typical figures for each. There's no current sense
+    // on the board to measure it.
+    uint32_t estimated_ma;
+    uint32_t estimated_idle_ma;
+    // WiFi power save in effect: 0 none, 1 min modem, 2 max modem
+    uint8_t wifi_ps;
+    uint8_t wifi_listen_interval;
+} power_stats_t;
+
+// Configure frequency scaling and light sleep, and create the locks. Must
+// come before anything that takes a lock.
+esp_err_t power_init(void);
+
+// Counting, so nested and concurrent holders are fine. Safe from any task,
+// not from ISRs.
+void power_lock_acquire(power_lock_t lock);
+void power_lock_release(power_lock_t lock);
+
+// Fill in the listen interval for the configured latency budget. It takes
+// effect at the next association.
+void power_wifi_configure(wifi_config_t* wifi_config);
+
+// Apply wifi_latency_budget_ms. Call once WiFi is initialized.
+void power_settings_changed(void);
+
+void power_get_stats(power_stats_t* stats);
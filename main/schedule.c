@@ -0,0 +1,650 @@
+
+#include "schedule.h"
+
+#include "esp_log.h"
+#define TAG "schedule.c"
+
+// Semaphore
+#include <freertos/semphr.h>
+
+// settings subsystem, for the every-day alarm
+#include "settings_storage.h"
+
+// notify alarm module of schedule changes
+#include "alarm.h"
+
+#include <cJSON.h>
+
+// strcmp
+#include <string.h>
+
+// persistence
+#include "nvs.h"
+
+#define TRANSMOG(name) #name,
+const char* schedule_action_names[] = { SCHEDULE_ACTIONS };
+#undef TRANSMOG
+
+// The entries from schedule_set, then the every-day alarm from settings
+#define SCHEDULE_SETTINGS_ALARM SCHEDULE_MAX_ENTRIES
+static schedule_entry_t schedule_entries[SCHEDULE_MAX_ENTRIES + 1];
+static bool schedule_entry_active[SCHEDULE_MAX_ENTRIES + 1];
+static int schedule_entry_count = 0;
+static uint32_t schedule_skip_dates[SCHEDULE_MAX_SKIP_DATES];
+static int schedule_skip_date_count = 0;
+
+// One pending occurrence per active entry, earliest at [0]
+typedef struct _schedule_heap_node_t {
+    time_t when;
+    uint8_t entry;
+} schedule_heap_node_t;
+
+static schedule_heap_node_t schedule_heap[SCHEDULE_MAX_ENTRIES + 1];
+static int schedule_heap_len = 0;
+static bool schedule_heap_valid = pdFALSE;
+
+static uint32_t schedule_rebuilds = 0;
+static uint32_t schedule_fired = 0;
+
+static SemaphoreHandle_t schedule_mutex = NULL;
+
+// Stored in the settings namespace, next to the settings blob, and written by
+// the settings save task. Unlike settings there's nothing to migrate: a blob
+// of another version or size is ignored and the schedules start out empty.
+#define SCHEDULE_NVS_NAMESPACE "settings"
+#define SCHEDULE_NVS_KEY "schedule"
+#define SCHEDULE_BLOB_VERSION 1
+
+typedef struct _schedule_blob_t {
+    uint16_t version;
+    uint8_t entry_count;
+    uint8_t skip_date_count;
+    schedule_entry_t entries[SCHEDULE_MAX_ENTRIES];
+    uint32_t skip_dates[SCHEDULE_MAX_SKIP_DATES];
+} schedule_blob_t;
+
+// Set under schedule_mutex when the schedules change, cleared by schedule_save
+static bool schedule_dirty = pdFALSE;
+
+static bool schedule_is_valid_date(uint32_t date);
+
+static bool schedule_is_valid_entry(const schedule_entry_t* entry)
+{
+    return entry->action < schedule_action_enum_max &&
+           entry->pattern < lpat_max &&
+           entry->hour < 24 &&
+           entry->minute < 60 &&
+           entry->days <= SCHEDULE_EVERY_DAY &&
+           (entry->days != 0 || schedule_is_valid_date(entry->date));
+}
+
+// Only called from schedule_init, before anything else can look at the schedules
+static void schedule_load(void)
+{
+    static schedule_blob_t blob;
+    nvs_handle_t handle;
+
+    esp_err_t err = nvs_open(SCHEDULE_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No stored schedules (%d)", err);
+        return;
+    }
+    size_t len = sizeof(blob);
+    err = nvs_get_blob(handle, SCHEDULE_NVS_KEY, &blob, &len);
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No stored schedules (%d)", err);
+        return;
+    }
+    if (len != sizeof(blob) || blob.version != SCHEDULE_BLOB_VERSION ||
+        blob.entry_count > SCHEDULE_MAX_ENTRIES || blob.skip_date_count > SCHEDULE_MAX_SKIP_DATES)
+    {
+        ESP_LOGE(TAG, "%s: unusable blob (version %u, %u bytes); starting empty", __FUNCTION__, blob.version, len);
+        return;
+    }
+    for (int entryIdx = 0; entryIdx < blob.entry_count; entryIdx++)
+    {
+        if (!schedule_is_valid_entry(&blob.entries[entryIdx]))
+        {
+            ESP_LOGE(TAG, "%s: stored entry %d is invalid; starting empty", __FUNCTION__, entryIdx);
+            return;
+        }
+    }
+
+    for (int entryIdx = 0; entryIdx < blob.entry_count; entryIdx++)
+    {
+        schedule_entries[entryIdx] = blob.entries[entryIdx];
+        schedule_entry_active[entryIdx] = pdTRUE;
+    }
+    schedule_entry_count = blob.entry_count;
+    memcpy(schedule_skip_dates, blob.skip_dates, blob.skip_date_count * sizeof(*blob.skip_dates));
+    schedule_skip_date_count = blob.skip_date_count;
+    ESP_LOGI(TAG, "Loaded %d schedules and %d skip dates", schedule_entry_count, schedule_skip_date_count);
+}
+
+void schedule_save(void)
+{
+    static schedule_blob_t blob;
+    nvs_handle_t handle;
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    if (!schedule_dirty)
+    {
+        xSemaphoreGive(schedule_mutex);
+        return;
+    }
+    // Zeroed so padding and unused slots are the same from save to save
+    memset(&blob, 0, sizeof(blob));
+    blob.version = SCHEDULE_BLOB_VERSION;
+    blob.entry_count = schedule_entry_count;
+    blob.skip_date_count = schedule_skip_date_count;
+    memcpy(blob.entries, schedule_entries, schedule_entry_count * sizeof(*schedule_entries));
+    memcpy(blob.skip_dates, schedule_skip_dates, schedule_skip_date_count * sizeof(*schedule_skip_dates));
+    schedule_dirty = pdFALSE;
+    xSemaphoreGive(schedule_mutex);
+
+    esp_err_t err = nvs_open(SCHEDULE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, SCHEDULE_NVS_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: saving schedules failed (%d)", __FUNCTION__, err);
+        // Try again with the next save
+        xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+        schedule_dirty = pdTRUE;
+        xSemaphoreGive(schedule_mutex);
+        return;
+    }
+    ESP_LOGI(TAG, "Saved %u schedules and %u skip dates", blob.entry_count, blob.skip_date_count);
+}
+
+esp_err_t schedule_init(void)
+{
+    schedule_mutex = xSemaphoreCreateMutex();
+    if (schedule_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "%s: failed to create mutex", __FUNCTION__);
+        return ESP_ERR_NO_MEM;
+    }
+    schedule_load();
+    return ESP_OK;
+}
+
+static uint32_t schedule_tm_to_date(const struct tm* t)
+{
+    return (t->tm_year + 1900) * 10000 + (t->tm_mon + 1) * 100 + t->tm_mday;
+}
+
+static bool schedule_is_skip_date(uint32_t date)
+{
+    for (int skipIdx = 0; skipIdx < schedule_skip_date_count; skipIdx++)
+    {
+        if (schedule_skip_dates[skipIdx] == date)
+        {
+            return pdTRUE;
+        }
+    }
+    return pdFALSE;
+}
+
+// The first time strictly after `after` that entry fires, if there is one.
+// mktime decides DST at each candidate, so a DST change in between is fine.
+static bool schedule_next_occurrence(const schedule_entry_t* entry, time_t after, time_t* when)
+{
+    struct tm candidate_local_time;
+
+    if (entry->days == 0)
+    {
+        memset(&candidate_local_time, 0, sizeof(candidate_local_time));
+        candidate_local_time.tm_year = entry->date / 10000 - 1900;
+        candidate_local_time.tm_mon = entry->date / 100 % 100 - 1;
+        candidate_local_time.tm_mday = entry->date % 100;
+        candidate_local_time.tm_hour = entry->hour;
+        candidate_local_time.tm_min = entry->minute;
+        candidate_local_time.tm_isdst = -1;
+        time_t candidate = mktime(&candidate_local_time);
+        if (candidate <= after)
+        {
+            return pdFALSE;
+        }
+        *when = candidate;
+        return pdTRUE;
+    }
+
+    struct tm local_after;
+    localtime_r(&after, &local_after);
+    // Every skip date can push a once-a-week entry back a week
+    const int max_days = 7 * (SCHEDULE_MAX_SKIP_DATES + 1) + 1;
+    for (int day = 0; day <= max_days; day++)
+    {
+        candidate_local_time = local_after;
+        candidate_local_time.tm_mday += day;
+        candidate_local_time.tm_hour = entry->hour;
+        candidate_local_time.tm_min = entry->minute;
+        candidate_local_time.tm_sec = 0;
+        candidate_local_time.tm_isdst = -1;
+        time_t candidate = mktime(&candidate_local_time);
+        if (candidate <= after ||
+            !(entry->days & SCHEDULE_DAY(candidate_local_time.tm_wday)))
+        {
+            continue;
+        }
+        if (entry->action == schedule_action_alarm &&
+            schedule_is_skip_date(schedule_tm_to_date(&candidate_local_time)))
+        {
+            continue;
+        }
+        *when = candidate;
+        return pdTRUE;
+    }
+    return pdFALSE;
+}
+
+static void schedule_heap_swap(int a, int b)
+{
+    schedule_heap_node_t temp = schedule_heap[a];
+    schedule_heap[a] = schedule_heap[b];
+    schedule_heap[b] = temp;
+}
+
+static void schedule_heap_sift_down(int idx)
+{
+    while (pdTRUE)
+    {
+        int smallest = idx;
+        int left = 2 * idx + 1;
+        int right = left + 1;
+        if (left < schedule_heap_len && schedule_heap[left].when < schedule_heap[smallest].when)
+        {
+            smallest = left;
+        }
+        if (right < schedule_heap_len && schedule_heap[right].when < schedule_heap[smallest].when)
+        {
+            smallest = right;
+        }
+        if (smallest == idx)
+        {
+            break;
+        }
+        schedule_heap_swap(smallest, idx);
+        idx = smallest;
+    }
+}
+
+// Must be called with schedule_mutex held
+static void schedule_load_settings_alarm(void)
+{
+    uint32_t alarm_enabled, alarm_hour, alarm_minute;
+
+    alarm_enabled = get_setting_u32(setting_alarm_enabled);
+    alarm_hour = get_setting_u32(setting_alarm_hour);
+    alarm_minute = get_setting_u32(setting_alarm_minute);
+    schedule_entry_active[SCHEDULE_SETTINGS_ALARM] = alarm_enabled != 0;
+    schedule_entries[SCHEDULE_SETTINGS_ALARM] = (schedule_entry_t){
+        .action = schedule_action_alarm,
+        .hour = alarm_hour,
+        .minute = alarm_minute,
+        .days = SCHEDULE_EVERY_DAY,
+    };
+}
+
+// Must be called with schedule_mutex held
+static void schedule_rebuild(time_t now)
+{
+    schedule_load_settings_alarm();
+
+    schedule_heap_len = 0;
+    for (int entryIdx = 0; entryIdx <= SCHEDULE_SETTINGS_ALARM; entryIdx++)
+    {
+        time_t when;
+        if (schedule_entry_active[entryIdx] &&
+            schedule_next_occurrence(&schedule_entries[entryIdx], now, &when))
+        {
+            schedule_heap[schedule_heap_len].when = when;
+            schedule_heap[schedule_heap_len].entry = entryIdx;
+            schedule_heap_len++;
+        }
+    }
+    // Floyd's heapify, O(n)
+    for (int idx = schedule_heap_len / 2 - 1; idx >= 0; idx--)
+    {
+        schedule_heap_sift_down(idx);
+    }
+
+    schedule_heap_valid = pdTRUE;
+    schedule_rebuilds++;
+    ESP_LOGI(TAG, "Rebuilt schedule, %d pending, next at Unix Epoch %ld",
+             schedule_heap_len, schedule_heap_len > 0 ? schedule_heap[0].when : 0);
+}
+
+esp_err_t schedule_set(const schedule_entry_t* entries, int entry_count, const uint32_t* skip_dates, int skip_date_count)
+{
+    if (entry_count < 0 || entry_count > SCHEDULE_MAX_ENTRIES ||
+        skip_date_count < 0 || skip_date_count > SCHEDULE_MAX_SKIP_DATES)
+    {
+        ESP_LOGE(TAG, "%s: too many entries (%d) or skip dates (%d)", __FUNCTION__, entry_count, skip_date_count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    for (int entryIdx = 0; entryIdx < SCHEDULE_MAX_ENTRIES; entryIdx++)
+    {
+        schedule_entry_active[entryIdx] = entryIdx < entry_count;
+        if (entryIdx < entry_count)
+        {
+            schedule_entries[entryIdx] = entries[entryIdx];
+        }
+    }
+    schedule_entry_count = entry_count;
+    memcpy(schedule_skip_dates, skip_dates, skip_date_count * sizeof(*skip_dates));
+    schedule_skip_date_count = skip_date_count;
+    schedule_heap_valid = pdFALSE;
+    schedule_dirty = pdTRUE;
+    xSemaphoreGive(schedule_mutex);
+
+    alarm_system_time_or_settings_changed();
+    settings_request_save();
+    return ESP_OK;
+}
+
+void schedule_invalidate(void)
+{
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    schedule_heap_valid = pdFALSE;
+    xSemaphoreGive(schedule_mutex);
+}
+
+bool schedule_next_time(time_t now, time_t* when)
+{
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    if (!schedule_heap_valid)
+    {
+        schedule_rebuild(now);
+    }
+    bool found = schedule_heap_len > 0;
+    if (found)
+    {
+        *when = schedule_heap[0].when;
+    }
+    xSemaphoreGive(schedule_mutex);
+    return found;
+}
+
+bool schedule_next_action_time(schedule_action action, time_t now, time_t* when)
+{
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    if (!schedule_heap_valid)
+    {
+        schedule_rebuild(now);
+    }
+    // The heap only orders by time, but it's small enough to scan
+    bool found = pdFALSE;
+    for (int idx = 0; idx < schedule_heap_len; idx++)
+    {
+        if (schedule_entries[schedule_heap[idx].entry].action == action &&
+            (!found || schedule_heap[idx].when < *when))
+        {
+            *when = schedule_heap[idx].when;
+            found = pdTRUE;
+        }
+    }
+    xSemaphoreGive(schedule_mutex);
+    return found;
+}
+
+bool schedule_pop_due(time_t now, schedule_event_t* event)
+{
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    if (!schedule_heap_valid)
+    {
+        schedule_rebuild(now);
+    }
+    bool due = schedule_heap_len > 0 && schedule_heap[0].when <= now;
+    if (due)
+    {
+        const schedule_entry_t* entry = &schedule_entries[schedule_heap[0].entry];
+        event->when = schedule_heap[0].when;
+        event->action = entry->action;
+        event->pattern = entry->pattern;
+        schedule_fired++;
+
+        // Queue the following occurrence in the head's place. Counting from
+        // now rather than the due time means a late look fires once, not
+        // once per occurrence missed.
+        time_t next;
+        if (schedule_next_occurrence(entry, now, &next))
+        {
+            schedule_heap[0].when = next;
+        }
+        else
+        {
+            schedule_heap_len--;
+            schedule_heap[0] = schedule_heap[schedule_heap_len];
+        }
+        schedule_heap_sift_down(0);
+    }
+    xSemaphoreGive(schedule_mutex);
+    return due;
+}
+
+void schedule_get_stats(schedule_stats_t* stats)
+{
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    stats->entries = schedule_entry_count;
+    stats->pending = schedule_heap_valid ? schedule_heap_len : 0;
+    stats->rebuilds = schedule_rebuilds;
+    stats->fired = schedule_fired;
+    stats->next = (schedule_heap_valid && schedule_heap_len > 0) ? schedule_heap[0].when : 0;
+    xSemaphoreGive(schedule_mutex);
+}
+
+esp_err_t schedule_to_json(char* buf, size_t buf_len)
+{
+    cJSON* root = cJSON_CreateObject();
+    cJSON* entry_array = cJSON_AddArrayToObject(root, "schedules");
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    for (int entryIdx = 0; entryIdx < schedule_entry_count; entryIdx++)
+    {
+        const schedule_entry_t* entry = &schedule_entries[entryIdx];
+        cJSON* entry_object = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry_object, "action", schedule_action_names[entry->action]);
+        if (entry->action == schedule_action_pattern)
+        {
+            cJSON_AddNumberToObject(entry_object, "pattern", entry->pattern);
+        }
+        cJSON_AddNumberToObject(entry_object, "hour", entry->hour);
+        cJSON_AddNumberToObject(entry_object, "minute", entry->minute);
+        cJSON_AddNumberToObject(entry_object, "days", entry->days);
+        if (entry->days == 0)
+        {
+            cJSON_AddNumberToObject(entry_object, "date", entry->date);
+        }
+        cJSON_AddItemToArray(entry_array, entry_object);
+    }
+    cJSON* skip_array = cJSON_AddArrayToObject(root, "skip");
+    for (int skipIdx = 0; skipIdx < schedule_skip_date_count; skipIdx++)
+    {
+        cJSON_AddItemToArray(skip_array, cJSON_CreateNumber(schedule_skip_dates[skipIdx]));
+    }
+    xSemaphoreGive(schedule_mutex);
+
+    cJSON_AddItemToObject(root, "actions", cJSON_CreateStringArray(schedule_action_names, schedule_action_enum_max));
+
+    // '- 5' is according to the function declaration comments
+    cJSON_bool succeeded = cJSON_PrintPreallocated(root, buf, buf_len - 5, 1);
+    if (!succeeded)
+    {
+        ESP_LOGE(TAG, "Writing JSON string to buffer failed");
+    }
+
+    cJSON_Delete(root);
+
+    return (succeeded != 0 ? ESP_OK : ESP_FAIL);
+}
+
+static bool schedule_is_valid_date(uint32_t date)
+{
+    uint32_t month = date / 100 % 100;
+    uint32_t day = date % 100;
+    return date / 10000 >= 1970 && 1 <= month && month <= 12 && 1 <= day && day <= 31;
+}
+
+// Read a whole number field; false if it's missing, not a number or >= limit
+static bool schedule_json_uint(const cJSON* object, const char* name, uint32_t limit, uint32_t* value)
+{
+    const cJSON* item = cJSON_GetObjectItem(object, name);
+    if (item == NULL || !cJSON_IsNumber(item) || item->valueint < 0 || (uint32_t)item->valueint >= limit)
+    {
+        return pdFALSE;
+    }
+    *value = item->valueint;
+    return pdTRUE;
+}
+
+static bool schedule_json_to_entry(const cJSON* object, schedule_entry_t* entry)
+{
+    uint32_t value;
+
+    memset(entry, 0, sizeof(*entry));
+
+    const cJSON* action = cJSON_GetObjectItem(object, "action");
+    if (action == NULL || !cJSON_IsString(action))
+    {
+        return pdFALSE;
+    }
+    entry->action = schedule_action_enum_max;
+    for (schedule_action a = 0; a < schedule_action_enum_max; a++)
+    {
+        if (strcmp(action->valuestring, schedule_action_names[a]) == 0)
+        {
+            entry->action = a;
+        }
+    }
+    if (entry->action == schedule_action_enum_max)
+    {
+        return pdFALSE;
+    }
+    if (entry->action == schedule_action_pattern)
+    {
+        if (!schedule_json_uint(object, "pattern", lpat_max, &value))
+        {
+            return pdFALSE;
+        }
+        entry->pattern = (led_pattern_t)value;
+    }
+
+    if (!schedule_json_uint(object, "hour", 24, &value))
+    {
+        return pdFALSE;
+    }
+    entry->hour = value;
+    if (!schedule_json_uint(object, "minute", 60, &value))
+    {
+        return pdFALSE;
+    }
+    entry->minute = value;
+    if (!schedule_json_uint(object, "days", SCHEDULE_EVERY_DAY + 1, &value))
+    {
+        return pdFALSE;
+    }
+    entry->days = value;
+    if (entry->days == 0)
+    {
+        if (!schedule_json_uint(object, "date", 100000000, &value) || !schedule_is_valid_date(value))
+        {
+            return pdFALSE;
+        }
+        entry->date = value;
+    }
+    return pdTRUE;
+}
+
+// buf must be null-terminated. Replaces every schedule, or none if any is invalid.
+esp_err_t json_to_schedule(char* buf, size_t buf_len)
+{
+    if (memchr(buf, '\0', buf_len) == NULL)
+    {
+        ESP_LOGE(TAG, "%s input buffer not null-terminated", __FUNCTION__);
+        return ESP_FAIL;
+    }
+
+    cJSON* json = cJSON_Parse(buf);
+    if (json == NULL || !cJSON_IsObject(json))
+    {
+        ESP_LOGE(TAG, "%s: JSON parsing failed", __FUNCTION__);
+        cJSON_Delete(json);
+        return ESP_FAIL;
+    }
+
+    // From this point forward, json needs to be deleted.
+
+    esp_err_t retVal = ESP_OK;
+    // About 400 bytes, so off the HTTP task's stack; the server handles one
+    // request at a time
+    static schedule_entry_t entries[SCHEDULE_MAX_ENTRIES];
+    uint32_t skip_dates[SCHEDULE_MAX_SKIP_DATES];
+    int entry_count = 0;
+    int skip_date_count = 0;
+
+    const cJSON* entry_array = cJSON_GetObjectItem(json, "schedules");
+    if (entry_array != NULL && cJSON_IsArray(entry_array))
+    {
+        const cJSON* child = NULL;
+        cJSON_ArrayForEach(child, entry_array)
+        {
+            if (entry_count == SCHEDULE_MAX_ENTRIES)
+            {
+                ESP_LOGE(TAG, "%s: more than %d schedules", __FUNCTION__, SCHEDULE_MAX_ENTRIES);
+                retVal = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            if (!cJSON_IsObject(child) || !schedule_json_to_entry(child, &entries[entry_count]))
+            {
+                ESP_LOGE(TAG, "%s: schedule %d is invalid", __FUNCTION__, entry_count);
+                retVal = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            entry_count++;
+        }
+    }
+
+    const cJSON* skip_array = cJSON_GetObjectItem(json, "skip");
+    if (retVal == ESP_OK && skip_array != NULL && cJSON_IsArray(skip_array))
+    {
+        const cJSON* child = NULL;
+        cJSON_ArrayForEach(child, skip_array)
+        {
+            if (skip_date_count == SCHEDULE_MAX_SKIP_DATES)
+            {
+                ESP_LOGE(TAG, "%s: more than %d skip dates", __FUNCTION__, SCHEDULE_MAX_SKIP_DATES);
+                retVal = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            if (!cJSON_IsNumber(child) || child->valueint < 0 || !schedule_is_valid_date(child->valueint))
+            {
+                ESP_LOGE(TAG, "%s: skip date %d is invalid", __FUNCTION__, skip_date_count);
+                retVal = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            skip_dates[skip_date_count++] = child->valueint;
+        }
+    }
+
+    cJSON_Delete(json);
+
+    if (retVal == ESP_OK)
+    {
+        retVal = schedule_set(entries, entry_count, skip_dates, skip_date_count);
+    }
+    return retVal;
+}
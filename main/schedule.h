@@ -0,0 +1,109 @@
+
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+
+// time_t
+#include <time.h>
+
+// led_pattern_t
+#include "led.h"
+
+// MAKE_ENUM
+#include "color.h"
+
+// Schedules
+//
+// Everything the clock does on its own at a time of day: weekly alarms,
+// one-shot alarms, sleep timers and patterns. Each schedule's next occurrence
+// sits in a binary min-heap keyed by UTC trigger time, so the alarm task only
+// ever looks at the head and firing or adding one is O(log n). The heap is
+// rebuilt lazily, on the first look after a schedule, setting or the wall
+// clock changes.
+//
+// The single alarm_hour/alarm_minute alarm in settings is still honored, as
+// an every-day alarm alongside these.
+
+#define SCHEDULE_MAX_ENTRIES 32
+#define SCHEDULE_MAX_SKIP_DATES 16
+
+// TRANSMOG(name)
+#define SCHEDULE_ACTIONS \
+    TRANSMOG(alarm) \
+    TRANSMOG(sleep) \
+    TRANSMOG(pattern) \
+
+#define TRANSMOG(name) schedule_action_##name,
+MAKE_ENUM(schedule_action, SCHEDULE_ACTIONS)
+#undef TRANSMOG
+
+extern const char* schedule_action_names[];
+
+// Bits of schedule_entry_t.days, by struct tm's tm_wday
+#define SCHEDULE_DAY(wday) (1 << (wday))
+#define SCHEDULE_WEEKDAYS 0x3E
+#define SCHEDULE_WEEKENDS 0x41
+#define SCHEDULE_EVERY_DAY 0x7F
+
+typedef struct _schedule_entry_t {
+    schedule_action action;
+    // only for schedule_action_pattern
+    led_pattern_t pattern;
+    // local time of day
+    uint8_t hour;
+    uint8_t minute;
+    // Days of the week this repeats on; 0 for a one-shot
+    uint8_t days;
+    // Local date of a one-shot, as YYYYMMDD
+    uint32_t date;
+} schedule_entry_t;
+
+// Something due to happen
+typedef struct _schedule_event_t {
+    time_t when;
+    schedule_action action;
+    led_pattern_t pattern;
+} schedule_event_t;
+
+typedef struct _schedule_stats_t {
+    uint32_t entries;
+    uint32_t pending;
+    uint32_t rebuilds;
+    uint32_t fired;
+    time_t next;
+} schedule_stats_t;
+
+// Loads the stored schedules, so it needs NVS initialized
+esp_err_t schedule_init(void);
+
+// Replace every schedule and skip date. Recurring alarms don't fire on a
+// skip date (YYYYMMDD); other actions do.
+esp_err_t schedule_set(const schedule_entry_t* entries, int entry_count, const uint32_t* skip_dates, int skip_date_count);
+
+// Write the schedules to NVS if they've changed since they were last
+// written. Called from the settings save task; ask for a save with
+// settings_request_save.
+void schedule_save(void);
+
+// Rebuild the heap on the next look, e.g. after the wall clock is set
+void schedule_invalidate(void);
+
+// When the next event is due, or false if nothing is scheduled
+bool schedule_next_time(time_t now, time_t* when);
+
+// When the next event of one kind is due, e.g. the next alarm
+bool schedule_next_action_time(schedule_action action, time_t now, time_t* when);
+
+// Take the next event if it's due by now, and queue that schedule's
+// following occurrence
+bool schedule_pop_due(time_t now, schedule_event_t* event);
+
+void schedule_get_stats(schedule_stats_t* stats);
+
+esp_err_t schedule_to_json(char* buf, size_t buf_len);
+esp_err_t json_to_schedule(char* buf, size_t buf_len);
@@ -20,7 +20,26 @@
 // expose color enumerations as settings values
 #include "color.h"
 
-#define RANGE_ARRAY(...) __VA_ARGS__
+// clip playback modes
+#include "clip.h"
+
+// palette choices, and notify the palettes of settings changes
+#include "palette.h"
+
+// notify power management of settings changes
+#include "power.h"
+
+// the schedules are saved by the same task
+#include "schedule.h"
+
+// persistence
+#include "nvs.h"
+
+// commit timing
+#include "esp_timer.h"
+
+// offsetof
+#include <stddef.h>
 
 typedef struct _setting_definition
 {
@@ -31,42 +50,20 @@ typedef struct _setting_definition
     int value_range_array_len;
 } setting_definition;
 
-#define DEFINE_SETTING(sname, default, range_array) \
+// Ranges taken from the color tables want just their values
+#define TRANSMOG(name, value) value,
+#define SETTING(sname, default, range_array) \
 { \
     .name = #sname, \
     .value = (int)default, \
     .value_range_array = (int[])range_array, \
     .value_range_array_len = LWIP_ARRAYSIZE(RANGE_ARRAY((int[])range_array)), \
-}
-
+},
 setting_definition settings[] = {
-    DEFINE_SETTING(alarm_hour, 9, RANGE_ARRAY({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23})),
-    DEFINE_SETTING(alarm_minute, 0, RANGE_ARRAY({
-         0, /* 1,  2,  3,  4,*/  5, /* 6,  7,  8,  9,*/
-        10, /*11, 12, 13, 14,*/ 15, /*16, 17, 18, 19,*/
-        20, /*21, 22, 23, 24,*/ 25, /*26, 27, 28, 29,*/
-        30, /*31, 32, 33, 34,*/ 35, /*36, 37, 38, 39,*/
-        40, /*41, 42, 43, 44,*/ 45, /*46, 47, 48, 49,*/
-        50, /*51, 52, 53, 54,*/ 55, /*56, 57, 58,*/ 59
-    })),
-    DEFINE_SETTING(alarm_enabled, 1, RANGE_ARRAY({0, 1})),
-    DEFINE_SETTING(alarm_led_pattern, lpat_fill_whyamionfirewhite, RANGE_ARRAY({})),
-    DEFINE_SETTING(alarm_snooze_interval_min, 9, RANGE_ARRAY({1, 3, 5, 7, 9, 11, 13, 15})),
-
-    DEFINE_SETTING(sleep_delay_min, 0, RANGE_ARRAY({
-        0, 1, 5, 10, 15, 30, 45,
-        60, 2*60, 3*60, 4*60, 5*60, 6*60, 7*60, 8*60, 9*60, 10*60})),
-    DEFINE_SETTING(sleep_fade_time_min, 8, RANGE_ARRAY({1, 3, 5, 8, 10, 15, 30, 45})),
-#define TRANSMOG(name, value) value,
-    DEFINE_SETTING(sleep_fade_start_temp, 2500, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })),
-#undef TRANSMOG
-#define TRANSMOG(name, value) value,
-    DEFINE_SETTING(sleep_fade_start_luminosity, 102, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })),
-#undef TRANSMOG
-    DEFINE_SETTING(sleep_fade_fill_time_ms, 3000, RANGE_ARRAY({1*1000, 3*1000, 5*1000, 7*1000, 9*1000, 11*1000})),
-
-    DEFINE_SETTING(fill_time_ms, 3000, RANGE_ARRAY({1*1000, 3*1000, 5*1000, 7*1000, 9*1000, 11*1000})),
+    SETTINGS_TABLE
 };
+#undef SETTING
+#undef TRANSMOG
 int settings_len = LWIP_ARRAYSIZE(settings);
 
 bool is_string_null_terminated(char* buf, size_t buf_len)
@@ -81,57 +78,103 @@ bool is_string_null_terminated(char* buf, size_t buf_len)
     return pdFALSE;
 }
 
-setting_definition* find_setting(char* name)
+// FNV-1a from a given offset basis, so the perfect hash below can try
+// different ones
+#define SETTINGS_FNV_OFFSET_BASIS 2166136261u
+static uint32_t settings_hash(uint32_t basis, const char* name)
 {
-    setting_definition* setting_found = NULL;
-    // N.B. This will not scale to lots of settings.
-    for (int settingIdx = 0; settingIdx < settings_len; settingIdx++)
+    uint32_t hash = basis;
+    while (*name != '\0')
     {
-        setting_definition* setting = &settings[settingIdx];
-        if (0 == strcmp(name, setting->name))
-        {
-            setting_found = setting;
-            break;
-        }
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
     }
-    return setting_found;
+    return hash;
 }
 
-esp_err_t get_setting(char* name, uint32_t* value)
+// Names are only looked up when settings arrive as JSON. They go through a
+// perfect hash: a table over four times the number of settings and an
+// FNV-1a offset basis under which no two names land in the same slot, so a lookup
+// is one hash and one strcmp. C can't hash strings at compile time, so the
+// basis is searched for at startup; it's deterministic and takes well under
+// a millisecond.
+// Slots come from the top bits; FNV-1a's low bits only see the low bits of
+// each character
+#define SETTINGS_HASH_BITS 8
+#define SETTINGS_HASH_LEN (1 << SETTINGS_HASH_BITS)
+#define SETTINGS_HASH_SLOT(hash) ((hash) >> (32 - SETTINGS_HASH_BITS))
+#define SETTINGS_HASH_MAX_TRIES 1000
+_Static_assert(SETTINGS_HASH_LEN >= 4 * settings_name_enum_max && settings_name_enum_max < UINT8_MAX, "settings perfect hash table too small");
+
+// Setting index + 1 in each slot; 0 for an empty slot
+static uint8_t settings_hash_slots[SETTINGS_HASH_LEN];
+static uint32_t settings_hash_basis = SETTINGS_FNV_OFFSET_BASIS;
+static bool settings_hash_ready = pdFALSE;
+
+static void settings_build_hash(void)
 {
-    if (name == NULL || value == NULL)
+    for (int tryIdx = 0; tryIdx < SETTINGS_HASH_MAX_TRIES; tryIdx++)
     {
-        ESP_LOGE(TAG, "%s given a null argument (%p %p)", __FUNCTION__, name, value);
-        return ESP_FAIL;
+        uint32_t basis = SETTINGS_FNV_OFFSET_BASIS + tryIdx;
+        bool collided = pdFALSE;
+        memset(settings_hash_slots, 0, sizeof(settings_hash_slots));
+        for (int settingIdx = 0; settingIdx < settings_len && !collided; settingIdx++)
+        {
+            uint32_t slot = SETTINGS_HASH_SLOT(settings_hash(basis, settings[settingIdx].name));
+            collided = settings_hash_slots[slot] != 0;
+            settings_hash_slots[slot] = settingIdx + 1;
+        }
+        if (!collided)
+        {
+            settings_hash_basis = basis;
+            settings_hash_ready = pdTRUE;
+            ESP_LOGI(TAG, "Settings perfect hash found after %d tries", tryIdx + 1);
+            return;
+        }
     }
+    ESP_LOGE(TAG, "%s: no perfect hash found; looking names up by scanning", __FUNCTION__);
+}
 
-    setting_definition* setting = find_setting(name);
-    if (setting != NULL)
+static setting_definition* find_setting(const char* name)
+{
+    if (!settings_hash_ready)
     {
-        *value = setting->value;
-        return ESP_OK;
+        for (int settingIdx = 0; settingIdx < settings_len; settingIdx++)
+        {
+            if (0 == strcmp(name, settings[settingIdx].name))
+            {
+                return &settings[settingIdx];
+            }
+        }
+        return NULL;
     }
-    else
+
+    uint8_t entry = settings_hash_slots[SETTINGS_HASH_SLOT(settings_hash(settings_hash_basis, name))];
+    if (entry == 0 || strcmp(name, settings[entry - 1].name) != 0)
     {
-        ESP_LOGE(TAG, "%s: setting %s not found", __FUNCTION__, name);
-        return ESP_FAIL;
+        return NULL;
     }
+    return &settings[entry - 1];
 }
 
-esp_err_t set_setting(char* name, uint32_t value)
+uint32_t get_setting_u32(settings_name id)
 {
-    if (name == NULL)
+    if (id >= settings_name_enum_max)
     {
-        ESP_LOGE(TAG, "%s given a null name", __FUNCTION__);
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "%s: no setting %d", __FUNCTION__, id);
+        return 0;
     }
+    return settings[id].value;
+}
 
-    setting_definition* setting = find_setting(name);
-    if (setting == NULL)
+esp_err_t set_setting_u32(settings_name id, uint32_t value)
+{
+    if (id >= settings_name_enum_max)
     {
-        ESP_LOGE(TAG, "%s: setting %s not found", __FUNCTION__, name);
+        ESP_LOGE(TAG, "%s: no setting %d", __FUNCTION__, id);
         return ESP_FAIL;
     }
+    setting_definition* setting = &settings[id];
 
     // N.B. This will also not scale to lots of settings.
     bool is_value_valid = pdFALSE;
@@ -144,7 +187,7 @@ esp_err_t set_setting(char* name, uint32_t value)
         }
     }
     // special-case the string-based LED pattern setting
-    if (strcmp(name, "alarm_led_pattern") == 0)
+    if (id == setting_alarm_led_pattern)
     {
         is_value_valid = pdFALSE;
         // value is unsigned and the enum starts at 0, so only the upper bound needs checking
@@ -155,7 +198,7 @@ esp_err_t set_setting(char* name, uint32_t value)
     }
     if (!is_value_valid)
     {
-        ESP_LOGE(TAG, "%s: invalid %s value (%d) provided", __FUNCTION__, name, value);
+        ESP_LOGE(TAG, "%s: invalid %s value (%d) provided", __FUNCTION__, setting->name, value);
         return ESP_FAIL;
     }
 
@@ -163,6 +206,24 @@ esp_err_t set_setting(char* name, uint32_t value)
     return ESP_OK;
 }
 
+// Settings by name, for JSON
+static esp_err_t set_setting(const char* name, uint32_t value)
+{
+    if (name == NULL)
+    {
+        ESP_LOGE(TAG, "%s given a null name", __FUNCTION__);
+        return ESP_FAIL;
+    }
+
+    setting_definition* setting = find_setting(name);
+    if (setting == NULL)
+    {
+        ESP_LOGE(TAG, "%s: setting %s not found", __FUNCTION__, name);
+        return ESP_FAIL;
+    }
+    return set_setting_u32((settings_name)(setting - settings), value);
+}
+
 esp_err_t settings_to_json(char* buf, size_t buf_len)
 {
     cJSON* root = cJSON_CreateObject();
@@ -251,6 +312,216 @@ esp_err_t json_to_settings(char* buf, size_t buf_len)
     cJSON_Delete(json);
 
     alarm_system_time_or_settings_changed();
+    palette_settings_changed();
+    led_settings_changed();
+    power_settings_changed();
+    settings_request_save();
 
     return retVal;
 }
+
+// Persistence
+//
+// Settings are kept in NVS as one blob: a header, then a (key, value) record
+// per setting, keyed by a hash of the setting's name. Settings added since
+// the blob was written keep their defaults and ones since removed are
+// skipped, so adding or removing a setting needs no migration. The version
+// only changes when a setting's meaning does, like a change of units, and
+// settings_migrate then brings old values forward.
+//
+// Changes are written by a task of their own, once they've stopped coming
+// for SETTINGS_SAVE_DEBOUNCE_MS, so a burst of POSTs is one flash commit.
+// A blob identical to the one already stored isn't written at all. The
+// schedules are stored alongside, in a blob of their own, by the same task.
+
+#define SETTINGS_NVS_NAMESPACE "settings"
+#define SETTINGS_NVS_KEY "blob"
+#define SETTINGS_BLOB_VERSION 1
+// Room for plenty more settings than there are
+#define SETTINGS_BLOB_MAX_RECORDS 128
+#define SETTINGS_SAVE_DEBOUNCE_MS 2000
+
+typedef struct _settings_blob_record_t {
+    uint32_t key;
+    int32_t value;
+} settings_blob_record_t;
+
+typedef struct _settings_blob_t {
+    uint16_t version;
+    uint16_t count;
+    settings_blob_record_t records[SETTINGS_BLOB_MAX_RECORDS];
+} settings_blob_t;
+
+#define SETTINGS_BLOB_LEN(count) (offsetof(settings_blob_t, records) + (count) * sizeof(settings_blob_record_t))
+
+// Only touched by settings_init, then the save task
+static settings_blob_t settings_blob;
+static settings_blob_t settings_blob_stored;
+static size_t settings_blob_stored_len = 0;
+
+static TaskHandle_t settings_save_task = NULL;
+static settings_storage_stats_t settings_stats;
+
+// Stored settings are keyed by the plain FNV-1a of their names, which stays
+// the same whatever basis the perfect hash ends up with
+static uint32_t settings_key(const char* name)
+{
+    return settings_hash(SETTINGS_FNV_OFFSET_BASIS, name);
+}
+
+// Bring a value stored under an older schema version forward. Returns false
+// to drop it, leaving the default.
+static bool settings_migrate(uint16_t version, setting_definition* setting, int32_t* value)
+{
+    switch (version)
+    {
+    case SETTINGS_BLOB_VERSION:
+        return pdTRUE;
+    default:
+        // Newer than this firmware, or older with no migration written for
+        // it; either way its values may not mean what we think
+        ESP_LOGW(TAG, "%s: no migration from version %u for %s", __FUNCTION__, version, setting->name);
+        return pdFALSE;
+    }
+}
+
+static void settings_load(void)
+{
+    nvs_handle_t handle;
+    int64_t start_us = esp_timer_get_time();
+
+    esp_err_t err = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        ESP_LOGI(TAG, "No stored settings; using defaults");
+        return;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: nvs_open failed (%d); using defaults", __FUNCTION__, err);
+        return;
+    }
+    size_t len = sizeof(settings_blob_stored);
+    err = nvs_get_blob(handle, SETTINGS_NVS_KEY, &settings_blob_stored, &len);
+    nvs_close(handle);
+    if (err != ESP_OK || len < SETTINGS_BLOB_LEN(0) || len != SETTINGS_BLOB_LEN(settings_blob_stored.count))
+    {
+        ESP_LOGE(TAG, "%s: no usable blob (%d, %u bytes); using defaults", __FUNCTION__, err, len);
+        return;
+    }
+    settings_blob_stored_len = len;
+
+    int applied = 0;
+    for (int recordIdx = 0; recordIdx < settings_blob_stored.count; recordIdx++)
+    {
+        const settings_blob_record_t* record = &settings_blob_stored.records[recordIdx];
+        for (int settingIdx = 0; settingIdx < settings_len; settingIdx++)
+        {
+            setting_definition* setting = &settings[settingIdx];
+            int32_t value = record->value;
+            if (settings_key(setting->name) == record->key &&
+                settings_migrate(settings_blob_stored.version, setting, &value) &&
+                set_setting_u32((settings_name)settingIdx, value) == ESP_OK)
+            {
+                applied++;
+                break;
+            }
+        }
+    }
+    settings_stats.loaded_version = settings_blob_stored.version;
+    settings_stats.load_us = esp_timer_get_time() - start_us;
+    ESP_LOGI(TAG, "Loaded %d of %d stored settings (version %u, %u bytes) in %u us",
+             applied, settings_blob_stored.count, settings_blob_stored.version, len, settings_stats.load_us);
+}
+
+static void settings_save(void)
+{
+    nvs_handle_t handle;
+
+    settings_blob.version = SETTINGS_BLOB_VERSION;
+    settings_blob.count = settings_len;
+    for (int settingIdx = 0; settingIdx < settings_len; settingIdx++)
+    {
+        settings_blob.records[settingIdx].key = settings_key(settings[settingIdx].name);
+        settings_blob.records[settingIdx].value = settings[settingIdx].value;
+    }
+    size_t len = SETTINGS_BLOB_LEN(settings_blob.count);
+    if (len == settings_blob_stored_len && memcmp(&settings_blob, &settings_blob_stored, len) == 0)
+    {
+        settings_stats.saves_skipped++;
+        return;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, SETTINGS_NVS_KEY, &settings_blob, len);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    uint32_t commit_us = esp_timer_get_time() - start_us;
+    if (err != ESP_OK)
+    {
+        settings_stats.save_errors++;
+        ESP_LOGE(TAG, "%s: saving settings failed (%d)", __FUNCTION__, err);
+        return;
+    }
+
+    memcpy(&settings_blob_stored, &settings_blob, len);
+    settings_blob_stored_len = len;
+    settings_stats.commits++;
+    settings_stats.commit_us_last = commit_us;
+    settings_stats.commit_us_total += commit_us;
+    if (commit_us > settings_stats.commit_us_max)
+    {
+        settings_stats.commit_us_max = commit_us;
+    }
+    settings_stats.blob_len = len;
+    ESP_LOGI(TAG, "Saved %u settings (%u bytes) in %u us", settings_blob.count, len, commit_us);
+}
+
+static void settings_save_task_func(void* param)
+{
+    while (pdTRUE)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Hold off until the changes stop
+        while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SETTINGS_SAVE_DEBOUNCE_MS)) != 0)
+        {
+        }
+        settings_save();
+        schedule_save();
+    }
+}
+
+void settings_request_save(void)
+{
+    settings_stats.save_requests++;
+    if (settings_save_task != NULL)
+    {
+        xTaskNotifyGive(settings_save_task);
+    }
+}
+
+esp_err_t settings_init(void)
+{
+    if (settings_len > SETTINGS_BLOB_MAX_RECORDS)
+    {
+        ESP_LOGE(TAG, "%s: %d settings won't fit in the blob", __FUNCTION__, settings_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    settings_build_hash();
+    settings_load();
+    BaseType_t xRet = xTaskCreate(settings_save_task_func, "settings save", 3*1024, NULL, 1, &settings_save_task);
+    return xRet == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void settings_get_stats(settings_storage_stats_t* stats)
+{
+    *stats = settings_stats;
+    stats->blob_len = settings_blob_stored_len;
+}
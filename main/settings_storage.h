@@ -8,28 +8,87 @@
 
 #include "led.h"
 
-typedef enum _settings_name
-{
-    // Alarm settings
-    alarm_hour,
-    alarm_minute,
-    alarm_enabled,
-    alarm_led_pattern,
-    alarm_snooze_interval_min,
-
-    // Sleep mode settings
-    sleep_delay_min,
-    sleep_fade_time_min,
-    sleep_fade_start_temp,
-    sleep_fade_start_luminosity,
-    sleep_fade_fill_time_ms,
-
-    // Color pattern settings
-    fill_time_ms,
-} settings_name;
-
-esp_err_t set_setting(char* name, uint32_t value);
-esp_err_t get_setting(char* name, uint32_t* value);
+// MAKE_ENUM
+#include "color.h"
+
+// Every setting: its name, default and the values it may take. The enum, the
+// definitions and the names used in JSON are all generated from this, so a
+// setting is added in exactly one place. Ranges may use the color tables'
+// TRANSMOG(name, value) lists; they're expanded where the definitions are.
+// Stored settings are keyed by name, so the order is free to change.
+//
+// SETTING(name, default, range)
+#define SETTINGS_TABLE \
+    /* Alarm settings */ \
+    SETTING(alarm_hour, 9, RANGE_ARRAY({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23})) \
+    SETTING(alarm_minute, 0, RANGE_ARRAY({ \
+         0, /* 1,  2,  3,  4,*/  5, /* 6,  7,  8,  9,*/ \
+        10, /*11, 12, 13, 14,*/ 15, /*16, 17, 18, 19,*/ \
+        20, /*21, 22, 23, 24,*/ 25, /*26, 27, 28, 29,*/ \
+        30, /*31, 32, 33, 34,*/ 35, /*36, 37, 38, 39,*/ \
+        40, /*41, 42, 43, 44,*/ 45, /*46, 47, 48, 49,*/ \
+        50, /*51, 52, 53, 54,*/ 55, /*56, 57, 58,*/ 59 \
+    })) \
+    SETTING(alarm_enabled, 1, RANGE_ARRAY({0, 1})) \
+    SETTING(alarm_led_pattern, lpat_fill_whyamionfirewhite, RANGE_ARRAY({})) \
+    SETTING(alarm_snooze_interval_min, 9, RANGE_ARRAY({1, 3, 5, 7, 9, 11, 13, 15})) \
+    \
+    /* Sleep mode settings */ \
+    SETTING(sleep_delay_min, 0, RANGE_ARRAY({ \
+        0, 1, 5, 10, 15, 30, 45, \
+        60, 2*60, 3*60, 4*60, 5*60, 6*60, 7*60, 8*60, 9*60, 10*60})) \
+    SETTING(sleep_fade_time_min, 8, RANGE_ARRAY({1, 3, 5, 8, 10, 15, 30, 45})) \
+    SETTING(sleep_fade_start_temp, 2500, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(sleep_fade_start_luminosity, 102, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })) \
+    \
+    /* Color pattern settings */ \
+    SETTING(fill_time_ms, 3000, RANGE_ARRAY({1*1000, 3*1000, 5*1000, 7*1000, 9*1000, 11*1000})) \
+    SETTING(clip_playback_mode, clip_mode_loop, RANGE_ARRAY({clip_mode_once, clip_mode_loop, clip_mode_ping_pong})) \
+    SETTING(transition_time_ms, 500, RANGE_ARRAY({0, 250, 500, 1000, 2000, 3000})) \
+    SETTING(transition_easing, led_easing_smooth, RANGE_ARRAY({led_easing_linear, led_easing_smooth, led_easing_ease_in, led_easing_ease_out})) \
+    SETTING(palette_pattern_palette, palette_fire, RANGE_ARRAY({palette_rainbow, palette_fire, palette_ocean, palette_sunrise, palette_custom, palette_aurora})) \
+    SETTING(palette_custom_hue_start, 180, RANGE_ARRAY({0, 30, 60, 90, 120, 150, 180, 210, 240, 270, 300, 330})) \
+    SETTING(palette_custom_hue_end, 300, RANGE_ARRAY({0, 30, 60, 90, 120, 150, 180, 210, 240, 270, 300, 330})) \
+    SETTING(night_light_mode, night_light_static, RANGE_ARRAY({night_light_static, night_light_candle, night_light_fire, night_light_aurora})) \
+    SETTING(particle_budget, 64, RANGE_ARRAY({8, 16, 32, 64, 128})) \
+    \
+    /* Power settings */ \
+    SETTING(wifi_latency_budget_ms, 300, RANGE_ARRAY({0, 100, 300, 1000, 3000})) \
+    \
+    /* Sunrise alarm settings */ \
+    SETTING(sunrise_duration_min, 0, RANGE_ARRAY({0, 15, 20, 30, 45})) \
+    SETTING(sunrise_curve, sunrise_curve_perceptual, RANGE_ARRAY({sunrise_curve_linear, sunrise_curve_perceptual, sunrise_curve_smooth})) \
+    \
+    /* Circadian light settings */ \
+    SETTING(circadian_temp_0h, 1000, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(circadian_temp_4h, 1000, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(circadian_temp_8h, 3800, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(circadian_temp_12h, 5500, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(circadian_temp_16h, 5500, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(circadian_temp_20h, 2500, RANGE_ARRAY({ COLOR_CCT_TEMPERATURES })) \
+    SETTING(circadian_lm_0h, 1, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })) \
+    SETTING(circadian_lm_4h, 1, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })) \
+    SETTING(circadian_lm_8h, 153, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })) \
+    SETTING(circadian_lm_12h, 255, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })) \
+    SETTING(circadian_lm_16h, 204, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES })) \
+    SETTING(circadian_lm_20h, 102, RANGE_ARRAY({ COLOR_CCT_LUMINOSITIES }))
+
+#define RANGE_ARRAY(...) __VA_ARGS__
+
+#define SETTING(name, default, range) setting_##name,
+MAKE_ENUM(settings_name, SETTINGS_TABLE)
+#undef SETTING
+
+// Load the stored settings and start saving changes. Needs NVS initialized.
+esp_err_t settings_init(void);
+
+// Have the save task write everything kept in NVS (settings and schedules)
+// once changes stop coming. Never blocks.
+void settings_request_save(void);
+
+// Typed, and an array index; names are only looked up at the JSON boundary
+uint32_t get_setting_u32(settings_name id);
+esp_err_t set_setting_u32(settings_name id, uint32_t value);
 
 esp_err_t settings_to_json(char*, size_t);
 esp_err_t json_to_settings(char*, size_t);
@@ -44,3 +103,23 @@ typedef enum _json_parse_fail_reason_t
 } json_parse_fail_reason_t;
 
 extern json_parse_fail_reason_t fail_reason;
+
+typedef struct _settings_storage_stats_t {
+    // changes reported, and what became of them
+    uint32_t save_requests;
+    uint32_t commits;
+    // saves that found nothing different from what's stored
+    uint32_t saves_skipped;
+    uint32_t save_errors;
+    // time to write and commit the blob, in us
+    uint32_t commit_us_last;
+    uint32_t commit_us_max;
+    uint64_t commit_us_total;
+    // time to read and apply the blob at boot, in us
+    uint32_t load_us;
+    uint32_t blob_len;
+    // 0 if nothing was stored
+    uint16_t loaded_version;
+} settings_storage_stats_t;
+
+void settings_get_stats(settings_storage_stats_t* stats);
@@ -0,0 +1,297 @@
+#include "stream.h"
+
+// Logging facility
+#include <esp_log.h>
+
+// memcpy
+#include <string.h>
+
+// BSD sockets
+#include "lwip/sockets.h"
+
+// Mutex
+#include <freertos/semphr.h>
+
+// esp_timer_get_time
+#include "esp_timer.h"
+
+// LED_FRAME_LEN, led_notify_frame_ready
+#include "led.h"
+
+// IP_EVENT
+#include "esp_netif.h"
+
+// DDP and E1.31 packets
+#include "stream_packet.h"
+
+#define TAG "stream.c"
+
+// Large enough for any packet that fits in an Ethernet frame
+#define STREAM_RX_BUFFER_LEN 1472
+
+static uint8_t stream_rx_buffer[STREAM_RX_BUFFER_LEN];
+
+// The listener fills stream_buffers[stream_back] while the render task shows
+// the other one. stream_frame_mutex guards the swap and stream_frame_ready.
+static uint8_t stream_buffers[2][LED_FRAME_LEN];
+static int stream_back = 0;
+static bool stream_frame_ready = pdFALSE;
+static SemaphoreHandle_t stream_frame_mutex = NULL;
+
+// When the first packet of the frame being filled arrived, or 0
+static int64_t stream_back_received_us = 0;
+static int64_t stream_front_received_us = 0;
+
+// Written by the listener only
+static stream_parser_t stream_parser;
+
+// Set when the station gets an address, so the listener joins the E1.31
+// multicast group on the new connection; the membership may not outlive the
+// old one, and the listener may have started before there was one at all
+static volatile bool stream_multicast_join_pending = pdTRUE;
+// How long the listener waits for packets before checking the above
+#define STREAM_SELECT_TIMEOUT_MS 1000
+
+// Counters are written by one task each and read without locking; a reading
+// that is one packet out of date is fine for diagnostics.
+static stream_stats_t stream_stats = { 0 };
+static int64_t stream_fps_window_start_us = 0;
+static uint32_t stream_fps_window_frames = 0;
+
+// The back buffer holds a complete frame; hand it to the render task.
+static void stream_push(int64_t received_us)
+{
+    if (stream_back_received_us == 0)
+    {
+        // A push with no data re-shows the last frame
+        stream_back_received_us = received_us;
+    }
+
+    xSemaphoreTake(stream_frame_mutex, portMAX_DELAY);
+    if (stream_frame_ready)
+    {
+        stream_stats.frames_dropped++;
+    }
+    stream_back ^= 1;
+    stream_frame_ready = pdTRUE;
+    stream_front_received_us = stream_back_received_us;
+    // DDP senders may update only part of the frame, so the next frame starts
+    // out as a copy of this one.
+    memcpy(stream_buffers[stream_back], stream_buffers[stream_back ^ 1], LED_FRAME_LEN);
+    xSemaphoreGive(stream_frame_mutex);
+
+    stream_back_received_us = 0;
+    stream_stats.frames++;
+    led_notify_frame_ready();
+}
+
+// Act on what stream_parse_* made of a packet
+static void stream_handle(uint32_t result, int64_t received_us)
+{
+    if ((result & STREAM_PACKET_PIXELS) && stream_back_received_us == 0)
+    {
+        stream_back_received_us = received_us;
+    }
+    if (result & STREAM_PACKET_COMPLETE)
+    {
+        stream_push(received_us);
+    }
+}
+
+static int stream_open_socket(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "%s: socket() failed, errno %d", __FUNCTION__, errno);
+        return -1;
+    }
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        ESP_LOGE(TAG, "%s: bind() to port %d failed, errno %d", __FUNCTION__, port, errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void stream_join_multicast(int sock)
+{
+    // E1.31 multicast goes to 239.255.<universe high byte>.<universe low byte>
+    struct ip_mreq mreq = { 0 };
+    mreq.imr_multiaddr.s_addr = htonl(0xEFFF0000 | CONFIG_LC_STREAM_E131_UNIVERSE);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    // Leave first, so a membership that survived the reconnect doesn't make
+    // the join fail as a duplicate; failing to leave just means there wasn't one
+    setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+    {
+        ESP_LOGW(TAG, "%s: could not join the E1.31 multicast group, errno %d; unicast still works", __FUNCTION__, errno);
+    }
+}
+
+static void stream_on_ip_acquired(void* arg, esp_event_base_t event_base,
+                                  int32_t event_id, void* event_data)
+{
+    stream_multicast_join_pending = pdTRUE;
+}
+
+static void stream_task_func(void* param)
+{
+    int ddp_sock = stream_open_socket(STREAM_DDP_PORT);
+    int e131_sock = stream_open_socket(STREAM_E131_PORT);
+
+    ESP_LOGI(TAG, "Listening for DDP on %d and E1.31 universe %d on %d",
+             STREAM_DDP_PORT, CONFIG_LC_STREAM_E131_UNIVERSE, STREAM_E131_PORT);
+
+    while (pdTRUE)
+    {
+        if (e131_sock >= 0 && stream_multicast_join_pending)
+        {
+            stream_multicast_join_pending = pdFALSE;
+            stream_join_multicast(e131_sock);
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        int max_fd = -1;
+        if (ddp_sock >= 0)
+        {
+            FD_SET(ddp_sock, &readable);
+            max_fd = ddp_sock;
+        }
+        if (e131_sock >= 0)
+        {
+            FD_SET(e131_sock, &readable);
+            max_fd = e131_sock > max_fd ? e131_sock : max_fd;
+        }
+        if (max_fd < 0)
+        {
+            ESP_LOGE(TAG, "%s: no sockets to listen on", __FUNCTION__);
+            break;
+        }
+
+        struct timeval timeout = { .tv_sec = STREAM_SELECT_TIMEOUT_MS / 1000, .tv_usec = 0 };
+        int ready = select(max_fd + 1, &readable, NULL, NULL, &timeout);
+        if (ready < 0)
+        {
+            ESP_LOGE(TAG, "%s: select() failed, errno %d", __FUNCTION__, errno);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        if (ready == 0)
+        {
+            continue;
+        }
+
+        if (ddp_sock >= 0 && FD_ISSET(ddp_sock, &readable))
+        {
+            int len = recv(ddp_sock, stream_rx_buffer, sizeof(stream_rx_buffer), 0);
+            if (len > 0)
+            {
+                stream_stats.packets++;
+                int64_t received_us = esp_timer_get_time();
+                stream_handle(stream_parse_ddp(&stream_parser, stream_buffers[stream_back], stream_rx_buffer, len), received_us);
+            }
+        }
+        if (e131_sock >= 0 && FD_ISSET(e131_sock, &readable))
+        {
+            int len = recv(e131_sock, stream_rx_buffer, sizeof(stream_rx_buffer), 0);
+            if (len > 0)
+            {
+                stream_stats.packets++;
+                int64_t received_us = esp_timer_get_time();
+                stream_handle(stream_parse_e131(&stream_parser, stream_buffers[stream_back], stream_rx_buffer, len), received_us);
+            }
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t stream_init(void)
+{
+    esp_err_t err;
+
+    stream_parser_init(&stream_parser, CONFIG_LC_STREAM_E131_UNIVERSE);
+    err = esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, stream_on_ip_acquired, NULL, NULL);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: esp_event_handler_instance_register failed: %s", __FUNCTION__, esp_err_to_name(err));
+        return err;
+    }
+
+    stream_frame_mutex = xSemaphoreCreateMutex();
+    if (stream_frame_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    BaseType_t xRet = xTaskCreate(stream_task_func, "stream.c listener", 4096, NULL, 3, NULL);
+    return xRet == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+const uint8_t* stream_lock_frame(int64_t* received_us)
+{
+    xSemaphoreTake(stream_frame_mutex, portMAX_DELAY);
+    if (!stream_frame_ready)
+    {
+        xSemaphoreGive(stream_frame_mutex);
+        return NULL;
+    }
+    stream_frame_ready = pdFALSE;
+    *received_us = stream_front_received_us;
+    return stream_buffers[stream_back ^ 1];
+}
+
+void stream_unlock_frame(void)
+{
+    xSemaphoreGive(stream_frame_mutex);
+}
+
+void stream_frame_shown(int64_t received_us, int64_t shown_us)
+{
+    uint32_t latency_us = (uint32_t)(shown_us - received_us);
+
+    stream_stats.frames_shown++;
+    stream_stats.latency_us_last = latency_us;
+    if (latency_us > stream_stats.latency_us_max)
+    {
+        stream_stats.latency_us_max = latency_us;
+    }
+    // Exponential moving average, 1/16 weight for the new sample
+    if (stream_stats.latency_us_avg == 0)
+    {
+        stream_stats.latency_us_avg = latency_us;
+    }
+    else
+    {
+        stream_stats.latency_us_avg = stream_stats.latency_us_avg - stream_stats.latency_us_avg / 16 + latency_us / 16;
+    }
+
+    stream_fps_window_frames++;
+    int64_t window_us = shown_us - stream_fps_window_start_us;
+    if (window_us >= 1000000)
+    {
+        stream_stats.fps = (uint32_t)(stream_fps_window_frames * 1000000LL / window_us);
+        stream_fps_window_start_us = shown_us;
+        stream_fps_window_frames = 0;
+    }
+}
+
+void stream_get_stats(stream_stats_t* stats)
+{
+    *stats = stream_stats;
+    stats->packets_rejected = stream_parser.packets_rejected;
+    stats->packets_lost = stream_parser.packets_lost;
+    if (esp_timer_get_time() - stream_fps_window_start_us > 2000000)
+    {
+        // Nothing has been shown lately
+        stats->fps = 0;
+    }
+}
@@ -0,0 +1,64 @@
+
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+
+// esp_err_t
+#include "esp_err.h"
+
+// Real-time pixel streaming from lighting controllers (xLights, WLED, QLC+...).
+//
+// A listener task accepts two protocols:
+//
+//   DDP (Distributed Display Protocol) on UDP port 4048. Packets carry a byte
+//   offset into the frame, so a frame may span several packets; the packet
+//   with the PUSH flag set completes it.
+//
+//   E1.31 (streaming ACN) on UDP port 5568, unicast or multicast. Channels
+//   1..360 of universe CONFIG_LC_STREAM_E131_UNIVERSE hold the frame. A data
+//   packet completes the frame unless it names a synchronization universe,
+//   in which case the matching sync packet does.
+//
+// Pixel data is copied straight from the receive buffer into the back half
+// of a double buffer. Completing a frame swaps the halves and wakes the render
+// task, which shows it while lpat_stream is running. Frames are laid out like
+// LED_FRAME_LEN: R,G,B bytes, strip after strip.
+
+#define STREAM_DDP_PORT 4048
+#define STREAM_E131_PORT 5568
+
+typedef struct _stream_stats_t {
+    uint32_t packets;
+    // packets that were malformed, not for us, or arrived out of order
+    uint32_t packets_rejected;
+    // packets missing according to the sequence numbers
+    uint32_t packets_lost;
+    // complete frames received
+    uint32_t frames;
+    // frames written to the strips
+    uint32_t frames_shown;
+    // complete frames replaced by a newer one before they could be shown
+    uint32_t frames_dropped;
+    // frames shown per second, averaged over the last second or so
+    uint32_t fps;
+    // time from receiving the first packet of a frame to the end of its refresh
+    uint32_t latency_us_last;
+    uint32_t latency_us_avg;
+    uint32_t latency_us_max;
+} stream_stats_t;
+
+esp_err_t stream_init(void);
+
+// Get the newest complete frame if one arrived since the last call, and keep
+// the listener from swapping it out until stream_unlock_frame. Returns NULL
+// (and does not lock) when there is nothing new. received_us is when the
+// frame's first packet arrived.
+const uint8_t* stream_lock_frame(int64_t* received_us);
+void stream_unlock_frame(void);
+
+// Record that a frame has made it onto the wire
+void stream_frame_shown(int64_t received_us, int64_t shown_us);
+
+void stream_get_stats(stream_stats_t* stats);
@@ -0,0 +1,221 @@
+#include "stream_packet.h"
+
+// Logging facility
+#include <esp_log.h>
+
+// memcpy
+#include <string.h>
+
+// LED_FRAME_LEN
+#include "led.h"
+
+#define TAG "stream_packet.c"
+
+// DDP header (http://www.3waylabs.com/ddp/)
+#define DDP_HEADER_LEN 10
+#define DDP_TIMECODE_LEN 4
+#define DDP_FLAGS_VER_MASK 0xC0
+#define DDP_FLAGS_VER1 0x40
+#define DDP_FLAGS_TIMECODE 0x10
+#define DDP_FLAGS_STORAGE 0x08
+#define DDP_FLAGS_REPLY 0x04
+#define DDP_FLAGS_QUERY 0x02
+#define DDP_FLAGS_PUSH 0x01
+#define DDP_SEQUENCE_MASK 0x0F
+#define DDP_ID_DISPLAY 1
+#define DDP_ID_ALL 255
+
+// E1.31 (ANSI E1.31-2018) field offsets and values
+#define E131_ACN_ID_OFFSET 4
+#define E131_ROOT_VECTOR_OFFSET 18
+#define E131_FRAMING_VECTOR_OFFSET 40
+#define E131_SYNC_ADDRESS_OFFSET 109
+#define E131_SEQUENCE_OFFSET 111
+#define E131_OPTIONS_OFFSET 112
+#define E131_UNIVERSE_OFFSET 113
+#define E131_DMP_VECTOR_OFFSET 117
+#define E131_DMP_TYPE_OFFSET 118
+#define E131_PROPERTY_COUNT_OFFSET 123
+#define E131_START_CODE_OFFSET 125
+#define E131_SLOTS_OFFSET 126
+#define E131_DATA_HEADER_LEN E131_SLOTS_OFFSET
+#define E131_SYNC_PACKET_SEQUENCE_OFFSET 44
+#define E131_SYNC_PACKET_ADDRESS_OFFSET 45
+#define E131_SYNC_PACKET_LEN 49
+#define E131_VECTOR_ROOT_DATA 0x00000004
+#define E131_VECTOR_ROOT_EXTENDED 0x00000008
+#define E131_VECTOR_DATA_PACKET 0x00000002
+#define E131_VECTOR_EXTENDED_SYNCHRONIZATION 0x00000001
+#define E131_DMP_VECTOR_SET_PROPERTY 0x02
+#define E131_DMP_ADDRESS_DATA_TYPE 0xA1
+#define E131_OPTION_STREAM_TERMINATED 0x40
+#define E131_DMX_START_CODE 0x00
+// E1.31 6.7.2: sequence numbers this far behind the last one are stale, not a wrap
+#define E131_SEQUENCE_STALE_WINDOW 20
+
+static const uint8_t e131_acn_id[] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+
+static uint16_t read_be16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t read_be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t stream_write_pixels(uint8_t* frame, uint32_t offset, const uint8_t* data, uint32_t len)
+{
+    if (offset >= LED_FRAME_LEN)
+    {
+        return 0;
+    }
+    if (len > LED_FRAME_LEN - offset)
+    {
+        len = LED_FRAME_LEN - offset;
+    }
+    memcpy(frame + offset, data, len);
+    return STREAM_PACKET_PIXELS;
+}
+
+void stream_parser_init(stream_parser_t* parser, uint16_t universe)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->universe = universe;
+}
+
+uint32_t stream_parse_ddp(stream_parser_t* parser, uint8_t* frame, const uint8_t* packet, int len)
+{
+    if (len < DDP_HEADER_LEN || (packet[0] & DDP_FLAGS_VER_MASK) != DDP_FLAGS_VER1)
+    {
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    const uint8_t flags = packet[0];
+    const uint8_t destination = packet[3];
+    // Queries, replies, and configuration are not supported; only pixel data
+    if ((flags & (DDP_FLAGS_QUERY | DDP_FLAGS_REPLY | DDP_FLAGS_STORAGE)) ||
+        (destination != DDP_ID_DISPLAY && destination != DDP_ID_ALL))
+    {
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    // Sequence numbers run 1..15; 0 means the sender doesn't use them. The
+    // range is too small to tell reordering from loss, so gaps count as loss.
+    const uint8_t sequence = packet[1] & DDP_SEQUENCE_MASK;
+    if (sequence != 0)
+    {
+        if (parser->ddp_last_sequence != 0)
+        {
+            uint8_t expected = parser->ddp_last_sequence % 15 + 1;
+            parser->packets_lost += (sequence + 15 - expected) % 15;
+        }
+        parser->ddp_last_sequence = sequence;
+    }
+
+    const int header_len = DDP_HEADER_LEN + ((flags & DDP_FLAGS_TIMECODE) ? DDP_TIMECODE_LEN : 0);
+    const uint32_t offset = read_be32(packet + 4);
+    uint32_t data_len = read_be16(packet + 8);
+    if (len < header_len || data_len > (uint32_t)(len - header_len))
+    {
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    uint32_t result = stream_write_pixels(frame, offset, packet + header_len, data_len);
+    if (flags & DDP_FLAGS_PUSH)
+    {
+        result |= STREAM_PACKET_COMPLETE;
+    }
+    return result;
+}
+
+uint32_t stream_parse_e131(stream_parser_t* parser, uint8_t* frame, const uint8_t* packet, int len)
+{
+    if (len < E131_SYNC_PACKET_LEN || memcmp(packet + E131_ACN_ID_OFFSET, e131_acn_id, sizeof(e131_acn_id)) != 0)
+    {
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    const uint32_t root_vector = read_be32(packet + E131_ROOT_VECTOR_OFFSET);
+    const uint32_t framing_vector = read_be32(packet + E131_FRAMING_VECTOR_OFFSET);
+
+    if (root_vector == E131_VECTOR_ROOT_EXTENDED && framing_vector == E131_VECTOR_EXTENDED_SYNCHRONIZATION)
+    {
+        uint16_t sync_address = read_be16(packet + E131_SYNC_PACKET_ADDRESS_OFFSET);
+        if (parser->e131_pending_sync_address != 0 && sync_address == parser->e131_pending_sync_address)
+        {
+            parser->e131_pending_sync_address = 0;
+            return STREAM_PACKET_COMPLETE;
+        }
+        return 0;
+    }
+
+    if (root_vector != E131_VECTOR_ROOT_DATA ||
+        framing_vector != E131_VECTOR_DATA_PACKET ||
+        len < E131_DATA_HEADER_LEN ||
+        packet[E131_DMP_VECTOR_OFFSET] != E131_DMP_VECTOR_SET_PROPERTY ||
+        packet[E131_DMP_TYPE_OFFSET] != E131_DMP_ADDRESS_DATA_TYPE)
+    {
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    if (read_be16(packet + E131_UNIVERSE_OFFSET) != parser->universe)
+    {
+        // Multicast can deliver other universes on the same port
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    if (packet[E131_OPTIONS_OFFSET] & E131_OPTION_STREAM_TERMINATED)
+    {
+        ESP_LOGI(TAG, "%s: sender terminated the stream", __FUNCTION__);
+        parser->e131_sequence_valid = pdFALSE;
+        parser->e131_pending_sync_address = 0;
+        return 0;
+    }
+
+    const uint8_t sequence = packet[E131_SEQUENCE_OFFSET];
+    if (parser->e131_sequence_valid)
+    {
+        int8_t delta = (int8_t)(sequence - parser->e131_last_sequence);
+        if (delta <= 0 && delta > -E131_SEQUENCE_STALE_WINDOW)
+        {
+            parser->packets_rejected++;
+            return 0;
+        }
+        if (delta > 1)
+        {
+            parser->packets_lost += delta - 1;
+        }
+    }
+    parser->e131_sequence_valid = pdTRUE;
+    parser->e131_last_sequence = sequence;
+
+    // The property value count includes the start code
+    uint32_t slot_count = read_be16(packet + E131_PROPERTY_COUNT_OFFSET);
+    if (slot_count < 1 || packet[E131_START_CODE_OFFSET] != E131_DMX_START_CODE ||
+        slot_count - 1 > (uint32_t)(len - E131_SLOTS_OFFSET))
+    {
+        parser->packets_rejected++;
+        return 0;
+    }
+
+    uint32_t result = stream_write_pixels(frame, 0, packet + E131_SLOTS_OFFSET, slot_count - 1);
+
+    uint16_t sync_address = read_be16(packet + E131_SYNC_ADDRESS_OFFSET);
+    if (sync_address == 0)
+    {
+        result |= STREAM_PACKET_COMPLETE;
+    }
+    else
+    {
+        parser->e131_pending_sync_address = sync_address;
+    }
+    return result;
+}
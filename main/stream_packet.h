@@ -0,0 +1,41 @@
+#pragma once
+
+// required by many headers
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+
+// Parsing of DDP and E1.31 packets into frames, for stream.c.
+//
+// No sockets, tasks or locks here: the parser is handed one received packet
+// at a time and the frame to write its pixels into, and says what the packet
+// did. That keeps it buildable off the device, so it can be checked against
+// packets from a real sender on a desktop.
+
+// What a packet did, as a bitmask; 0 when it did nothing
+// Pixels were written into the frame
+#define STREAM_PACKET_PIXELS 0x01
+// The frame is complete and should be shown
+#define STREAM_PACKET_COMPLETE 0x02
+
+typedef struct _stream_parser_t {
+    // E1.31 universe whose channels 1..LED_FRAME_LEN are the frame
+    uint16_t universe;
+    // packets that were malformed, not for us, or arrived out of order
+    uint32_t packets_rejected;
+    // packets missing according to the sequence numbers
+    uint32_t packets_lost;
+
+    // Sequence tracking; 0 means no packet seen yet
+    uint8_t ddp_last_sequence;
+    bool e131_sequence_valid;
+    uint8_t e131_last_sequence;
+    // Synchronization universe the filled frame is waiting on, or 0
+    uint16_t e131_pending_sync_address;
+} stream_parser_t;
+
+void stream_parser_init(stream_parser_t* parser, uint16_t universe);
+
+// Parse one packet, writing any pixels it carries into frame (LED_FRAME_LEN
+// bytes). Returns STREAM_PACKET_* flags.
+uint32_t stream_parse_ddp(stream_parser_t* parser, uint8_t* frame, const uint8_t* packet, int len);
+uint32_t stream_parse_e131(stream_parser_t* parser, uint8_t* frame, const uint8_t* packet, int len);
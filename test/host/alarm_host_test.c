@@ -0,0 +1,718 @@
+// Runs the alarm state machine and the schedules off the device, on a virtual
+// clock in US Pacific time, through DST changes and across midnight. Each
+// scenario checks when the machine changed state and what it asked the LEDs
+// to show, and the per-step cost is reported.
+//
+// alarm_host_test [SCENARIO...]
+
+#include "alarm.h"
+#include "led.h"
+#include "schedule.h"
+#include "settings_storage.h"
+
+#include "host_stubs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// With the DST rules spelled out, so the scenarios don't depend on the host's
+// zoneinfo
+#define HOST_TZ "PST+8PDT,M3.2.0/2,M11.1.0/2"
+
+// alarm.c's states, in the order of its alarm_wait_task_state_t; read the way
+// http.c reads them
+extern int alarm_current_state;
+
+typedef enum _host_alarm_state_t {
+    host_initializing,
+    host_configuring,
+    host_waiting,
+    host_snoozing,
+    host_running,
+    host_sleep_mode_start,
+    host_sleep_mode_delay,
+    host_sleep_mode_fade,
+} host_alarm_state_t;
+
+static const char* host_state_names[] = {
+    "initializing",
+    "configuring",
+    "waiting",
+    "snoozing",
+    "running",
+    "sleep_mode_start",
+    "sleep_mode_delay",
+    "sleep_mode_fade",
+};
+
+// Virtual clock and command source
+//
+// Replaces alarm_platform.c. Waiting for a command moves the clock to the
+// next scripted command or the deadline, whichever is first, and takes no
+// time otherwise.
+
+static int64_t host_now_us = 0;
+static int64_t host_end_us = 0;
+
+#define HOST_SCRIPT_MAX 16
+
+typedef struct _host_command_t {
+    int64_t at_us;
+    alarm_command command;
+} host_command_t;
+
+static host_command_t host_script[HOST_SCRIPT_MAX];
+static int host_script_len = 0;
+static int host_script_next = 0;
+
+static alarm_command_message_t host_queue[ALARM_COMMAND_QUEUE_LEN];
+static int host_queue_len = 0;
+
+esp_err_t alarm_platform_init(void)
+{
+    return ESP_OK;
+}
+
+int64_t alarm_clock_us(void)
+{
+    return host_now_us;
+}
+
+int64_t alarm_uptime_us(void)
+{
+    return host_now_us;
+}
+
+// Host CPU nanoseconds stand in for cycles
+uint32_t alarm_cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+bool alarm_post_command(const alarm_command_message_t* message, TickType_t ticks)
+{
+    if (host_queue_len >= ALARM_COMMAND_QUEUE_LEN)
+    {
+        return pdFALSE;
+    }
+    host_queue[host_queue_len++] = *message;
+    return pdTRUE;
+}
+
+// Send a command the way the web server or a button would
+static void host_send(alarm_command command)
+{
+    switch (command)
+    {
+    case alarm_command_stop:
+        alarm_stop();
+        break;
+    case alarm_command_snooze:
+        alarm_snooze();
+        break;
+    case alarm_command_reconfig:
+        alarm_system_time_or_settings_changed();
+        break;
+    case alarm_command_manual_start:
+        alarm_manual_start();
+        break;
+    case alarm_command_sleep_start:
+        sleep_start();
+        break;
+    case alarm_command_sleep_stop:
+        sleep_stop();
+        break;
+    default:
+        break;
+    }
+}
+
+bool alarm_wait_command(alarm_command_message_t* message, TickType_t ticks)
+{
+    if (host_queue_len == 0 && ticks > 0)
+    {
+        int64_t wake_us = host_end_us;
+        if (ticks != portMAX_DELAY && host_now_us + (int64_t)ticks * portTICK_PERIOD_MS * 1000 < wake_us)
+        {
+            wake_us = host_now_us + (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+        }
+        if (host_script_next < host_script_len && host_script[host_script_next].at_us <= wake_us)
+        {
+            // Commands scripted for the same time arrive together, as one
+            // batch
+            wake_us = host_script[host_script_next].at_us;
+            while (host_script_next < host_script_len && host_script[host_script_next].at_us == wake_us)
+            {
+                host_send(host_script[host_script_next++].command);
+            }
+        }
+        if (wake_us > host_now_us)
+        {
+            host_now_us = wake_us;
+        }
+    }
+    if (host_queue_len == 0)
+    {
+        return pdFALSE;
+    }
+    *message = host_queue[0];
+    host_queue_len--;
+    memmove(host_queue, host_queue + 1, host_queue_len * sizeof(*host_queue));
+    return pdTRUE;
+}
+
+// The rest of the firmware the alarm and schedules call into
+
+// What the state machine asked the LEDs to do
+#define HOST_LED_SUNRISE lpat_max
+
+typedef struct _host_led_t {
+    int64_t at_us;
+    // a pattern, or HOST_LED_SUNRISE
+    led_pattern_t pattern;
+    time_t alarm_time;
+} host_led_t;
+
+#define HOST_LED_LOG_MAX 4096
+
+static host_led_t host_led_log[HOST_LED_LOG_MAX];
+static int host_led_log_len = 0;
+
+static void host_led_record(led_pattern_t p, time_t alarm_time)
+{
+    if (host_led_log_len < HOST_LED_LOG_MAX)
+    {
+        host_led_log[host_led_log_len++] = (host_led_t){ host_now_us, p, alarm_time };
+    }
+}
+
+esp_err_t led_run_sync(led_pattern_t p)
+{
+    host_led_record(p, 0);
+    return ESP_OK;
+}
+
+esp_err_t led_run_sunrise(time_t alarm_time)
+{
+    host_led_record(HOST_LED_SUNRISE, alarm_time);
+    return ESP_OK;
+}
+
+void led_set_status_indicator(led_status_index idx, led_color_t color_id)
+{
+}
+
+void led_settings_changed(void)
+{
+}
+
+void palette_settings_changed(void)
+{
+}
+
+void settings_request_save(void)
+{
+}
+
+// State changes
+
+typedef struct _host_transition_t {
+    int64_t at_us;
+    int state;
+} host_transition_t;
+
+#define HOST_TRANSITIONS_MAX 1024
+
+static host_transition_t host_transitions[HOST_TRANSITIONS_MAX];
+static int host_transition_count = 0;
+
+// Scenarios
+
+static const char* host_scenario_name = NULL;
+static int host_failures = 0;
+
+#define HOST_CHECK(cond, ...) \
+    do { \
+        if (!(cond)) \
+        { \
+            host_failures++; \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, host_scenario_name); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+        } \
+    } while (0)
+
+static int64_t host_local_us(int year, int month, int day, int hour, int minute)
+{
+    struct tm local = {
+        .tm_year = year - 1900,
+        .tm_mon = month - 1,
+        .tm_mday = day,
+        .tm_hour = hour,
+        .tm_min = minute,
+        .tm_isdst = -1,
+    };
+    return (int64_t)mktime(&local) * 1000000;
+}
+
+// For the times DST makes ambiguous or skips
+static int64_t host_utc_us(int year, int month, int day, int hour, int minute)
+{
+    struct tm utc = {
+        .tm_year = year - 1900,
+        .tm_mon = month - 1,
+        .tm_mday = day,
+        .tm_hour = hour,
+        .tm_min = minute,
+    };
+    return (int64_t)timegm(&utc) * 1000000;
+}
+
+#define HOST_MINUTE_US (60 * 1000000LL)
+
+static void host_at(int64_t at_us, alarm_command command)
+{
+    if (host_script_len < HOST_SCRIPT_MAX)
+    {
+        host_script[host_script_len++] = (host_command_t){ at_us, command };
+    }
+}
+
+// Everything back to defaults, with no schedules, starting at start_us
+static void host_reset(int64_t start_us)
+{
+    host_settings_reset();
+    ESP_ERROR_CHECK(schedule_set(NULL, 0, NULL, 0));
+    host_now_us = start_us;
+    host_script_len = 0;
+    host_script_next = 0;
+    host_queue_len = 0;
+}
+
+typedef struct _host_result_t {
+    uint32_t steps;
+    int64_t cpu_ns;
+} host_result_t;
+
+// Run the alarm task from a reconfiguration until end_us, recording every
+// state change
+static void host_run(int64_t end_us, host_result_t* result)
+{
+    alarm_stats_t before;
+    alarm_get_stats(&before);
+    host_led_log_len = 0;
+    host_transition_count = 0;
+    host_end_us = end_us;
+
+    struct timespec start_ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_ts);
+
+    alarm_system_time_or_settings_changed();
+    int64_t deadline_us = INT64_MAX;
+    int last_state = -1;
+    int stalled = 0;
+    while (host_now_us < host_end_us)
+    {
+        int64_t pass_start_us = host_now_us;
+        deadline_us = alarm_task_pass(deadline_us);
+        if (alarm_current_state != last_state && host_transition_count < HOST_TRANSITIONS_MAX)
+        {
+            host_transitions[host_transition_count++] = (host_transition_t){ host_now_us, alarm_current_state };
+            last_state = alarm_current_state;
+        }
+        stalled = host_now_us == pass_start_us ? stalled + 1 : 0;
+        if (stalled > 100)
+        {
+            HOST_CHECK(pdFALSE, "stuck at %lld in state %s", (long long)host_now_us, host_state_names[alarm_current_state]);
+            break;
+        }
+    }
+
+    struct timespec end_ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end_ts);
+    alarm_stats_t after;
+    alarm_get_stats(&after);
+    result->steps = after.steps - before.steps;
+    result->cpu_ns = (int64_t)(end_ts.tv_sec - start_ts.tv_sec) * 1000000000 + (end_ts.tv_nsec - start_ts.tv_nsec);
+}
+
+// Times the machine entered state in [from_us, to_us), up to max of them
+static int host_entries(int state, int64_t from_us, int64_t to_us, int64_t* at_us, int max)
+{
+    int found = 0;
+    for (int idx = 0; idx < host_transition_count; idx++)
+    {
+        const host_transition_t* t = &host_transitions[idx];
+        if (t->state == state && from_us <= t->at_us && t->at_us < to_us)
+        {
+            if (found < max)
+            {
+                at_us[found] = t->at_us;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+// The state the machine was in at at_us
+static int host_state_at(int64_t at_us)
+{
+    int state = -1;
+    for (int idx = 0; idx < host_transition_count && host_transitions[idx].at_us <= at_us; idx++)
+    {
+        state = host_transitions[idx].state;
+    }
+    return state;
+}
+
+// LED requests for p (or HOST_LED_SUNRISE) in [from_us, to_us)
+static int host_led_count(led_pattern_t p, int64_t from_us, int64_t to_us)
+{
+    int found = 0;
+    for (int idx = 0; idx < host_led_log_len; idx++)
+    {
+        const host_led_t* led = &host_led_log[idx];
+        found += led->pattern == p && from_us <= led->at_us && led->at_us < to_us;
+    }
+    return found;
+}
+
+static const host_led_t* host_led_first(led_pattern_t p, int64_t from_us)
+{
+    for (int idx = 0; idx < host_led_log_len; idx++)
+    {
+        if (host_led_log[idx].pattern == p && host_led_log[idx].at_us >= from_us)
+        {
+            return &host_led_log[idx];
+        }
+    }
+    return NULL;
+}
+
+// Check the machine went off exactly at expected_us, and nowhere else in
+// [from_us, to_us)
+static void host_check_running_at(int64_t from_us, int64_t to_us, const int64_t* expected_us, int expected_count)
+{
+    int64_t at_us[8];
+    int count = host_entries(host_running, from_us, to_us, at_us, 8);
+    HOST_CHECK(count == expected_count, "went off %d times, expected %d", count, expected_count);
+    for (int idx = 0; idx < count && idx < expected_count; idx++)
+    {
+        HOST_CHECK(at_us[idx] == expected_us[idx], "went off at %lld, expected %lld",
+                   (long long)at_us[idx] / 1000000, (long long)expected_us[idx] / 1000000);
+    }
+}
+
+// An alarm every day at 02:30, which doesn't exist on the day DST starts:
+// mktime moves it an hour on, to 03:30 PDT, and it goes off once
+static void scenario_spring_forward(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 3, 13, 12, 0));
+    set_setting_u32(setting_alarm_hour, 2);
+    set_setting_u32(setting_alarm_minute, 30);
+    host_run(host_local_us(2021, 3, 16, 0, 0), result);
+
+    const int64_t expected_us[] = {
+        // 03:30 PDT
+        host_utc_us(2021, 3, 14, 10, 30),
+        // 02:30 PDT
+        host_utc_us(2021, 3, 15, 9, 30),
+    };
+    host_check_running_at(0, INT64_MAX, expected_us, 2);
+    // Flashing between black and the alarm pattern, a pair a second, until
+    // it gives up on its own after alarm_on_cycle_count_max of them and one
+    HOST_CHECK(host_led_count(lpat_fill_whyamionfirewhite, expected_us[0], expected_us[0] + HOST_MINUTE_US) == 51,
+               "flashed %d times", host_led_count(lpat_fill_whyamionfirewhite, expected_us[0], expected_us[0] + HOST_MINUTE_US));
+    HOST_CHECK(host_state_at(expected_us[0] + 2 * HOST_MINUTE_US) == host_waiting, "still going after two minutes");
+}
+
+// An alarm every day at 01:30, which happens twice on the day DST ends; it
+// goes off at the first, in PDT, and not again an hour later
+static void scenario_fall_back(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 11, 6, 12, 0));
+    set_setting_u32(setting_alarm_hour, 1);
+    set_setting_u32(setting_alarm_minute, 30);
+    host_at(host_utc_us(2021, 11, 7, 8, 31), alarm_command_stop);
+    host_run(host_local_us(2021, 11, 9, 0, 0), result);
+
+    const int64_t expected_us[] = {
+        // 01:30 PDT
+        host_utc_us(2021, 11, 7, 8, 30),
+        // 01:30 PST
+        host_utc_us(2021, 11, 8, 9, 30),
+    };
+    host_check_running_at(0, INT64_MAX, expected_us, 2);
+    HOST_CHECK(host_state_at(host_utc_us(2021, 11, 7, 8, 31) + 1) == host_waiting, "stop didn't stop it");
+}
+
+// A sunrise for an alarm just after midnight starts the evening before, and
+// the alarm that follows holds the daylight rather than flashing
+static void scenario_midnight_sunrise(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 6, 21, 22, 0));
+    set_setting_u32(setting_alarm_hour, 0);
+    set_setting_u32(setting_alarm_minute, 10);
+    set_setting_u32(setting_sunrise_duration_min, 30);
+    int64_t alarm_us = host_local_us(2021, 6, 22, 0, 10);
+    host_at(alarm_us + 5 * HOST_MINUTE_US, alarm_command_stop);
+    host_run(host_local_us(2021, 6, 22, 1, 0), result);
+
+    const host_led_t* sunrise = host_led_first(HOST_LED_SUNRISE, 0);
+    HOST_CHECK(sunrise != NULL, "no sunrise");
+    if (sunrise != NULL)
+    {
+        HOST_CHECK(sunrise->at_us == host_local_us(2021, 6, 21, 23, 40), "sunrise started at %lld", (long long)sunrise->at_us / 1000000);
+        HOST_CHECK(sunrise->alarm_time == alarm_us / 1000000, "sunrise for %lld", (long long)sunrise->alarm_time);
+    }
+    HOST_CHECK(host_led_count(HOST_LED_SUNRISE, 0, INT64_MAX) == 1, "%d sunrises", host_led_count(HOST_LED_SUNRISE, 0, INT64_MAX));
+    host_check_running_at(0, INT64_MAX, &alarm_us, 1);
+    HOST_CHECK(host_led_count(lpat_fill_black, alarm_us, INT64_MAX) == 0, "flashed after a sunrise");
+    HOST_CHECK(host_state_at(alarm_us + 6 * HOST_MINUTE_US) == host_waiting, "stop didn't stop it");
+}
+
+// Getting up during the sunrise dismisses the alarm it leads to
+static void scenario_sunrise_dismissed(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 6, 22, 22, 0));
+    set_setting_u32(setting_alarm_hour, 0);
+    set_setting_u32(setting_alarm_minute, 5);
+    set_setting_u32(setting_sunrise_duration_min, 15);
+    int64_t alarm_us = host_local_us(2021, 6, 23, 0, 5);
+    host_at(alarm_us - 2 * HOST_MINUTE_US, alarm_command_stop);
+    host_run(host_local_us(2021, 6, 23, 1, 0), result);
+
+    HOST_CHECK(host_led_count(HOST_LED_SUNRISE, host_local_us(2021, 6, 22, 23, 50), alarm_us) == 1, "no sunrise at 23:50");
+    host_check_running_at(0, INT64_MAX, NULL, 0);
+    HOST_CHECK(host_led_count(lpat_fill_black, alarm_us - 2 * HOST_MINUTE_US, alarm_us) == 1, "the sunrise wasn't turned off");
+}
+
+// Weekday alarms just after midnight skip Saturday and Sunday mornings, even
+// though they're Friday and Saturday nights
+static void scenario_midnight_weekdays(host_result_t* result)
+{
+    // Friday
+    host_reset(host_local_us(2021, 6, 25, 12, 0));
+    set_setting_u32(setting_alarm_enabled, 0);
+    const schedule_entry_t entries[] = {
+        { .action = schedule_action_alarm, .hour = 0, .minute = 5, .days = SCHEDULE_WEEKDAYS },
+    };
+    // Not on Tuesday, either
+    const uint32_t skip_dates[] = { 20210629 };
+    ESP_ERROR_CHECK(schedule_set(entries, 1, skip_dates, 1));
+    host_run(host_local_us(2021, 7, 1, 1, 0), result);
+
+    const int64_t expected_us[] = {
+        host_local_us(2021, 6, 28, 0, 5),
+        host_local_us(2021, 6, 30, 0, 5),
+        host_local_us(2021, 7, 1, 0, 5),
+    };
+    host_check_running_at(0, INT64_MAX, expected_us, 3);
+}
+
+// Snoozing just before midnight goes off again in the next day
+static void scenario_midnight_snooze(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 6, 24, 22, 0));
+    set_setting_u32(setting_alarm_hour, 23);
+    set_setting_u32(setting_alarm_minute, 55);
+    set_setting_u32(setting_alarm_snooze_interval_min, 9);
+    int64_t alarm_us = host_local_us(2021, 6, 24, 23, 55);
+    int64_t snooze_us = alarm_us + 30 * 1000000;
+    host_at(snooze_us, alarm_command_snooze);
+    host_at(snooze_us + 10 * HOST_MINUTE_US, alarm_command_stop);
+    host_run(host_local_us(2021, 6, 25, 1, 0), result);
+
+    const int64_t expected_us[] = { alarm_us, snooze_us + 9 * HOST_MINUTE_US };
+    host_check_running_at(0, INT64_MAX, expected_us, 2);
+    HOST_CHECK(host_state_at(snooze_us + 1) == host_snoozing, "not snoozing");
+    HOST_CHECK(host_led_count(lpat_fill_black, snooze_us, snooze_us + 1) == 1, "snoozing didn't turn the light off");
+    HOST_CHECK(host_led_count(lpat_fill_whyamionfirewhite, snooze_us, expected_us[1]) == 0, "flashed while snoozing");
+    HOST_CHECK(host_state_at(snooze_us + 10 * HOST_MINUTE_US) == host_waiting, "stop didn't stop it");
+}
+
+// A sleep timer started before midnight fades out after it
+static void scenario_midnight_sleep(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 6, 25, 23, 0));
+    set_setting_u32(setting_alarm_enabled, 0);
+    set_setting_u32(setting_sleep_delay_min, 5);
+    set_setting_u32(setting_sleep_fade_time_min, 15);
+    int64_t start_us = host_local_us(2021, 6, 25, 23, 58);
+    host_at(start_us, alarm_command_sleep_start);
+    host_run(host_local_us(2021, 6, 26, 1, 0), result);
+
+    HOST_CHECK(host_led_count(lpat_fade_start, start_us, start_us + 1) == 1, "fade_start not shown");
+    const host_led_t* step = host_led_first(lpat_fade_step, 0);
+    HOST_CHECK(step != NULL && step->at_us == start_us + 5 * HOST_MINUTE_US, "fade_step not shown at 00:03");
+    int64_t at_us[2];
+    HOST_CHECK(host_entries(host_waiting, start_us, INT64_MAX, at_us, 2) == 1 && at_us[0] == start_us + 20 * HOST_MINUTE_US,
+               "didn't finish at 00:18");
+}
+
+// Four weeks of a full schedule, to time the steps
+static void scenario_busy_month(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 2, 28, 0, 0));
+    set_setting_u32(setting_sunrise_duration_min, 15);
+    schedule_entry_t entries[SCHEDULE_MAX_ENTRIES];
+    for (int entryIdx = 0; entryIdx < SCHEDULE_MAX_ENTRIES; entryIdx++)
+    {
+        entries[entryIdx] = (schedule_entry_t){
+            .action = entryIdx % 4 == 0 ? schedule_action_alarm : schedule_action_pattern,
+            .pattern = lpat_fill_red + entryIdx % 8,
+            .hour = (entryIdx * 7) % 24,
+            .minute = (entryIdx * 13) % 60,
+            .days = SCHEDULE_DAY(entryIdx % 7) | SCHEDULE_DAY((entryIdx + 3) % 7),
+        };
+    }
+    ESP_ERROR_CHECK(schedule_set(entries, SCHEDULE_MAX_ENTRIES, NULL, 0));
+    host_run(host_local_us(2021, 3, 28, 0, 0), result);
+
+    // 8 alarms twice a week, and the settings alarm every day
+    int64_t at_us[1];
+    int count = host_entries(host_running, 0, INT64_MAX, at_us, 0);
+    HOST_CHECK(count == 4 * (8 * 2 + 7), "went off %d times", count);
+}
+
+// Batches
+//
+// Commands sent while the alarm task is busy, e.g. drawing a fill, are taken
+// together. Each must still act, in order, except where a later one in the
+// batch overrides it.
+
+// Starting and straight away cancelling a sleep timer leaves no fade running
+static void scenario_batch_sleep_cancel(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 7, 2, 21, 0));
+    set_setting_u32(setting_alarm_enabled, 0);
+    set_setting_u32(setting_sleep_delay_min, 5);
+    int64_t batch_us = host_local_us(2021, 7, 2, 21, 30);
+    host_at(batch_us, alarm_command_sleep_start);
+    host_at(batch_us, alarm_command_sleep_stop);
+    host_run(host_local_us(2021, 7, 2, 23, 0), result);
+
+    HOST_CHECK(host_state_at(batch_us) == host_waiting, "in %s after the batch", host_state_names[host_state_at(batch_us)]);
+    HOST_CHECK(host_led_count(lpat_fade_start, batch_us, batch_us + 1) == 1, "fade_start not shown");
+    HOST_CHECK(host_led_count(lpat_fade_step, 0, INT64_MAX) == 0, "faded after the timer was cancelled");
+}
+
+// A manual start right behind a settings change still starts the alarm
+static void scenario_batch_reconfig_start(host_result_t* result)
+{
+    host_reset(host_local_us(2021, 7, 3, 21, 0));
+    int64_t batch_us = host_local_us(2021, 7, 3, 21, 30);
+    host_at(batch_us, alarm_command_reconfig);
+    host_at(batch_us, alarm_command_manual_start);
+    host_at(batch_us + HOST_MINUTE_US, alarm_command_stop);
+    host_run(host_local_us(2021, 7, 3, 23, 0), result);
+
+    host_check_running_at(0, INT64_MAX, &batch_us, 1);
+    HOST_CHECK(host_state_at(batch_us + HOST_MINUTE_US) == host_waiting, "stop didn't stop it");
+}
+
+// Snooze and stop together stop the alarm, whichever came first
+static void host_batch_snooze_stop(int day, alarm_command first, alarm_command second, host_result_t* result)
+{
+    host_reset(host_local_us(2021, 7, day, 6, 0));
+    set_setting_u32(setting_alarm_hour, 7);
+    set_setting_u32(setting_alarm_minute, 0);
+    int64_t alarm_us = host_local_us(2021, 7, day, 7, 0);
+    int64_t batch_us = alarm_us + 30 * 1000000;
+    host_at(batch_us, first);
+    host_at(batch_us, second);
+    alarm_stats_t before;
+    alarm_get_stats(&before);
+    host_run(host_local_us(2021, 7, day, 8, 0), result);
+    alarm_stats_t after;
+    alarm_get_stats(&after);
+
+    host_check_running_at(0, INT64_MAX, &alarm_us, 1);
+    HOST_CHECK(host_state_at(batch_us) == host_waiting, "in %s after the batch", host_state_names[host_state_at(batch_us)]);
+    HOST_CHECK(host_entries(host_snoozing, 0, INT64_MAX, NULL, 0) == 0, "snoozed");
+    HOST_CHECK(host_led_count(lpat_fill_black, batch_us, INT64_MAX) == 0, "snoozing turned the light off");
+    HOST_CHECK(after.commands_superseded - before.commands_superseded == 1, "%u commands superseded",
+               after.commands_superseded - before.commands_superseded);
+}
+
+static void scenario_batch_snooze_stop(host_result_t* result)
+{
+    host_batch_snooze_stop(4, alarm_command_snooze, alarm_command_stop, result);
+}
+
+static void scenario_batch_stop_snooze(host_result_t* result)
+{
+    host_batch_snooze_stop(5, alarm_command_stop, alarm_command_snooze, result);
+}
+
+typedef struct _host_scenario_t {
+    const char* name;
+    void (*run)(host_result_t* result);
+} host_scenario_t;
+
+// In order of date, so nothing one leaves behind is in the next one's future
+static const host_scenario_t host_scenarios[] = {
+    { "busy_month", scenario_busy_month },
+    { "spring_forward", scenario_spring_forward },
+    { "midnight_sunrise", scenario_midnight_sunrise },
+    { "sunrise_dismissed", scenario_sunrise_dismissed },
+    { "midnight_snooze", scenario_midnight_snooze },
+    { "midnight_weekdays", scenario_midnight_weekdays },
+    { "midnight_sleep", scenario_midnight_sleep },
+    { "batch_sleep_cancel", scenario_batch_sleep_cancel },
+    { "batch_reconfig_start", scenario_batch_reconfig_start },
+    { "batch_snooze_stop", scenario_batch_snooze_stop },
+    { "batch_stop_snooze", scenario_batch_stop_snooze },
+    { "fall_back", scenario_fall_back },
+};
+
+#define HOST_SCENARIO_COUNT ((int)(sizeof(host_scenarios) / sizeof(host_scenarios[0])))
+
+int main(int argc, char** argv)
+{
+    setenv("TZ", HOST_TZ, 1);
+    tzset();
+    ESP_ERROR_CHECK(schedule_init());
+
+    int run = 0;
+    printf("%-24s %8s %12s %10s\n", "scenario", "steps", "transitions", "ns/step");
+    for (int scenarioIdx = 0; scenarioIdx < HOST_SCENARIO_COUNT; scenarioIdx++)
+    {
+        const host_scenario_t* scenario = &host_scenarios[scenarioIdx];
+        bool selected = argc < 2;
+        for (int argIdx = 1; argIdx < argc; argIdx++)
+        {
+            selected |= strcmp(argv[argIdx], scenario->name) == 0;
+        }
+        if (!selected)
+        {
+            continue;
+        }
+
+        host_scenario_name = scenario->name;
+        int failures_before = host_failures;
+        host_result_t result;
+        scenario->run(&result);
+        run++;
+        printf("%-24s %8u %12d %10.0f%s\n", scenario->name, result.steps, host_transition_count,
+               result.steps > 0 ? (double)result.cpu_ns / result.steps : 0,
+               host_failures == failures_before ? "" : "  FAILED");
+    }
+    if (run == 0)
+    {
+        fprintf(stderr, "no scenario matched\n");
+        return 2;
+    }
+
+    // The state machine's own timing, leaving out the LED calls
+    alarm_stats_t stats;
+    alarm_get_stats(&stats);
+    printf("alarm_step: %u steps, %u ns average, %u ns worst\n", stats.steps, stats.step_cycles_avg, stats.step_cycles_max);
+    printf("%s\n", host_failures == 0 ? "all alarm scenarios passed" : "alarm scenarios FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "host_led.h"
+#include "palette.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Not in led.h: the device only starts these from led_init
+void led_init_task(void* param);
+
+// Virtual clock
+//
+// Waits take no time; they just move the clock.
+
+static int64_t host_now_us = 0;
+
+int64_t led_clock_us(void)
+{
+    return host_now_us;
+}
+
+void led_clock_wall(struct timeval* tv)
+{
+    tv->tv_sec = HOST_WALL_EPOCH + host_now_us / 1000000;
+    tv->tv_usec = host_now_us % 1000000;
+}
+
+// Only patterns drawing inside led_run_sync wait, with led_semaphore free, so
+// the render task gets to run any passes due meanwhile
+void led_clock_delay_ms(int ms)
+{
+    int64_t end_us = host_now_us + (int64_t)ms * 1000;
+    int64_t wake_us = led_render_pass(host_now_us, pdFALSE);
+    while (wake_us >= 0 && wake_us < end_us)
+    {
+        if (wake_us > host_now_us)
+        {
+            host_now_us = wake_us;
+        }
+        wake_us = led_render_pass(wake_us, pdTRUE);
+    }
+    host_now_us = end_us;
+}
+
+int64_t host_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+esp_err_t host_led_init(void)
+{
+    // Patterns that show the time show it in UTC
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    esp_err_t err = palette_init();
+    if (err == ESP_OK)
+    {
+        led_init_task(&err);
+    }
+    return err;
+}
+
+void host_run_pattern(led_pattern_t p, int64_t duration_us)
+{
+    int64_t end_us = host_now_us + duration_us;
+    esp_err_t err = led_run_sync(p);
+    if (err != ESP_OK)
+    {
+        fprintf(stderr, "led_run_sync(%s) failed (0x%x)\n", led_pattern_names[p], err);
+    }
+
+    int64_t due_us = 0;
+    bool on_deadline = pdFALSE;
+    while (pdTRUE)
+    {
+        int64_t wake_us = led_render_pass(due_us, on_deadline);
+        if (wake_us < 0 || wake_us >= end_us)
+        {
+            break;
+        }
+        if (wake_us > host_now_us)
+        {
+            host_now_us = wake_us;
+        }
+        due_us = wake_us;
+        on_deadline = pdTRUE;
+    }
+    if (host_now_us < end_us)
+    {
+        host_now_us = end_us;
+    }
+}
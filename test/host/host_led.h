@@ -0,0 +1,21 @@
+#pragma once
+
+#include "led.h"
+
+// What the host executables share for running led.c: a virtual clock that
+// replaces led.c's weak clocks, and a loop that stands in for the render task.
+// Compiled into each executable rather than host_platform, so the clocks
+// override led.c's (an archive member would never be pulled in for them).
+
+// 2021-06-21 07:00:00 UTC, a Monday morning
+#define HOST_WALL_EPOCH 1624258800
+
+// Set up the palettes and led.c as led_init would, without starting its task
+esp_err_t host_led_init(void);
+
+// Run p the way led_run_sync and the render task would, until duration_us
+// has passed on the virtual clock or p has nothing left to draw
+void host_run_pattern(led_pattern_t p, int64_t duration_us);
+
+// Host CPU time used by this process, in ns
+int64_t host_cpu_ns(void);
@@ -0,0 +1,359 @@
+// Host implementations of the ESP-IDF and FreeRTOS calls the firmware makes.
+// Everything runs on the one thread that calls it.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "driver/rmt.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "cJSON.h"
+
+// clock_gettime
+#include <time.h>
+
+// memcpy, memset, strcmp
+#include <string.h>
+
+// Any non-NULL handle will do
+static int host_handle;
+
+BaseType_t __attribute__((weak)) xTaskCreate(TaskFunction_t func, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* task)
+{
+    return pdFAIL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* task, BaseType_t core)
+{
+    return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+uint32_t __attribute__((weak)) ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    return 0;
+}
+
+BaseType_t __attribute__((weak)) xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &host_handle;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return pdTRUE;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return &host_handle;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks)
+{
+    return bits;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* timer)
+{
+    *timer = (esp_timer_handle_t)&host_handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t rmt_config(const rmt_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+// The data partition, erased to 0xFF like flash
+#define HOST_PARTITION_SIZE (64 * 1024)
+static uint8_t host_partition_data[HOST_PARTITION_SIZE];
+static bool host_partition_erased = pdFALSE;
+static const esp_partition_t host_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .size = HOST_PARTITION_SIZE,
+    .label = "host",
+};
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    if (!host_partition_erased)
+    {
+        memset(host_partition_data, 0xFF, sizeof(host_partition_data));
+        host_partition_erased = pdTRUE;
+    }
+    return type == ESP_PARTITION_TYPE_DATA ? &host_partition : NULL;
+}
+
+static bool host_partition_in_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    return partition == &host_partition && offset <= HOST_PARTITION_SIZE && size <= HOST_PARTITION_SIZE - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if (!host_partition_in_range(partition, src_offset, size))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, host_partition_data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if (!host_partition_in_range(partition, dst_offset, size))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Writes can only clear bits, as on flash
+    const uint8_t* bytes = src;
+    for (size_t i = 0; i < size; i++)
+    {
+        host_partition_data[dst_offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if (!host_partition_in_range(partition, offset, size) || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(host_partition_data + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle)
+{
+    if (!host_partition_in_range(partition, offset, size))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_ptr = host_partition_data + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+}
+
+// NVS
+
+#define HOST_NVS_KEYS 8
+#define HOST_NVS_KEY_LEN 16
+#define HOST_NVS_BLOB_LEN 4096
+
+typedef struct {
+    char key[HOST_NVS_KEY_LEN];
+    size_t len;
+    uint8_t data[HOST_NVS_BLOB_LEN];
+} host_nvs_blob_t;
+
+static host_nvs_blob_t host_nvs_blobs[HOST_NVS_KEYS];
+
+static host_nvs_blob_t* host_nvs_find(const char* key, bool create)
+{
+    for (int blobIdx = 0; blobIdx < HOST_NVS_KEYS; blobIdx++)
+    {
+        host_nvs_blob_t* blob = &host_nvs_blobs[blobIdx];
+        if (strcmp(blob->key, key) == 0 || (create && blob->key[0] == '\0'))
+        {
+            strncpy(blob->key, key, HOST_NVS_KEY_LEN - 1);
+            return blob;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    host_nvs_blob_t* blob = host_nvs_find(key, pdFALSE);
+    if (blob == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (*length < blob->len)
+    {
+        *length = blob->len;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, blob->data, blob->len);
+    *length = blob->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    host_nvs_blob_t* blob = host_nvs_find(key, pdTRUE);
+    if (blob == NULL || length > HOST_NVS_BLOB_LEN)
+    {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    memcpy(blob->data, value, length);
+    blob->len = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+// cJSON
+
+cJSON* cJSON_CreateObject(void)
+{
+    return NULL;
+}
+
+cJSON* cJSON_CreateNumber(double num)
+{
+    return NULL;
+}
+
+cJSON* cJSON_CreateStringArray(const char* const* strings, int count)
+{
+    return NULL;
+}
+
+cJSON* cJSON_CreateIntArray(const int* numbers, int count)
+{
+    return NULL;
+}
+
+cJSON* cJSON_AddArrayToObject(cJSON* object, const char* name)
+{
+    return NULL;
+}
+
+cJSON* cJSON_AddObjectToObject(cJSON* object, const char* name)
+{
+    return NULL;
+}
+
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number)
+{
+    return NULL;
+}
+
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string)
+{
+    return NULL;
+}
+
+cJSON_bool cJSON_AddItemToArray(cJSON* array, cJSON* item)
+{
+    return pdFALSE;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item)
+{
+    return pdFALSE;
+}
+
+cJSON_bool cJSON_PrintPreallocated(cJSON* item, char* buffer, const int length, const cJSON_bool format)
+{
+    return pdFALSE;
+}
+
+cJSON* cJSON_Parse(const char* value)
+{
+    return NULL;
+}
+
+void cJSON_Delete(cJSON* item)
+{
+}
+
+void cJSON_DeleteItemFromObject(cJSON* object, const char* name)
+{
+}
+
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* name)
+{
+    return NULL;
+}
+
+cJSON_bool cJSON_IsArray(const cJSON* item)
+{
+    return pdFALSE;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON* item)
+{
+    return pdFALSE;
+}
+
+cJSON_bool cJSON_IsObject(const cJSON* item)
+{
+    return pdFALSE;
+}
+
+cJSON_bool cJSON_IsString(const cJSON* item)
+{
+    return pdFALSE;
+}
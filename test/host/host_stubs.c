@@ -0,0 +1,93 @@
+// The firmware modules the LED code calls into but the host build leaves
+// out: settings without NVS, power locks that only count, and a stream
+// listener that never receives anything.
+
+#include "host_stubs.h"
+
+// SETTINGS_TABLE
+#include "settings_storage.h"
+
+// Setting defaults name these
+#include "clip.h"
+#include "palette.h"
+
+#include "power.h"
+#include "stream.h"
+
+// memcpy
+#include <string.h>
+
+#define SETTING(name, default, range) [setting_##name] = default,
+static const uint32_t host_setting_defaults[settings_name_enum_max] = { SETTINGS_TABLE };
+#undef SETTING
+
+static uint32_t host_settings[settings_name_enum_max];
+
+void host_settings_reset(void)
+{
+    memcpy(host_settings, host_setting_defaults, sizeof(host_settings));
+    palette_settings_changed();
+    led_settings_changed();
+}
+
+uint32_t get_setting_u32(settings_name id)
+{
+    if (id >= settings_name_enum_max)
+    {
+        return 0;
+    }
+    return host_settings[id];
+}
+
+// Not range checked; the harness only sets values from the table
+esp_err_t set_setting_u32(settings_name id, uint32_t value)
+{
+    if (id >= settings_name_enum_max)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_settings[id] = value;
+    palette_settings_changed();
+    led_settings_changed();
+    return ESP_OK;
+}
+
+static uint32_t host_power_locks[power_lock_max];
+
+void power_lock_acquire(power_lock_t lock)
+{
+    host_power_locks[lock]++;
+}
+
+void power_lock_release(power_lock_t lock)
+{
+    if (host_power_locks[lock] == 0)
+    {
+        fprintf(stderr, "power lock %d released more often than acquired\n", lock);
+        abort();
+    }
+    host_power_locks[lock]--;
+}
+
+uint32_t host_power_locks_held(void)
+{
+    uint32_t held = 0;
+    for (int lock = 0; lock < power_lock_max; lock++)
+    {
+        held += host_power_locks[lock];
+    }
+    return held;
+}
+
+const uint8_t* stream_lock_frame(int64_t* received_us)
+{
+    return NULL;
+}
+
+void stream_unlock_frame(void)
+{
+}
+
+void stream_frame_shown(int64_t received_us, int64_t shown_us)
+{
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+// Put every setting back to its default from SETTINGS_TABLE
+void host_settings_reset(void);
+
+// Power locks currently held, over all locks; 0 whenever nothing is drawing
+uint32_t host_power_locks_held(void);
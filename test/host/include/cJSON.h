@@ -0,0 +1,40 @@
+// The cJSON calls the firmware makes, declared so it builds. The JSON for the
+// web pages isn't exercised off the device: host_platform.c builds nothing and
+// parses nothing.
+#pragma once
+
+typedef int cJSON_bool;
+
+typedef struct cJSON {
+    struct cJSON* next;
+    struct cJSON* prev;
+    struct cJSON* child;
+    int type;
+    char* valuestring;
+    int valueint;
+    double valuedouble;
+    char* string;
+} cJSON;
+
+cJSON* cJSON_CreateObject(void);
+cJSON* cJSON_CreateNumber(double num);
+cJSON* cJSON_CreateStringArray(const char* const* strings, int count);
+cJSON* cJSON_CreateIntArray(const int* numbers, int count);
+cJSON* cJSON_AddArrayToObject(cJSON* object, const char* name);
+cJSON* cJSON_AddObjectToObject(cJSON* object, const char* name);
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number);
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string);
+cJSON_bool cJSON_AddItemToArray(cJSON* array, cJSON* item);
+cJSON_bool cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item);
+cJSON_bool cJSON_PrintPreallocated(cJSON* item, char* buffer, const int length, const cJSON_bool format);
+cJSON* cJSON_Parse(const char* value);
+void cJSON_Delete(cJSON* item);
+void cJSON_DeleteItemFromObject(cJSON* object, const char* name);
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* name);
+cJSON_bool cJSON_IsArray(const cJSON* item);
+cJSON_bool cJSON_IsNumber(const cJSON* item);
+cJSON_bool cJSON_IsObject(const cJSON* item);
+cJSON_bool cJSON_IsString(const cJSON* item);
+
+#define cJSON_ArrayForEach(element, array) \
+    for (element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
@@ -0,0 +1,34 @@
+// Enough of the RMT driver to configure channels that don't exist; the LED
+// strips themselves are mocked
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum {
+    RMT_CHANNEL_0,
+    RMT_CHANNEL_1,
+    RMT_CHANNEL_2,
+    RMT_CHANNEL_3,
+    RMT_CHANNEL_4,
+    RMT_CHANNEL_5,
+    RMT_CHANNEL_6,
+    RMT_CHANNEL_7,
+} rmt_channel_t;
+
+typedef struct {
+    rmt_channel_t channel;
+    int gpio_num;
+    uint8_t clk_div;
+    uint8_t mem_block_num;
+} rmt_config_t;
+
+#define RMT_DEFAULT_CONFIG_TX(gpio, channel_id) \
+    {                                           \
+        .channel = channel_id,                  \
+        .gpio_num = gpio,                       \
+        .clk_div = 80,                          \
+        .mem_block_num = 1,                     \
+    }
+
+esp_err_t rmt_config(const rmt_config_t* config);
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags);
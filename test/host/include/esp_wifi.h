@@ -0,0 +1,14 @@
+// Only the configuration type power.h mentions
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint16_t listen_interval;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+// Fail, so nothing that would run forever is ever started. These and the
+// notifications are weak, so a harness can run a task itself.
+BaseType_t xTaskCreate(TaskFunction_t func, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* task);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* task, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
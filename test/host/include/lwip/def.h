@@ -0,0 +1,3 @@
+#pragma once
+
+#define LWIP_ARRAYSIZE(x) (sizeof(x) / sizeof((x)[0]))
@@ -0,0 +1,7 @@
+// The sdkconfig values the host build needs, at their defaults from
+// main/Kconfig.projbuild
+#pragma once
+
+#define CONFIG_LC_LED_STRIP_1_DATA_PIN 12
+#define CONFIG_LC_LED_STRIP_2_DATA_PIN 13
+#define CONFIG_LC_STREAM_E131_UNIVERSE 1
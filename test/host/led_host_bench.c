@@ -0,0 +1,240 @@
+// Benchmarks for the LED effects, on host CPU time. The host is many times
+// faster than an ESP32, so the numbers are for comparing changes and for
+// checking an effect's cost stays a small share of a core, not for predicting
+// the device's; the device reports its own in /diag.
+//
+// led_host_bench
+//
+// Fails if an effect goes over its budget on the host, which would mean
+// something has become far slower than it should be.
+
+#include "led.h"
+#include "noise.h"
+#include "settings_storage.h"
+
+#include "host_led.h"
+#include "host_stubs.h"
+#include "mock_strip.h"
+
+#include <stdio.h>
+
+#define BENCH_FPS 60
+#define BENCH_PIXELS (LED_STRIP_COUNT * LEDS_PER_STRIP)
+#define BENCH_SECONDS 60
+
+// Noise
+//
+// Each ambient effect samples noise per pixel per frame in its own way. Shown
+// at BENCH_PIXELS x BENCH_FPS, with every frame rendered, which is three times
+// as often as the night light actually renders keyframes.
+
+// Share of one host core the noise for any effect may take at BENCH_FPS
+#define BENCH_NOISE_MAX_PERCENT 5.0
+
+typedef enum _bench_noise_shape_t {
+    // two 2D samples per pixel, like the candle
+    bench_noise_candle,
+    // one 2D sample per pixel, like the fire
+    bench_noise_fire,
+    // a 3D and a 2D sample per pixel, like the aurora
+    bench_noise_aurora,
+    bench_noise_shape_max
+} bench_noise_shape_t;
+
+static const char* bench_noise_names[] = {
+    [bench_noise_candle] = "candle",
+    [bench_noise_fire] = "fire",
+    [bench_noise_aurora] = "aurora",
+};
+
+// Sums every sample, so none of them can be optimized away
+static volatile uint32_t bench_sink;
+
+static uint32_t bench_noise_frame(bench_noise_shape_t shape, uint32_t t)
+{
+    uint32_t sum = 0;
+    for (int pixelIdx = 0; pixelIdx < BENCH_PIXELS; pixelIdx++)
+    {
+        uint32_t x = pixelIdx * (NOISE_ONE / 12);
+        switch (shape)
+        {
+        case bench_noise_candle:
+            sum += noise2(x, t * 3) + noise2(x, t / 2);
+            break;
+        case bench_noise_fire:
+            sum += noise2(x, t);
+            break;
+        case bench_noise_aurora:
+            sum += noise3(x, (pixelIdx / LEDS_PER_STRIP) * NOISE_ONE / 2, t / 8) + noise2(x * 2, t / 3);
+            break;
+        default:
+            break;
+        }
+    }
+    return sum;
+}
+
+static bool bench_noise(void)
+{
+    bool passed = pdTRUE;
+    printf("%-24s %10s %10s %10s\n", "noise", "ns/pixel", "us/frame", "% core");
+    for (int shape = 0; shape < bench_noise_shape_max; shape++)
+    {
+        int frames = BENCH_SECONDS * BENCH_FPS;
+        uint32_t sum = 0;
+        int64_t start_ns = host_cpu_ns();
+        for (int frameIdx = 0; frameIdx < frames; frameIdx++)
+        {
+            // One noise unit a second
+            sum += bench_noise_frame(shape, (uint32_t)((int64_t)frameIdx * NOISE_ONE / BENCH_FPS));
+        }
+        int64_t cpu_ns = host_cpu_ns() - start_ns;
+        bench_sink += sum;
+
+        double ns_per_frame = (double)cpu_ns / frames;
+        double percent = ns_per_frame * BENCH_FPS / 1e7;
+        bool over = percent > BENCH_NOISE_MAX_PERCENT;
+        printf("%-24s %10.1f %10.2f %10.3f%s\n", bench_noise_names[shape], ns_per_frame / BENCH_PIXELS,
+               ns_per_frame / 1e3, percent, over ? "  OVER BUDGET" : "");
+        passed &= !over;
+    }
+    return passed;
+}
+
+// Patterns
+//
+// Whole patterns through led.c, as the render task runs them, for
+// BENCH_SECONDS on the virtual clock. Includes interpolating, committing and
+// the mock strips, so it's what the pattern as a whole costs.
+
+typedef struct _bench_pattern_t {
+    const char* name;
+    led_pattern_t pattern;
+    // One setting to change from its default, or settings_name_enum_max
+    settings_name setting;
+    uint32_t value;
+} bench_pattern_t;
+
+static const bench_pattern_t bench_patterns[] = {
+    { "night_light_candle", lpat_night_light, setting_night_light_mode, night_light_candle },
+    { "night_light_fire", lpat_night_light, setting_night_light_mode, night_light_fire },
+    { "night_light_aurora", lpat_night_light, setting_night_light_mode, night_light_aurora },
+};
+
+#define BENCH_PATTERN_COUNT ((int)(sizeof(bench_patterns) / sizeof(bench_patterns[0])))
+
+static void bench_patterns_run(void)
+{
+    printf("%-24s %10s %10s %10s\n", "pattern", "fps", "us/frame", "% core");
+    for (int patternIdx = 0; patternIdx < BENCH_PATTERN_COUNT; patternIdx++)
+    {
+        const bench_pattern_t* bench = &bench_patterns[patternIdx];
+        host_settings_reset();
+        if (bench->setting != settings_name_enum_max)
+        {
+            set_setting_u32(bench->setting, bench->value);
+        }
+        mock_strip_reset_stats();
+        int64_t start_ns = host_cpu_ns();
+        host_run_pattern(bench->pattern, BENCH_SECONDS * 1000000LL);
+        int64_t cpu_ns = host_cpu_ns() - start_ns;
+
+        mock_strip_stats_t strip_stats;
+        mock_strip_get_stats(&strip_stats);
+        uint32_t frames = strip_stats.refreshes / LED_STRIP_COUNT;
+        printf("%-24s %10.1f %10.2f %10.3f\n", bench->name, (double)frames / BENCH_SECONDS,
+               frames > 0 ? cpu_ns / 1e3 / frames : 0, cpu_ns / (BENCH_SECONDS * 1e7));
+    }
+}
+
+// Particles
+//
+// The particle effects through led.c for BENCH_SECONDS each, with the
+// smallest and the largest particle budget. Particles per ms counts every
+// particle moved and drawn, over the CPU time of the whole render pass, so
+// it includes clearing and committing the frame and is the rate the effect
+// as a whole sustains.
+
+typedef struct _bench_particles_t {
+    led_pattern_t pattern;
+    uint32_t budget;
+} bench_particles_t;
+
+static const bench_particles_t bench_particles[] = {
+    { lpat_comets, 8 },
+    { lpat_comets, 128 },
+    { lpat_twinkles, 8 },
+    { lpat_twinkles, 128 },
+    { lpat_raindrops, 8 },
+    { lpat_raindrops, 128 },
+};
+
+#define BENCH_PARTICLES_COUNT ((int)(sizeof(bench_particles) / sizeof(bench_particles[0])))
+
+// Particles drawn into the frames committed so far; the live count as a frame
+// is committed is every particle that frame moved and drew
+static uint64_t bench_particle_updates = 0;
+static uint32_t bench_particle_peak = 0;
+
+static void bench_particles_refreshed(int stripIdx, const uint8_t* rgb, uint32_t led_count)
+{
+    if (stripIdx == 0)
+    {
+        led_particle_stats_t stats;
+        led_get_particle_stats(&stats);
+        bench_particle_updates += stats.live;
+        if (stats.live > bench_particle_peak)
+        {
+            bench_particle_peak = stats.live;
+        }
+    }
+}
+
+static void bench_particles_run(void)
+{
+    printf("%-24s %10s %10s %10s %10s %10s\n", "particles", "budget", "mean live", "peak", "dropped", "per ms");
+    mock_strip_set_refresh_cb(bench_particles_refreshed);
+    for (int benchIdx = 0; benchIdx < BENCH_PARTICLES_COUNT; benchIdx++)
+    {
+        const bench_particles_t* bench = &bench_particles[benchIdx];
+        host_settings_reset();
+        set_setting_u32(setting_particle_budget, bench->budget);
+        led_particle_stats_t before;
+        led_get_particle_stats(&before);
+        mock_strip_reset_stats();
+        bench_particle_updates = 0;
+        bench_particle_peak = 0;
+        int64_t start_ns = host_cpu_ns();
+        host_run_pattern(bench->pattern, BENCH_SECONDS * 1000000LL);
+        int64_t cpu_ns = host_cpu_ns() - start_ns;
+
+        led_particle_stats_t after;
+        led_get_particle_stats(&after);
+        mock_strip_stats_t strip_stats;
+        mock_strip_get_stats(&strip_stats);
+        uint32_t frames = strip_stats.refreshes / LED_STRIP_COUNT;
+        printf("%-24s %10u %10.1f %10u %10u %10.0f\n", led_pattern_names[bench->pattern], bench->budget,
+               frames > 0 ? (double)bench_particle_updates / frames : 0,
+               bench_particle_peak,
+               after.dropped - before.dropped,
+               cpu_ns > 0 ? bench_particle_updates * 1e6 / cpu_ns : 0);
+    }
+    mock_strip_set_refresh_cb(NULL);
+}
+
+int main(int argc, char** argv)
+{
+    esp_err_t err = host_led_init();
+    if (err != ESP_OK)
+    {
+        fprintf(stderr, "LED init failed (0x%x)\n", err);
+        return 2;
+    }
+
+    bool passed = bench_noise();
+    printf("\n");
+    bench_patterns_run();
+    printf("\n");
+    bench_particles_run();
+    return passed ? 0 : 1;
+}
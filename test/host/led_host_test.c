@@ -0,0 +1,692 @@
+// Runs the LED patterns off the device, against mock strips and a virtual
+// clock, and checks every refresh against the golden frames checked in under
+// golden/. Prints each pattern's frame rate on the virtual clock and how fast
+// the host pushed pixels to the strips.
+//
+// led_host_test GOLDEN_DIR [--update] [SCENARIO...]
+//
+// --update rewrites the golden files instead of checking them. Review the
+// diff before committing it: any change to a pattern's output shows up there.
+
+#include "led.h"
+#include "clip.h"
+#include "palette.h"
+#include "settings_storage.h"
+
+#include "host_led.h"
+#include "host_stubs.h"
+#include "mock_strip.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Scenarios
+
+typedef struct _host_scenario_t {
+    const char* name;
+    // Shown for HOST_FROM_US first, so the scenario covers the transition from
+    // it; lpat_max to start from black
+    led_pattern_t from;
+    led_pattern_t pattern;
+    // One setting to change from its default, or settings_name_enum_max
+    settings_name setting;
+    uint32_t value;
+    int64_t duration_us;
+    // lpat_clip plays the delta clip from the golden directory rather than
+    // the raw one built by host_store_clip
+    bool delta_clip;
+} host_scenario_t;
+
+#define HOST_FROM_US 1000000
+#define HOST_STILL_US 1000000
+#define HOST_ANIMATION_US 2000000
+// A fill takes fill_time_ms, then the transition has to finish
+#define HOST_FILL_US 3500000
+
+#define STILL(p) { #p, lpat_max, lpat_##p, settings_name_enum_max, 0, HOST_STILL_US }
+#define FILL(p) { #p, lpat_max, lpat_##p, settings_name_enum_max, 0, HOST_FILL_US }
+#define ANIMATION(p) { #p, lpat_max, lpat_##p, settings_name_enum_max, 0, HOST_ANIMATION_US }
+#define WITH_SETTING(name, p, s, v) { name, lpat_max, lpat_##p, setting_##s, v, HOST_ANIMATION_US }
+#define TRANSITION(from, p) { #from "_to_" #p, lpat_##from, lpat_##p, settings_name_enum_max, 0, HOST_ANIMATION_US }
+#define DELTA_CLIP(name, mode) { name, lpat_max, lpat_clip, setting_clip_playback_mode, mode, HOST_ANIMATION_US, pdTRUE }
+
+static const host_scenario_t host_scenarios[] = {
+    STILL(sudden_red),
+    STILL(sudden_green),
+    STILL(sudden_blue),
+    STILL(sudden_cyan),
+    STILL(sudden_magenta),
+    STILL(sudden_yellow),
+    STILL(sudden_black),
+    STILL(sudden_white),
+    FILL(fill_red),
+    FILL(fill_green),
+    FILL(fill_blue),
+    FILL(fill_cyan),
+    FILL(fill_magenta),
+    FILL(fill_yellow),
+    FILL(fill_black),
+    FILL(fill_white),
+    FILL(fill_whyamionfirewhite),
+    FILL(fill_auiiieeyellow),
+    FILL(fill_whosebloodisthisred),
+    FILL(night_light),
+    WITH_SETTING("night_light_candle", night_light, night_light_mode, night_light_candle),
+    WITH_SETTING("night_light_fire", night_light, night_light_mode, night_light_fire),
+    WITH_SETTING("night_light_aurora", night_light, night_light_mode, night_light_aurora),
+    ANIMATION(current_time),
+    STILL(color_showcase),
+    STILL(brightness_gradient),
+    STILL(demo_cie),
+    STILL(demo_cct),
+    ANIMATION(status_indicators),
+    STILL(local_time_in_unix_epoch_seconds),
+    STILL(fade_start),
+    ANIMATION(fade_step),
+    ANIMATION(rambo_brite),
+    ANIMATION(clip),
+    WITH_SETTING("clip_ping_pong", clip, clip_playback_mode, clip_mode_ping_pong),
+    ANIMATION(stream),
+    ANIMATION(analog_clock),
+    ANIMATION(palette),
+    WITH_SETTING("palette_custom", palette, palette_pattern_palette, palette_custom),
+    ANIMATION(comets),
+    ANIMATION(twinkles),
+    ANIMATION(raindrops),
+    ANIMATION(sunrise),
+    ANIMATION(circadian),
+    WITH_SETTING("sudden_blue_linear", sudden_blue, transition_easing, led_easing_linear),
+    TRANSITION(comets, twinkles),
+    TRANSITION(palette, analog_clock),
+    TRANSITION(circadian, fade_step),
+    TRANSITION(comets, fill_blue),
+    DELTA_CLIP("clip_delta", clip_mode_loop),
+    DELTA_CLIP("clip_delta_ping_pong", clip_mode_ping_pong),
+};
+
+#define HOST_SCENARIO_COUNT ((int)(sizeof(host_scenarios) / sizeof(host_scenarios[0])))
+
+// Recording
+//
+// One line per strip refresh: the time since the scenario started, the strip
+// and a CRC-32 of its pixels. Every HOST_DUMP_INTERVAL-th refresh, and each
+// strip as the scenario ends, also has the pixels in hex, so a failure shows
+// what changed and not just that something did.
+
+#define HOST_DUMP_INTERVAL 30
+
+static char* host_record = NULL;
+static size_t host_record_len = 0;
+static size_t host_record_cap = 0;
+static bool host_recording = pdFALSE;
+static int64_t host_record_start_us = 0;
+static uint32_t host_record_refreshes = 0;
+// Refreshes at distinct times, so both strips refreshed together count once
+static uint32_t host_record_frames = 0;
+static int64_t host_record_last_frame_us = -1;
+static int64_t host_record_ns = 0;
+
+static void host_record_printf(const char* format, ...)
+{
+    va_list args;
+    while (pdTRUE)
+    {
+        size_t room = host_record_cap - host_record_len;
+        va_start(args, format);
+        int len = vsnprintf(host_record + host_record_len, room, format, args);
+        va_end(args);
+        if (len >= 0 && (size_t)len < room)
+        {
+            host_record_len += len;
+            return;
+        }
+        host_record_cap = host_record_cap * 2 + 4096;
+        host_record = realloc(host_record, host_record_cap);
+        if (host_record == NULL)
+        {
+            fprintf(stderr, "out of memory recording frames\n");
+            exit(2);
+        }
+    }
+}
+
+static uint32_t host_crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static void host_record_hex(const uint8_t* rgb, uint32_t len)
+{
+    host_record_printf(" ");
+    for (uint32_t i = 0; i < len; i++)
+    {
+        host_record_printf("%02x", rgb[i]);
+    }
+}
+
+static void host_strip_refreshed(int stripIdx, const uint8_t* rgb, uint32_t led_count)
+{
+    if (!host_recording)
+    {
+        return;
+    }
+    int64_t start_ns = host_cpu_ns();
+    int64_t t_us = led_clock_us() - host_record_start_us;
+    host_record_printf("%lld %d %08x", (long long)t_us, stripIdx, host_crc32(rgb, led_count * 3));
+    if (host_record_refreshes % HOST_DUMP_INTERVAL == 0)
+    {
+        host_record_hex(rgb, led_count * 3);
+    }
+    host_record_printf("\n");
+    host_record_refreshes++;
+    if (t_us != host_record_last_frame_us)
+    {
+        host_record_frames++;
+        host_record_last_frame_us = t_us;
+    }
+    host_record_ns += host_cpu_ns() - start_ns;
+}
+
+// Clips
+
+// clip_delta.bin, built with
+//   python tools/clip_encode.py --raw clip_delta.raw --fps 20 --keyframe-interval 12 -o clip_delta.bin
+// and the frames it was built from. Its first half is a dot passing over a
+// sparse pattern, an RLE keyframe and then XOR deltas; its second half passes
+// over a gradient, a raw keyframe and then XOR deltas.
+#define HOST_DELTA_CLIP "clip_delta.bin"
+#define HOST_DELTA_FRAMES "clip_delta.raw"
+
+static char* host_delta_clip = NULL;
+static size_t host_delta_clip_len = 0;
+static char* host_delta_frames = NULL;
+static size_t host_delta_frames_len = 0;
+
+// Replace the stored clip, returning what clip_upload_end made of it
+static esp_err_t host_upload_clip(const void* clip, size_t len)
+{
+    ESP_ERROR_CHECK(clip_upload_begin(len));
+    ESP_ERROR_CHECK(clip_upload_write(clip, len));
+    return clip_upload_end();
+}
+
+// A raw clip of a dot chasing along both strips, for lpat_clip
+#define HOST_CLIP_FRAMES 12
+#define HOST_CLIP_FPS 10
+
+static void host_store_clip(void)
+{
+    static uint8_t clip[sizeof(clip_header_t) + HOST_CLIP_FRAMES * LED_FRAME_LEN];
+    clip_header_t header = {
+        .magic = CLIP_MAGIC,
+        .version = CLIP_VERSION_RAW,
+        .header_len = sizeof(clip_header_t),
+        .strip_count = LED_STRIP_COUNT,
+        .leds_per_strip = LEDS_PER_STRIP,
+        .frame_count = HOST_CLIP_FRAMES,
+        .fps = HOST_CLIP_FPS,
+    };
+    memcpy(clip, &header, sizeof(header));
+    for (int frameIdx = 0; frameIdx < HOST_CLIP_FRAMES; frameIdx++)
+    {
+        uint8_t* frame = clip + sizeof(header) + frameIdx * LED_FRAME_LEN;
+        for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+        {
+            uint8_t* px = frame + (stripIdx * LEDS_PER_STRIP + frameIdx * 5) * 3;
+            px[0] = 40 * stripIdx;
+            px[1] = 200;
+            px[2] = 20 * frameIdx;
+        }
+    }
+    ESP_ERROR_CHECK(host_upload_clip(clip, sizeof(clip)));
+}
+
+// Running patterns
+
+typedef struct _host_result_t {
+    uint32_t frames;
+    uint32_t refreshes;
+    uint64_t pixels;
+    int64_t virtual_us;
+    // host CPU time spent in the LED code, not counting the recording
+    int64_t cpu_ns;
+} host_result_t;
+
+static const uint8_t host_black[LED_FRAME_LEN];
+
+static void host_run_scenario(const host_scenario_t* scenario, host_result_t* result)
+{
+    host_settings_reset();
+    if (scenario->setting != settings_name_enum_max)
+    {
+        set_setting_u32(scenario->setting, scenario->value);
+    }
+    // Start from black, with nothing running and the scenario's clip stored
+    led_show_frame(host_black);
+    if (scenario->pattern == lpat_clip)
+    {
+        if (scenario->delta_clip)
+        {
+            ESP_ERROR_CHECK(host_upload_clip(host_delta_clip, host_delta_clip_len));
+        }
+        else
+        {
+            host_store_clip();
+        }
+    }
+
+    host_record_len = 0;
+    host_record_refreshes = 0;
+    host_record_frames = 0;
+    host_record_last_frame_us = -1;
+    host_record_ns = 0;
+    host_record_start_us = led_clock_us();
+    mock_strip_reset_stats();
+    host_recording = pdTRUE;
+    int64_t start_ns = host_cpu_ns();
+
+    if (scenario->from != lpat_max)
+    {
+        host_run_pattern(scenario->from, HOST_FROM_US);
+    }
+    host_run_pattern(scenario->pattern, scenario->duration_us);
+
+    int64_t cpu_ns = host_cpu_ns() - start_ns - host_record_ns;
+    host_recording = pdFALSE;
+
+    uint8_t frame[LED_FRAME_LEN];
+    led_get_frame(frame);
+    for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+    {
+        host_record_printf("end %d", stripIdx);
+        host_record_hex(frame + stripIdx * LEDS_PER_STRIP * 3, LEDS_PER_STRIP * 3);
+        host_record_printf("\n");
+    }
+
+    mock_strip_stats_t strip_stats;
+    mock_strip_get_stats(&strip_stats);
+    result->frames = host_record_frames;
+    result->refreshes = host_record_refreshes;
+    result->pixels = strip_stats.pixels_set;
+    result->virtual_us = led_clock_us() - host_record_start_us;
+    result->cpu_ns = cpu_ns;
+}
+
+// Golden files
+
+static char* host_read_file(const char* path, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(size + 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size)
+    {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    data[size] = '\0';
+    fclose(f);
+    *len = size;
+    return data;
+}
+
+static bool host_write_file(const char* path, const char* data, size_t len)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        return pdFALSE;
+    }
+    bool ok = fwrite(data, 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+// Report the first line that differs, cut short so the hex stays readable
+static void host_report_difference(const char* name, const char* expected, const char* actual)
+{
+    int line = 1;
+    while (*expected != '\0' && *expected == *actual)
+    {
+        if (*expected == '\n')
+        {
+            line++;
+        }
+        expected++;
+        actual++;
+    }
+    while (line > 1 && expected[-1] != '\n')
+    {
+        expected--;
+        actual--;
+    }
+    int expected_len = (int)strcspn(expected, "\n");
+    int actual_len = (int)strcspn(actual, "\n");
+    fprintf(stderr, "%s: frames differ from line %d\n  expected: %.*s\n  actual:   %.*s\n",
+            name, line, expected_len < 100 ? expected_len : 100, expected, actual_len < 100 ? actual_len : 100, actual);
+}
+
+static bool host_check_golden(const char* dir, const char* name, bool update)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.txt", dir, name);
+
+    if (update)
+    {
+        if (!host_write_file(path, host_record, host_record_len))
+        {
+            fprintf(stderr, "%s: couldn't write %s\n", name, path);
+            return pdFALSE;
+        }
+        return pdTRUE;
+    }
+
+    size_t len;
+    char* expected = host_read_file(path, &len);
+    if (expected == NULL)
+    {
+        fprintf(stderr, "%s: no golden frames at %s (run with --update to record them)\n", name, path);
+        return pdFALSE;
+    }
+    bool same = len == host_record_len && memcmp(expected, host_record, len) == 0;
+    if (!same)
+    {
+        host_report_difference(name, expected, host_record);
+    }
+    free(expected);
+    return same;
+}
+
+// Requests led_run_sync turns down, a pattern that doesn't exist and a clip
+// that doesn't fit the strips, must leave what's showing running rather than
+// fading it out
+static bool host_check_rejected(void)
+{
+    bool passed = pdTRUE;
+    host_settings_reset();
+    // Nothing left over from the scenarios, like a clip still mapped
+    led_show_frame(host_black);
+    host_run_pattern(lpat_comets, 500000);
+
+    esp_err_t err = led_run_sync(lpat_max);
+    if (err != ESP_ERR_INVALID_ARG)
+    {
+        fprintf(stderr, "rejected: lpat_max gave 0x%x\n", err);
+        passed = pdFALSE;
+    }
+
+    // One black frame, for strips half as long
+    static uint8_t clip[sizeof(clip_header_t) + LED_FRAME_LEN / 2];
+    clip_header_t header = {
+        .magic = CLIP_MAGIC,
+        .version = CLIP_VERSION_RAW,
+        .header_len = sizeof(clip_header_t),
+        .strip_count = LED_STRIP_COUNT,
+        .leds_per_strip = LEDS_PER_STRIP / 2,
+        .frame_count = 1,
+        .fps = HOST_CLIP_FPS,
+    };
+    memcpy(clip, &header, sizeof(header));
+    ESP_ERROR_CHECK(host_upload_clip(clip, sizeof(clip)));
+    err = led_run_sync(lpat_clip);
+    if (err == ESP_OK)
+    {
+        fprintf(stderr, "rejected: a clip for other strips played\n");
+        passed = pdFALSE;
+    }
+
+    // Long past any transition, the comets still move
+    uint8_t before[LED_FRAME_LEN];
+    uint8_t after[LED_FRAME_LEN];
+    led_clock_delay_ms(3000);
+    led_get_frame(before);
+    led_clock_delay_ms(200);
+    led_get_frame(after);
+    if (memcmp(before, after, LED_FRAME_LEN) == 0)
+    {
+        fprintf(stderr, "rejected: the comets stopped\n");
+        passed = pdFALSE;
+    }
+
+    printf("%-36s %s\n", "rejected_requests", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+static bool host_check_delta_frame(clip_t* clip, uint32_t frame_idx, const char* what)
+{
+    const uint8_t* pixels = clip_get_frame(clip, frame_idx);
+    if (pixels == NULL || memcmp(pixels, host_delta_frames + frame_idx * LED_FRAME_LEN, LED_FRAME_LEN) != 0)
+    {
+        fprintf(stderr, "delta clip: frame %u, reached %s, %s\n", frame_idx, what, pixels == NULL ? "didn't decode" : "differs");
+        return pdFALSE;
+    }
+    return pdTRUE;
+}
+
+// Store a damaged copy of the delta clip: cut short at len, and with the byte
+// at offset set to value unless offset is 0. Returns what clip_upload_end and
+// then clip_map made of it; a clip that maps is left mapped.
+static esp_err_t host_map_damaged_clip(clip_t* clip, size_t len, size_t offset, uint8_t value)
+{
+    static uint8_t damaged[4096];
+    static uint8_t framebuffer[LED_FRAME_LEN];
+    if (host_delta_clip_len > sizeof(damaged))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(damaged, host_delta_clip, host_delta_clip_len);
+    if (offset != 0)
+    {
+        damaged[offset] = value;
+    }
+    esp_err_t err = host_upload_clip(damaged, len);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    return clip_map(clip, framebuffer, sizeof(framebuffer));
+}
+
+// The delta clip has to decode to the frames it was built from whichever way
+// it's stepped through, and damaged copies have to be refused up front or fail
+// to decode, never read outside their records
+static bool host_check_delta_clip(void)
+{
+    bool passed = pdTRUE;
+    static uint8_t framebuffer[LED_FRAME_LEN];
+    const clip_header_t* header = (const clip_header_t*)host_delta_clip;
+    const uint32_t* offsets = (const uint32_t*)(host_delta_clip + header->header_len);
+    const uint32_t frame_count = header->frame_count;
+    clip_t clip = { 0 };
+
+    ESP_ERROR_CHECK(host_upload_clip(host_delta_clip, host_delta_clip_len));
+    ESP_ERROR_CHECK(clip_map(&clip, framebuffer, sizeof(framebuffer)));
+    if (frame_count * LED_FRAME_LEN != host_delta_frames_len)
+    {
+        fprintf(stderr, "delta clip: %u frames, but %zu bytes of them to compare\n", frame_count, host_delta_frames_len);
+        passed = pdFALSE;
+    }
+    for (uint32_t frameIdx = 0; passed && frameIdx < frame_count; frameIdx++)
+    {
+        passed = host_check_delta_frame(&clip, frameIdx, "going forward");
+    }
+    // Undoing deltas, then back past the second keyframe into the first run
+    for (int32_t frameIdx = frame_count - 1; passed && frameIdx >= 0; frameIdx--)
+    {
+        passed = host_check_delta_frame(&clip, frameIdx, "going backward");
+    }
+    // Seeking both ways across the keyframes
+    static const uint32_t jumps[] = { 7, 19, 3, 12, 11, 23, 0, 13 };
+    for (int jumpIdx = 0; passed && jumpIdx < sizeof(jumps) / sizeof(jumps[0]); jumpIdx++)
+    {
+        passed = host_check_delta_frame(&clip, jumps[jumpIdx], "by seeking");
+    }
+    clip_unmap(&clip);
+
+    // Cut off inside the last record, and inside the record table
+    if (host_map_damaged_clip(&clip, host_delta_clip_len - 1, 0, 0) == ESP_OK ||
+        host_map_damaged_clip(&clip, header->header_len + 2 * sizeof(uint32_t), 0, 0) == ESP_OK)
+    {
+        fprintf(stderr, "delta clip: a truncated clip was stored\n");
+        clip_unmap(&clip);
+        passed = pdFALSE;
+    }
+    // Record 4 starting before record 3, and record 0 a delta with nothing to apply it to
+    if (host_map_damaged_clip(&clip, host_delta_clip_len, header->header_len + 4 * sizeof(uint32_t), 0) == ESP_OK ||
+        host_map_damaged_clip(&clip, host_delta_clip_len, offsets[0], clip_record_xor) == ESP_OK)
+    {
+        fprintf(stderr, "delta clip: a clip with a broken record table was mapped\n");
+        clip_unmap(&clip);
+        passed = pdFALSE;
+    }
+
+    // Records that only show up as corrupt once they're decoded: an unknown
+    // record type, an RLE run past the end of the frame and an XOR op past it
+    const struct {
+        size_t offset;
+        uint8_t value;
+        uint32_t frame_idx;
+    } corrupt[] = {
+        { offsets[5], 7, 5 },
+        { offsets[0] + 1, 255, 0 },
+        { offsets[1] + 1, 255, 1 },
+    };
+    for (int corruptIdx = 0; corruptIdx < sizeof(corrupt) / sizeof(corrupt[0]); corruptIdx++)
+    {
+        uint32_t frame_idx = corrupt[corruptIdx].frame_idx;
+        esp_err_t err = host_map_damaged_clip(&clip, host_delta_clip_len, corrupt[corruptIdx].offset, corrupt[corruptIdx].value);
+        if (err != ESP_OK)
+        {
+            fprintf(stderr, "delta clip: corrupt record %u turned away up front (0x%x)\n", frame_idx, err);
+            passed = pdFALSE;
+            continue;
+        }
+        if (clip_get_frame(&clip, frame_idx) != NULL)
+        {
+            fprintf(stderr, "delta clip: corrupt record %u decoded\n", frame_idx);
+            passed = pdFALSE;
+        }
+        // The frames before it still decode, and playback can carry on from a keyframe after it
+        if ((frame_idx > 0 && !host_check_delta_frame(&clip, frame_idx - 1, "before a corrupt record")) ||
+            !host_check_delta_frame(&clip, 12, "past a corrupt record"))
+        {
+            passed = pdFALSE;
+        }
+        clip_unmap(&clip);
+    }
+
+    printf("%-36s %s\n", "delta_clip_decoding", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s GOLDEN_DIR [--update] [SCENARIO...]\n", argv[0]);
+        return 2;
+    }
+    const char* golden_dir = argv[1];
+    bool update = pdFALSE;
+    int first_name = 2;
+    if (argc > 2 && strcmp(argv[2], "--update") == 0)
+    {
+        update = pdTRUE;
+        first_name = 3;
+    }
+
+    esp_err_t err = host_led_init();
+    if (err != ESP_OK)
+    {
+        fprintf(stderr, "LED init failed (0x%x)\n", err);
+        return 2;
+    }
+    mock_strip_set_refresh_cb(host_strip_refreshed);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", golden_dir, HOST_DELTA_CLIP);
+    host_delta_clip = host_read_file(path, &host_delta_clip_len);
+    snprintf(path, sizeof(path), "%s/%s", golden_dir, HOST_DELTA_FRAMES);
+    host_delta_frames = host_read_file(path, &host_delta_frames_len);
+    if (host_delta_clip == NULL || host_delta_frames == NULL || host_delta_clip_len < sizeof(clip_header_t))
+    {
+        fprintf(stderr, "no delta clip at %s/%s\n", golden_dir, HOST_DELTA_CLIP);
+        return 2;
+    }
+    // A system part way through booting, for the status display
+    led_set_status_indicator(led_status_led, LED_STATUS_COLOR_SUCCESS);
+    led_set_status_indicator(led_status_nvs, LED_STATUS_COLOR_SUCCESS);
+    led_set_status_indicator(led_status_wifi, LED_STATUS_COLOR_AQUIRING);
+    led_set_status_indicator(led_status_sntp, LED_STATUS_COLOR_ERROR);
+
+    int failures = 0;
+    int run = 0;
+    printf("%-36s %7s %7s %9s %10s %8s\n", "scenario", "frames", "fps", "pixels", "us/frame", "Mpx/s");
+    for (int scenarioIdx = 0; scenarioIdx < HOST_SCENARIO_COUNT; scenarioIdx++)
+    {
+        const host_scenario_t* scenario = &host_scenarios[scenarioIdx];
+        bool selected = first_name >= argc;
+        for (int argIdx = first_name; argIdx < argc; argIdx++)
+        {
+            selected |= strcmp(argv[argIdx], scenario->name) == 0;
+        }
+        if (!selected)
+        {
+            continue;
+        }
+
+        host_result_t result;
+        host_run_scenario(scenario, &result);
+        run++;
+
+        bool passed = host_check_golden(golden_dir, scenario->name, update);
+        if (host_power_locks_held() != 0)
+        {
+            fprintf(stderr, "%s: %u power locks still held\n", scenario->name, host_power_locks_held());
+            passed = pdFALSE;
+        }
+        if (!passed)
+        {
+            failures++;
+        }
+
+        double fps = result.virtual_us > 0 ? result.frames * 1e6 / result.virtual_us : 0;
+        double us_per_frame = result.frames > 0 ? result.cpu_ns / 1e3 / result.frames : 0;
+        double mpx_per_s = result.cpu_ns > 0 ? result.pixels * 1e3 / result.cpu_ns : 0;
+        printf("%-36s %7u %7.1f %9llu %10.2f %8.1f%s\n", scenario->name, result.frames, fps,
+               (unsigned long long)result.pixels, us_per_frame, mpx_per_s, passed ? "" : "  FAILED");
+    }
+
+    if (run == 0)
+    {
+        fprintf(stderr, "no scenario matched\n");
+        return 2;
+    }
+    printf("%d of %d scenarios %s\n", run - failures, run, update ? "recorded" : "match their golden frames");
+    if (!host_check_rejected())
+    {
+        failures++;
+    }
+    if (!host_check_delta_clip())
+    {
+        failures++;
+    }
+    free(host_record);
+    return failures == 0 ? 0 : 1;
+}
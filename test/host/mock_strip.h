@@ -0,0 +1,19 @@
+// LED strips that keep their pixels in memory and report each refresh, in
+// place of the RMT APA104 driver
+#pragma once
+
+#include "led_strip.h"
+
+// Called with the strip's pixels, R,G,B bytes, every time it's refreshed
+typedef void (*mock_strip_refresh_cb_t)(int stripIdx, const uint8_t* rgb, uint32_t led_count);
+
+void mock_strip_set_refresh_cb(mock_strip_refresh_cb_t cb);
+
+typedef struct _mock_strip_stats_t {
+    // pixels handed to set_pixel and set_pixels
+    uint64_t pixels_set;
+    uint32_t refreshes;
+} mock_strip_stats_t;
+
+void mock_strip_get_stats(mock_strip_stats_t* stats);
+void mock_strip_reset_stats(void);
@@ -0,0 +1,370 @@
+// Runs settings_storage.c against the in-memory NVS in host_platform.c, with
+// its save task run on this thread. Settings the save task writes come back
+// after a reboot, a save that changes nothing isn't written, and stored
+// settings this firmware doesn't know, or can't take, leave the defaults.
+//
+// settings_host_test
+
+#include "settings_storage.h"
+
+// Setting defaults name these
+#include "clip.h"
+#include "palette.h"
+
+#include "alarm.h"
+#include "power.h"
+#include "schedule.h"
+
+#include "nvs.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+static int settings_checks = 0;
+static int settings_failures = 0;
+
+#define SETTINGS_CHECK(cond) \
+    do { \
+        settings_checks++; \
+        if (!(cond)) \
+        { \
+            settings_failures++; \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __FUNCTION__, #cond); \
+        } \
+    } while (0)
+
+#define SETTING(name, default, range) [setting_##name] = default,
+static const uint32_t settings_defaults[settings_name_enum_max] = { SETTINGS_TABLE };
+#undef SETTING
+
+// What settings_storage.c tells about changes, and the JSON it fills in for
+// the web page, which isn't exercised here
+
+const char* led_pattern_names[] = { NULL };
+
+void alarm_system_time_or_settings_changed()
+{
+}
+
+void led_settings_changed(void)
+{
+}
+
+void palette_settings_changed(void)
+{
+}
+
+void power_settings_changed(void)
+{
+}
+
+static int settings_schedule_saves = 0;
+
+void schedule_save(void)
+{
+    settings_schedule_saves++;
+}
+
+// The save task
+//
+// Replaces host_platform.c's weak task calls. settings_init's task is run on
+// this thread: a wait with a timeout returns at once, as if it timed out, and
+// a wait forever with nothing to wake for jumps back out of the task.
+
+static TaskFunction_t settings_task_func = NULL;
+static void* settings_task_param = NULL;
+static uint32_t settings_task_notifications = 0;
+static jmp_buf settings_task_blocked;
+// Run once while the task holds off, as a change arriving mid-debounce would be
+static void (*settings_during_debounce)(void) = NULL;
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* task)
+{
+    settings_task_func = func;
+    settings_task_param = param;
+    *task = &settings_task_func;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    settings_task_notifications++;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    if (ticks != portMAX_DELAY && settings_during_debounce != NULL)
+    {
+        void (*during)(void) = settings_during_debounce;
+        settings_during_debounce = NULL;
+        during();
+    }
+    uint32_t notifications = settings_task_notifications;
+    if (notifications == 0 && ticks == portMAX_DELAY)
+    {
+        longjmp(settings_task_blocked, 1);
+    }
+    settings_task_notifications = clear || notifications == 0 ? 0 : notifications - 1;
+    return notifications;
+}
+
+// Let the save task do whatever it's been asked to
+static void settings_run_save_task(void)
+{
+    if (setjmp(settings_task_blocked) == 0)
+    {
+        settings_task_func(settings_task_param);
+    }
+}
+
+// Every setting back to its default, then settings_init, as at power on
+static void settings_reboot(void)
+{
+    for (int settingIdx = 0; settingIdx < settings_name_enum_max; settingIdx++)
+    {
+        SETTINGS_CHECK(set_setting_u32((settings_name)settingIdx, settings_defaults[settingIdx]) == ESP_OK);
+    }
+    SETTINGS_CHECK(settings_init() == ESP_OK);
+}
+
+// The stored blob, laid out the way settings_storage.c writes it
+
+#define SETTINGS_NVS_KEY "blob"
+
+typedef struct _settings_stored_t {
+    uint16_t version;
+    uint16_t count;
+    struct {
+        uint32_t key;
+        int32_t value;
+    } records[128];
+} settings_stored_t;
+
+#define SETTINGS_STORED_LEN(count) (offsetof(settings_stored_t, records) + (count) * sizeof(((settings_stored_t*)0)->records[0]))
+
+// FNV-1a of the name, as settings are keyed in the blob
+static uint32_t settings_stored_key(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name != '\0')
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void settings_read_stored(settings_stored_t* stored)
+{
+    size_t len = sizeof(*stored);
+    memset(stored, 0, sizeof(*stored));
+    SETTINGS_CHECK(nvs_get_blob(1, SETTINGS_NVS_KEY, stored, &len) == ESP_OK);
+    SETTINGS_CHECK(len == SETTINGS_STORED_LEN(stored->count));
+}
+
+static void settings_write_stored(const settings_stored_t* stored, size_t len)
+{
+    SETTINGS_CHECK(nvs_set_blob(1, SETTINGS_NVS_KEY, stored, len) == ESP_OK);
+}
+
+// The record stored for name, or -1
+static int settings_stored_find(const settings_stored_t* stored, const char* name)
+{
+    uint32_t key = settings_stored_key(name);
+    for (int recordIdx = 0; recordIdx < stored->count; recordIdx++)
+    {
+        if (stored->records[recordIdx].key == key)
+        {
+            return recordIdx;
+        }
+    }
+    return -1;
+}
+
+static bool settings_all_defaults(void)
+{
+    for (int settingIdx = 0; settingIdx < settings_name_enum_max; settingIdx++)
+    {
+        if (get_setting_u32((settings_name)settingIdx) != settings_defaults[settingIdx])
+        {
+            return pdFALSE;
+        }
+    }
+    return pdTRUE;
+}
+
+// Tests, in order: each starts from what the one before it stored
+
+static void test_first_boot(void)
+{
+    settings_storage_stats_t stats;
+    SETTINGS_CHECK(settings_init() == ESP_OK);
+    settings_get_stats(&stats);
+    SETTINGS_CHECK(settings_all_defaults());
+    SETTINGS_CHECK(stats.loaded_version == 0);
+    SETTINGS_CHECK(stats.blob_len == 0);
+
+    // Nothing is stored yet, so even the defaults are written
+    settings_request_save();
+    settings_run_save_task();
+    settings_get_stats(&stats);
+    SETTINGS_CHECK(stats.commits == 1);
+    SETTINGS_CHECK(settings_schedule_saves == 1);
+
+    settings_stored_t stored;
+    settings_read_stored(&stored);
+    SETTINGS_CHECK(stored.version == 1);
+    SETTINGS_CHECK(stored.count == settings_name_enum_max);
+    SETTINGS_CHECK(stats.blob_len == SETTINGS_STORED_LEN(stored.count));
+}
+
+static void settings_change_late(void)
+{
+    SETTINGS_CHECK(set_setting_u32(setting_circadian_lm_20h, 153) == ESP_OK);
+    settings_request_save();
+}
+
+static void test_round_trip(void)
+{
+    settings_storage_stats_t before;
+    settings_storage_stats_t after;
+    settings_get_stats(&before);
+
+    // A burst of changes, each saved as json_to_settings would, and one more
+    // while the task holds off: one commit has them all
+    SETTINGS_CHECK(set_setting_u32(setting_alarm_hour, 6) == ESP_OK);
+    settings_request_save();
+    SETTINGS_CHECK(set_setting_u32(setting_alarm_minute, 30) == ESP_OK);
+    settings_request_save();
+    SETTINGS_CHECK(set_setting_u32(setting_clip_playback_mode, clip_mode_ping_pong) == ESP_OK);
+    SETTINGS_CHECK(set_setting_u32(setting_sunrise_curve, sunrise_curve_linear) == ESP_OK);
+    settings_request_save();
+    settings_during_debounce = settings_change_late;
+    settings_run_save_task();
+    settings_get_stats(&after);
+    SETTINGS_CHECK(after.save_requests - before.save_requests == 4);
+    SETTINGS_CHECK(after.commits - before.commits == 1);
+    SETTINGS_CHECK(after.save_errors == 0);
+
+    settings_reboot();
+    settings_get_stats(&after);
+    SETTINGS_CHECK(after.loaded_version == 1);
+    SETTINGS_CHECK(get_setting_u32(setting_alarm_hour) == 6);
+    SETTINGS_CHECK(get_setting_u32(setting_alarm_minute) == 30);
+    SETTINGS_CHECK(get_setting_u32(setting_clip_playback_mode) == clip_mode_ping_pong);
+    SETTINGS_CHECK(get_setting_u32(setting_sunrise_curve) == sunrise_curve_linear);
+    SETTINGS_CHECK(get_setting_u32(setting_circadian_lm_20h) == 153);
+    SETTINGS_CHECK(get_setting_u32(setting_fill_time_ms) == settings_defaults[setting_fill_time_ms]);
+}
+
+static void test_skip_unchanged(void)
+{
+    settings_storage_stats_t before;
+    settings_storage_stats_t after;
+    settings_get_stats(&before);
+    int schedule_saves = settings_schedule_saves;
+
+    // Just after loading, and after a change that was taken back
+    settings_request_save();
+    settings_run_save_task();
+    SETTINGS_CHECK(set_setting_u32(setting_alarm_hour, 7) == ESP_OK);
+    settings_request_save();
+    SETTINGS_CHECK(set_setting_u32(setting_alarm_hour, 6) == ESP_OK);
+    settings_request_save();
+    settings_run_save_task();
+    settings_get_stats(&after);
+    SETTINGS_CHECK(after.commits == before.commits);
+    SETTINGS_CHECK(after.saves_skipped - before.saves_skipped == 2);
+    // The schedules decide for themselves
+    SETTINGS_CHECK(settings_schedule_saves - schedule_saves == 2);
+}
+
+static void test_unknown_keys(void)
+{
+    settings_stored_t stored;
+    settings_read_stored(&stored);
+
+    // A setting since removed, one since added (so not stored), a value
+    // since dropped from a setting's range, and one still in it
+    int count = stored.count;
+    stored.records[count].key = settings_stored_key("alarm_volume");
+    stored.records[count].value = 5;
+    count++;
+    int sunrise_curve = settings_stored_find(&stored, "sunrise_curve");
+    SETTINGS_CHECK(sunrise_curve >= 0);
+    stored.records[sunrise_curve] = stored.records[--count];
+    int alarm_minute = settings_stored_find(&stored, "alarm_minute");
+    SETTINGS_CHECK(alarm_minute >= 0);
+    stored.records[alarm_minute].value = 7;
+    int alarm_hour = settings_stored_find(&stored, "alarm_hour");
+    SETTINGS_CHECK(alarm_hour >= 0);
+    stored.records[alarm_hour].value = 5;
+    stored.count = count;
+    settings_write_stored(&stored, SETTINGS_STORED_LEN(count));
+
+    settings_reboot();
+    SETTINGS_CHECK(get_setting_u32(setting_alarm_hour) == 5);
+    SETTINGS_CHECK(get_setting_u32(setting_alarm_minute) == settings_defaults[setting_alarm_minute]);
+    SETTINGS_CHECK(get_setting_u32(setting_sunrise_curve) == settings_defaults[setting_sunrise_curve]);
+    SETTINGS_CHECK(get_setting_u32(setting_clip_playback_mode) == clip_mode_ping_pong);
+
+    // The next save writes what this firmware has, and nothing it doesn't know
+    settings_storage_stats_t before;
+    settings_storage_stats_t after;
+    settings_get_stats(&before);
+    settings_request_save();
+    settings_run_save_task();
+    settings_get_stats(&after);
+    SETTINGS_CHECK(after.commits - before.commits == 1);
+    settings_read_stored(&stored);
+    SETTINGS_CHECK(stored.count == settings_name_enum_max);
+    SETTINGS_CHECK(settings_stored_find(&stored, "alarm_volume") < 0);
+    sunrise_curve = settings_stored_find(&stored, "sunrise_curve");
+    SETTINGS_CHECK(sunrise_curve >= 0 && stored.records[sunrise_curve].value == settings_defaults[setting_sunrise_curve]);
+}
+
+// Blobs that can't be used at all: from a newer schema, from an older one
+// this firmware has no migration for, and cut short
+static void test_unusable(void)
+{
+    settings_stored_t good;
+    settings_read_stored(&good);
+    size_t good_len = SETTINGS_STORED_LEN(good.count);
+    settings_stored_t stored;
+    settings_storage_stats_t stats;
+
+    static const uint16_t versions[] = { 2, 0 };
+    for (int versionIdx = 0; versionIdx < sizeof(versions) / sizeof(versions[0]); versionIdx++)
+    {
+        stored = good;
+        stored.version = versions[versionIdx];
+        settings_write_stored(&stored, good_len);
+        settings_reboot();
+        settings_get_stats(&stats);
+        SETTINGS_CHECK(stats.loaded_version == versions[versionIdx]);
+        SETTINGS_CHECK(settings_all_defaults());
+    }
+
+    settings_write_stored(&good, good_len - 3);
+    settings_reboot();
+    SETTINGS_CHECK(settings_all_defaults());
+
+    // Still good once it's whole again
+    settings_write_stored(&good, good_len);
+    settings_reboot();
+    SETTINGS_CHECK(get_setting_u32(setting_alarm_hour) == 5);
+}
+
+int main(int argc, char** argv)
+{
+    test_first_boot();
+    test_round_trip();
+    test_skip_unchanged();
+    test_unknown_keys();
+    test_unusable();
+
+    printf("%d of %d settings checks passed\n", settings_checks - settings_failures, settings_checks);
+    return settings_failures == 0 ? 0 : 1;
+}
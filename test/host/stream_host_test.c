@@ -0,0 +1,417 @@
+// Checks stream_packet.c's DDP and E1.31 parsing against packets built here,
+// and can listen for a real sender on this machine.
+//
+// stream_host_test
+// stream_host_test --listen
+//
+// --listen binds the DDP and E1.31 ports, joins universe
+// CONFIG_LC_STREAM_E131_UNIVERSE's multicast group, and prints every frame
+// that completes, so xLights, a WLED sync or a short script can be pointed at
+// 127.0.0.1 to see what the device would make of it.
+
+#include "led.h"
+#include "stream.h"
+#include "stream_packet.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int stream_checks = 0;
+static int stream_failures = 0;
+
+#define STREAM_CHECK(cond) \
+    do { \
+        stream_checks++; \
+        if (!(cond)) \
+        { \
+            stream_failures++; \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __FUNCTION__, #cond); \
+        } \
+    } while (0)
+
+// Bytes past the frame that nothing may write
+#define STREAM_GUARD_LEN 64
+#define STREAM_GUARD 0xA5
+
+static uint8_t stream_frame[LED_FRAME_LEN + STREAM_GUARD_LEN];
+static uint8_t stream_packet[1500];
+static uint8_t stream_pixels[LED_FRAME_LEN];
+
+static void stream_test_reset(stream_parser_t* parser)
+{
+    stream_parser_init(parser, CONFIG_LC_STREAM_E131_UNIVERSE);
+    memset(stream_frame, 0, LED_FRAME_LEN);
+    memset(stream_frame + LED_FRAME_LEN, STREAM_GUARD, STREAM_GUARD_LEN);
+    for (int i = 0; i < LED_FRAME_LEN; i++)
+    {
+        stream_pixels[i] = (uint8_t)(i * 7 + 1);
+    }
+}
+
+static bool stream_guard_intact(void)
+{
+    for (int i = 0; i < STREAM_GUARD_LEN; i++)
+    {
+        if (stream_frame[LED_FRAME_LEN + i] != STREAM_GUARD)
+        {
+            return pdFALSE;
+        }
+    }
+    return pdTRUE;
+}
+
+static void write_be16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void write_be32(uint8_t* p, uint32_t v)
+{
+    write_be16(p, v >> 16);
+    write_be16(p + 2, v & 0xFFFF);
+}
+
+// Packets
+
+#define DDP_VER1 0x40
+#define DDP_TIMECODE 0x10
+#define DDP_QUERY 0x02
+#define DDP_PUSH 0x01
+
+static int ddp_packet(uint8_t flags, uint8_t sequence, uint8_t destination, uint32_t offset,
+                      const uint8_t* data, uint16_t len)
+{
+    int header_len = (flags & DDP_TIMECODE) ? 14 : 10;
+    memset(stream_packet, 0, header_len);
+    stream_packet[0] = flags;
+    stream_packet[1] = sequence;
+    stream_packet[2] = 1;
+    stream_packet[3] = destination;
+    write_be32(stream_packet + 4, offset);
+    write_be16(stream_packet + 8, len);
+    memcpy(stream_packet + header_len, data, len);
+    return header_len + len;
+}
+
+#define E131_TERMINATED 0x40
+
+static const uint8_t e131_acn_id[] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+
+static int e131_data_packet(uint16_t universe, uint8_t sequence, uint8_t options, uint16_t sync_address,
+                            uint8_t start_code, const uint8_t* slots, uint16_t count)
+{
+    int len = 126 + count;
+    memset(stream_packet, 0, 126);
+    write_be16(stream_packet, 0x0010);
+    memcpy(stream_packet + 4, e131_acn_id, sizeof(e131_acn_id));
+    write_be16(stream_packet + 16, 0x7000 | (len - 16));
+    write_be32(stream_packet + 18, 0x00000004);
+    write_be16(stream_packet + 38, 0x7000 | (len - 38));
+    write_be32(stream_packet + 40, 0x00000002);
+    strcpy((char*)stream_packet + 44, "stream_host_test");
+    stream_packet[108] = 100;
+    write_be16(stream_packet + 109, sync_address);
+    stream_packet[111] = sequence;
+    stream_packet[112] = options;
+    write_be16(stream_packet + 113, universe);
+    write_be16(stream_packet + 115, 0x7000 | (len - 115));
+    stream_packet[117] = 0x02;
+    stream_packet[118] = 0xA1;
+    write_be16(stream_packet + 121, 1);
+    write_be16(stream_packet + 123, count + 1);
+    stream_packet[125] = start_code;
+    memcpy(stream_packet + 126, slots, count);
+    return len;
+}
+
+static int e131_sync_packet(uint8_t sequence, uint16_t sync_address)
+{
+    memset(stream_packet, 0, 49);
+    write_be16(stream_packet, 0x0010);
+    memcpy(stream_packet + 4, e131_acn_id, sizeof(e131_acn_id));
+    write_be16(stream_packet + 16, 0x7000 | (49 - 16));
+    write_be32(stream_packet + 18, 0x00000008);
+    write_be16(stream_packet + 38, 0x7000 | (49 - 38));
+    write_be32(stream_packet + 40, 0x00000001);
+    stream_packet[44] = sequence;
+    write_be16(stream_packet + 45, sync_address);
+    return 49;
+}
+
+// DDP
+
+static void test_ddp_whole_frame(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    int len = ddp_packet(DDP_VER1 | DDP_PUSH, 0, 1, 0, stream_pixels, LED_FRAME_LEN);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == (STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE));
+    STREAM_CHECK(memcmp(stream_frame, stream_pixels, LED_FRAME_LEN) == 0);
+    STREAM_CHECK(parser.packets_rejected == 0);
+}
+
+static void test_ddp_split_frame(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    int half = LED_FRAME_LEN / 2;
+    int len = ddp_packet(DDP_VER1, 1, 1, 0, stream_pixels, half);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == STREAM_PACKET_PIXELS);
+    // With a timecode, which moves the data along
+    len = ddp_packet(DDP_VER1 | DDP_TIMECODE | DDP_PUSH, 2, 255, half, stream_pixels + half, half);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == (STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE));
+    STREAM_CHECK(memcmp(stream_frame, stream_pixels, LED_FRAME_LEN) == 0);
+    STREAM_CHECK(parser.packets_lost == 0);
+}
+
+static void test_ddp_past_the_frame(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    // Runs off the end: only what fits is written
+    int len = ddp_packet(DDP_VER1, 0, 1, LED_FRAME_LEN - 10, stream_pixels, 40);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == STREAM_PACKET_PIXELS);
+    STREAM_CHECK(memcmp(stream_frame + LED_FRAME_LEN - 10, stream_pixels, 10) == 0);
+    STREAM_CHECK(stream_guard_intact());
+    // Starts past the end: nothing is written, but the push still counts
+    len = ddp_packet(DDP_VER1 | DDP_PUSH, 0, 1, LED_FRAME_LEN, stream_pixels, 40);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == STREAM_PACKET_COMPLETE);
+    STREAM_CHECK(stream_guard_intact());
+    STREAM_CHECK(parser.packets_rejected == 0);
+}
+
+static void test_ddp_rejected(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    int len = ddp_packet(DDP_VER1 | DDP_PUSH, 0, 1, 0, stream_pixels, 30);
+    // Too short for a header
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, 9) == 0);
+    // Shorter than its data length says
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len - 1) == 0);
+    // Not version 1
+    stream_packet[0] = 0x80 | DDP_PUSH;
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == 0);
+    len = ddp_packet(DDP_VER1 | DDP_QUERY, 0, 1, 0, stream_pixels, 30);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == 0);
+    // Configuration, not the display
+    len = ddp_packet(DDP_VER1 | DDP_PUSH, 0, 250, 0, stream_pixels, 30);
+    STREAM_CHECK(stream_parse_ddp(&parser, stream_frame, stream_packet, len) == 0);
+    STREAM_CHECK(parser.packets_rejected == 5);
+    STREAM_CHECK(memcmp(stream_frame, (uint8_t[30]){ 0 }, 30) == 0);
+}
+
+static void test_ddp_sequence(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    const uint8_t sequences[] = { 14, 15, 1, 4, 0, 5 };
+    for (int i = 0; i < (int)sizeof(sequences); i++)
+    {
+        int len = ddp_packet(DDP_VER1 | DDP_PUSH, sequences[i], 1, 0, stream_pixels, 3);
+        stream_parse_ddp(&parser, stream_frame, stream_packet, len);
+    }
+    // 15 wraps to 1, 2 and 3 are missing, and 0 is a sender not numbering
+    STREAM_CHECK(parser.packets_lost == 2);
+    STREAM_CHECK(parser.packets_rejected == 0);
+}
+
+// E1.31
+
+static void test_e131_frame(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    int len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 1, 0, 0, 0, stream_pixels, LED_FRAME_LEN);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == (STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE));
+    STREAM_CHECK(memcmp(stream_frame, stream_pixels, LED_FRAME_LEN) == 0);
+    // A full universe is more than a frame
+    uint8_t slots[512];
+    memset(slots, 0x3C, sizeof(slots));
+    len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 2, 0, 0, 0, slots, sizeof(slots));
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == (STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE));
+    STREAM_CHECK(stream_frame[LED_FRAME_LEN - 1] == 0x3C);
+    STREAM_CHECK(stream_guard_intact());
+    STREAM_CHECK(parser.packets_rejected == 0);
+}
+
+static void test_e131_rejected(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    int len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE + 1, 1, 0, 0, 0, stream_pixels, 30);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+    // Not DMX data
+    len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 2, 0, 0, 0xDD, stream_pixels, 30);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+    len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 3, 0, 0, 0, stream_pixels, 30);
+    // Cut short of its property count
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len - 1) == 0);
+    stream_packet[4] = 'X';
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, 48) == 0);
+    STREAM_CHECK(parser.packets_rejected == 5);
+    STREAM_CHECK(memcmp(stream_frame, (uint8_t[30]){ 0 }, 30) == 0);
+}
+
+static void test_e131_sequence(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    const struct {
+        uint8_t sequence;
+        uint32_t result;
+    } steps[] = {
+        { 254, STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE },
+        // a duplicate and a reordered packet
+        { 254, 0 },
+        { 253, 0 },
+        // wraps, with 255 and 0 missing
+        { 1, STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE },
+        // far enough back to be a restarted sender, not a late packet
+        { 200, STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE },
+    };
+    for (int i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])); i++)
+    {
+        int len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, steps[i].sequence, 0, 0, 0, stream_pixels, 3);
+        STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == steps[i].result);
+    }
+    STREAM_CHECK(parser.packets_rejected == 2);
+    STREAM_CHECK(parser.packets_lost == 2);
+
+    // Terminating forgets the sequence, so an older one starts the stream again
+    int len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 201, E131_TERMINATED, 0, 0, stream_pixels, 3);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+    len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 190, 0, 0, 0, stream_pixels, 3);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == (STREAM_PACKET_PIXELS | STREAM_PACKET_COMPLETE));
+    STREAM_CHECK(parser.packets_rejected == 2);
+}
+
+static void test_e131_sync(void)
+{
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    int len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 1, 0, 7000, 0, stream_pixels, LED_FRAME_LEN);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == STREAM_PACKET_PIXELS);
+    // Another synchronization universe's sync
+    len = e131_sync_packet(1, 7001);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+    len = e131_sync_packet(2, 7000);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == STREAM_PACKET_COMPLETE);
+    // Only once per frame
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+    STREAM_CHECK(memcmp(stream_frame, stream_pixels, LED_FRAME_LEN) == 0);
+    STREAM_CHECK(parser.packets_rejected == 0);
+
+    // Terminating drops a frame still waiting on its sync
+    len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 2, 0, 7000, 0, stream_pixels, 3);
+    stream_parse_e131(&parser, stream_frame, stream_packet, len);
+    len = e131_data_packet(CONFIG_LC_STREAM_E131_UNIVERSE, 3, E131_TERMINATED, 7000, 0, stream_pixels, 3);
+    stream_parse_e131(&parser, stream_frame, stream_packet, len);
+    len = e131_sync_packet(3, 7000);
+    STREAM_CHECK(stream_parse_e131(&parser, stream_frame, stream_packet, len) == 0);
+}
+
+// Listening
+
+static int stream_listen_socket(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("binding the listener");
+        return -1;
+    }
+    return sock;
+}
+
+static int stream_listen(void)
+{
+    int socks[2] = { stream_listen_socket(STREAM_DDP_PORT), stream_listen_socket(STREAM_E131_PORT) };
+    if (socks[0] < 0 || socks[1] < 0)
+    {
+        return 2;
+    }
+    struct ip_mreq mreq = { 0 };
+    mreq.imr_multiaddr.s_addr = htonl(0xEFFF0000 | CONFIG_LC_STREAM_E131_UNIVERSE);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(socks[1], IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+    {
+        perror("joining the E1.31 multicast group; unicast still works");
+    }
+    printf("Listening for DDP on %d and E1.31 universe %d on %d\n",
+           STREAM_DDP_PORT, CONFIG_LC_STREAM_E131_UNIVERSE, STREAM_E131_PORT);
+
+    stream_parser_t parser;
+    stream_test_reset(&parser);
+    uint32_t frames = 0;
+    while (pdTRUE)
+    {
+        struct pollfd fds[2] = { { socks[0], POLLIN, 0 }, { socks[1], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0)
+        {
+            perror("poll");
+            return 2;
+        }
+        for (int sockIdx = 0; sockIdx < 2; sockIdx++)
+        {
+            if (!(fds[sockIdx].revents & POLLIN))
+            {
+                continue;
+            }
+            int len = recv(socks[sockIdx], stream_packet, sizeof(stream_packet), 0);
+            if (len <= 0)
+            {
+                continue;
+            }
+            uint32_t result = sockIdx == 0 ? stream_parse_ddp(&parser, stream_frame, stream_packet, len)
+                                           : stream_parse_e131(&parser, stream_frame, stream_packet, len);
+            if (result & STREAM_PACKET_COMPLETE)
+            {
+                frames++;
+                printf("%s frame %u, %u rejected, %u lost:", sockIdx == 0 ? "DDP" : "E1.31", frames,
+                       parser.packets_rejected, parser.packets_lost);
+                for (int stripIdx = 0; stripIdx < LED_STRIP_COUNT; stripIdx++)
+                {
+                    const uint8_t* px = stream_frame + stripIdx * LEDS_PER_STRIP * 3;
+                    printf(" strip %d starts %02x%02x%02x", stripIdx, px[0], px[1], px[2]);
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--listen") == 0)
+    {
+        return stream_listen();
+    }
+
+    test_ddp_whole_frame();
+    test_ddp_split_frame();
+    test_ddp_past_the_frame();
+    test_ddp_rejected();
+    test_ddp_sequence();
+    test_e131_frame();
+    test_e131_rejected();
+    test_e131_sequence();
+    test_e131_sync();
+
+    printf("%d of %d stream checks passed\n", stream_checks - stream_failures, stream_checks);
+    return stream_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+#
+# Build animation clips for the "clips" partition (see main/clip.h).
+#
+# Input is either a raw dump of frames (R,G,B bytes, strip after strip, frame
+# after frame) or a PNG where each row of pixels is one frame, laid out strip
+# after strip. The clip is written as a version 1 (raw) or version 2 (delta)
+# clip, then decoded again with a reference decoder to check the round trip and
+# to report the compression ratio and how much work decoding takes.
+#
+# Examples:
+#   python tools/clip_encode.py --png sunrise.png --fps 30 -o clip.bin
+#   python tools/clip_encode.py --raw capture.bin --fps 60 --keyframe-interval 300 -o clip.bin
+#
+# Upload the result with:
+#   curl -X PUT http://lightclock.local/clip --data-binary @clip.bin
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+CLIP_MAGIC = 0x50494C43
+CLIP_VERSION_RAW = 1
+CLIP_VERSION_DELTA = 2
+HEADER_FORMAT = '<IHHHHHH'
+HEADER_LEN = struct.calcsize(HEADER_FORMAT)
+
+RECORD_RAW = 0
+RECORD_RLE = 1
+RECORD_XOR = 2
+
+MAX_RUN = 255
+
+
+def read_png(path):
+    """Minimal reader for 8-bit, non-interlaced RGB or RGBA PNGs. Returns (width, height, rows of RGB bytes)."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:8] != b'\x89PNG\r\n\x1a\n':
+        raise ValueError('%s is not a PNG' % path)
+    pos = 8
+    idat = b''
+    width = height = channels = None
+    while pos < len(data):
+        length, kind = struct.unpack('>I4s', data[pos:pos + 8])
+        body = data[pos + 8:pos + 8 + length]
+        pos += 12 + length
+        if kind == b'IHDR':
+            width, height, depth, color_type, _, _, interlace = struct.unpack('>IIBBBBB', body)
+            if depth != 8 or color_type not in (2, 6) or interlace != 0:
+                raise ValueError('only 8-bit non-interlaced RGB/RGBA PNGs are supported')
+            channels = 3 if color_type == 2 else 4
+        elif kind == b'IDAT':
+            idat += body
+        elif kind == b'IEND':
+            break
+    raw = zlib.decompress(idat)
+    stride = width * channels
+    rows = []
+    prev = bytearray(stride)
+    for y in range(height):
+        filter_type = raw[y * (stride + 1)]
+        line = bytearray(raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)])
+        for x in range(stride):
+            a = line[x - channels] if x >= channels else 0
+            b = prev[x]
+            c = prev[x - channels] if x >= channels else 0
+            if filter_type == 1:
+                line[x] = (line[x] + a) & 0xFF
+            elif filter_type == 2:
+                line[x] = (line[x] + b) & 0xFF
+            elif filter_type == 3:
+                line[x] = (line[x] + ((a + b) >> 1)) & 0xFF
+            elif filter_type == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                pred = a if pa <= pb and pa <= pc else (b if pb <= pc else c)
+                line[x] = (line[x] + pred) & 0xFF
+        prev = line
+        if channels == 4:
+            line = bytearray(v for i, v in enumerate(line) if i % 4 != 3)
+        rows.append(bytes(line))
+    return width, height, rows
+
+
+def encode_rle(frame):
+    out = bytearray([RECORD_RLE])
+    px = 0
+    pixels = len(frame) // 3
+    while px < pixels:
+        color = frame[px * 3:px * 3 + 3]
+        run = 1
+        while px + run < pixels and run < MAX_RUN and frame[(px + run) * 3:(px + run) * 3 + 3] == color:
+            run += 1
+        out += bytes([run]) + color
+        px += run
+    return bytes(out)
+
+
+def encode_xor(prev, frame):
+    out = bytearray([RECORD_XOR])
+    pixels = len(frame) // 3
+    changed = [prev[i * 3:i * 3 + 3] != frame[i * 3:i * 3 + 3] for i in range(pixels)]
+    px = 0
+    while px < pixels:
+        skip = 0
+        while px + skip < pixels and not changed[px + skip]:
+            skip += 1
+        if px + skip == pixels:
+            # trailing unchanged pixels need no op
+            break
+        while skip > MAX_RUN:
+            out += bytes([MAX_RUN, 0])
+            skip -= MAX_RUN
+            px += MAX_RUN
+        px += skip
+        run = 0
+        while px + run < pixels and run < MAX_RUN and changed[px + run]:
+            run += 1
+        out += bytes([skip, run])
+        out += bytes(a ^ b for a, b in zip(prev[px * 3:(px + run) * 3], frame[px * 3:(px + run) * 3]))
+        px += run
+    return bytes(out)
+
+
+def encode_delta(frames, keyframe_interval):
+    records = []
+    for idx, frame in enumerate(frames):
+        key = min(bytes([RECORD_RAW]) + frame, encode_rle(frame), key=len)
+        if idx % keyframe_interval == 0:
+            records.append(key)
+        else:
+            records.append(min(key, encode_xor(frames[idx - 1], frame), key=len))
+    return records
+
+
+def build_clip(version, strips, leds, fps, frames, keyframe_interval):
+    header_len = HEADER_LEN
+    header = struct.pack(HEADER_FORMAT, CLIP_MAGIC, version, header_len, strips, leds, len(frames), fps)
+    if version == CLIP_VERSION_RAW:
+        return header + b''.join(frames), None
+    records = encode_delta(frames, keyframe_interval)
+    offset = header_len + 4 * (len(records) + 1)
+    offsets = []
+    for record in records:
+        offsets.append(offset)
+        offset += len(record)
+    offsets.append(offset)
+    return header + struct.pack('<%dI' % len(offsets), *offsets) + b''.join(records), records
+
+
+def decode_delta(clip, frame_len):
+    """Reference decoder mirroring clip_apply_record. Returns (frames, bytes touched)."""
+    _, _, header_len, _, _, frame_count, _ = struct.unpack_from(HEADER_FORMAT, clip)
+    offsets = struct.unpack_from('<%dI' % (frame_count + 1), clip, header_len)
+    fb = bytearray(frame_len)
+    frames = []
+    touched = 0
+    for idx in range(frame_count):
+        record = clip[offsets[idx]:offsets[idx + 1]]
+        kind, pos, fb_idx = record[0], 1, 0
+        if kind == RECORD_RAW:
+            fb[:] = record[1:]
+            touched += frame_len
+        elif kind == RECORD_RLE:
+            while pos < len(record):
+                run, color = record[pos], record[pos + 1:pos + 4]
+                fb[fb_idx:fb_idx + run * 3] = color * run
+                fb_idx += run * 3
+                pos += 4
+            touched += frame_len
+        elif kind == RECORD_XOR:
+            while pos < len(record):
+                fb_idx += record[pos] * 3
+                run = record[pos + 1] * 3
+                pos += 2
+                for i in range(run):
+                    fb[fb_idx + i] ^= record[pos + i]
+                fb_idx += run
+                pos += run
+                touched += run
+        else:
+            raise ValueError('record %d has unknown type %d' % (idx, kind))
+        frames.append(bytes(fb))
+    return frames, touched
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build animation clips for the clips partition')
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument('--raw', help='raw frame dump (R,G,B bytes, strip after strip, frame after frame)')
+    source.add_argument('--png', help='PNG with one frame per row of pixels')
+    parser.add_argument('--strips', type=int, default=2)
+    parser.add_argument('--leds', type=int, default=60, help='LEDs per strip')
+    parser.add_argument('--fps', type=int, default=60)
+    parser.add_argument('--format', choices=['raw', 'delta'], default='delta')
+    parser.add_argument('--keyframe-interval', type=int, default=120,
+                        help='frames between forced keyframes; bounds the cost of seeking')
+    parser.add_argument('-o', '--output', required=True)
+    args = parser.parse_args()
+
+    frame_len = args.strips * args.leds * 3
+    if args.png:
+        width, _, rows = read_png(args.png)
+        if width * 3 != frame_len:
+            sys.exit('PNG is %d pixels wide but %d strips of %d LEDs need %d' % (width, args.strips, args.leds, frame_len // 3))
+        frames = rows
+    else:
+        with open(args.raw, 'rb') as f:
+            data = f.read()
+        if len(data) % frame_len != 0:
+            sys.exit('raw dump is %d bytes, which is not a whole number of %d-byte frames' % (len(data), frame_len))
+        frames = [data[i:i + frame_len] for i in range(0, len(data), frame_len)]
+    if not 0 < len(frames) < 65536:
+        sys.exit('clips hold 1 to 65535 frames, not %d' % len(frames))
+
+    version = CLIP_VERSION_RAW if args.format == 'raw' else CLIP_VERSION_DELTA
+    clip, records = build_clip(version, args.strips, args.leds, args.fps, frames, args.keyframe_interval)
+    with open(args.output, 'wb') as f:
+        f.write(clip)
+
+    raw_len = HEADER_LEN + frame_len * len(frames)
+    print('%d frames, %.1f s at %d fps' % (len(frames), len(frames) / args.fps, args.fps))
+    print('raw size %d bytes, clip size %d bytes, ratio %.2f:1' % (raw_len, len(clip), raw_len / len(clip)))
+
+    if records is not None:
+        keyframes = sum(1 for r in records if r[0] != RECORD_XOR)
+        start = time.perf_counter()
+        decoded, touched = decode_delta(clip, frame_len)
+        elapsed = time.perf_counter() - start
+        if decoded != frames:
+            sys.exit('round trip FAILED')
+        print('%d keyframes, %d deltas' % (keyframes, len(frames) - keyframes))
+        print('decoder touches %.1f of %d bytes per frame (%.1f%%)' %
+              (touched / len(frames), frame_len, 100.0 * touched / (len(frames) * frame_len)))
+        print('reference decoder: %.0f frames/s (host Python; the device decoder is the same loop in C)' %
+              (len(frames) / elapsed if elapsed > 0 else float('inf')))
+        print('round trip OK')
+
+
+if __name__ == '__main__':
+    main()
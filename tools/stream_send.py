@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+#
+# Stream a test animation to the clock over DDP or E1.31 (see main/stream.h).
+#
+# Run the "stream" pattern on the clock first, then e.g.:
+#   python tools/stream_send.py --host lightclock.local --protocol ddp --fps 60
+#   python tools/stream_send.py --host 239.255.0.1 --protocol e131 --sync 7
+#
+# --drop and --reorder randomly drop or swap packets so the loss counters on
+# /diag (sp: r<rejected> l<lost>) can be checked against what was sent.
+
+import argparse
+import colorsys
+import random
+import socket
+import struct
+import time
+import uuid
+
+DDP_PORT = 4048
+E131_PORT = 5568
+
+DDP_FLAGS_VER1 = 0x40
+DDP_FLAGS_PUSH = 0x01
+DDP_TYPE_RGB24 = 0x0B
+DDP_ID_DISPLAY = 1
+# keeps packets within a 1500-byte MTU, and a multiple of 3 so pixels don't straddle packets
+DDP_MAX_DATA = 1440
+
+E131_ACN_ID = b'ASC-E1.17\x00\x00\x00'
+E131_CID = uuid.uuid4().bytes
+
+
+def frame_at(t, pixels):
+    """A rainbow that drifts along the strips with a white dot sweeping over it."""
+    out = bytearray()
+    dot = int(t * 30) % pixels
+    for i in range(pixels):
+        if i == dot:
+            out += b'\xff\xff\xff'
+        else:
+            r, g, b = colorsys.hsv_to_rgb((i / pixels + t / 5) % 1.0, 1.0, 0.25)
+            out += bytes([int(r * 255), int(g * 255), int(b * 255)])
+    return bytes(out)
+
+
+def ddp_packets(frame, sequence):
+    packets = []
+    for offset in range(0, len(frame), DDP_MAX_DATA):
+        data = frame[offset:offset + DDP_MAX_DATA]
+        flags = DDP_FLAGS_VER1
+        if offset + len(data) == len(frame):
+            flags |= DDP_FLAGS_PUSH
+        packets.append(struct.pack('>BBBBIH', flags, sequence, DDP_TYPE_RGB24, DDP_ID_DISPLAY, offset, len(data)) + data)
+        sequence = sequence % 15 + 1
+    return packets, sequence
+
+
+def flags_and_length(length):
+    return 0x7000 | length
+
+
+def e131_data_packet(frame, universe, sequence, sync_address):
+    slots = b'\x00' + frame
+    dmp = struct.pack('>HBBHHH', flags_and_length(10 + len(slots)), 0x02, 0xA1, 0, 1, len(slots)) + slots
+    framing = struct.pack('>HI64sBHBBH', flags_and_length(77 + len(dmp)), 0x00000002,
+                          b'lc-esp32 stream_send.py', 100, sync_address, sequence, 0, universe) + dmp
+    root = struct.pack('>HH12sHI16s', 0x0010, 0, E131_ACN_ID, flags_and_length(22 + len(framing)), 0x00000004, E131_CID)
+    return root + framing
+
+
+def e131_sync_packet(sync_address, sequence):
+    framing = struct.pack('>HIBHH', flags_and_length(11), 0x00000001, sequence, sync_address, 0)
+    return struct.pack('>HH12sHI16s', 0x0010, 0, E131_ACN_ID, flags_and_length(22 + len(framing)), 0x00000008, E131_CID) + framing
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stream a test animation over DDP or E1.31')
+    parser.add_argument('--host', default='lightclock.local')
+    parser.add_argument('--protocol', choices=['ddp', 'e131'], default='ddp')
+    parser.add_argument('--strips', type=int, default=2)
+    parser.add_argument('--leds', type=int, default=60, help='LEDs per strip')
+    parser.add_argument('--fps', type=float, default=60)
+    parser.add_argument('--seconds', type=float, default=10)
+    parser.add_argument('--universe', type=int, default=1)
+    parser.add_argument('--sync', type=int, default=0, help='E1.31 synchronization universe, 0 for none')
+    parser.add_argument('--drop', type=float, default=0.0, help='fraction of packets to drop')
+    parser.add_argument('--reorder', type=float, default=0.0, help='fraction of packets to swap with the next one')
+    args = parser.parse_args()
+
+    pixels = args.strips * args.leds
+    port = DDP_PORT if args.protocol == 'ddp' else E131_PORT
+    address = (socket.gethostbyname(args.host), port)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 4)
+
+    sent = dropped = swapped = frames = 0
+    ddp_sequence = 1
+    e131_sequence = 0
+    sync_sequence = 0
+    held = None
+    start = time.monotonic()
+    next_frame = start
+    while next_frame - start < args.seconds:
+        frame = frame_at(next_frame - start, pixels)
+        if args.protocol == 'ddp':
+            packets, ddp_sequence = ddp_packets(frame, ddp_sequence)
+        else:
+            packets = [e131_data_packet(frame, args.universe, e131_sequence, args.sync)]
+            e131_sequence = (e131_sequence + 1) & 0xFF
+            if args.sync:
+                packets.append(e131_sync_packet(args.sync, sync_sequence))
+                sync_sequence = (sync_sequence + 1) & 0xFF
+
+        for packet in packets:
+            if random.random() < args.drop:
+                dropped += 1
+                continue
+            if held is None and random.random() < args.reorder:
+                held = packet
+                swapped += 1
+                continue
+            sock.sendto(packet, address)
+            sent += 1
+            if held is not None:
+                sock.sendto(held, address)
+                sent += 1
+                held = None
+        frames += 1
+
+        next_frame += 1.0 / args.fps
+        delay = next_frame - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+    elapsed = time.monotonic() - start
+    print('%d frames in %.1f s (%.1f fps) to %s:%d' % (frames, elapsed, frames / elapsed, address[0], address[1]))
+    print('%d packets sent, %d dropped, %d reordered' % (sent, dropped, swapped))
+
+
+if __name__ == '__main__':
+    main()